@@ -0,0 +1,251 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+// Measures the throughput and round trip latency of a Channel. Each message is
+// written the way the backend writes a script load (an id followed by a string)
+// and flushed as one frame, so the results reflect the framing and buffering in
+// Channel as well as the transport.
+//
+// Usage: ChannelBenchmark [pipe|tcp|pair] [port]
+
+#include "Channel.h"
+
+#ifndef _WIN32
+#include "PosixTransport.h"
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+    typedef std::chrono::steady_clock Clock;
+
+    double GetSeconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /**
+     * Connects the two channels to each other with the transport named by mode.
+     */
+    bool ConnectChannels(const char* mode, unsigned short port, Channel& server, Channel& client)
+    {
+
+        if (strcmp(mode, "tcp") == 0)
+        {
+
+            if (!server.Listen(port))
+            {
+                return false;
+            }
+
+            bool connected = false;
+            std::thread connectThread([&] { connected = client.Connect("127.0.0.1", port); });
+
+            bool accepted = server.WaitForConnection();
+            connectThread.join();
+
+            return accepted && connected;
+
+        }
+        else if (strcmp(mode, "pipe") == 0)
+        {
+
+            char name[64];
+#ifdef _WIN32
+            _snprintf(name, sizeof(name), "\\\\.\\pipe\\Decoda.Benchmark.%u", GetCurrentProcessId());
+#else
+            snprintf(name, sizeof(name), "Decoda.Benchmark.%u", static_cast<unsigned int>(getpid()));
+#endif
+
+            if (!server.Create(name))
+            {
+                return false;
+            }
+
+            bool connected = false;
+            std::thread connectThread([&] { connected = client.Connect(name); });
+
+            bool accepted = server.WaitForConnection();
+            connectThread.join();
+
+            return accepted && connected;
+
+        }
+#ifndef _WIN32
+        else if (strcmp(mode, "pair") == 0)
+        {
+
+            PosixTransport* transport1 = NULL;
+            PosixTransport* transport2 = NULL;
+
+            if (!PosixTransport::CreatePair(transport1, transport2))
+            {
+                return false;
+            }
+
+            server.Attach(transport1);
+            client.Attach(transport2);
+
+            return true;
+
+        }
+#endif
+
+        return false;
+
+    }
+
+    /**
+     * Sends numMessages messages with a payload of the size from the client to
+     * the server and reports the rate they were received at.
+     */
+    bool MeasureThroughput(Channel& server, Channel& client, unsigned int size, unsigned int numMessages)
+    {
+
+        std::string payload(size, 'x');
+
+        Clock::time_point start = Clock::now();
+
+        std::thread writeThread([&]
+            {
+                for (unsigned int i = 0; i < numMessages; ++i)
+                {
+                    client.WriteUInt32(i);
+                    client.WriteString(payload);
+                    client.Flush();
+                }
+            });
+
+        std::vector<char> buffer;
+        bool success = true;
+
+        for (unsigned int i = 0; i < numMessages && success; ++i)
+        {
+            unsigned int id;
+            success = server.ReadUInt32(id) && id == i && server.ReadBuffer(buffer) && buffer.size() == size;
+        }
+
+        writeThread.join();
+
+        double seconds = GetSeconds(start);
+        double megabytes = static_cast<double>(size + 8) * numMessages / (1024.0 * 1024.0);
+
+        printf("%10u bytes  %8u messages  %12.0f messages/s  %10.1f MB/s\n",
+            size, numMessages, numMessages / seconds, megabytes / seconds);
+
+        return success;
+
+    }
+
+    /**
+     * Sends small commands from the server and waits for each reply, the way
+     * the frontend requests values while the debuggee is stopped.
+     */
+    bool MeasureRoundTrip(Channel& server, Channel& client, unsigned int numRoundTrips)
+    {
+
+        std::thread replyThread([&]
+            {
+                unsigned int command;
+                while (client.ReadUInt32(command))
+                {
+                    client.WriteUInt32(command);
+                    client.Flush();
+                }
+            });
+
+        Clock::time_point start = Clock::now();
+        bool success = true;
+
+        for (unsigned int i = 0; i < numRoundTrips && success; ++i)
+        {
+            unsigned int reply;
+            success = server.WriteUInt32(i) && server.Flush() && server.ReadUInt32(reply) && reply == i;
+        }
+
+        double seconds = GetSeconds(start);
+
+        // Closing the channel releases the reply thread.
+        client.Destroy();
+        replyThread.join();
+
+        printf("%u round trips  %.1f us per round trip\n", numRoundTrips, seconds * 1000000.0 / numRoundTrips);
+
+        return success;
+
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+
+#ifdef _WIN32
+    const char* mode = argc > 1 ? argv[1] : "pipe";
+#else
+    const char* mode = argc > 1 ? argv[1] : "pair";
+#endif
+
+    unsigned short port = static_cast<unsigned short>(argc > 2 ? atoi(argv[2]) : 51263);
+
+    Channel server;
+    Channel client;
+
+    if (!ConnectChannels(mode, port, server, client))
+    {
+        fprintf(stderr, "Couldn't connect a %s channel\n", mode);
+        return 1;
+    }
+
+    printf("Transport: %s\n", mode);
+
+    static const unsigned int sizes[] = { 16, 256, 4 * 1024, 64 * 1024, 1024 * 1024 };
+
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        unsigned int numMessages = static_cast<unsigned int>(256 * 1024 * 1024 / (sizes[i] + 8 * 1024));
+        if (!MeasureThroughput(server, client, sizes[i], numMessages))
+        {
+            fprintf(stderr, "Messages were corrupted\n");
+            return 1;
+        }
+    }
+
+    if (!MeasureRoundTrip(server, client, 20000))
+    {
+        fprintf(stderr, "Replies were corrupted\n");
+        return 1;
+    }
+
+    return 0;
+
+}
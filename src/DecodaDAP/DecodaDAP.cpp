@@ -1,7 +1,9 @@
 #include "DecodaDAP.h"
 
+#include <algorithm>
 #include <condition_variable>
 #include <cstdio>
+#include <cstring>
 #include <mutex>
 #include <unordered_set>
 #include <io.h>
@@ -12,64 +14,235 @@
 #endif
 
 
-int DecodaDAP::StoreVariables(const std::vector<dap::Variable>& vars) {
-    int ref = nextVariableReference++;
-    variableStore[ref] = vars;
-    return ref;
+int DecodaDAP::AllocateVariablesReference(VariableSlot*& slot) {
+    int variablesReference = m_variablesBase + static_cast<int>(m_variableSlots.size());
+    m_variableSlots.emplace_back();
+    slot = &m_variableSlots.back();
+    return variablesReference;
 }
 
-dap::Variable ParseXmlToVariable(TiXmlElement* elem, DecodaDAP* dap, int depth = 0) {
-    dap::Variable var;
-    if (!elem) return var;
-
-    std::string tag = elem->Value();
-
-    if (tag == "value") {
-        // <value><data>foo</data><type>string</type></value>
-        TiXmlElement* dataElem = elem->FirstChildElement("data");
-        TiXmlElement* typeElem = elem->FirstChildElement("type");
-        var.value = dataElem && dataElem->GetText() ? dataElem->GetText() : "";
-        var.type = typeElem && typeElem->GetText() ? typeElem->GetText() : "";
-        var.variablesReference = 0;
-    }
-    else if (tag == "function") {
-        // <function><script>24</script><line>105</line></function>
-        std::string script = elem->FirstChildElement("script") && elem->FirstChildElement("script")->GetText() ? elem->FirstChildElement("script")->GetText() : "";
-        std::string line = elem->FirstChildElement("line") && elem->FirstChildElement("line")->GetText() ? elem->FirstChildElement("line")->GetText() : "";
-        var.value = "function (script: " + script + ", line: " + line + ")";
+DecodaDAP::VariableSlot* DecodaDAP::GetVariableSlot(int variablesReference) {
+    if (variablesReference < m_variablesBase) {
+        return nullptr;
+    }
+    size_t index = static_cast<size_t>(variablesReference - m_variablesBase);
+    return index < m_variableSlots.size() ? &m_variableSlots[index] : nullptr;
+}
+
+
+// Reads values from the binary encoding that the backend uses once the protocol
+// version has been negotiated. See ValueTag in Protocol.h for the layout.
+class ValueReader {
+public:
+    explicit ValueReader(const std::string& data, size_t offset = 0)
+        : m_begin(data.data()), m_data(data.data() + offset), m_end(data.data() + data.size()) {}
+
+    bool ReadTag(unsigned char& tag) {
+        if (m_data == m_end) return false;
+        tag = static_cast<unsigned char>(*m_data++);
+        return true;
+    }
+
+    bool ReadUInt32(unsigned int& value) {
+        if (m_end - m_data < 4) return false;
+        memcpy(&value, m_data, 4);
+        m_data += 4;
+        return true;
+    }
+
+    bool ReadString(std::string& value) {
+        unsigned int length;
+        if (!ReadUInt32(length) || static_cast<size_t>(m_end - m_data) < length) return false;
+        value.assign(m_data, length);
+        m_data += length;
+        return true;
+    }
+
+    size_t GetOffset() const {
+        return m_data - m_begin;
+    }
+
+private:
+    const char* m_begin;
+    const char* m_data;
+    const char* m_end;
+};
+
+bool ReadBinaryTableHeader(ValueReader& reader, unsigned int& id, unsigned int& handle, unsigned int& size, unsigned int& numElements) {
+    std::string type;
+    return reader.ReadString(type) && reader.ReadUInt32(id) && reader.ReadUInt32(handle) && reader.ReadUInt32(size) && reader.ReadUInt32(numElements);
+}
+
+// Reads a value into var. Tables and multiple results get a variables reference
+// but their elements are only skipped over; they're read from the encoded value
+// by MaterializeVariables when the client expands the variable. When skipping,
+// only tables that can be referred to later in the value are given a reference.
+bool ReadBinaryVariable(ValueReader& reader, DecodaDAP* dap, unsigned int vm, const std::shared_ptr<DecodaDAP::EncodedValue>& value, dap::Variable& var, bool skip = false) {
+    unsigned char tag;
+    if (!reader.ReadTag(tag)) return false;
+
+    var.variablesReference = 0;
+
+    switch (tag) {
+    case ValueTag_Value: {
+        std::string type;
+        if (!reader.ReadString(type) || !reader.ReadString(var.value)) return false;
+        var.type = type;
+        return true;
+    }
+    case ValueTag_Function: {
+        unsigned int script, line;
+        if (!reader.ReadUInt32(script) || !reader.ReadUInt32(line)) return false;
+        var.value = "function (script: " + std::to_string(script) + ", line: " + std::to_string(line) + ")";
         var.type = "function";
-        var.variablesReference = 0;
+        return true;
     }
-    else if (tag == "table") {
-        // <table>...</table>
+    case ValueTag_Error:
+        return reader.ReadString(var.value);
+    case ValueTag_TruncatedValue: {
+        // Only the start of a long string was sent.
+        std::string type;
+        unsigned int handle, length;
+        if (!reader.ReadString(type) || !reader.ReadString(var.value) || !reader.ReadUInt32(handle) || !reader.ReadUInt32(length)) return false;
+        var.value += "... (" + std::to_string(length) + " bytes)";
+        var.type = type;
+        return true;
+    }
+    case ValueTag_Table: {
+        unsigned int id, handle, size, numElements;
+        if (!ReadBinaryTableHeader(reader, id, handle, size, numElements)) return false;
         var.type = "table";
         var.value = "table";
-        std::vector<dap::Variable> children;
-        for (TiXmlElement* el = elem->FirstChildElement("element"); el; el = el->NextSiblingElement("element")) {
-            // Each <element> has <key> and <data>
-            TiXmlElement* keyElem = el->FirstChildElement("key");
-            TiXmlElement* dataElem = el->FirstChildElement("data");
-            std::string keyStr;
-            if (keyElem) {
-                // Key can be a <value> or <table>
-                TiXmlElement* keyVal = keyElem->FirstChildElement();
-                if (keyVal) {
-                    dap::Variable keyVar = ParseXmlToVariable(keyVal, dap, depth + 1);
-                    keyStr = keyVar.value;
-                }
+        auto it = id != 0 ? value->tables.find(id) : value->tables.end();
+        if (it != value->tables.end()) {
+            // The table was already read when the value was first skipped over.
+            var.variablesReference = it->second;
+        }
+        else if (!skip || id != 0) {
+            if (handle != 0 && numElements < size) {
+                // Not all of the elements were sent; they're fetched from the backend
+                // a page at a time when the variable is expanded.
+                DecodaDAP::VariableSlot* slot;
+                var.variablesReference = dap->AllocateVariablesReference(slot);
+                slot->vm = vm;
+                slot->handle = handle;
             }
-            if (dataElem) {
-                TiXmlElement* dataVal = dataElem->FirstChildElement();
-                if (dataVal) {
-                    dap::Variable child = ParseXmlToVariable(dataVal, dap, depth + 1);
-                    child.name = keyStr;
-                    children.push_back(child);
-                }
+            else if (numElements > 0) {
+                DecodaDAP::VariableSlot* slot;
+                var.variablesReference = dap->AllocateVariablesReference(slot);
+                slot->vm = vm;
+                slot->value = value;
+                slot->offset = reader.GetOffset();
+                slot->numElements = numElements;
             }
         }
-        var.variablesReference = !children.empty() ? dap->StoreVariables(children) : 0;
+        if (id != 0) {
+            // The elements may refer back to this table, so its reference has to
+            // be known before they're read.
+            value->tables[id] = static_cast<int>(var.variablesReference);
+        }
+        if (handle != 0 && numElements < size) {
+            var.namedVariables = size;
+        }
+        for (unsigned int i = 0; i < numElements; ++i) {
+            dap::Variable key;
+            dap::Variable child;
+            if (!ReadBinaryVariable(reader, dap, vm, value, key, true) || !ReadBinaryVariable(reader, dap, vm, value, child, true)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case ValueTag_Reference: {
+        // A table that was already read earlier in the value.
+        unsigned int id;
+        if (!reader.ReadUInt32(id)) return false;
+        auto it = value->tables.find(id);
+        var.type = "table";
+        var.value = "table";
+        var.variablesReference = it != value->tables.end() ? it->second : 0;
+        return true;
+    }
+    case ValueTag_Values: {
+        // An expression that evaluated to multiple values.
+        unsigned int numValues;
+        if (!reader.ReadUInt32(numValues)) return false;
+        if (numValues > 0 && !skip) {
+            DecodaDAP::VariableSlot* slot;
+            var.variablesReference = dap->AllocateVariablesReference(slot);
+            slot->vm = vm;
+            slot->value = value;
+            slot->offset = reader.GetOffset();
+            slot->numElements = numValues;
+            slot->results = true;
+        }
+        for (unsigned int i = 0; i < numValues; ++i) {
+            dap::Variable result;
+            if (!ReadBinaryVariable(reader, dap, vm, value, result, true)) return false;
+            var.value += (i > 0 ? ", " : "") + result.value;
+        }
+        return true;
+    }
     }
-    return var;
+    return false;
+}
+
+// Reads the elements of a table or the results of an expression the first time
+// the client asks for them.
+const std::vector<dap::Variable>& MaterializeVariables(DecodaDAP* dap, DecodaDAP::VariableSlot& slot) {
+    if (!slot.materialized && slot.value) {
+        // The slot doesn't need to keep the encoded value alive once its elements
+        // have been read.
+        std::shared_ptr<DecodaDAP::EncodedValue> value = std::move(slot.value);
+        ValueReader reader(value->data, slot.offset);
+        slot.children.reserve(slot.numElements);
+        for (unsigned int i = 0; i < slot.numElements; ++i) {
+            dap::Variable key;
+            dap::Variable child;
+            if (slot.results) {
+                if (!ReadBinaryVariable(reader, dap, slot.vm, value, child)) break;
+                child.name = "[" + std::to_string(i + 1) + "]";
+            }
+            else {
+                if (!ReadBinaryVariable(reader, dap, slot.vm, value, key) || !ReadBinaryVariable(reader, dap, slot.vm, value, child)) break;
+                child.name = key.value;
+            }
+            slot.children.push_back(std::move(child));
+        }
+    }
+    slot.materialized = true;
+    return slot.children;
+}
+
+// Reads a value returned by Evaluate.
+bool ReadBinaryResult(const std::string& result, DecodaDAP* dap, unsigned int vm, dap::Variable& var) {
+    auto value = std::make_shared<DecodaDAP::EncodedValue>();
+    value->data = result;
+    ValueReader reader(value->data);
+    return ReadBinaryVariable(reader, dap, vm, value, var);
+}
+
+// Reads a page of table elements returned by ExpandValue.
+bool ReadBinaryTablePage(const std::string& page, DecodaDAP* dap, unsigned int vm, std::vector<dap::Variable>& children) {
+    auto value = std::make_shared<DecodaDAP::EncodedValue>();
+    value->data = page;
+    ValueReader reader(value->data);
+    unsigned char tag;
+    unsigned int id, handle, size, numElements;
+    if (!reader.ReadTag(tag) || tag != ValueTag_Table || !ReadBinaryTableHeader(reader, id, handle, size, numElements)) {
+        return false;
+    }
+    children.reserve(children.size() + numElements);
+    for (unsigned int i = 0; i < numElements; ++i) {
+        dap::Variable key;
+        dap::Variable child;
+        if (!ReadBinaryVariable(reader, dap, vm, value, key) || !ReadBinaryVariable(reader, dap, vm, value, child)) {
+            return false;
+        }
+        child.name = key.value;
+        children.push_back(std::move(child));
+    }
+    return true;
 }
 
 // Helper to extract value/type from Decoda XML
@@ -96,92 +269,32 @@ dap::Variable ParseXmlToVariable(TiXmlElement* elem, DecodaDAP* dap, int depth =
         value = "";
 }*/
 
-// Helper to convert bytes to hex string
-std::string BytesToHex(const std::vector<unsigned char>&bytes) {
-    static const char hex_digits[] = "0123456789abcdef";
-    std::string hex;
-    hex.reserve(bytes.size() * 2);
-    for (unsigned char b : bytes) {
-        hex.push_back(hex_digits[b >> 4]);
-        hex.push_back(hex_digits[b & 0xF]);
-    }
-    return hex;
-}
-
-/*std::vector<unsigned char> ComputeSHA256(const std::string& filePath) {
-    std::vector<unsigned char> hash(32); // SHA-256 is 32 bytes
-    HCRYPTPROV hProv = 0;
-    HCRYPTHASH hHash = 0;
-    std::ifstream file(filePath, std::ios::binary);
-
-    if (!file) return {};
-
-    if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT))
-        return {};
-
-    if (!CryptCreateHash(hProv, CALG_SHA_256, 0, 0, &hHash)) {
-        CryptReleaseContext(hProv, 0);
-        return {};
-    }
-
-    char buffer[4096];
-    while (file.read(buffer, sizeof(buffer)) || file.gcount()) {
-        if (!CryptHashData(hHash, reinterpret_cast<BYTE*>(buffer), static_cast<DWORD>(file.gcount()), 0)) {
-            CryptDestroyHash(hHash);
-            CryptReleaseContext(hProv, 0);
-            return {};
-        }
-    }
-
-    DWORD hashLen = static_cast<DWORD>(hash.size());
-    if (!CryptGetHashParam(hHash, HP_HASHVAL, hash.data(), &hashLen, 0)) {
-        hash.clear();
-    }
-
-    CryptDestroyHash(hHash);
-    CryptReleaseContext(hProv, 0);
-    return hash;
-}*/
-
-std::vector<unsigned char> ComputeSHA256(const std::string& code) {
-    std::vector<unsigned char> hash(32); // SHA-256 is 32 bytes
-    HCRYPTPROV hProv = 0;
-    HCRYPTHASH hHash = 0;
-
-    if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT))
-        return {};
-
-    if (!CryptCreateHash(hProv, CALG_SHA_256, 0, 0, &hHash)) {
-        CryptReleaseContext(hProv, 0);
-        return {};
-    }
-
-    // Hash the code string directly
-    if (!code.empty()) {
-        if (!CryptHashData(hHash, reinterpret_cast<const BYTE*>(code.data()), static_cast<DWORD>(code.size()), 0)) {
-            CryptDestroyHash(hHash);
-            CryptReleaseContext(hProv, 0);
-            return {};
-        }
-    }
-
-    DWORD hashLen = static_cast<DWORD>(hash.size());
-    if (!CryptGetHashParam(hHash, HP_HASHVAL, hash.data(), &hashLen, 0)) {
-        hash.clear();
-    }
-
-    CryptDestroyHash(hHash);
-    CryptReleaseContext(hProv, 0);
-    return hash;
-}
+// Scope references are kept in their own range so that they don't collide with
+// the references handed out for variables.
+const unsigned int scopeReferenceFlag = 0x40000000;
 
 unsigned int makeVariablesReference(unsigned int frameIndex, bool isGlobal) {
-    return (frameIndex << 1) | (isGlobal ? 1 : 0);
+    return scopeReferenceFlag | (frameIndex << 1) | (isGlobal ? 1 : 0);
 }
 
-void decodeVariablesReference(unsigned int variablesReference, unsigned int& frameIndex, bool& isGlobal) {
+bool decodeVariablesReference(unsigned int variablesReference, unsigned int& frameIndex, bool& isGlobal) {
+    if ((variablesReference & scopeReferenceFlag) == 0) {
+        return false;
+    }
+    variablesReference &= ~scopeReferenceFlag;
     frameIndex = variablesReference >> 1;
     isGlobal = (variablesReference & 1) != 0;
+    return true;
+}
+
+void DecodaDAP::ReleaseVariables() {
+    // The next stop's references start after this one's so that a late request
+    // for an old reference isn't answered with the wrong variable.
+    m_variablesBase += static_cast<int>(m_variableSlots.size());
+    if (m_variablesBase >= static_cast<int>(scopeReferenceFlag / 2)) {
+        m_variablesBase = 1;
+    }
+    std::deque<VariableSlot>().swap(m_variableSlots);
 }
 
 
@@ -380,18 +493,48 @@ bool DecodaDAP::InitializeBackend(const char* symbolsDirectory)
     char commandChannelName[256];
     _snprintf(commandChannelName, 256, "Decoda.Command.%x", m_processId);
 
-    // Setup communication channel with the process that is used to receive events
-    // back to the frontend.
-    if (!m_eventChannel.Create(eventChannelName))
+    // If a debugger address is specified in the environment, the backend
+    // connects to us over TCP instead of using pipes. The process we start
+    // inherits our environment, so it will use the same address.
+
+    std::string host;
+    unsigned short port;
+
+    bool useSockets = Channel::GetSocketAddress(host, port);
+
+    if (useSockets)
     {
-        return false;
-    }
 
-    // Setup communication channel with the process that is used to send commands
-    // to the backend.
-    if (!m_commandChannel.Create(commandChannelName))
+        if (!m_eventChannel.Listen(port))
+        {
+            MessageEvent("Error: Couldn't listen for the debugger connection", MessageType_Error);
+            return false;
+        }
+
+        if (!m_commandChannel.Listen(port + 1))
+        {
+            MessageEvent("Error: Couldn't listen for the debugger connection", MessageType_Error);
+            return false;
+        }
+
+    }
+    else
     {
-        return false;
+
+        // Setup communication channel with the process that is used to receive events
+        // back to the frontend.
+        if (!m_eventChannel.Create(eventChannelName))
+        {
+            return false;
+        }
+
+        // Setup communication channel with the process that is used to send commands
+        // to the backend.
+        if (!m_commandChannel.Create(commandChannelName))
+        {
+            return false;
+        }
+
     }
     //Sleep(30000);
     // Inject our debugger DLL into the process so that we can monitor from
@@ -405,6 +548,13 @@ bool DecodaDAP::InitializeBackend(const char* symbolsDirectory)
     // Wait for the client to connect.
     m_eventChannel.WaitForConnection();
 
+    // With pipes the command channel is ready as soon as the client opens it,
+    // but a socket has to be accepted.
+    if (useSockets && !m_commandChannel.WaitForConnection())
+    {
+        return false;
+    }
+
     // Read the initialization function from the event channel.
 
     if (!ProcessInitialization(symbolsDirectory))
@@ -413,7 +563,34 @@ bool DecodaDAP::InitializeBackend(const char* symbolsDirectory)
         return false;
     }
 
-    m_state = State_Running;
+    // Values are returned with the binary encoding rather than as XML.
+    m_commandChannel.WriteUInt32(CommandId_SetProtocolVersion);
+    m_commandChannel.WriteUInt32(ProtocolVersion_Current);
+
+    // Strings longer than this are only sent as a preview.
+    if (maxStringLength != 0)
+    {
+        m_commandChannel.WriteUInt32(CommandId_SetMaxStringLength);
+        m_commandChannel.WriteUInt32(maxStringLength);
+    }
+
+    // Scripts with breakpoints get them from the backend as they load, so the
+    // backend doesn't need to stop and wait for us on every load.
+    m_commandChannel.WriteUInt32(CommandId_SetLoadPolicy);
+    m_commandChannel.WriteUInt32(LoadPolicy_NoWait);
+
+    {
+        // breakpoints set from here on are sent as they change
+        CriticalSectionLock lock(m_criticalSection);
+        for (const auto& scriptData : m_scriptData)
+        {
+            SendFileBreakpoints(scriptData.second);
+        }
+
+        m_commandChannel.Flush();
+
+        m_state = State_Running;
+    }
 
     // Start a new thread to handle the incoming event channel.
     DWORD threadId;
@@ -693,8 +870,22 @@ void DecodaDAP::EventThreadProc()
 
             //m_eventChannel.ReadString(script->name);
             m_eventChannel.ReadString(script_name);
-            //m_eventChannel.ReadString(script->source);
-            m_eventChannel.ReadString(script_source);
+            std::string script_hash;
+            m_eventChannel.ReadString(script_hash);
+
+            // The backend only sends the source the first time it sees it.
+            bool hasSource = true;
+            m_eventChannel.ReadBool(hasSource);
+
+            if (hasSource) {
+                m_eventChannel.ReadString(script_source);
+            }
+            else {
+                auto foundHash = m_hashToScriptName.find(script_hash);
+                if (foundHash != m_hashToScriptName.end()) {
+                    script_source = m_scriptData[foundHash->second].source;
+                }
+            }
 
             unsigned int codeState;
             m_eventChannel.ReadUInt32(codeState);
@@ -702,11 +893,19 @@ void DecodaDAP::EventThreadProc()
             //script->state = static_cast<CodeState>(codeState);
             CodeState script_state = static_cast<CodeState>(codeState);
 
+            // If the backend already applied the breakpoints we registered for the
+            // file, it isn't waiting for us and we shouldn't send them again.
+            bool resolved = false;
+            m_eventChannel.ReadBool(resolved);
+            bool wait = true;
+            m_eventChannel.ReadBool(wait);
+
             // If the debuggee does wacky things when it specifies the file name
             // we need to correct for that or it can make trying to access the
             // file bad.
             //script->name = MakeValidFileName(script->name);
             script_name = MakeValidFileName(script_name);
+            std::string script_path = script_name;
 
             // extract filename from script_name
             size_t lastSlash = script_name.find_last_of("/\\");
@@ -714,18 +913,20 @@ void DecodaDAP::EventThreadProc()
                 script_name = script_name.substr(lastSlash + 1);
 
             //unsigned int scriptIndex = m_scripts.size();
-            unsigned int scriptIndex = m_scriptIndexes.size();
+            unsigned int scriptIndex = m_nextScriptIndex++;
             //m_scriptIndexes.push_back(script->name);
-            m_scriptIndexes.push_back(script_name);
+            m_scriptIndexes[scriptIndex] = script_name;
             //auto foundScriptData = m_scriptData.find(script->name);
             auto foundScriptData = m_scriptData.find(script_name);
             if (foundScriptData == m_scriptData.end())
             {
                 //auto newscriptdata = ScriptData(script->name);
                 auto newscriptdata = ScriptData(script_name);
+                newscriptdata.path = script_path;
                 newscriptdata.indexMap[scriptIndex] = vm;
 
                 newscriptdata.source = script_source;
+                newscriptdata.hash = script_hash;
                 newscriptdata.state = script_state;
 
                 //m_scriptData[script->name] = newscriptdata;
@@ -737,12 +938,18 @@ void DecodaDAP::EventThreadProc()
                 foundScriptData->second.indexMap[scriptIndex] = vm;
                 // TODO update existing breakpoints for DAP and inject them into backend
             }
+            m_hashToScriptName.emplace(script_hash, script_name);
             //m_scripts.push_back(script);
 
             //for (const auto& existingBp : m_scriptData[script->name].breakpoints)
-            for (const auto& existingBp : m_scriptData[script_name].breakpoints)
+            // scripts are keyed by title, so only apply the breakpoints if they were
+            // set in this file rather than another one with the same title
+            if (!resolved && GetIsScriptFile(m_scriptData[script_name], script_path))
             {
-                ApplyScriptBreakpoint(vm, scriptIndex, existingBp.first);
+                for (const auto& existingBp : m_scriptData[script_name].breakpoints)
+                {
+                    ApplyScriptBreakpoint(vm, scriptIndex, existingBp.first);
+                }
             }
 
             // DAP: Determine if this is a real file
@@ -750,13 +957,12 @@ void DecodaDAP::EventThreadProc()
             loadedEvent.reason = "new";
             //loadedEvent.source.name = script->name;
             loadedEvent.source.name = script_name;
-            //auto sha256 = ComputeSHA256(script->source);
-            auto sha256 = ComputeSHA256(script_source);
-            if (!sha256.empty()) {
+            // The backend computes the digest of the source when it's loaded.
+            if (!script_hash.empty()) {
                 loadedEvent.source.checksums = std::vector<dap::Checksum>();
                 dap::Checksum check = {
-                    "sha256",
-                    BytesToHex(sha256)
+                    "SHA256",
+                    script_hash
                 };
                 loadedEvent.source.checksums.value().push_back(check);
             }
@@ -808,17 +1014,68 @@ void DecodaDAP::EventThreadProc()
             session->send(loadedEvent);
 
             // tell the backend we finished loading the file so it can continue
-            m_commandChannel.WriteUInt32(CommandId_LoadDone);
-            m_commandChannel.WriteUInt32(vm);
-            m_commandChannel.Flush();
+            if (wait)
+            {
+                m_commandChannel.WriteUInt32(CommandId_LoadDone);
+                m_commandChannel.WriteUInt32(vm);
+                m_commandChannel.Flush();
+            }
+        }
+        else if (eventId == EventId_UnloadScript)
+        {
+            CriticalSectionLock lock(m_criticalSection);
+
+            unsigned int scriptIndex;
+            m_eventChannel.ReadUInt32(scriptIndex);
+
+            auto foundIndex = m_scriptIndexes.find(scriptIndex);
+            if (foundIndex != m_scriptIndexes.end())
+            {
+                std::string script_name = foundIndex->second;
+                m_scriptIndexes.erase(foundIndex);
+
+                auto foundScriptData = m_scriptData.find(script_name);
+                if (foundScriptData != m_scriptData.end())
+                {
+                    ScriptData& scriptData = foundScriptData->second;
+                    scriptData.indexMap.erase(scriptIndex);
+
+                    auto hashes = m_hashToScriptName.equal_range(scriptData.hash);
+                    for (auto it = hashes.first; it != hashes.second; ++it) {
+                        if (it->second == script_name) {
+                            m_hashToScriptName.erase(it);
+                            break;
+                        }
+                    }
+
+                    if (scriptData.indexMap.empty())
+                    {
+                        dap::LoadedSourceEvent loadedEvent;
+                        loadedEvent.reason = "removed";
+                        loadedEvent.source = scriptData.sourceInfo;
+                        session->send(loadedEvent);
+
+                        // Keep the breakpoints so they're applied if the script is loaded again.
+                        if (scriptData.breakpoints.empty()) {
+                            m_scriptData.erase(foundScriptData);
+                        }
+                        else {
+                            std::string().swap(scriptData.source);
+                        }
+                    }
+                }
+            }
         }
         else if (eventId == EventId_Break)
         {
             m_state = State_Broken;
 
+            // The break only includes the script frames, the native frames are
+            // requested when the stack trace is.
             unsigned int numStackFrames;
             m_eventChannel.ReadUInt32(numStackFrames);
             m_stackFrames.resize(numStackFrames);
+            m_haveNativeFrames = false;
 
             for (unsigned int i = 0; i < numStackFrames; ++i)
             {
@@ -827,13 +1084,14 @@ void DecodaDAP::EventThreadProc()
                 if (m_stackFrames[i].scriptIndex != -1)
                 {
                     //assert(m_stackFrames[i].scriptIndex < m_scripts.size());
-                    assert(m_stackFrames[i].scriptIndex < m_scriptIndexes.size());
+                    assert(m_scriptIndexes.count(m_stackFrames[i].scriptIndex) != 0);
                 }
 
                 m_eventChannel.ReadUInt32(m_stackFrames[i].line);
                 m_stackFrames[i].line++;
                 m_eventChannel.ReadString(m_stackFrames[i].function);
                 m_stackFrames[i].vm = vm;
+                m_stackFrames[i].stackLevel = i;
             }
 
             //if (numStackFrames > 0)
@@ -851,78 +1109,24 @@ void DecodaDAP::EventThreadProc()
             }
             else if (m_stepping)
             {
-                // only send event if the step doesn't have another step next
-                if (!PerformAutoStep(vm))
-                {
-                    dap::StoppedEvent stopped;
-                    stopped.reason = "step";
-                    stopped.threadId = vm;
-                    //session->send(stopped);
-                    BufferEvent(std::make_unique<dap::StoppedEvent>(stopped), 1000);
-                }
+                dap::StoppedEvent stopped;
+                stopped.reason = "step";
+                stopped.threadId = vm;
+                //session->send(stopped);
+                BufferEvent(std::make_unique<dap::StoppedEvent>(stopped), 1000);
             }
             else
             {
+                // Conditions, hit counts and log points are evaluated by the backend,
+                // so if we stopped on a breakpoint line its condition was met.
                 bool wasBreakpoint = false;
-                // Only check condition for the top stack frame
                 if (!m_stackFrames.empty()) {
                     const auto& frame = m_stackFrames[0];
                     if (frame.scriptIndex != 0xffffffff) { // not native
                         auto scriptName = m_scriptIndexes.at(frame.scriptIndex);
                         auto scriptIt = m_scriptData.find(scriptName);
                         if (scriptIt != m_scriptData.end()) {
-                            auto bpIt = scriptIt->second.breakpoints.find(frame.line);
-                            if (bpIt != scriptIt->second.breakpoints.end()) {
-                                wasBreakpoint = true;
-                                const std::string& cond = bpIt->second.condition;
-                                if (!cond.empty()) {
-                                    std::string evalResult;
-                                    // Evaluate the condition in the context of this frame
-                                    // stackLevel = 0 for top frame
-                                    bool evalSuccess = Evaluate(frame.vm, cond, 0, evalResult);
-                                    bool shouldBreak = false;
-                                    if (!evalSuccess) {
-                                        // Evaluation failed: treat as break due to error
-                                        dap::StoppedEvent stopped;
-                                        stopped.reason = "exception"; // or "breakpoint" if you prefer
-                                        stopped.description = "Error evaluating breakpoint condition: " + cond;
-                                        stopped.text = "Error evaluating breakpoint condition: " + cond;
-                                        stopped.threadId = frame.vm;
-                                        session->send(stopped);
-                                        return;
-                                    }
-                                    else
-                                    {
-                                        // Accept "true" (string or boolean) as break, everything else as continue
-                                        // You may want to parse XML more robustly if needed
-                                        TiXmlDocument doc;
-                                        doc.Parse(evalResult.c_str());
-                                        TiXmlElement* root = doc.RootElement();
-                                        if (root) {
-                                            if (std::string(root->Value()) == "value") {
-                                                TiXmlElement* dataElem = root->FirstChildElement("data");
-                                                if (dataElem && dataElem->GetText()) {
-                                                    std::string val = dataElem->GetText();
-                                                    if (val != "false" && val != "nil") {
-                                                        shouldBreak = true;
-                                                    }
-                                                }
-                                            }
-                                            else if (std::string(root->Value()) == "table") {
-                                                shouldBreak = true; // a table means complex data, which is not false or nil
-                                            }
-                                            else if (std::string(root->Value()) == "function") {
-                                                shouldBreak = true; // a function exists and thus is not false or nil
-                                            }
-                                        }
-                                    }
-                                    if (!shouldBreak) {
-                                        // Condition not met, auto-continue
-                                        Continue(frame.vm);
-                                        return;
-                                    }
-                                }
-                            }
+                            wasBreakpoint = scriptIt->second.breakpoints.find(frame.line) != scriptIt->second.breakpoints.end();
                         }
                     }
                 }
@@ -1184,6 +1388,19 @@ void DecodaDAP::ApplyScriptBreakpoint(unsigned int vm, unsigned int scriptIndex,
     auto existingBpData = script->second.breakpoints.find(line);
     if (existingBpData != script->second.breakpoints.end()) // this should never fail
     {
+        // Send the condition before the breakpoint is activated so the backend
+        // never stops on it unconditionally.
+        if (existingBpData->second.desireActive)
+        {
+            for (const auto& scriptIndexes : script->second.indexMap)
+            {
+                if (scriptIndexes.second == vm)
+                {
+                    SetBreakpointCondition(vm, scriptIndexes.first, line, existingBpData->second);
+                }
+            }
+        }
+
         // Check if the breakpoint's active state differs from the desired state
         if (existingBpData->second.VmIsActiveMap[vm] != existingBpData->second.desireActive)
         {
@@ -1282,6 +1499,8 @@ void DecodaDAP::Continue(unsigned int vm)
         SetFocus(hwnd);
     }
 
+    ResetWatchResults();
+    ReleaseVariables();
     m_state = State_Running;
     m_stepping = false;
     m_commandChannel.WriteUInt32(CommandId_Continue);
@@ -1299,6 +1518,8 @@ void DecodaDAP::Break(unsigned int vm)
 
 void DecodaDAP::StepOver(unsigned int vm)
 {
+    ResetWatchResults();
+    ReleaseVariables();
     m_stepping = true;
     m_state = State_Running;
     m_commandChannel.WriteUInt32(CommandId_StepOver);
@@ -1308,6 +1529,8 @@ void DecodaDAP::StepOver(unsigned int vm)
 
 void DecodaDAP::StepInto(unsigned int vm)
 {
+    ResetWatchResults();
+    ReleaseVariables();
     m_stepping = true;
     m_state = State_Running;
     m_commandChannel.WriteUInt32(CommandId_StepInto);
@@ -1315,44 +1538,161 @@ void DecodaDAP::StepInto(unsigned int vm)
     m_commandChannel.Flush();
 }
 
-bool DecodaDAP::PerformAutoStep(unsigned int vm) {
-    if (m_step_until_under_depth == 0)
+void DecodaDAP::StepOut(unsigned int vm) {
+    // The backend tracks the depth itself and only breaks once the current
+    // function has returned.
+    ResetWatchResults();
+    ReleaseVariables();
+    m_stepping = true;
+    m_state = State_Running;
+    m_commandChannel.WriteUInt32(CommandId_StepOut);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.Flush();
+}
+
+bool DecodaDAP::Evaluate(unsigned int vm, std::string expression, unsigned int stackLevel, std::string& result, unsigned int maxDepth)
+{
+    if (vm == 0)
+    {
         return false;
+    }
 
-    unsigned int currentDepth = GetNumStackFrames();
-    if (currentDepth >= m_step_until_under_depth) {
-        StepOver(vm); // trigger a Break event
-        return true;
+    m_commandChannel.WriteUInt32(CommandId_Evaluate);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteString(expression);
+    m_commandChannel.WriteUInt32(stackLevel);
+    m_commandChannel.WriteUInt32(maxDepth);
+    m_commandChannel.Flush();
+
+    unsigned int success;
+    m_commandChannel.ReadUInt32(success);
+    m_commandChannel.ReadString(result);
+
+    return success != 0;
+}
+
+bool DecodaDAP::EvaluateBatch(unsigned int vm, const std::vector<std::string>& expressions, unsigned int stackLevel, std::vector<std::string>& results, std::vector<bool>& succeeded, unsigned int maxDepth)
+{
+    if (vm == 0)
+    {
+        return false;
     }
 
-    m_step_until_under_depth = 0;
-    return false;
+    m_commandChannel.WriteUInt32(CommandId_EvaluateBatch);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(static_cast<unsigned int>(expressions.size()));
+    for (const std::string& expression : expressions)
+    {
+        m_commandChannel.WriteString(expression);
+    }
+    m_commandChannel.WriteUInt32(stackLevel);
+    m_commandChannel.WriteUInt32(maxDepth);
+    m_commandChannel.Flush();
+
+    unsigned int success;
+    m_commandChannel.ReadUInt32(success);
+
+    results.resize(expressions.size());
+    succeeded.resize(expressions.size());
+    for (size_t i = 0; i < expressions.size(); ++i)
+    {
+        unsigned int expressionSuccess;
+        m_commandChannel.ReadUInt32(expressionSuccess);
+        m_commandChannel.ReadString(results[i]);
+        succeeded[i] = expressionSuccess != 0;
+    }
+
+    return success != 0;
 }
 
-void DecodaDAP::StepOut(unsigned int vm) {
-    unsigned int initialDepth = GetNumStackFrames();
-    if (initialDepth <= 1) {
-        // Already at the top level, nothing to step out of.
-        Continue(vm);
-        return;
+bool DecodaDAP::EvaluateWatch(unsigned int vm, const std::string& expression, unsigned int stackLevel, std::string& result)
+{
+    if (vm != m_watchVm || stackLevel != m_watchStackLevel)
+    {
+        m_watchResults.clear();
+        m_watchVm = vm;
+        m_watchStackLevel = stackLevel;
     }
-    m_stepping = true;
-    m_step_until_under_depth = initialDepth;
-    StepOver(vm); // trigger a Break event
-    return;
+
+    if (std::find(m_requestedWatches.begin(), m_requestedWatches.end(), expression) == m_requestedWatches.end())
+    {
+        m_requestedWatches.push_back(expression);
+    }
+
+    auto it = m_watchResults.find(expression);
+    if (it == m_watchResults.end())
+    {
+        // Evaluate every watch the client asked for at the last stop along with
+        // this one, since the requests for the others are likely to follow.
+        if (std::find(m_watchExpressions.begin(), m_watchExpressions.end(), expression) == m_watchExpressions.end())
+        {
+            m_watchExpressions.push_back(expression);
+        }
+
+        std::vector<std::string> results;
+        std::vector<bool> succeeded;
+        if (!EvaluateBatch(vm, m_watchExpressions, stackLevel, results, succeeded, 1))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < m_watchExpressions.size(); ++i)
+        {
+            m_watchResults[m_watchExpressions[i]] = { succeeded[i], results[i] };
+        }
+        it = m_watchResults.find(expression);
+    }
+
+    result = it->second.result;
+    return it->second.success;
+}
+
+void DecodaDAP::ResetWatchResults()
+{
+    // Watches that weren't asked for at this stop have been removed by the user.
+    m_watchExpressions.swap(m_requestedWatches);
+    m_requestedWatches.clear();
+    ClearWatchResults();
 }
 
-bool DecodaDAP::Evaluate(unsigned int vm, std::string expression, unsigned int stackLevel, std::string& result)
+void DecodaDAP::ClearWatchResults()
+{
+    m_watchResults.clear();
+}
+
+bool DecodaDAP::ExpandValue(unsigned int vm, unsigned int handle, unsigned int start, unsigned int count, std::string& result)
 {
     if (vm == 0)
     {
         return false;
     }
 
-    m_commandChannel.WriteUInt32(CommandId_Evaluate);
+    m_commandChannel.WriteUInt32(CommandId_ExpandValue);
     m_commandChannel.WriteUInt32(vm);
-    m_commandChannel.WriteString(expression);
-    m_commandChannel.WriteUInt32(stackLevel);
+    m_commandChannel.WriteUInt32(handle);
+    m_commandChannel.WriteUInt32(start);
+    m_commandChannel.WriteUInt32(count);
+    m_commandChannel.Flush();
+
+    unsigned int success;
+    m_commandChannel.ReadUInt32(success);
+    m_commandChannel.ReadString(result);
+
+    return success != 0;
+}
+
+bool DecodaDAP::GetStringRange(unsigned int vm, unsigned int handle, unsigned int start, unsigned int count, std::string& result)
+{
+    if (vm == 0)
+    {
+        return false;
+    }
+
+    m_commandChannel.WriteUInt32(CommandId_GetStringRange);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(handle);
+    m_commandChannel.WriteUInt32(start);
+    m_commandChannel.WriteUInt32(count);
     m_commandChannel.Flush();
 
     unsigned int success;
@@ -1371,6 +1711,18 @@ void DecodaDAP::ToggleBreakpoint(unsigned int vm, unsigned int scriptIndex, unsi
     m_commandChannel.Flush();
 }
 
+void DecodaDAP::SetBreakpointCondition(unsigned int vm, unsigned int scriptIndex, unsigned int line, const ScriptBreakpoint& breakpoint)
+{
+    m_commandChannel.WriteUInt32(CommandId_SetBreakpointCondition);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(scriptIndex);
+    m_commandChannel.WriteUInt32(line - 1);
+    m_commandChannel.WriteString(breakpoint.condition);
+    m_commandChannel.WriteString(breakpoint.hitCondition);
+    m_commandChannel.WriteString(breakpoint.logMessage);
+    m_commandChannel.Flush();
+}
+
 void DecodaDAP::RemoveAllBreakPoints()
 {
     m_commandChannel.WriteUInt32(CommandId_DeleteAllBreakpoints);
@@ -1378,6 +1730,53 @@ void DecodaDAP::RemoveAllBreakPoints()
     m_commandChannel.Flush();
 }
 
+bool DecodaDAP::LoadNativeStackFrames(unsigned int vm)
+{
+    if (vm == 0 || m_haveNativeFrames)
+    {
+        return m_haveNativeFrames;
+    }
+
+    m_commandChannel.WriteUInt32(CommandId_GetNativeStack);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.Flush();
+
+    unsigned int numStackFrames;
+    m_commandChannel.ReadUInt32(numStackFrames);
+
+    std::vector<StackFrame> stackFrames(numStackFrames);
+    for (unsigned int i = 0; i < numStackFrames; ++i)
+    {
+        m_commandChannel.ReadUInt32(stackFrames[i].scriptIndex);
+        m_commandChannel.ReadUInt32(stackFrames[i].line);
+        stackFrames[i].line++;
+        m_commandChannel.ReadString(stackFrames[i].function);
+        m_commandChannel.ReadUInt32(stackFrames[i].stackLevel);
+        stackFrames[i].vm = vm;
+    }
+
+    // If the VM is no longer stopped we get back an empty stack, so keep the
+    // script frames we have.
+    if (numStackFrames > 0)
+    {
+        m_stackFrames.swap(stackFrames);
+        m_haveNativeFrames = true;
+    }
+
+    return m_haveNativeFrames;
+}
+
+void DecodaDAP::GetExpressionCacheStats(unsigned int vm, unsigned int& hits, unsigned int& misses, unsigned int& size)
+{
+    m_commandChannel.WriteUInt32(CommandId_GetExpressionCacheStats);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.Flush();
+
+    m_commandChannel.ReadUInt32(hits);
+    m_commandChannel.ReadUInt32(misses);
+    m_commandChannel.ReadUInt32(size);
+}
+
 unsigned int DecodaDAP::GetNumStackFrames() const
 {
     return m_stackFrames.size();
@@ -1610,6 +2009,12 @@ void DecodaDAP::SetBreakpointsForScript(dap::Source source, dap::array<dap::Sour
     }
     ScriptData& scriptData = m_scriptData[name];
 
+    // the backend matches the file by its path, not just the title
+    if (source.path.has_value() && !source.path.value().empty())
+        scriptData.path = source.path.value();
+    else
+        scriptData.path = source.name.value();
+
     std::unordered_set<int64_t> newBreakpoints; // line list so we can remove those not in this list
     for (const auto& bp : breakpoints)
     {
@@ -1619,8 +2024,22 @@ void DecodaDAP::SetBreakpointsForScript(dap::Source source, dap::array<dap::Sour
         if (existing != scriptData.breakpoints.end())
         {
             // update existing
+            bool changed = existing->second.condition != bp.condition.value("") ||
+                existing->second.hitCondition != bp.hitCondition.value("") ||
+                existing->second.logMessage != bp.logMessage.value("");
+
             existing->second.dap = bp;
             existing->second.condition = bp.condition.value("");
+            existing->second.hitCondition = bp.hitCondition.value("");
+            existing->second.logMessage = bp.logMessage.value("");
+
+            if (changed && existing->second.desireActive)
+            {
+                for (const auto& scriptIndex : scriptData.indexMap)
+                {
+                    SetBreakpointCondition(scriptIndex.second, scriptIndex.first, bp.line, existing->second);
+                }
+            }
         }
         else
         {
@@ -1628,6 +2047,8 @@ void DecodaDAP::SetBreakpointsForScript(dap::Source source, dap::array<dap::Sour
             scriptData.breakpoints[bp.line].dap = bp;
             scriptData.breakpoints[bp.line].desireActive = true;
             scriptData.breakpoints[bp.line].condition = bp.condition.value("");
+            scriptData.breakpoints[bp.line].hitCondition = bp.hitCondition.value("");
+            scriptData.breakpoints[bp.line].logMessage = bp.logMessage.value("");
 
             // new breakpoint so activate it
             for (const auto& scriptIndex : scriptData.indexMap)
@@ -1666,6 +2087,54 @@ void DecodaDAP::SetBreakpointsForScript(dap::Source source, dap::array<dap::Sour
             }
         }
     }
+
+    // keep the backend's list for the file current so scripts loaded later get it too
+    if (m_state != State_Inactive)
+    {
+        SendFileBreakpoints(scriptData);
+        m_commandChannel.Flush();
+    }
+}
+
+void DecodaDAP::SendFileBreakpoints(const ScriptData& scriptData)
+{
+    // the backend normalizes the name the same way as the names of loaded scripts
+    // (see NormalizeFileName) and matches them by path, so send the path we know
+    // the file by rather than the title we key scripts by
+    const std::string& fileName = scriptData.path.empty() ? scriptData.name : scriptData.path;
+
+    std::vector<const std::pair<const int64_t, ScriptBreakpoint>*> active;
+    for (const auto& bp : scriptData.breakpoints)
+    {
+        if (bp.second.desireActive)
+            active.push_back(&bp);
+    }
+
+    m_commandChannel.WriteUInt32(CommandId_SetFileBreakpoints);
+    m_commandChannel.WriteString(fileName);
+    m_commandChannel.WriteBool(false);
+    m_commandChannel.WriteUInt32(static_cast<unsigned int>(active.size()));
+    for (const auto* bp : active)
+    {
+        m_commandChannel.WriteUInt32(static_cast<unsigned int>(bp->first - 1));
+        m_commandChannel.WriteString(bp->second.condition);
+        m_commandChannel.WriteString(bp->second.hitCondition);
+        m_commandChannel.WriteString(bp->second.logMessage);
+    }
+}
+
+bool DecodaDAP::GetIsScriptFile(const ScriptData& scriptData, const std::string& scriptName) const
+{
+    if (scriptData.path.empty())
+        return true;
+
+    std::string fileName;
+    NormalizeFileName(scriptData.path.c_str(), fileName);
+
+    std::string normalizedScriptName;
+    NormalizeFileName(scriptName.c_str(), normalizedScriptName);
+
+    return GetFileNameMatchLength(fileName, normalizedScriptName) > 0;
 }
 
 dap::Source DecodaDAP::GetDapSource(int scriptIndex)
@@ -1710,6 +2179,9 @@ int main(int, char* []) {
         response.supportsSetVariable = true; // Optional, if you support variable setting
         response.supportsEvaluateForHovers = true; // Optional, if you support hover evaluation
         response.supportsConditionalBreakpoints = true;
+        response.supportsHitConditionalBreakpoints = true;
+        response.supportsLogPoints = true;
+        response.supportsClipboardContext = true; // Long strings are copied in full
         //response.supportsPauseRequest = true;
         return response;
     });
@@ -1730,6 +2202,8 @@ int main(int, char* []) {
             std::string cwd = request.cwd.value("");
             std::string symbols = request.symbols.value("");
             decoda.ignorePureNativeExceptions = request.ignorePureNativeExceptions.value(true);
+            decoda.showNativeFrames = request.nativeFrames.value(false);
+            decoda.maxStringLength = static_cast<unsigned int>(request.maxStringLength.value(0));
             bool breakOnStart = request.breakOnStart.value(false);
 
             if (request.luaWorkspaceLibrary.has_value())
@@ -1799,6 +2273,8 @@ int main(int, char* []) {
             unsigned int pid = pid = request.processId.value(0);
             std::string symbols = request.symbols.value("");
             decoda.ignorePureNativeExceptions = request.ignorePureNativeExceptions.value(true);
+            decoda.showNativeFrames = request.nativeFrames.value(false);
+            decoda.maxStringLength = static_cast<unsigned int>(request.maxStringLength.value(0));
 
             if (request.luaWorkspaceLibrary.has_value())
             {
@@ -1889,6 +2365,11 @@ int main(int, char* []) {
 
         //log << "StackTraceRequest received for threadId: " << std::to_string(request.threadId) << std::endl;
 
+        // Walking the native stack is slow, so it's only done when asked for.
+        if (decoda.showNativeFrames && decoda.GetNumStackFrames() > 0) {
+            decoda.LoadNativeStackFrames(decoda.GetStackFrame(0).vm);
+        }
+
         unsigned int numFrames = decoda.GetNumStackFrames();
         for (unsigned int i = 0; i < numFrames; ++i) {
             auto frame = decoda.GetStackFrame(i);
@@ -1924,6 +2405,11 @@ int main(int, char* []) {
             return dap::Error("Invalid frameId");
         }
 
+        // Native frames don't have any variables we can show.
+        if (decoda.GetStackFrame(frameIndex).stackLevel == 0xffffffff) {
+            return response;
+        }
+
         // Locals scope
         //dap::Scope locals;
         //locals.name = "Locals";
@@ -1955,43 +2441,28 @@ int main(int, char* []) {
 
             unsigned int frameIndex;
             bool isGlobal;
-            decodeVariablesReference(request.variablesReference, frameIndex, isGlobal);
 
-            if (frameIndex < decoda.GetNumStackFrames()) {
+            if (decodeVariablesReference(static_cast<unsigned int>(request.variablesReference), frameIndex, isGlobal) && frameIndex < decoda.GetNumStackFrames()) {
                 if (isGlobal) {
                     // Only support globals
                     const auto& frame = decoda.GetStackFrame(frameIndex);
                     unsigned int vm = frame.vm;
-                    unsigned int stackLevel = frameIndex;
+                    unsigned int stackLevel = frame.stackLevel;
 
+                    // Only get the handle for the globals table, and then fetch the
+                    // requested range of its elements.
                     std::string result;
-                    if (decoda.Evaluate(vm, "_G", stackLevel, result)) {
-                        TiXmlDocument doc;
-                        doc.Parse(result.c_str());
-                        TiXmlElement* root = doc.RootElement();
-                        if (root && std::string(root->Value()) == "table") {
-                            std::vector<dap::Variable> vars;
-                            for (TiXmlElement* el = root->FirstChildElement("element"); el; el = el->NextSiblingElement("element")) {
-                                TiXmlElement* keyElem = el->FirstChildElement("key");
-                                TiXmlElement* dataElem = el->FirstChildElement("data");
-                                std::string keyStr;
-                                if (keyElem) {
-                                    TiXmlElement* keyVal = keyElem->FirstChildElement();
-                                    if (keyVal) {
-                                        dap::Variable keyVar = ParseXmlToVariable(keyVal, &decoda, 1);
-                                        keyStr = keyVar.value;
-                                    }
-                                }
-                                if (dataElem) {
-                                    TiXmlElement* dataVal = dataElem->FirstChildElement();
-                                    if (dataVal) {
-                                        dap::Variable child = ParseXmlToVariable(dataVal, &decoda, 1);
-                                        child.name = keyStr;
-                                        vars.push_back(child);
-                                    }
-                                }
+                    if (decoda.Evaluate(vm, "_G", stackLevel, result, 0)) {
+                        ValueReader reader(result);
+                        unsigned char tag;
+                        unsigned int id, handle, size, numElements;
+                        if (reader.ReadTag(tag) && tag == ValueTag_Table && ReadBinaryTableHeader(reader, id, handle, size, numElements) && handle != 0) {
+                            unsigned int start = static_cast<unsigned int>(request.start.value(0));
+                            unsigned int count = static_cast<unsigned int>(request.count.value(0));
+                            std::string page;
+                            if (decoda.ExpandValue(vm, handle, start, count, page)) {
+                                ReadBinaryTablePage(page, &decoda, vm, response.variables);
                             }
-                            response.variables = vars;
                         }
                     }
                     return response;
@@ -2003,13 +2474,28 @@ int main(int, char* []) {
                 }
             }
 
-            // Fallback: check variableStore for Evaluate expansion
-            auto it = decoda.variableStore.find(request.variablesReference);
-            if (it != decoda.variableStore.end()) {
-                response.variables = it->second;
+            DecodaDAP::VariableSlot* slot = decoda.GetVariableSlot(static_cast<int>(request.variablesReference));
+            if (slot == nullptr) {
+                return dap::Error("Unknown variablesReference");
+            }
+
+            // Tables whose elements weren't sent with the value are expanded a
+            // page at a time.
+            if (slot->handle != 0) {
+                unsigned int vm = slot->vm;
+                unsigned int handle = slot->handle;
+                unsigned int start = static_cast<unsigned int>(request.start.value(0));
+                unsigned int count = static_cast<unsigned int>(request.count.value(0));
+                std::string page;
+                if (!decoda.ExpandValue(vm, handle, start, count, page)) {
+                    return dap::Error("The value is no longer available");
+                }
+                ReadBinaryTablePage(page, &decoda, vm, response.variables);
                 return response;
             }
-            return dap::Error("Unknown variablesReference");
+
+            response.variables = MaterializeVariables(&decoda, *slot);
+            return response;
         });
 
     // Continue execution.
@@ -2095,13 +2581,27 @@ int main(int, char* []) {
                 // For example, if your StackFrame struct has a vm/threadId:
                 const auto& frame = decoda.GetStackFrame(frameIndex);
                 vm = frame.vm; // or frame.threadId, depending on your struct
-                stackLevel = frameIndex;
+                if (frame.stackLevel == 0xffffffff) {
+                    return dap::Error("Expressions can't be evaluated in a native frame");
+                }
+                stackLevel = frame.stackLevel;
             }
             else {
                 // Fallback: use a default VM/thread or return an error
                 return dap::Error("EvaluateRequest missing frameId; cannot determine thread context");
             }
 
+            // debugger commands start with a dot, which can't start a Lua expression
+            if (request.context.value("") == "repl" && request.expression == ".cachestats") {
+                unsigned int hits, misses, size;
+                decoda.GetExpressionCacheStats(vm, hits, misses, size);
+                unsigned int lookups = hits + misses;
+                response.result = "Expression cache: " + std::to_string(hits) + " hits, " + std::to_string(misses) + " misses (" +
+                    std::to_string(lookups > 0 ? hits * 100 / lookups : 0) + "% hit rate), " + std::to_string(size) + " cached";
+                response.variablesReference = 0;
+                return response;
+            }
+
             //if (decoda.Evaluate(vm, request.expression, stackLevel, result)) {
             //    std::string value, type;
             //    ParseDecodaXmlResult(result, value, type);
@@ -2111,11 +2611,44 @@ int main(int, char* []) {
             //    response.variablesReference = 0; // Set to nonzero if you support children/expansion
             //    return response;
             //}
-            if (decoda.Evaluate(vm, request.expression, stackLevel, result)) {
-                TiXmlDocument doc;
-                doc.Parse(result.c_str());
-                TiXmlElement* root = doc.RootElement();
-                dap::Variable topVar = ParseXmlToVariable(root, &decoda);
+            // Only the top level of the result is sent; nested tables are fetched
+            // when they're expanded.
+            bool success;
+            if (request.context.value("") == "watch") {
+                success = decoda.EvaluateWatch(vm, request.expression, stackLevel, result);
+            }
+            else {
+                success = decoda.Evaluate(vm, request.expression, stackLevel, result, 1);
+                // The expression may have changed the values of the watches.
+                decoda.ClearWatchResults();
+            }
+            if (success && request.context.value("") == "clipboard") {
+                // Copying a long string copies all of it rather than the preview.
+                ValueReader reader(result);
+                unsigned char tag;
+                std::string type, preview;
+                unsigned int handle, length;
+                if (reader.ReadTag(tag) && tag == ValueTag_TruncatedValue &&
+                    reader.ReadString(type) && reader.ReadString(preview) && reader.ReadUInt32(handle) && reader.ReadUInt32(length)) {
+                    const unsigned int chunkSize = 1024 * 1024;
+                    std::string text;
+                    text.reserve(length);
+                    while (text.length() < length) {
+                        std::string chunk;
+                        if (!decoda.GetStringRange(vm, handle, static_cast<unsigned int>(text.length()), chunkSize, chunk) || chunk.empty()) {
+                            return dap::Error("The value is no longer available");
+                        }
+                        text += chunk;
+                    }
+                    response.result = text;
+                    response.type = type;
+                    response.variablesReference = 0;
+                    return response;
+                }
+            }
+            if (success) {
+                dap::Variable topVar;
+                ReadBinaryResult(result, &decoda, vm, topVar);
                 response.result = topVar.value;
                 if (topVar.type.has_value())
                     response.type = topVar.type;
@@ -12,6 +12,7 @@
 #include "CriticalSectionLock.h"
 #include "Protocol.h"
 #include "Channel.h"
+#include "FileName.h"
 //#include "LineMapper.h"
 
 #include "MutexEvent.h"
@@ -19,8 +20,9 @@
 #include <imagehlp.h>
 #include <tlhelp32.h>
 
-#include <wincrypt.h>
 #include <vector>
+#include <deque>
+#include <memory>
 #include <fstream>
 
 #include <unordered_set>
@@ -37,6 +39,8 @@ namespace dap {
         optional<dap::integer> processId;
         optional<std::string> symbols;
         optional<dap::boolean> ignorePureNativeExceptions;
+        optional<dap::boolean> nativeFrames;
+        optional<dap::integer> maxStringLength;
         optional<dap::array<dap::string>> luaWorkspaceLibrary;
     };
 
@@ -46,6 +50,8 @@ namespace dap {
         DAP_FIELD(processId, "processId"),
         DAP_FIELD(symbols, "symbols"),
         DAP_FIELD(ignorePureNativeExceptions, "ignorePureNativeExceptions"),
+        DAP_FIELD(nativeFrames, "nativeFrames"),
+        DAP_FIELD(maxStringLength, "maxStringLength"),
         DAP_FIELD(luaWorkspaceLibrary, "luaWorkspaceLibrary"));
 
 
@@ -56,6 +62,8 @@ namespace dap {
         optional<dap::string> cwd;
         optional<dap::string> symbols;
         optional<dap::boolean> ignorePureNativeExceptions;
+        optional<dap::boolean> nativeFrames;
+        optional<dap::integer> maxStringLength;
         optional<dap::boolean> breakOnStart;
         optional<dap::integer> delayedAttach;
         optional<dap::array<dap::string>> luaWorkspaceLibrary;
@@ -69,6 +77,8 @@ namespace dap {
         DAP_FIELD(cwd, "cwd"),
         DAP_FIELD(symbols, "symbols"),
         DAP_FIELD(ignorePureNativeExceptions, "ignorePureNativeExceptions"),
+        DAP_FIELD(nativeFrames, "nativeFrames"),
+        DAP_FIELD(maxStringLength, "maxStringLength"),
         DAP_FIELD(breakOnStart, "breakOnStart"),
         DAP_FIELD(delayedAttach, "delayedAttach"),
         DAP_FIELD(luaWorkspaceLibrary, "luaWorkspaceLibrary"));
@@ -102,6 +112,8 @@ private:
         dap::SourceBreakpoint dap;
         std::unordered_map<unsigned int, bool> VmIsActiveMap; // current state of breakpoint in a VM
         std::string condition;
+        std::string hitCondition;
+        std::string logMessage;
 
         ScriptBreakpoint() : desireActive(false) {}
         ScriptBreakpoint(dap::SourceBreakpoint dap) : dap(dap), desireActive(false) {}
@@ -110,12 +122,14 @@ private:
     struct ScriptData
     {
         std::string name; // name of the script, generally filename
+        std::string path; // name of the file including its directory, if we know it
         std::unordered_map<unsigned int, unsigned int> indexMap; // what script indexes there are and what VM index it is loaded for (allow cleaning when VMs are gone)
 
         std::unordered_map<int64_t, ScriptBreakpoint> breakpoints; // set of breakpoint lines
 
 
         std::string     source;     // Source code for the script
+        std::string     hash;       // SHA-256 digest of the source, computed by the backend
         CodeState       state;
         dap::Source  sourceInfo; // DAP source info
 
@@ -130,6 +144,7 @@ private:
         unsigned int    line;
         std::string     function;
         unsigned int    vm;
+        unsigned int    stackLevel; // Level in the script stack, or -1 for native frames
     };
 
     enum State
@@ -157,19 +172,58 @@ private:
 
     //std::vector<Script*>        m_scripts;
     std::vector<StackFrame>     m_stackFrames;
+    bool                        m_haveNativeFrames = false; // m_stackFrames includes the native frames
 
     std::unordered_map<std::string, ScriptData> m_scriptData;
-    std::vector<std::string>                    m_scriptIndexes;
+    std::unordered_map<unsigned int, std::string> m_scriptIndexes; // Script names for the indexes that are loaded
+    unsigned int                                m_nextScriptIndex = 0; // The backend numbers the scripts in the order it sends them
+    std::unordered_multimap<std::string, std::string> m_hashToScriptName; // One entry for each loaded index
 
     State                       m_state;
 
-    unsigned int m_step_until_under_depth = 0;
+    // Clients evaluate each watch with a separate request every time execution
+    // stops, so the watches are evaluated together and answered from this cache.
+    struct WatchResult
+    {
+        bool success;
+        std::string result;
+    };
+
+    std::vector<std::string>    m_watchExpressions;     // Watches to evaluate together at the next stop
+    std::vector<std::string>    m_requestedWatches;     // Watches the client asked for at this stop
+    std::unordered_map<std::string, WatchResult> m_watchResults;
+    unsigned int                m_watchVm = 0;
+    unsigned int                m_watchStackLevel = 0;
 
 public:
-    std::unordered_map<int, std::vector<dap::Variable>> variableStore;
-    int StoreVariables(const std::vector<dap::Variable>& vars);
+    // A value as it was sent by the backend. The elements of its tables are only
+    // turned into variables when the client asks for them.
+    struct EncodedValue
+    {
+        std::string data;
+        std::unordered_map<unsigned int, int> tables; // Variables reference for each table id in the value
+    };
+
+    // Storage behind a variables reference. References are only valid while
+    // stopped, so the whole store is dropped when execution continues.
+    struct VariableSlot
+    {
+        unsigned int vm = 0;
+        unsigned int handle = 0;                // Backend handle for a table whose elements are fetched a page at a time
+        std::shared_ptr<EncodedValue> value;    // Value holding the elements that haven't been materialized yet
+        size_t offset = 0;                      // Position of the first element in the value
+        unsigned int numElements = 0;
+        bool results = false;                   // The elements are the results of an expression rather than key/value pairs
+        bool materialized = false;
+        std::vector<dap::Variable> children;
+    };
+
+    int AllocateVariablesReference(VariableSlot*& slot);
+    VariableSlot* GetVariableSlot(int variablesReference);
+    void ReleaseVariables();
 private:
-    int nextVariableReference = 1;
+    std::deque<VariableSlot>    m_variableSlots;        // Deque so slots don't move as more are allocated
+    int                         m_variablesBase = 1;    // Reference of the first slot in this stop
 
 public:
     dap::Source GetDapSource(int scriptIndex);
@@ -180,6 +234,8 @@ public:
     std::unordered_map<std::string, dap::string> sourceMap;
 
     bool ignorePureNativeExceptions = true;
+    bool showNativeFrames = false;
+    unsigned int maxStringLength = 0; // 0 uses the backend's default
 
 public:
     bool m_stepping = false;
@@ -239,24 +295,39 @@ public:
     void StepOver(unsigned int vm);
     void StepInto(unsigned int vm);
     void StepOut(unsigned int vm);
-    bool Evaluate(unsigned int vm, std::string expression, unsigned int stackLevel, std::string& result);
+    bool Evaluate(unsigned int vm, std::string expression, unsigned int stackLevel, std::string& result, unsigned int maxDepth = 10);
+    bool ExpandValue(unsigned int vm, unsigned int handle, unsigned int start, unsigned int count, std::string& result);
+    bool GetStringRange(unsigned int vm, unsigned int handle, unsigned int start, unsigned int count, std::string& result);
+    bool EvaluateBatch(unsigned int vm, const std::vector<std::string>& expressions, unsigned int stackLevel, std::vector<std::string>& results, std::vector<bool>& succeeded, unsigned int maxDepth = 10);
+    bool EvaluateWatch(unsigned int vm, const std::string& expression, unsigned int stackLevel, std::string& result);
+    void ResetWatchResults();
+    void ClearWatchResults();
 
     void ToggleBreakpoint(unsigned int vm, unsigned int scriptIndex, unsigned int line);
+    void SetBreakpointCondition(unsigned int vm, unsigned int scriptIndex, unsigned int line, const ScriptBreakpoint& breakpoint);
     void RemoveAllBreakPoints();
 
     void SetBreakpointsForScript(dap::Source source, dap::array<dap::SourceBreakpoint> breakpoints, dap::array<dap::Breakpoint>& breakpointsOut);
 
+    // sends the breakpoints for a file so the backend can apply them when it loads
+    void SendFileBreakpoints(const ScriptData& scriptData);
+
+    // true if a script loaded with the name is the file the script data is for
+    bool GetIsScriptFile(const ScriptData& scriptData, const std::string& scriptName) const;
+
     // used for internal tracking
     void ApplyScriptBreakpoint(unsigned int vm, unsigned int scriptIndex, dap::integer line);
 
     // used for system breakpoints
     void SetBreakpoint(HANDLE p_process, LPVOID entryPoint, bool set, BYTE* data) const;
 
+    bool LoadNativeStackFrames(unsigned int vm);
+
+    // gets the hit and miss counts of the backend's compiled expression cache
+    void GetExpressionCacheStats(unsigned int vm, unsigned int& hits, unsigned int& misses, unsigned int& size);
     unsigned int GetNumStackFrames() const;
     const StackFrame GetStackFrame(unsigned int i) const;
 
-    bool PerformAutoStep(unsigned int vm);
-
     //Script* GetScript(unsigned int scriptIndex);
 
     unsigned int m_vm; // For now, always 0
@@ -51,12 +51,13 @@ DebugFrontend::DebugFrontend()
     m_eventHandler  = NULL;
     m_eventThread   = NULL;
     m_state         = State_Inactive;
+    m_nextScriptIndex = 0;
 }
 
 DebugFrontend::~DebugFrontend()
 {
     Stop(false);
-    ClearVector(m_scripts);
+    ClearScripts();
 }
 
 void DebugFrontend::SetEventHandler(wxEvtHandler* eventHandler)
@@ -179,18 +180,48 @@ bool DebugFrontend::InitializeBackend(const char* symbolsDirectory)
     char commandChannelName[256];
     _snprintf(commandChannelName, 256, "Decoda.Command.%x", m_processId);
     
-    // Setup communication channel with the process that is used to receive events
-    // back to the frontend.
-    if (!m_eventChannel.Create(eventChannelName))
+    // If a debugger address is specified in the environment, the backend
+    // connects to us over TCP instead of using pipes. The process we start
+    // inherits our environment, so it will use the same address.
+
+    std::string host;
+    unsigned short port;
+
+    bool useSockets = Channel::GetSocketAddress(host, port);
+
+    if (useSockets)
     {
-        return false;
-    }
 
-    // Setup communication channel with the process that is used to send commands
-    // to the backend.
-    if (!m_commandChannel.Create(commandChannelName))
+        if (!m_eventChannel.Listen(port))
+        {
+            MessageEvent("Error: Couldn't listen for the debugger connection", MessageType_Error);
+            return false;
+        }
+
+        if (!m_commandChannel.Listen(port + 1))
+        {
+            MessageEvent("Error: Couldn't listen for the debugger connection", MessageType_Error);
+            return false;
+        }
+
+    }
+    else
     {
-        return false;
+
+        // Setup communication channel with the process that is used to receive events
+        // back to the frontend.
+        if (!m_eventChannel.Create(eventChannelName))
+        {
+            return false;
+        }
+
+        // Setup communication channel with the process that is used to send commands
+        // to the backend.
+        if (!m_commandChannel.Create(commandChannelName))
+        {
+            return false;
+        }
+
     }
 
     // Inject our debugger DLL into the process so that we can monitor from
@@ -204,6 +235,13 @@ bool DebugFrontend::InitializeBackend(const char* symbolsDirectory)
     // Wait for the client to connect.
     m_eventChannel.WaitForConnection();
 
+    // With pipes the command channel is ready as soon as the client opens it,
+    // but a socket has to be accepted.
+    if (useSockets && !m_commandChannel.WaitForConnection())
+    {
+        return false;
+    }
+
     // Read the initialization function from the event channel.
 
     if (!ProcessInitialization(symbolsDirectory))
@@ -514,20 +552,51 @@ void DebugFrontend::EventThreadProc()
             Script* script = new Script;
 
             m_eventChannel.ReadString(script->name);
-            m_eventChannel.ReadString(script->source);
+            m_eventChannel.ReadString(script->hash);
+
+            // The backend only sends the source the first time it sees it, so if
+            // we don't get it, copy it from the script we already have.
+
+            bool hasSource = true;
+            m_eventChannel.ReadBool(hasSource);
+
+            if (hasSource)
+            {
+                m_eventChannel.ReadString(script->source);
+            }
+            else
+            {
+                std::multimap<std::string, unsigned int>::const_iterator iterator = m_hashToScript.find(script->hash);
+                if (iterator != m_hashToScript.end())
+                {
+                    script->source = m_scripts[iterator->second]->source;
+                }
+            }
 
             unsigned int codeState;
             m_eventChannel.ReadUInt32(codeState);
 
             script->state = static_cast<CodeState>(codeState);
 
+            // We never pre-register breakpoints or change the load policy, so the
+            // backend always waits for us; pass the flag along anyway.
+            bool resolved = false;
+            bool wait     = true;
+            m_eventChannel.ReadBool(resolved);
+            m_eventChannel.ReadBool(wait);
+
+            event.SetEnabled(wait);
+
             // If the debuggee does wacky things when it specifies the file name
             // we need to correct for that or it can make trying to access the
             // file bad.
             script->name = MakeValidFileName(script->name);
 
-            unsigned int scriptIndex = m_scripts.size();
-            m_scripts.push_back(script);
+            // The backend numbers the scripts in the order it sends them.
+            unsigned int scriptIndex = m_nextScriptIndex++;
+            m_scripts.insert(std::make_pair(scriptIndex, script));
+
+            m_hashToScript.insert(std::make_pair(script->hash, scriptIndex));
         
             event.SetScriptIndex(scriptIndex);
 
@@ -548,7 +617,7 @@ void DebugFrontend::EventThreadProc()
 
                 if (m_stackFrames[i].scriptIndex != -1)
                 {
-                    assert(m_stackFrames[i].scriptIndex < m_scripts.size());
+                    assert(m_scripts.find(m_stackFrames[i].scriptIndex) != m_scripts.end());
                 }
 
                 m_eventChannel.ReadUInt32(m_stackFrames[i].line);
@@ -625,6 +694,16 @@ void DebugFrontend::EventThreadProc()
             
             event.SetMessage(message);            
 
+        }
+        else if (eventId == EventId_UnloadScript)
+        {
+
+            unsigned int scriptIndex;
+            m_eventChannel.ReadUInt32(scriptIndex);
+
+            // The script is removed by the UI once it has handled the event.
+            event.SetScriptIndex(scriptIndex);
+
         }
 
         // Dispatch the message to the UI.
@@ -650,7 +729,7 @@ void DebugFrontend::Shutdown()
     m_state = State_Inactive;
 
     // Clean up the scripts.
-    ClearVector(m_scripts);
+    ClearScripts();
 
     // Clean up.
     CloseHandle(m_process);
@@ -706,6 +785,14 @@ void DebugFrontend::StepInto(unsigned int vm)
     m_commandChannel.Flush();
 }
 
+void DebugFrontend::StepOut(unsigned int vm)
+{
+    m_state = State_Running;
+    m_commandChannel.WriteUInt32(CommandId_StepOut);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.Flush();
+}
+
 void DebugFrontend::DoneLoadingScript(unsigned int vm)
 {
     m_commandChannel.WriteUInt32(CommandId_LoadDone);
@@ -713,7 +800,7 @@ void DebugFrontend::DoneLoadingScript(unsigned int vm)
     m_commandChannel.Flush();
 }
 
-bool DebugFrontend::Evaluate(unsigned int vm, const char* expression, unsigned int stackLevel, std::string& result)
+bool DebugFrontend::Evaluate(unsigned int vm, const char* expression, unsigned int stackLevel, std::string& result, unsigned int maxDepth)
 {
 
     if (vm == 0)
@@ -725,6 +812,7 @@ bool DebugFrontend::Evaluate(unsigned int vm, const char* expression, unsigned i
     m_commandChannel.WriteUInt32(vm);
     m_commandChannel.WriteString(expression);
     m_commandChannel.WriteUInt32(stackLevel);
+    m_commandChannel.WriteUInt32(maxDepth);
     m_commandChannel.Flush();
 
     unsigned int success;
@@ -735,6 +823,47 @@ bool DebugFrontend::Evaluate(unsigned int vm, const char* expression, unsigned i
 
 }
 
+bool DebugFrontend::EvaluateBatch(unsigned int vm, const std::vector<std::string>& expressions, unsigned int stackLevel, std::vector<std::string>& results, unsigned int maxDepth)
+{
+
+    results.clear();
+
+    if (vm == 0)
+    {
+        return false;
+    }
+
+    m_commandChannel.WriteUInt32(CommandId_EvaluateBatch);
+    m_commandChannel.WriteUInt32(vm);
+    m_commandChannel.WriteUInt32(static_cast<unsigned int>(expressions.size()));
+
+    for (unsigned int i = 0; i < expressions.size(); ++i)
+    {
+        m_commandChannel.WriteString(expressions[i]);
+    }
+
+    m_commandChannel.WriteUInt32(stackLevel);
+    m_commandChannel.WriteUInt32(maxDepth);
+    m_commandChannel.Flush();
+
+    unsigned int success;
+    m_commandChannel.ReadUInt32(success);
+
+    results.resize(expressions.size());
+
+    for (unsigned int i = 0; i < expressions.size(); ++i)
+    {
+        // The result contains the error message if the expression failed, so
+        // we don't need to keep track of which ones succeeded.
+        unsigned int succeeded;
+        m_commandChannel.ReadUInt32(succeeded);
+        m_commandChannel.ReadString(results[i]);
+    }
+
+    return success != 0;
+
+}
+
 void DebugFrontend::ToggleBreakpoint(unsigned int vm, unsigned int scriptIndex, unsigned int line)
 {
 
@@ -758,24 +887,69 @@ void DebugFrontend::RemoveAllBreakPoints(unsigned int vm)
 DebugFrontend::Script* DebugFrontend::GetScript(unsigned int scriptIndex)
 {
     CriticalSectionLock lock(m_criticalSection);
-    if (scriptIndex == -1)
+    std::map<unsigned int, Script*>::const_iterator iterator = m_scripts.find(scriptIndex);
+    if (iterator == m_scripts.end())
     {
         return NULL;
     }
     else
     {
-        return m_scripts[scriptIndex];
+        return iterator->second;
+    }
+}
+
+void DebugFrontend::RemoveScript(unsigned int scriptIndex)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    std::map<unsigned int, Script*>::iterator iterator = m_scripts.find(scriptIndex);
+
+    if (iterator == m_scripts.end())
+    {
+        return;
     }
+
+    Script* script = iterator->second;
+
+    std::pair<std::multimap<std::string, unsigned int>::iterator, std::multimap<std::string, unsigned int>::iterator> matches = m_hashToScript.equal_range(script->hash);
+
+    for (std::multimap<std::string, unsigned int>::iterator match = matches.first; match != matches.second; ++match)
+    {
+        if (match->second == scriptIndex)
+        {
+            m_hashToScript.erase(match);
+            break;
+        }
+    }
+
+    m_scripts.erase(iterator);
+    delete script;
+
+}
+
+void DebugFrontend::ClearScripts()
+{
+
+    for (std::map<unsigned int, Script*>::iterator iterator = m_scripts.begin(); iterator != m_scripts.end(); ++iterator)
+    {
+        delete iterator->second;
+    }
+
+    m_scripts.clear();
+    m_hashToScript.clear();
+    m_nextScriptIndex = 0;
+
 }
 
 unsigned int DebugFrontend::GetScriptIndex(const char* name) const
 {
 
-    for (unsigned int i = 0; i < m_scripts.size(); ++i)
+    for (std::map<unsigned int, Script*>::const_iterator iterator = m_scripts.begin(); iterator != m_scripts.end(); ++iterator)
     {
-        if (m_scripts[i]->name == name)
+        if (iterator->second->name == name)
         {
-            return i;
+            return iterator->first;
         }
     }
 
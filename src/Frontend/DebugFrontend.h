@@ -28,6 +28,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include <windows.h>
 #include <string>
 #include <vector>
+#include <map>
 
 #include "Channel.h"
 #include "Protocol.h"
@@ -46,6 +47,7 @@ public:
     {
         std::string     name;       // Identifying name of the script (usually a file name)
         std::string     source;     // Source code for the script
+        std::string     hash;       // SHA-256 digest of the source code
         CodeState       state;
         LineMapper      lineMapper; // Current mapping from lines in the local file to backend script lines.
     };
@@ -138,6 +140,12 @@ public:
      */
     void StepInto(unsigned int vm);
 
+    /**
+     * Instructs the debugger to continue until the current function returns
+     * to its caller.
+     */
+    void StepOut(unsigned int vm);
+
     /**
      * Signals to the debugger that we've finished the processing we needed to
      * do in response to a load script event.
@@ -145,9 +153,16 @@ public:
     void DoneLoadingScript(unsigned int vm);
 
     /**
-     * Evaluates the expression in the current context.
+     * Evaluates the expression in the current context. Tables nested deeper than
+     * maxDepth are returned without their elements.
+     */
+    bool Evaluate(unsigned int vm, const char* expression, unsigned int stackLevel, std::string& result, unsigned int maxDepth = 10);
+
+    /**
+     * Evaluates a list of expressions in the current context with a single request
+     * to the backend. If the context couldn't be accessed the method returns false.
      */
-    bool Evaluate(unsigned int vm, const char* expression, unsigned int stackLevel, std::string& result);
+    bool EvaluateBatch(unsigned int vm, const std::vector<std::string>& expressions, unsigned int stackLevel, std::vector<std::string>& results, unsigned int maxDepth = 10);
 
     /**
      * Toggles a breakpoint on the specified line.
@@ -164,6 +179,13 @@ public:
      */
     Script* GetScript(unsigned int scriptIndex);
 
+    /**
+     * Removes a script the backend has unloaded. This is called by the UI after it
+     * has processed the unload event, so that script pointers it holds stay valid
+     * until then.
+     */
+    void RemoveScript(unsigned int scriptIndex);
+
     /**
      * Returns the index of the script with te specified name. If the name could not be
      * matched the method returns -1.
@@ -316,6 +338,11 @@ private:
      */
     void OutputError(DWORD error);
 
+    /**
+     * Deletes all of the scripts.
+     */
+    void ClearScripts();
+
 private:
 
     static DebugFrontend*       s_instance;
@@ -330,7 +357,9 @@ private:
     Channel                     m_commandChannel;
 
     mutable CriticalSection     m_criticalSection;
-    std::vector<Script*>        m_scripts;
+    std::map<unsigned int, Script*> m_scripts;          // Keyed by index, which the backend never reuses.
+    unsigned int                m_nextScriptIndex;
+    std::multimap<std::string, unsigned int> m_hashToScript;
 
     std::vector<StackFrame>     m_stackFrames;
 
@@ -159,6 +159,8 @@ BEGIN_EVENT_TABLE(MainFrame, wxFrame)
     EVT_UPDATE_UI(ID_DebugStepInto,                 MainFrame::OnUpdateDebugStepInto)
     EVT_MENU(ID_DebugStepOver,                      MainFrame::OnDebugStepOver)
     EVT_UPDATE_UI(ID_DebugStepOver,                 MainFrame::EnableWhenBroken)
+    EVT_MENU(ID_DebugStepOut,                       MainFrame::OnDebugStepOut)
+    EVT_UPDATE_UI(ID_DebugStepOut,                  MainFrame::EnableWhenBroken)
     EVT_MENU(ID_DebugQuickWatch,                    MainFrame::OnDebugQuickWatch)
     EVT_UPDATE_UI(ID_DebugQuickWatch,               MainFrame::EnableWhenBroken)
     EVT_MENU(ID_DebugToggleBreakpoint,              MainFrame::OnDebugToggleBreakpoint)
@@ -628,6 +630,7 @@ void MainFrame::InitializeMenu()
     menuDebug->AppendSeparator();
     menuDebug->Append(ID_DebugStepInto,                 _("Step &Into"));
     menuDebug->Append(ID_DebugStepOver,                 _("Step &Over"));
+    menuDebug->Append(ID_DebugStepOut,                  _("Step O&ut"));
     menuDebug->Append(ID_DebugQuickWatch,               _("&Quick Watch..."));
     menuDebug->AppendSeparator();
     menuDebug->Append(ID_DebugToggleBreakpoint,         _("To&ggle Breakpoint"),        _("Toggles a breakpoint on the current line"));
@@ -1543,6 +1546,12 @@ void MainFrame::OnDebugStepOver(wxCommandEvent& WXUNUSED(event))
     UpdateForNewState();
 }
 
+void MainFrame::OnDebugStepOut(wxCommandEvent& WXUNUSED(event))
+{
+    DebugFrontend::Get().StepOut(m_vm);
+    UpdateForNewState();
+}
+
 void MainFrame::OnDebugQuickWatch(wxCommandEvent& WXUNUSED(event))
 {
 
@@ -2000,7 +2009,10 @@ void MainFrame::OnDebugEvent(wxDebugEvent& event)
             }
 
             // Tell the backend we're done processing this script for loading.
-            DebugFrontend::Get().DoneLoadingScript(event.GetVm());
+            if (event.GetEnabled())
+            {
+                DebugFrontend::Get().DoneLoadingScript(event.GetVm());
+            }
 
         }
         break;
@@ -2077,6 +2089,10 @@ void MainFrame::OnDebugEvent(wxDebugEvent& event)
         SetVmName(event.GetVm(), event.GetMessage());
         break;
 
+    case EventId_UnloadScript:
+        OnUnloadScript(event);
+        break;
+
     }
 
 }
@@ -2934,6 +2950,37 @@ void MainFrame::OnLoadError(wxDebugEvent& event)
 
 }
 
+void MainFrame::OnUnloadScript(wxDebugEvent& event)
+{
+
+    unsigned int scriptIndex = event.GetScriptIndex();
+    Project::File* file = m_project->GetFileForScript(scriptIndex);
+
+    if (file != NULL)
+    {
+
+        file->scriptIndex = -1;
+
+        if (file->temporary && GetOpenFileIndex(file) == -1)
+        {
+
+            std::vector<Project::File*> files;
+            files.push_back(file);
+
+            m_autoCompleteManager.ClearEntries(file);
+            m_projectExplorer->RemoveFiles(files);
+            m_project->RemoveFile(file, false);
+
+        }
+
+        m_breakpointsWindow->UpdateBreakpoints();
+
+    }
+
+    DebugFrontend::Get().RemoveScript(scriptIndex);
+
+}
+
 void MainFrame::OnMessage(wxDebugEvent& event)
 {
 
@@ -4836,6 +4883,7 @@ void MainFrame::SetDefaultHotKeys()
     m_keyBinder.SetShortcut(ID_DebugStop,                   wxT("Shift+F5"));
     m_keyBinder.SetShortcut(ID_DebugStepInto,               wxT("F11"));
     m_keyBinder.SetShortcut(ID_DebugStepOver,               wxT("F10"));
+    m_keyBinder.SetShortcut(ID_DebugStepOut,                wxT("Shift+F11"));
     m_keyBinder.SetShortcut(ID_DebugQuickWatch,             wxT("Shift+F9"));
     m_keyBinder.SetShortcut(ID_DebugToggleBreakpoint,       wxT("F9"));
     m_keyBinder.SetShortcut(ID_DebugDeleteAllBreakpoints,   wxT("Ctrl+Shift+F9"));
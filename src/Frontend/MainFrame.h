@@ -328,6 +328,8 @@ public:
 
     void OnDebugStepOver(wxCommandEvent& event);
 
+    void OnDebugStepOut(wxCommandEvent& event);
+
     void OnDebugQuickWatch(wxCommandEvent& event);
 
     /**
@@ -549,6 +551,12 @@ public:
      * Called when an error occurs while loading a script.
      */
     void OnLoadError(wxDebugEvent& event);
+
+    /**
+     * Called when the backend has unloaded a script. Temporary files that were
+     * created for the script are removed unless they're open in the editor.
+     */
+    void OnUnloadScript(wxDebugEvent& event);
     
     /**
      * Called when the debugger sends a text message.
@@ -1331,6 +1339,8 @@ private:
 
         ID_EditZoomIn                       = 89,
         ID_EditZoomOut                      = 90,
+
+        ID_DebugStepOut                     = 91,
         
         ID_AutoComplete                     = 101,
         ID_WindowAutoComplete               = 102,
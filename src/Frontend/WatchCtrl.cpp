@@ -141,6 +141,37 @@ void WatchCtrl::GetColumnSizes(int totalSize, int columnSize[s_numColumns]) cons
 bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
 {
 
+    if (root != NULL && root->GetName() == "reference")
+    {
+
+        // Tables that appear more than once in a value are only included the
+        // first time, so summarize the original in place of the reference. The
+        // elements aren't added since the table may contain itself.
+
+        unsigned int id = 0;
+        ReadXmlNode(root, "reference", id);
+
+        std::map<unsigned int, wxXmlNode*>::const_iterator iterator = m_tables.find(id);
+
+        if (iterator != m_tables.end())
+        {
+
+            wxString typeName;
+            wxXmlNode* typeNode = FindChildNode(iterator->second, "type");
+
+            if (typeNode != NULL)
+            {
+                ReadXmlNode(typeNode, "type", typeName);
+            }
+
+            SetItemText(item, 1, typeName);
+            SetItemText(item, 2, GetTableAsText(iterator->second));
+            return true;
+
+        }
+
+    }
+
     wxString type;
     wxString text = GetNodeAsText(root, type);
     
@@ -177,6 +208,9 @@ bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
 
             // Add the elements of the table as tree children.
 
+            unsigned int numElements = 0;
+            unsigned int size = 0;
+
             wxXmlNode* node = root->GetChildren();
             while (node != NULL)
             {
@@ -187,9 +221,15 @@ bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
                 {
                     SetItemText(item, 1, typeName);
                 }
+                else if (node->GetName() == "size")
+                {
+                    ReadXmlNode(node, "size", size);
+                }
                 else if (node->GetName() == "element")
                 {
 
+                    ++numElements;
+
                     wxXmlNode* keyNode  = FindChildNode(node, "key");
                     wxXmlNode* dataNode = FindChildNode(node, "data");
 
@@ -212,6 +252,13 @@ bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
 
             }
 
+            // If the value was too large, the backend stops sending elements.
+            if (size > numElements)
+            {
+                wxTreeItemId child = AppendItem(item, "...");
+                SetItemFont(child, m_valueFont);
+            }
+
         }
         else if (root->GetName() == "values")
         {
@@ -241,52 +288,113 @@ bool WatchCtrl::AddCompoundExpression(wxTreeItemId item, wxXmlNode* root)
 
 void WatchCtrl::UpdateItem(wxTreeItemId item)
 {
-    SetItemFont(item, m_valueFont);
+    std::vector<wxTreeItemId> items(1, item);
+    UpdateItems(items);
+}
+
+void WatchCtrl::UpdateItems(const std::vector<wxTreeItemId>& items)
+{
+
+    // Evaluate all of the expressions with one request to the backend, rather
+    // than making a round trip for each one.
+
+    std::vector<std::string> expressions;
+    std::vector<std::string> results;
+
     if (m_vm != 0)
     {
 
-        wxString expression = GetItemText(item);
+        for (unsigned int i = 0; i < items.size(); ++i)
+        {
+            wxString expression = GetItemText(items[i]);
+            if (!expression.empty())
+            {
+                expressions.push_back(std::string(expression));
+            }
+        }
+
+        if (!expressions.empty())
+        {
+            DebugFrontend::Get().EvaluateBatch(m_vm, expressions, m_stackLevel, results);
+        }
+
+    }
+
+    unsigned int resultIndex = 0;
+
+    for (unsigned int i = 0; i < items.size(); ++i)
+    {
+
         wxString result;
 
-        if (!expression.empty())
+        if (m_vm != 0 && !GetItemText(items[i]).empty() && resultIndex < results.size())
         {
-            std::string temp;
-            DebugFrontend::Get().Evaluate(m_vm, expression, m_stackLevel, temp);
-            result = temp.c_str();
+            result = results[resultIndex].c_str();
+            ++resultIndex;
         }
 
-        DeleteChildren(item);
+        SetItemResult(items[i], result);
+
+    }
+
+}
+
+void WatchCtrl::SetItemResult(wxTreeItemId item, const wxString& result)
+{
+
+    SetItemFont(item, m_valueFont);
+    DeleteChildren(item);
 
-        if (result.IsEmpty())
+    if (result.IsEmpty())
+    {
+        SetItemText(item, 1, "");
+        SetItemText(item, 2, "");
+    }
+    else
+    {
+        wxStringInputStream stream(wxString::FromUTF8(result));
+        wxXmlDocument document;
+
+        wxLogNull logNo;
+        
+        if (document.Load(stream))
         {
-            SetItemText(item, 1, "");
-            SetItemText(item, 2, "");
+            AddTables(document.GetRoot());
+            AddCompoundExpression(item, document.GetRoot());
+            m_tables.clear();
         }
         else
         {
-            wxStringInputStream stream(wxString::FromUTF8(result));
-            wxXmlDocument document;
+            SetItemText(item, 1, "Improperly formatted XML data");
+            SetItemText(item, 2, "");
+        }
 
-            wxLogNull logNo;
-            
-            if (document.Load(stream))
-            {
-                AddCompoundExpression(item, document.GetRoot());
-            }
-            else
+    }
+
+}
+
+void WatchCtrl::AddTables(wxXmlNode* node)
+{
+
+    while (node != NULL)
+    {
+
+        if (node->GetName() == "table")
+        {
+
+            wxXmlNode* idNode = FindChildNode(node, "id");
+            unsigned int id;
+
+            if (idNode != NULL && ReadXmlNode(idNode, "id", id))
             {
-                SetItemText(item, 1, "Improperly formatted XML data");
-                SetItemText(item, 2, "");
+                m_tables[id] = node;
             }
-    
+
         }
 
-    }
-    else
-    {
-        SetItemText(item, 1, "");
-        SetItemText(item, 2, "");
-        DeleteChildren(item);
+        AddTables(node->GetChildren());
+        node = node->GetNext();
+
     }
 
 }
@@ -365,11 +473,16 @@ wxString WatchCtrl::GetTableAsText(wxXmlNode* root)
     wxXmlNode* node = root->GetChildren();
 
     int numElements = 0;
+    unsigned int size = 0;
 
     while (node != NULL)
     {
 
-        if (node->GetName() == "element")
+        if (node->GetName() == "size")
+        {
+            ReadXmlNode(node, "size", size);
+        }
+        else if (node->GetName() == "element")
         {
 
             wxXmlNode* keyNode  = FindChildNode(node, "key");
@@ -398,6 +511,12 @@ wxString WatchCtrl::GetTableAsText(wxXmlNode* root)
 
     }
 
+    // Elements that weren't sent by the backend.
+    if (node == NULL && static_cast<int>(size) > numElements)
+    {
+        result += "...";
+    }
+
     result += "}";
 
     return result;
@@ -419,6 +538,11 @@ wxString WatchCtrl::GetNodeAsText(wxXmlNode* node, wxString& type)
         {
             text = GetTableAsText(node);
         }
+        else if (node->GetName() == "reference")
+        {
+            // A table that was already included elsewhere in the value.
+            text = "{...}";
+        }
         else if (node->GetName() == "values")
         {
 
@@ -444,13 +568,22 @@ wxString WatchCtrl::GetNodeAsText(wxXmlNode* node, wxString& type)
 
             wxXmlNode* child = node->GetChildren();
 
+            // Long strings only include a preview of the value.
+            unsigned int length = 0;
+
             while (child != NULL)
             {
                 ReadXmlNode(child, "type", type) ||
-                ReadXmlNode(child, "data", text);
+                ReadXmlNode(child, "data", text) ||
+                ReadXmlNode(child, "length", length);
                 child = child->GetNext();
             }
 
+            if (length != 0)
+            {
+                text += wxString::Format("... (%u bytes)", length);
+            }
+
         }
         else if (node->GetName() == "function")
         {
@@ -24,6 +24,8 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #define WATCH_CTRL_H
 
 #include <wx/wx.h>
+#include <map>
+#include <vector>
 #include "treelistctrl.h"
 #include "FontColorSettings.h"
 
@@ -61,6 +63,12 @@ public:
      */
     void UpdateItem(wxTreeItemId item);
 
+    /**
+     * Updates the values for a list of expressions. The expressions are evaluated
+     * together, which is much faster than updating them one at a time.
+     */
+    void UpdateItems(const std::vector<wxTreeItemId>& items);
+
     /**
      * Sets the font used to display values.
      */
@@ -110,6 +118,17 @@ private:
      */
     void UpdateFont(wxTreeItemId item);
 
+    /**
+     * Displays the result of evaluating the expression for an item.
+     */
+    void SetItemResult(wxTreeItemId item, const wxString& result);
+
+    /**
+     * Records the tables with ids in the node and its siblings so that references
+     * to them can be displayed.
+     */
+    void AddTables(wxXmlNode* node);
+
 private:
 
     float                       m_columnSize[s_numColumns];
@@ -121,6 +140,8 @@ private:
 
     wxFont                      m_valueFont;
     wxColor                     m_fontColor;
+
+    std::map<unsigned int, wxXmlNode*>  m_tables;   // Tables in the value being displayed, by id.
 };
 
 #endif
\ No newline at end of file
@@ -49,15 +49,19 @@ WatchWindow::WatchWindow(wxWindow* parent, wxWindowID winid)
 void WatchWindow::UpdateItems()
 {
 
+    std::vector<wxTreeItemId> items;
+
     wxTreeItemIdValue cookie;
     wxTreeItemId item = GetFirstChild(m_root, cookie);
 
     while (item.IsOk())
     {
-        UpdateItem(item);        
+        items.push_back(item);
         item = GetNextSibling(item);
     }
 
+    WatchCtrl::UpdateItems(items);
+
 }
 
 void WatchWindow::AddWatch(const wxString& expression)
@@ -0,0 +1,184 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "BinaryValueWriter.h"
+#include "Protocol.h"
+
+#include <string.h>
+#include <assert.h>
+
+void BinaryValueWriter::WriteUInt32(unsigned int value)
+{
+    char data[4];
+    memcpy(data, &value, 4);
+    m_buffer.append(data, 4);
+}
+
+void BinaryValueWriter::WriteString(const char* value, size_t length)
+{
+    WriteUInt32(static_cast<unsigned int>(length));
+    m_buffer.append(value, length);
+}
+
+void BinaryValueWriter::PatchUInt32(size_t offset, unsigned int value)
+{
+    memcpy(&m_buffer[offset], &value, 4);
+}
+
+void BinaryValueWriter::BeginValue(unsigned char tag)
+{
+
+    if (!m_containers.empty() && m_containers.back().values)
+    {
+        ++m_containers.back().count;
+    }
+
+    m_buffer.push_back(static_cast<char>(tag));
+
+}
+
+void BinaryValueWriter::WriteValue(const std::string& data, const char* type)
+{
+    BeginValue(ValueTag_Value);
+    WriteString(type, strlen(type));
+    WriteString(data.c_str(), data.length());
+}
+
+void BinaryValueWriter::WriteTruncatedValue(const std::string& data, const char* type, unsigned int handle, size_t length)
+{
+    BeginValue(ValueTag_TruncatedValue);
+    WriteString(type, strlen(type));
+    WriteString(data.c_str(), data.length());
+    WriteUInt32(handle);
+    WriteUInt32(static_cast<unsigned int>(length));
+}
+
+void BinaryValueWriter::WriteFunction(int scriptIndex, int line)
+{
+    BeginValue(ValueTag_Function);
+    WriteUInt32(scriptIndex);
+    WriteUInt32(line);
+}
+
+void BinaryValueWriter::WriteError(const std::string& message)
+{
+    BeginValue(ValueTag_Error);
+    WriteString(message.c_str(), message.length());
+}
+
+void BinaryValueWriter::BeginTable(const char* type, unsigned int id)
+{
+
+    BeginValue(ValueTag_Table);
+
+    if (type != NULL)
+    {
+        WriteString(type, strlen(type));
+    }
+    else
+    {
+        WriteUInt32(0);
+    }
+
+    WriteUInt32(id);
+
+    // Reserve space for the handle, size and number of elements, which are
+    // filled in once the table is finished.
+
+    Container container;
+    container.offset    = m_buffer.length();
+    container.count     = 0;
+    container.values    = false;
+
+    m_containers.push_back(container);
+
+    WriteUInt32(0);
+    WriteUInt32(0);
+    WriteUInt32(0);
+
+}
+
+void BinaryValueWriter::WriteReference(unsigned int id)
+{
+    BeginValue(ValueTag_Reference);
+    WriteUInt32(id);
+}
+
+void BinaryValueWriter::EndTable(unsigned int handle, unsigned int size)
+{
+
+    assert(!m_containers.empty() && !m_containers.back().values);
+
+    const Container& container = m_containers.back();
+
+    PatchUInt32(container.offset + 0, handle);
+    PatchUInt32(container.offset + 4, handle != 0 ? size : container.count);
+    PatchUInt32(container.offset + 8, container.count);
+
+    m_containers.pop_back();
+
+}
+
+void BinaryValueWriter::BeginElement()
+{
+    assert(!m_containers.empty() && !m_containers.back().values);
+    ++m_containers.back().count;
+}
+
+void BinaryValueWriter::BeginElementValue()
+{
+    // The key and value are written one after the other, so there's nothing
+    // to do here.
+}
+
+void BinaryValueWriter::EndElement()
+{
+}
+
+void BinaryValueWriter::BeginValues()
+{
+
+    BeginValue(ValueTag_Values);
+
+    Container container;
+    container.offset    = m_buffer.length();
+    container.count     = 0;
+    container.values    = true;
+
+    m_containers.push_back(container);
+
+    WriteUInt32(0);
+
+}
+
+void BinaryValueWriter::EndValues()
+{
+    assert(!m_containers.empty() && m_containers.back().values);
+    PatchUInt32(m_containers.back().offset, m_containers.back().count);
+    m_containers.pop_back();
+}
+
+void BinaryValueWriter::GetResult(std::string& result)
+{
+    assert(m_containers.empty());
+    result.swap(m_buffer);
+}
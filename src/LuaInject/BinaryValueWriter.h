@@ -0,0 +1,80 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BINARY_VALUE_WRITER_H
+#define BINARY_VALUE_WRITER_H
+
+#include "ValueWriter.h"
+
+#include <vector>
+
+/**
+ * Value writer that encodes the value in the compact binary format described
+ * by ValueTag in Protocol.h. The encoding is written directly into a single
+ * buffer as the value is traversed.
+ */
+class BinaryValueWriter : public ValueWriter
+{
+
+public:
+
+    virtual void WriteValue(const std::string& data, const char* type);
+    virtual void WriteTruncatedValue(const std::string& data, const char* type, unsigned int handle, size_t length);
+    virtual void WriteFunction(int scriptIndex, int line);
+    virtual void WriteError(const std::string& message);
+    virtual void BeginTable(const char* type, unsigned int id);
+    virtual void WriteReference(unsigned int id);
+    virtual void EndTable(unsigned int handle, unsigned int size);
+    virtual void BeginElement();
+    virtual void BeginElementValue();
+    virtual void EndElement();
+    virtual void BeginValues();
+    virtual void EndValues();
+    virtual void GetResult(std::string& result);
+
+private:
+
+    struct Container
+    {
+        size_t          offset;     // Offset of the fields that are filled in when the container is finished.
+        unsigned int    count;      // Number of elements or values in the container.
+        bool            values;     // True if this is a list of values rather than a table.
+    };
+
+    /**
+     * Called before each value is written so that the number of values in a
+     * list of values can be counted.
+     */
+    void BeginValue(unsigned char tag);
+
+    void WriteUInt32(unsigned int value);
+    void WriteString(const char* value, size_t length);
+    void PatchUInt32(size_t offset, unsigned int value);
+
+private:
+
+    std::string             m_buffer;
+    std::vector<Container>  m_containers;
+
+};
+
+#endif
@@ -26,10 +26,14 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "CriticalSectionLock.h"
 #include "CriticalSectionTryLock.h"
 #include "StlUtility.h"
-#include "XmlUtility.h"
+#include "XmlValueWriter.h"
+#include "BinaryValueWriter.h"
 #include "DebugHelp.h"
+#include "Sha256.h"
+#include "FileName.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <algorithm>
 #include <sstream>
 
@@ -67,59 +71,119 @@ const char* MemoryReader(lua_State* L, void* data, size_t* size)
 
 }
 
+DebugBackend::Script::Script()
+{
+    index           = 0;
+    refCount        = 0;
+    collectable     = false;
+    m_breakpoints   = new BreakpointSet;
+}
+
+DebugBackend::Script::~Script()
+{
+    delete m_breakpoints;
+    ClearVector(m_retired);
+    ClearVector(m_conditions);
+}
+
+const DebugBackend::Script::BreakpointSet* DebugBackend::Script::GetBreakpoints() const
+{
+    // Reads of volatile variables have acquire semantics with MSVC, so the
+    // contents of the set are visible once we have the pointer.
+    return m_breakpoints;
+}
+
+void DebugBackend::Script::PublishBreakpoints(BreakpointSet* breakpoints)
+{
+    const BreakpointSet* old = static_cast<const BreakpointSet*>(
+        InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(const_cast<BreakpointSet**>(&m_breakpoints)), breakpoints));
+    m_retired.push_back(old);
+}
+
 bool DebugBackend::Script::GetHasBreakPoint(unsigned int line) const
 {
-    
-    for (size_t i = 0; i < breakpoints.size(); i++)
-    {
-        if(breakpoints[i] == line)
-        {
-            return true;
-        }
-    }
-    
-    return false;
+    return GetBreakpoints()->lines.GetIsSet(line);
 }
 
 bool DebugBackend::Script::HasBreakPointInRange(unsigned int start, unsigned int end) const
 {
-    
-    for (size_t i = 0; i < breakpoints.size(); i++)
+
+    if (end <= start)
     {
-        if(breakpoints[i] >= start && breakpoints[i] < end)
-        {
-            return true;
-        }
+        return false;
     }
-    
-    return false;
+
+    const BreakpointSet* breakpoints = GetBreakpoints();
+    return breakpoints->lines.GetCountBefore(end) != breakpoints->lines.GetCountBefore(start);
+
 }
 
 bool DebugBackend::Script::ToggleBreakpoint(unsigned int line)
 {
 
-    std::vector<unsigned int>::iterator result = std::find(breakpoints.begin(), breakpoints.end(), line);
+    // The published set is never modified, so make a copy with the change.
+    BreakpointSet* breakpoints = new BreakpointSet(*GetBreakpoints());
+    bool set = breakpoints->lines.Toggle(line);
+
+    PublishBreakpoints(breakpoints);
+    return set;
+
+}
+
+void DebugBackend::Script::ClearBreakpoints()
+{
+    const BreakpointSet* breakpoints = GetBreakpoints();
+    if (breakpoints->lines.GetCount() != 0 || !breakpoints->conditions.empty())
+    {
+        PublishBreakpoints(new BreakpointSet);
+    }
+}
+
+const DebugBackend::BreakpointCondition* DebugBackend::Script::GetBreakpointCondition(unsigned int line) const
+{
+
+    const BreakpointSet* breakpoints = GetBreakpoints();
 
-    if (result == breakpoints.end())
+    if (breakpoints->conditions.empty())
     {
-        breakpoints.push_back(line);
-        return true;
+        return NULL;
     }
-    else
+
+    std::unordered_map<unsigned int, const BreakpointCondition*>::const_iterator iterator = breakpoints->conditions.find(line);
+
+    if (iterator == breakpoints->conditions.end())
     {
-        breakpoints.erase(result);
-        return false;
+        return NULL;
     }
+
+    return iterator->second;
+
 }
 
-void DebugBackend::Script::ClearBreakpoints()
+void DebugBackend::Script::SetBreakpointCondition(unsigned int line, BreakpointCondition* condition)
 {
-    breakpoints.resize(0);
+
+    BreakpointSet* breakpoints = new BreakpointSet(*GetBreakpoints());
+
+    if (condition != NULL)
+    {
+        // Conditions that have been replaced are kept since a hook may still be
+        // evaluating them.
+        m_conditions.push_back(condition);
+        breakpoints->conditions[line] = condition;
+    }
+    else
+    {
+        breakpoints->conditions.erase(line);
+    }
+
+    PublishBreakpoints(breakpoints);
+
 }
 
-bool DebugBackend::Script::HasBreakpointsActive()
+bool DebugBackend::Script::HasBreakpointsActive() const
 {
-  return breakpoints.size() != 0;
+  return GetBreakpoints()->lines.GetCount() != 0;
 }
 
 DebugBackend& DebugBackend::Get()
@@ -146,6 +210,20 @@ DebugBackend::DebugBackend()
     m_mode                  = Mode_Continue;
     m_log                   = NULL;
     m_warnedAboutUserData   = false;
+    m_hookCacheIndex        = TlsAlloc();
+    m_vmGeneration          = 0;
+    m_nextVmSerial          = 0;
+    m_nextScriptIndex       = 0;
+    m_scriptGeneration      = 0;
+    m_activeHooks           = 0;
+    m_breakState            = NULL;
+    m_globalsGeneration     = 0;
+    m_breakThread           = NULL;
+    m_nextConditionId       = 1;
+    m_conditionGeneration   = 0;
+    m_protocolVersion       = ProtocolVersion_Initial;
+    m_maxStringLength       = s_defaultMaxStringLength;
+    m_loadPolicy            = LoadPolicy_Wait;
 }
 
 DebugBackend::~DebugBackend()
@@ -190,13 +268,22 @@ DebugBackend::~DebugBackend()
         m_detachEvent = NULL;
     }
 
-    for (unsigned int i = 0; i < m_scripts.size(); ++i)
+    for (ScriptMap::iterator iterator = m_scripts.begin(); iterator != m_scripts.end(); ++iterator)
     {
-        delete m_scripts[i];
+        delete iterator->second;
     }
 
     m_scripts.clear();
     m_nameToScript.clear();
+    m_hashToScript.clear();
+
+    ClearVector(m_hookCaches);
+
+    if (m_hookCacheIndex != TLS_OUT_OF_INDEXES)
+    {
+        TlsFree(m_hookCacheIndex);
+        m_hookCacheIndex = TLS_OUT_OF_INDEXES;
+    }
 
 }
 
@@ -260,18 +347,43 @@ bool DebugBackend::Initialize(HINSTANCE hInstance)
     char commandChannelName[256];
     _snprintf(commandChannelName, 256, "Decoda.Command.%x", processId);
 
-    // Open up a communication channel with the debugger that is used to send
-    // events back to the frontend.
-    if (!m_eventChannel.Connect(eventChannelName))
+    // If a debugger address is specified in the environment, connect to the
+    // debugger over TCP instead of using pipes.
+
+    std::string host;
+    unsigned short port;
+
+    if (Channel::GetSocketAddress(host, port))
     {
-        return false;
-    }
 
-    // Open up a communication channel with the debugger that is used to receive
-    // commands from the backend.
-    if (!m_commandChannel.Connect(commandChannelName))
+        if (!m_eventChannel.Connect(host.c_str(), port))
+        {
+            return false;
+        }
+
+        if (!m_commandChannel.Connect(host.c_str(), port + 1))
+        {
+            return false;
+        }
+
+    }
+    else
     {
-        return false;
+
+        // Open up a communication channel with the debugger that is used to send
+        // events back to the frontend.
+        if (!m_eventChannel.Connect(eventChannelName))
+        {
+            return false;
+        }
+
+        // Open up a communication channel with the debugger that is used to receive
+        // commands from the backend.
+        if (!m_commandChannel.Connect(commandChannelName))
+        {
+            return false;
+        }
+
     }
 
     // Create the event used to signal when we should stop "breaking"
@@ -321,24 +433,8 @@ DebugBackend::VirtualMachine* DebugBackend::AttachState(unsigned long api, lua_S
         return stateIterator->second;
     }
 
-    VirtualMachine* vm = new VirtualMachine;
+    VirtualMachine* vm = AllocateVm(api, L);
 
-    vm->L                   = L;
-    vm->hThread             = GetCurrentThread();
-    vm->initialized         = false;
-    vm->callCount           = 0;
-    vm->callStackDepth      = 0;
-    vm->lastStepLine        = -2;
-    vm->lastStepScript      = -1;
-    vm->api                 = api;
-    vm->stackTop            = 0;
-    vm->luaJitWorkAround    = false;
-    vm->breakpointInStack   = true;// Force the stack tobe checked when the first script is entered
-    vm->haveActiveBreakpoints = false;
-    
-    m_vms.push_back(vm);
-    m_stateToVm.insert(std::make_pair(L, vm));
-   
     if (!lua_checkstack_dll(api, L, 3))
     {
         return NULL;
@@ -348,6 +444,8 @@ DebugBackend::VirtualMachine* DebugBackend::AttachState(unsigned long api, lua_S
     m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
     m_eventChannel.Flush();
 
+    vm->announced = true;
+
     // Register the debug API.
     RegisterDebugLibrary(api, L);
 
@@ -380,53 +478,232 @@ DebugBackend::VirtualMachine* DebugBackend::AttachState(unsigned long api, lua_S
 
 }
 
-void DebugBackend::DetachState(unsigned long api, lua_State* L)
+DebugBackend::VirtualMachine* DebugBackend::AttachThread(unsigned long api, lua_State* L, lua_State* thread)
 {
 
-    CriticalSectionLock lock1(m_criticalSection);
+    if (!GetIsAttached())
+    {
+        return NULL;
+    }
 
-    // Remove all of the class names associated with this state.
+    CriticalSectionLock lock(m_criticalSection);
 
-    std::list<ClassInfo>::iterator iterator = m_classInfos.begin();
+    StateToVmMap::iterator parentIterator = m_stateToVm.find(L);
 
-    while (iterator != m_classInfos.end())
+    if (parentIterator == m_stateToVm.end())
     {
-        if (iterator->L == L)
-        {
-            m_classInfos.erase(iterator++);
-        }
-        else
-        {
-            ++iterator;
-        }
+        // We don't know the state the thread was created from, so treat the
+        // thread as a state of its own.
+        return AttachState(api, thread);
+    }
+
+    VirtualMachine* mainVm = parentIterator->second;
+
+    if (mainVm->mainVm != NULL)
+    {
+        mainVm = mainVm->mainVm;
+    }
+
+    // If the thread has the address of a thread which was collected since the
+    // last sweep, the old record is stale.
+
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(thread);
+
+    if (stateIterator != m_stateToVm.end())
+    {
+        RemoveVm(stateIterator->second);
+    }
+
+    // Lua copies the hook from L into the new thread, so unlike AttachState we
+    // don't need to set the hook, register the debug library or tell the frontend
+    // about the thread.
+
+    VirtualMachine* vm = AllocateVm(api, thread);
+
+    vm->mainVm      = mainVm;
+    vm->threadIndex = mainVm->threads.size();
+    vm->sweep       = mainVm->sweep;
+    mainVm->threads.push_back(vm);
+
+    if (!lua_checkstack_dll(api, L, 3))
+    {
+        return vm;
+    }
+
+    // Record the thread in a weak table rather than giving each thread its own
+    // garbage collection sentinel. A single sentinel per main state checks which
+    // threads have dropped out of the table each time the collector runs.
+
+    PushThreadTable(api, L);
+    lua_pushvalue_dll(api, L, -2);
+    lua_pushlightuserdata_dll(api, L, thread);
+    lua_rawset_dll(api, L, -3);
+    lua_pop_dll(api, L, 1);
+
+    if (!mainVm->sweeping)
+    {
+        CreateSweepSentinel(api, L, mainVm->L);
+        mainVm->sweeping = true;
     }
 
-    // Remove the state from our list.
+    return vm;
+
+}
+
+void DebugBackend::DetachState(unsigned long api, lua_State* L)
+{
+
+    CriticalSectionLock lock1(m_criticalSection);
 
     StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
 
     if (stateIterator != m_stateToVm.end())
     {
+        RemoveVm(stateIterator->second);
+    }
+
+}
+
+DebugBackend::VirtualMachine* DebugBackend::AllocateVm(unsigned long api, lua_State* L)
+{
+
+    VirtualMachine* vm = NULL;
+
+    if (!m_freeVms.empty())
+    {
+        vm = m_freeVms.back();
+        m_freeVms.pop_back();
+    }
+    else
+    {
+        vm = new VirtualMachine;
+    }
+
+    vm->L                   = L;
+    vm->initialized         = false;
+    vm->callCount           = 0;
+    vm->callStackDepth      = 0;
+    vm->stepOutDepth        = 0;
+    vm->lastStepLine        = -2;
+    vm->lastStepScript      = -1;
+    vm->api                 = api;
+    vm->name.clear();
+    vm->stackTop            = 0;
+    vm->luaJitWorkAround    = false;
+    vm->breakpointInStack   = true;// Force the stack tobe checked when the first script is entered
+    vm->haveActiveBreakpoints = false;
+    vm->scripts.clear();
+    vm->scriptGeneration    = m_scriptGeneration;
+    // The state that owned any compiled conditions has been closed, so the
+    // references don't need to be released.
+    vm->conditions.clear();
+    vm->conditionGeneration = m_conditionGeneration;
+    vm->expressionCache     = ExpressionCache();
+    vm->vmIndex             = m_vms.size();
+    vm->serial              = ++m_nextVmSerial;
+    vm->announced           = false;
+    vm->mainVm              = NULL;
+    vm->threadIndex         = 0;
+    vm->threads.clear();
+    vm->sweep               = 0;
+    vm->sweeping            = false;
+    vm->scriptRefs.clear();
+    vm->numChunks           = 0;
+
+    m_vms.push_back(vm);
+    m_stateToVm.insert(std::make_pair(L, vm));
+
+    return vm;
+
+}
+
+void DebugBackend::RemoveVm(VirtualMachine* vm)
+{
+
+    // Threads can't outlive the state they were created from.
+    while (!vm->threads.empty())
+    {
+        RemoveVm(vm->threads.back());
+    }
+
+    while (!vm->scriptRefs.empty())
+    {
+        ReleaseScript(vm, vm->scriptRefs.begin()->first);
+    }
+
+    const ExpressionCache& cache = vm->expressionCache;
+
+    // Threads share their main state's cache, so this is only reported once for
+    // each Lua instance.
+    if (vm->mainVm == NULL && cache.hits + cache.misses > 0)
+    {
+        char message[256];
+        _snprintf(message, sizeof(message), "Expression cache for VM 0x%08x: %u hits, %u misses (%u%% hit rate)",
+            reinterpret_cast<unsigned int>(vm->L), cache.hits, cache.misses, cache.hits * 100 / (cache.hits + cache.misses));
+        Message(message);
+    }
 
+    if (vm->announced)
+    {
         m_eventChannel.WriteUInt32(EventId_DestroyVM);
-        m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+        m_eventChannel.WriteUInt32(reinterpret_cast<int>(vm->L));
         m_eventChannel.Flush();
+    }
 
-        m_stateToVm.erase(stateIterator);
-    
+    m_stateToVm.erase(vm->L);
+
+    // Swap the last entries into the removed positions so removal doesn't depend
+    // on the number of threads.
+
+    VirtualMachine* last = m_vms.back();
+    m_vms[vm->vmIndex] = last;
+    last->vmIndex = vm->vmIndex;
+    m_vms.pop_back();
+
+    if (vm->mainVm != NULL)
+    {
+        std::vector<VirtualMachine*>& threads = vm->mainVm->threads;
+        last = threads.back();
+        threads[vm->threadIndex] = last;
+        last->threadIndex = vm->threadIndex;
+        threads.pop_back();
     }
 
-    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    // Invalidate the entries the hooks cached for the VM, since the address of
+    // the state may be reused by a new state.
+    vm->serial = 0;
+
+    if (m_freeVms.size() < s_maxFreeVms)
     {
-        VirtualMachine* vm = m_vms[i];
-        if (vm->L == L)
-        {
-            CloseHandle(vm->hThread);
-            delete vm;
-            m_vms.erase(m_vms.begin() + i);
-        }
+        m_freeVms.push_back(vm);
+    }
+    else
+    {
+        delete vm;
+        // The hook caches may still point to the record, so they all have to be
+        // cleared.
+        InterlockedIncrement(&m_vmGeneration);
+    }
+
+}
+
+void DebugBackend::AnnounceVm(VirtualMachine* vm)
+{
+
+    m_eventChannel.WriteUInt32(EventId_CreateVM);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(vm->L));
+    m_eventChannel.Flush();
+
+    if (!vm->name.empty())
+    {
+        m_eventChannel.WriteUInt32(EventId_NameVM);
+        m_eventChannel.WriteUInt32(reinterpret_cast<int>(vm->L));
+        m_eventChannel.WriteString(vm->name);
+        m_eventChannel.Flush();
     }
 
+    vm->announced = true;
+
 }
 
 int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, const char* source, size_t size, const char* name)
@@ -437,13 +714,40 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
         return result;
     }
 
-    bool registered = false;
+    // The chunk's source name may have been allocated where a collected one used to
+    // be, so the hook script caches can't be trusted after a load.
+    InterlockedIncrement(&m_scriptGeneration);
+
+    bool wait = false;
 
-    // Register the script before dealing with errors, since the front end has enough
-    // information to display the error.
-    if (RegisterScript(L, source, size, name, false) != -1)
     {
-        registered = true;
+
+        CriticalSectionLock lock(m_criticalSection);
+
+        // Register the script before dealing with errors, since the front end has enough
+        // information to display the error.
+        unsigned int scriptIndex = -1;
+        wait = RegisterScript(L, source, size, name, false, &scriptIndex);
+
+        // Scripts loaded from files stay loaded until the state is closed, since the
+        // front end shows them by name and sets breakpoints in them before they run.
+        // Anything else (generated code) is referenced by the chunk and the functions
+        // the hook sees it run, and is unloaded once those have been collected. If an
+        // unseen function still runs after that, the hook registers the script again.
+        if (scriptIndex != -1)
+        {
+            bool isFile = name != NULL && name[0] == '@';
+            if (result == 0 && !isFile)
+            {
+                GetScript(scriptIndex)->collectable = true;
+                AddChunkReference(api, L, scriptIndex);
+            }
+            else
+            {
+                PinScript(GetMainVm(L), scriptIndex);
+            }
+        }
+
     }
 
     if (result != 0)
@@ -470,7 +774,7 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
         }
 
         // Wait for the front-end to tell use to continue.
-        WaitForContinue();
+        WaitForContinue(api, L);
 
     }
     /*
@@ -509,7 +813,7 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
     }
     */
 
-    if (registered)
+    if (wait)
     {
         // Stop execution so that the frontend has an opportunity to send us the break points
         // before we start executing the first line of the script.
@@ -520,8 +824,7 @@ int DebugBackend::PostLoadScript(unsigned long api, int result, lua_State* L, co
 
 }
 
-// TODO WARNING script list will grow forever, should consider methods to purge it, like tracking what scripts are loaded per VM and removing some after VM unloads, which would require moving from a vector to a map (or sparse vector)
-int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable)
+bool DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable, unsigned int* scriptIndex)
 {
 
     CriticalSectionLock lock(m_criticalSection);
@@ -543,54 +846,86 @@ int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size,
     // Check that we haven't already assigned this script an index. That happens
     // if the same script is loaded twice by the application.
 
-    if (GetScriptIndex(name) != -1)
+    int existingIndex = GetScriptIndex(name);
+
+    if (existingIndex != -1)
     {
+        if (scriptIndex != NULL)
+        {
+            *scriptIndex = existingIndex;
+        }
         if (freeName)
         {
             delete [] name;
             name = NULL;
         }
-        return -1;
+        return false;
     }
 
     // Since the name can be a file name, and multiple names can map to the same file,
-    // extract the file title from the name and compare the code with any matches.
+    // compare the code with any scripts that have the same path. Scripts are identified
+    // by a hash of their source so we don't need to compare the code against every
+    // script. Without the source there's nothing to compare, so those scripts are only
+    // matched by name.
+
+    std::string path;
+    GetFilePath(name, path);
+
+    bool haveSource = source != NULL && size > 0;
+    std::string hash = ComputeSha256(source, haveSource ? size : 0);
+
+    std::pair<HashToScriptMap::const_iterator, HashToScriptMap::const_iterator> matches(m_hashToScript.end(), m_hashToScript.end());
 
-    std::string title;
-    GetFileTitle(name, title);
+    if (haveSource)
+    {
+        matches = m_hashToScript.equal_range(hash);
+    }
 
-    for (unsigned int i = 0; i < m_scripts.size(); ++i)
+    for (HashToScriptMap::const_iterator iterator = matches.first; iterator != matches.second; ++iterator)
     {   
-        if (m_scripts[i]->title == title)
+        Script* script = GetScript(iterator->second);
+        if (script->path == path)
         {
-            // Check that the source matches.
-            if (m_scripts[i]->source == std::string(source, size))
+            // Record the script index under this other name.
+            m_nameToScript.insert(std::make_pair(name, script->index));
+            script->aliases.push_back(name);
+            if (scriptIndex != NULL)
             {
-                // Record the script index under this other name.
-                m_nameToScript.insert(std::make_pair(name, i));
-                if (freeName)
-                {
-                    delete [] name;
-                    name = NULL;
-                }
-                return -1;
+                *scriptIndex = script->index;
             }
+            if (freeName)
+            {
+                delete [] name;
+                name = NULL;
+            }
+            return false;
         }
     }
+
+    // If another script has the same source, the frontend already has the code and
+    // we don't need to send it again.
+    bool sendSource = matches.first == matches.second;
     
     Script* script = new Script;
     script->name    = name;
-    script->title   = title;
+    script->path    = path;
+    script->hash    = hash;
+    script->index   = m_nextScriptIndex++;
+
+    // The source is only needed while we send it, so we read it straight out of the
+    // caller's buffer rather than keeping a copy for the life of the script.
+    const char* scriptSource = source;
+    size_t scriptSourceSize = source != NULL ? size : 0;
 
-    if (size > 0 && source != NULL)
+    m_scripts.insert(std::make_pair(script->index, script));
+
+    m_nameToScript.insert(std::make_pair(name, script->index));
+    m_hashToScript.insert(std::make_pair(hash, script->index));
+
+    if (scriptIndex != NULL)
     {
-        script->source = std::string(source, size);
+        *scriptIndex = script->index;
     }
-    
-    unsigned int scriptIndex = m_scripts.size();
-    m_scripts.push_back(script);
-
-    m_nameToScript.insert(std::make_pair(name, scriptIndex));
 
     std::string fileName;
 
@@ -601,7 +936,7 @@ int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size,
     if (source != NULL && strncmp(name, source, length) == 0)
     {
         char buffer[32];
-        sprintf(buffer, "@Untitled%d.lua", scriptIndex + 1);
+        sprintf(buffer, "@Untitled%d.lua", script->index + 1);
         fileName = buffer;
     }
     else
@@ -637,18 +972,55 @@ int DebugBackend::RegisterScript(lua_State* L, const char* source, size_t size,
     m_eventChannel.WriteUInt32(EventId_LoadScript);
     m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
     m_eventChannel.WriteString(fileName);
-    m_eventChannel.WriteString(script->source);
+    m_eventChannel.WriteString(script->hash);
+    m_eventChannel.WriteBool(sendSource);
 
-    m_eventChannel.WriteUInt32(state);
-    m_eventChannel.Flush();
-
-    if (freeName)
+    if (sendSource)
+    {
+        m_eventChannel.WriteString(scriptSource, scriptSourceSize);
+    }
+
+    // If the frontend registered breakpoints for the file we can apply them here
+    // rather than waiting for the frontend to send them.
+
+    bool resolved = false;
+    bool wait = true;
+
+    std::string normalizedName;
+    NormalizeFileName(fileName.c_str(), normalizedName);
+
+    FileBreakpointMap::const_iterator fileBreakpoints = FindFileBreakpoints(normalizedName);
+
+    if (m_loadPolicy != LoadPolicy_Wait)
+    {
+        resolved = fileBreakpoints != m_fileBreakpoints.end();
+        if (resolved)
+        {
+            wait = fileBreakpoints->second.wait;
+        }
+        else
+        {
+            wait = m_loadPolicy == LoadPolicy_WaitIfUnresolved;
+        }
+    }
+
+    m_eventChannel.WriteUInt32(state);
+    m_eventChannel.WriteBool(resolved);
+    m_eventChannel.WriteBool(wait);
+    m_eventChannel.Flush();
+
+    if (resolved)
+    {
+        ApplyFileBreakpoints(L, script, fileBreakpoints->second);
+    }
+
+    if (freeName)
     {
         delete [] name;
         name = NULL;
     }
 
-    return scriptIndex;
+    return wait;
 
 }
 
@@ -664,13 +1036,13 @@ int DebugBackend::RegisterScript(unsigned long api, lua_State* L, lua_Debug* ar)
         size   = strlen(source);
     }
   
-    int scriptIndex = RegisterScript(L, source, size, arsource, source == NULL);
+    bool wait = RegisterScript(L, source, size, arsource, source == NULL);
   
     // We need to exit the critical section before waiting so that we don't
     // monopolize it. Specifically, ToggleBreakpoint will need it.
     m_criticalSection.Exit();
   
-    if (scriptIndex != -1)
+    if (wait)
     {
         // Stop execution so that the frontend has an opportunity to send us the break points
         // before we start executing the first line of the script.
@@ -684,8 +1056,227 @@ int DebugBackend::RegisterScript(unsigned long api, lua_State* L, lua_Debug* ar)
     return GetScriptIndex(arsource);
 }
 
+void DebugBackend::AddChunkReference(unsigned long api, lua_State* L, unsigned int scriptIndex)
+{
+
+    VirtualMachine* mainVm = GetMainVm(L);
+    Script* script = GetScript(scriptIndex);
+
+    if (mainVm == NULL || script == NULL)
+    {
+        return;
+    }
+
+    if (!lua_checkstack_dll(api, L, 3))
+    {
+        PinScript(mainVm, scriptIndex);
+        return;
+    }
+
+    PushChunkTable(api, L);
+    lua_pushvalue_dll(api, L, -2);
+    lua_pushinteger_dll(api, L, scriptIndex);
+    lua_rawset_dll(api, L, -3);
+    lua_pop_dll(api, L, 1);
+
+    std::pair<ScriptRefMap::iterator, bool> result = mainVm->scriptRefs.insert(std::make_pair(scriptIndex, ScriptRef()));
+
+    if (result.second)
+    {
+        ++script->refCount;
+    }
+
+    ++result.first->second.chunks;
+    ++mainVm->numChunks;
+
+    if (!mainVm->sweeping)
+    {
+        CreateSweepSentinel(api, L, mainVm->L);
+        mainVm->sweeping = true;
+    }
+
+}
+
+void DebugBackend::PinScript(VirtualMachine* mainVm, unsigned int scriptIndex)
+{
+
+    Script* script = GetScript(scriptIndex);
+
+    if (mainVm == NULL || script == NULL)
+    {
+        return;
+    }
+
+    std::pair<ScriptRefMap::iterator, bool> result = mainVm->scriptRefs.insert(std::make_pair(scriptIndex, ScriptRef()));
+
+    if (result.second)
+    {
+        result.first->second.pinned = true;
+        ++script->refCount;
+    }
+
+}
+
+void DebugBackend::ReferenceFunction(unsigned long api, lua_State* L, lua_Debug* ar, Script* script)
+{
+
+    if (!lua_checkstack_dll(api, L, 3))
+    {
+        return;
+    }
+
+    lua_getinfo_dll(api, L, "f", ar);
+
+    // Most calls are to functions we've already seen, so check that before taking
+    // the critical section.
+    PushChunkTable(api, L);
+    lua_pushvalue_dll(api, L, -2);
+    lua_rawget_dll(api, L, -2);
+
+    bool known = !lua_isnil_dll(api, L, -1);
+    lua_pop_dll(api, L, 2);
+
+    if (!known)
+    {
+        CriticalSectionLock lock(m_criticalSection);
+        AddChunkReference(api, L, script->index);
+    }
+
+    lua_pop_dll(api, L, 1);
+
+}
+
+void DebugBackend::ReleaseScript(VirtualMachine* mainVm, unsigned int scriptIndex)
+{
+
+    ScriptRefMap::iterator iterator = mainVm->scriptRefs.find(scriptIndex);
+
+    if (iterator == mainVm->scriptRefs.end())
+    {
+        return;
+    }
+
+    mainVm->numChunks -= iterator->second.chunks;
+    mainVm->scriptRefs.erase(iterator);
+
+    Script* script = GetScript(scriptIndex);
+
+    if (script != NULL && --script->refCount == 0)
+    {
+        UnloadScript(mainVm->L, script);
+    }
+
+}
+
+void DebugBackend::UnloadScript(lua_State* L, Script* script)
+{
+
+    m_nameToScript.erase(script->name);
+
+    for (unsigned int i = 0; i < script->aliases.size(); ++i)
+    {
+        m_nameToScript.erase(script->aliases[i]);
+    }
+
+    std::pair<HashToScriptMap::iterator, HashToScriptMap::iterator> matches = m_hashToScript.equal_range(script->hash);
+
+    for (HashToScriptMap::iterator iterator = matches.first; iterator != matches.second; ++iterator)
+    {
+        if (iterator->second == script->index)
+        {
+            m_hashToScript.erase(iterator);
+            break;
+        }
+    }
+
+    m_scripts.erase(script->index);
+
+    // Make the hooks drop the pointers they've cached to the script and release
+    // the conditions they compiled for it.
+    InterlockedIncrement(&m_scriptGeneration);
+    InterlockedIncrement(&m_conditionGeneration);
+
+    m_eventChannel.WriteUInt32(EventId_UnloadScript);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+    m_eventChannel.WriteUInt32(script->index);
+    m_eventChannel.Flush();
+
+    bool hadBreakpoints = script->HasBreakpointsActive();
+
+    // We may have been called from a garbage collection step inside a hook, or a
+    // hook on another thread may be using the script, so it can't be deleted
+    // until the hooks have finished.
+    if (m_activeHooks == 0)
+    {
+        delete script;
+    }
+    else
+    {
+        m_unloadedScripts.push_back(script);
+    }
+
+    if (hadBreakpoints && !GetHaveActiveBreakpoints())
+    {
+        SetHaveActiveBreakpoints(false);
+    }
+
+}
+
+void DebugBackend::DeleteUnloadedScripts()
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    // Another hook may have started since the last one finished.
+    if (m_activeHooks == 0)
+    {
+        ClearVector(m_unloadedScripts);
+    }
+
+}
+
+void DebugBackend::SetVmName(lua_State* L, const char* name)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    // Scripts can call decoda_setname before we've attached to the state.
+    StateToVmMap::iterator iterator = m_stateToVm.find(L);
+
+    if (iterator == m_stateToVm.end())
+    {
+        return;
+    }
+
+    VirtualMachine* vm = iterator->second;
+
+    if (name != vm->name)
+    {
+
+        vm->name = name;
+
+        // Threads which haven't stopped are named when they're announced.
+        if (!vm->announced)
+        {
+            return;
+        }
+
+        m_eventChannel.WriteUInt32(EventId_NameVM);
+        m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+        m_eventChannel.WriteString(vm->name);
+        m_eventChannel.Flush();
+
+    }
+
+}
+
 void DebugBackend::Message(const char* message, MessageType type)
 {
+
+    // Messages can be sent from the hook without the critical section held, so
+    // make sure they don't interleave with other events.
+    CriticalSectionLock lock(m_criticalSection);
+
     // Send a message.
     m_eventChannel.WriteUInt32(EventId_Message);
     m_eventChannel.WriteUInt32(0);
@@ -697,8 +1288,23 @@ void DebugBackend::Message(const char* message, MessageType type)
 void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
 {
 
-    m_criticalSection.Enter(); 
-    
+    // The hook holds on to script pointers while it runs Lua code, which can step
+    // the garbage collector and unload scripts, so scripts are only deleted when
+    // no hooks are running.
+    InterlockedIncrement(&m_activeHooks);
+
+    HandleHookEvent(api, L, ar);
+
+    if (InterlockedDecrement(&m_activeHooks) == 0 && !m_unloadedScripts.empty())
+    {
+        DeleteUnloadedScripts();
+    }
+
+}
+
+void DebugBackend::HandleHookEvent(unsigned long api, lua_State* L, lua_Debug* ar)
+{
+
 #ifdef VERBOSE
     // Log for debugging.
     LogHookEvent(api, L, ar);
@@ -706,30 +1312,31 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
 
     if (!lua_checkstack_dll(api, L, 2))
     {
-        m_criticalSection.Exit();
         return;
     }
 
     // Note this executes in the thread of the script being debugged,
-    // not our debugger, so we can block.
+    // not our debugger, so we can block. The critical section is only
+    // entered when something actually needs it (a new VM or script, a
+    // name change or a break) so that VMs running on different threads
+    // don't serialize on each other in the common case.
 
-    VirtualMachine* vm = NULL;
-    StateToVmMap::const_iterator iterator = m_stateToVm.find(L);
+    VirtualMachine* vm = GetVmForHook(api, L);
 
-    if (iterator == m_stateToVm.end())
-    {
-        // If somehow a thread was started without us intercepting the
-        // lua_newthread call, we can reach this point. If so, attach
-        // to the VM.
-        vm = AttachState(api, L);
-    }
-    else
+    if (vm == NULL)
     {
-        vm = iterator->second;
+        return;
     }
 
     assert(vm->api == api);
 
+    VirtualMachine* mainVm = vm->mainVm != NULL ? vm->mainVm : vm;
+
+    if (mainVm->conditionGeneration != m_conditionGeneration)
+    {
+        PruneCompiledConditions(api, L, mainVm);
+    }
+
     if (!vm->initialized && GetEvent(api, ar) == LUA_HOOKLINE)
     {
             
@@ -760,35 +1367,28 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
 
         lua_pop_dll(api, L, 1);
 
-        vm->initialized = true;
+        // Pick up a name that was assigned to the decoda_name global before we
+        // attached (or by the state this thread was created from). After this
+        // the name is only updated when the script calls decoda_setname.
 
-    }
+        lua_rawgetglobal_dll(api, L, "decoda_name");
+        const char* name = lua_tostring_dll(api, L, -1);
 
-    // Get the name of the VM. Polling like this is pretty excessive since the
-    // name won't change often, but it's the easiest way and works fine.
+        if (name != NULL)
+        {
+            SetVmName(L, name);
+        }
 
-    lua_rawgetglobal_dll(api, L, "decoda_name");
-    const char* name = lua_tostring_dll(api, L, -1);
+        lua_pop_dll(api, L, 1);
 
-    if (name == NULL)
-    {
-        name = "";
-    }
+        vm->initialized = true;
 
-    if (name != vm->name)
-    {
-        vm->name = name;
-        m_eventChannel.WriteUInt32(EventId_NameVM);
-        m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
-        m_eventChannel.WriteString(vm->name);
     }
 
-    lua_pop_dll(api, L, 1);
-
     //Only try to downgrade the hook when the debugger is not stepping   
     if(m_mode == Mode_Continue)
     {
-        UpdateHookMode(api, L, ar);
+        UpdateHookMode(api, L, vm, ar);
     }
     else
     {
@@ -807,14 +1407,10 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
 
         // Fill in the rest of the structure.
         lua_getinfo_dll(api, L, "Sl", ar);
-        const char* arsource = GetSource(api, ar);
-        int scriptIndex = GetScriptIndex(arsource);
 
-        if (scriptIndex == -1)
-        {
-            // This isn't a script we've seen before, so tell the debugger about it.
-            scriptIndex = RegisterScript( api, L, ar);
-        }
+        // This registers the script with the debugger if we haven't seen it before.
+        Script* script = GetScriptForHook(api, L, vm, ar, true);
+        int scriptIndex = script != NULL ? script->index : -1;
 
         bool stop = false;
         bool onLastStepLine = false;
@@ -841,30 +1437,47 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
                     vm->callStackDepth  = 0;
                 }
             }
+
+            // LuaJIT doesn't give us return events for all functions, so use the
+            // stack depth to tell when we've left the function we're stepping out of.
+            if (m_mode == Mode_StepOut && vm->stepOutDepth > 0 && stackDepth < vm->stepOutDepth)
+            {
+                vm->callCount = -1;
+            }
         }
 
-        if (scriptIndex != -1)
+        if (script != NULL)
         {
             // Check to see if we're on a breakpoint and should break.
-            if (!onLastStepLine && m_scripts[scriptIndex]->GetHasBreakPoint(GetCurrentLine(api, ar) - 1))
+            unsigned int line = GetCurrentLine(api, ar) - 1;
+            if (!onLastStepLine && script->GetHasBreakPoint(line))
             {
-                stop = true;
+                stop = ShouldStopAtBreakpoint(api, L, vm, script, line);
             }
         } 
         
         //Break if were doing some kind of stepping 
-        if (!onLastStepLine && (m_mode == Mode_StepInto || (m_mode == Mode_StepOver && vm->callCount == 0)))
+        Mode mode = m_mode;
+        if (!onLastStepLine && (mode == Mode_StepInto || (mode == Mode_StepOver && vm->callCount == 0)))
+        {
+            stop = true;
+        }
+
+        // When stepping out, the count goes negative once the function we were in
+        // has returned, so this only stops once.
+        if (mode == Mode_StepOut && vm->callCount < 0)
         {
             stop = true;
         }
-       
-        // We need to exit the critical section before waiting so that we don't
-        // monopolize it.
-        m_criticalSection.Exit();
 
         if (stop)
         {
             BreakFromScript(api, L);
+
+            if (vm->luaJitWorkAround)
+            {
+                vm->stepOutDepth = m_mode == Mode_StepOut ? GetStackDepth(api, L) : 0;
+            }
         }
         
         if (vm->luaJitWorkAround)
@@ -876,84 +1489,212 @@ void DebugBackend::HookCallback(unsigned long api, lua_State* L, lua_Debug* ar)
     }
     else
     {
-        if (m_mode == Mode_StepOver)
+        Mode mode = m_mode;
+        if (mode == Mode_StepOver || mode == Mode_StepOut)
         {
             if (GetIsHookEventRet( api, arevent)) // only LUA_HOOKRET for Lua 5.2, can also be LUA_HOOKTAILRET for older versions
             {
-                if (vm->callCount > 0)
+                // When stepping out we count the return from the function we're
+                // in, which takes the count below zero.
+                if (vm->callCount > 0 || mode == Mode_StepOut)
                 {
                     --vm->callCount;
                 }
             }
             else if( GetIsHookEventCall( api, arevent)) // only LUA_HOOKCALL for Lua 5.1, can also be LUA_HOOKTAILCALL for newer versions
             {
-                if (m_mode == Mode_StepOver)
-                {
-                    ++vm->callCount;
-                }
+                ++vm->callCount;
             }
         }
-
-        m_criticalSection.Exit(); 
-    
     }
 
 }
 
-void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* hookEvent)
+DebugBackend::VirtualMachine* DebugBackend::GetVmForHook(unsigned long api, lua_State* L)
 {
-    int arevent = GetEvent(api, hookEvent);
-    //Only update the hook mode for call or return hook events 
-    if (arevent == LUA_HOOKLINE)
-    {
-        return;
-    }
 
-    VirtualMachine* vm = GetVm(L);
-    HookMode mode = HookMode_CallsOnly;
+    HookThreadCache* cache = static_cast<HookThreadCache*>(TlsGetValue(m_hookCacheIndex));
 
-    // Populate the line number and source name debug fields
-    lua_getinfo_dll(api, L, "S", hookEvent);
-    int linedefined = GetLineDefined(api, hookEvent);
+    // Read the generation before looking up the VM so that a VM record deleted
+    // while we're doing the lookup invalidates what we cache.
+    LONG generation = m_vmGeneration;
 
-    if( GetIsHookEventCall( api, arevent) && linedefined != -1)
+    HookThreadCache::Entry* entry = NULL;
+
+    if (cache != NULL)
     {
-        vm->lastFunctions = GetSource(api, hookEvent);
 
-        int scriptIndex = GetScriptIndex(vm->lastFunctions.c_str());
+        entry = &cache->entries[(reinterpret_cast<size_t>(L) >> 4) % s_hookCacheSize];
 
-        if (scriptIndex == -1)
+        // Records of removed VMs are pooled rather than deleted, so we can check
+        // the serial number to see if the entry's VM is still the one for L.
+        if (cache->generation == generation && entry->L == L && entry->vm->serial == entry->serial)
         {
-            RegisterScript(api, L, hookEvent);
-            scriptIndex = GetScriptIndex(vm->lastFunctions.c_str());
+            return entry->vm;
         }
 
-        Script* script = scriptIndex != -1 ? m_scripts[scriptIndex] : NULL;
-
-        int lastlinedefined = GetLastLineDefined( api, hookEvent);
-        if(script != NULL && (script->HasBreakPointInRange(linedefined, lastlinedefined) ||
-           //Check if the function is the top level chunk of a script because they always have there lastlinedefined set to 0                  
-           (script->HasBreakpointsActive() && linedefined == 0 && lastlinedefined == 0)))
-        {
-            mode = HookMode_Full;
-            vm->breakpointInStack = true;
-        }
     }
 
-    //Keep the hook in Full mode while theres a function in the stack somewhere that has a breakpoint in it
-    if(mode != HookMode_Full && vm->breakpointInStack)
-    {
-      if(StackHasBreakpoint(api, L))
-      {
-          mode = HookMode_Full;
-      }
-      else
-      {
-          vm->breakpointInStack = false;
-      }
-    }
+    CriticalSectionLock lock(m_criticalSection);
 
-    HookMode currentMode = GetHookMode(api, L);
+    VirtualMachine* vm = NULL;
+    StateToVmMap::const_iterator iterator = m_stateToVm.find(L);
+
+    if (iterator == m_stateToVm.end())
+    {
+        // If somehow a thread was started without us intercepting the
+        // lua_newthread call, we can reach this point. If so, attach
+        // to the VM.
+        vm = AttachState(api, L);
+    }
+    else
+    {
+        vm = iterator->second;
+    }
+
+    if (vm != NULL)
+    {
+
+        if (cache == NULL)
+        {
+            cache = new HookThreadCache;
+            cache->generation = generation;
+            memset(cache->entries, 0, sizeof(cache->entries));
+            m_hookCaches.push_back(cache);
+            TlsSetValue(m_hookCacheIndex, cache);
+            entry = &cache->entries[(reinterpret_cast<size_t>(L) >> 4) % s_hookCacheSize];
+        }
+        else if (cache->generation != generation)
+        {
+            memset(cache->entries, 0, sizeof(cache->entries));
+            cache->generation = generation;
+        }
+
+        entry->L        = L;
+        entry->vm       = vm;
+        entry->serial   = vm->serial;
+
+    }
+
+    return vm;
+
+}
+
+DebugBackend::Script* DebugBackend::GetScriptForHook(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* ar, bool registerNew)
+{
+
+    const char* source = GetSource(api, ar);
+
+    if (source == NULL)
+    {
+        return NULL;
+    }
+
+    // Scripts may have been loaded or unloaded since we cached them.
+    LONG generation = m_scriptGeneration;
+
+    if (vm->scriptGeneration != generation)
+    {
+        vm->scripts.clear();
+        vm->scriptGeneration = generation;
+    }
+
+    SourceToScriptMap::iterator iterator = vm->scripts.find(source);
+
+    if (iterator != vm->scripts.end())
+    {
+        return iterator->second;
+    }
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    int scriptIndex = GetScriptIndex(source);
+
+    if (scriptIndex == -1 && registerNew)
+    {
+        // This isn't a script we've seen before, so tell the debugger about it.
+        scriptIndex = RegisterScript(api, L, ar);
+
+        if (scriptIndex != -1 && source[0] != '@')
+        {
+            GetScript(scriptIndex)->collectable = true;
+        }
+    }
+
+    if (scriptIndex == -1)
+    {
+        return NULL;
+    }
+
+    Script* script = GetScript(scriptIndex);
+
+    // Scripts from files stay loaded for as long as the state uses them. Other
+    // scripts are kept alive by the functions running them. When a script is
+    // unloaded the generation changes, so the pointer can be cached.
+    if (script->collectable)
+    {
+        ReferenceFunction(api, L, ar, script);
+    }
+    else
+    {
+        PinScript(vm->mainVm != NULL ? vm->mainVm : vm, scriptIndex);
+    }
+
+    vm->scripts[source] = script;
+
+    return script;
+
+}
+
+void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* hookEvent)
+{
+    int arevent = GetEvent(api, hookEvent);
+    //Only update the hook mode for call or return hook events 
+    if (arevent == LUA_HOOKLINE)
+    {
+        return;
+    }
+
+    HookMode mode = HookMode_CallsOnly;
+
+    // Populate the line number and source name debug fields
+    lua_getinfo_dll(api, L, "S", hookEvent);
+    int linedefined = GetLineDefined(api, hookEvent);
+
+    if( GetIsHookEventCall( api, arevent) && linedefined != -1)
+    {
+        Script* script = GetScriptForHook(api, L, vm, hookEvent, true);
+
+        // Each closure that runs keeps its script loaded for as long as it's alive.
+        if (script != NULL && script->collectable)
+        {
+            ReferenceFunction(api, L, hookEvent, script);
+        }
+
+        int lastlinedefined = GetLastLineDefined( api, hookEvent);
+        if(script != NULL && (script->HasBreakPointInRange(linedefined, lastlinedefined) ||
+           //Check if the function is the top level chunk of a script because they always have there lastlinedefined set to 0                  
+           (script->HasBreakpointsActive() && linedefined == 0 && lastlinedefined == 0)))
+        {
+            mode = HookMode_Full;
+            vm->breakpointInStack = true;
+        }
+    }
+
+    //Keep the hook in Full mode while theres a function in the stack somewhere that has a breakpoint in it
+    if(mode != HookMode_Full && vm->breakpointInStack)
+    {
+      if(StackHasBreakpoint(api, L, vm))
+      {
+          mode = HookMode_Full;
+      }
+      else
+      {
+          vm->breakpointInStack = false;
+      }
+    }
+
+    HookMode currentMode = GetHookMode(api, L);
 
     if(!vm->haveActiveBreakpoints)
     {
@@ -971,11 +1712,10 @@ void DebugBackend::UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* ho
     }
 }
 
-bool DebugBackend::StackHasBreakpoint(unsigned long api, lua_State* L)
+bool DebugBackend::StackHasBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm)
 {
     
     lua_Debug functionInfo;
-    VirtualMachine* vm = GetVm(L);
 
     for(int stackIndex = 0; lua_getstack_dll(api, L, stackIndex, &functionInfo) ;stackIndex++)
     {
@@ -988,11 +1728,7 @@ bool DebugBackend::StackHasBreakpoint(unsigned long api, lua_State* L)
             continue;
         }
 
-        vm->lastFunctions = GetSource( api, &functionInfo);
-
-        int scriptIndex = GetScriptIndex(vm->lastFunctions.c_str());
-        
-        Script* script = scriptIndex != -1 ? m_scripts[scriptIndex] : NULL;
+        Script* script = GetScriptForHook(api, L, vm, &functionInfo, false);
 
         int lastlinedefined = GetLastLineDefined( api, &functionInfo);
         if(script != NULL && (script->HasBreakPointInRange(linedefined, lastlinedefined) ||
@@ -1025,10 +1761,30 @@ int DebugBackend::GetScriptIndex(const char* name) const
 
 }
 
-void DebugBackend::WaitForContinue()
+void DebugBackend::WaitForContinue(unsigned long api, lua_State* L)
 {
     // Wait until the UI to tell us to step to the next line.
     WaitForEvent(m_stepEvent);
+
+    {
+
+        // The thread is about to run again, so its native stack can't be walked.
+        CriticalSectionLock lock(m_criticalSection);
+
+        if (m_breakThread != NULL)
+        {
+            CloseHandle(m_breakThread);
+            m_breakThread = NULL;
+        }
+
+        m_breakState = NULL;
+
+    }
+
+    // The frontend can't refer to any of the values from this break anymore,
+    // and the stack frames are about to change.
+    ReleaseValueHandles(api, L);
+    ReleaseFrameEnvironments(api, L);
 }
 
 void DebugBackend::WaitForEvent(HANDLE hEvent)
@@ -1091,6 +1847,54 @@ void DebugBackend::CommandThreadProc()
             m_commandChannel.ReadString(message);
             IgnoreException(message);
         }
+        else if (commandId == CommandId_SetProtocolVersion)
+        {
+            unsigned int version;
+            m_commandChannel.ReadUInt32(version);
+            m_protocolVersion = std::min<unsigned int>(version, ProtocolVersion_Current);
+        }
+        else if (commandId == CommandId_SetMaxStringLength)
+        {
+            unsigned int length;
+            m_commandChannel.ReadUInt32(length);
+            m_maxStringLength = std::max<unsigned int>(length, 2);
+        }
+        else if (commandId == CommandId_SetLoadPolicy)
+        {
+            unsigned int policy;
+            m_commandChannel.ReadUInt32(policy);
+            m_loadPolicy = static_cast<LoadPolicy>(policy);
+        }
+        else if (commandId == CommandId_SetFileBreakpoints)
+        {
+
+            std::string fileName;
+            m_commandChannel.ReadString(fileName);
+
+            bool wait;
+            m_commandChannel.ReadBool(wait);
+
+            unsigned int numBreakpoints;
+            m_commandChannel.ReadUInt32(numBreakpoints);
+
+            std::vector<FileBreakpoint> breakpoints(numBreakpoints);
+
+            for (unsigned int i = 0; i < numBreakpoints; ++i)
+            {
+                m_commandChannel.ReadUInt32(breakpoints[i].line);
+                m_commandChannel.ReadString(breakpoints[i].condition);
+                m_commandChannel.ReadString(breakpoints[i].hitCondition);
+                m_commandChannel.ReadString(breakpoints[i].logMessage);
+            }
+
+            // Frontends may key their files differently, so normalize the name the
+            // same way as the names of the scripts it's matched against.
+            std::string normalizedName;
+            NormalizeFileName(fileName.c_str(), normalizedName);
+
+            SetFileBreakpoints(normalizedName, wait, breakpoints);
+
+        }
         else
         {
 
@@ -1110,6 +1914,9 @@ void DebugBackend::CommandThreadProc()
             case CommandId_StepInto:
                 StepInto();
                 break;
+            case CommandId_StepOut:
+                StepOut();
+                break;
             case CommandId_DeleteAllBreakpoints:
                 DeleteAllBreakpoints();
                 break;
@@ -1124,6 +1931,25 @@ void DebugBackend::CommandThreadProc()
                     
                     ToggleBreakpoint(L, scriptIndex, line);
                 
+                }
+                break;
+            case CommandId_SetBreakpointCondition:
+                {
+
+                    unsigned int scriptIndex;
+                    unsigned int line;
+                    std::string condition;
+                    std::string hitCondition;
+                    std::string logMessage;
+
+                    m_commandChannel.ReadUInt32(scriptIndex);
+                    m_commandChannel.ReadUInt32(line);
+                    m_commandChannel.ReadString(condition);
+                    m_commandChannel.ReadString(hitCondition);
+                    m_commandChannel.ReadString(logMessage);
+
+                    SetBreakpointCondition(scriptIndex, line, condition, hitCondition, logMessage);
+
                 }
                 break;
             case CommandId_Break:
@@ -1138,6 +1964,9 @@ void DebugBackend::CommandThreadProc()
                     unsigned int stackLevel;
                     m_commandChannel.ReadUInt32(stackLevel);
 
+                    unsigned int maxDepth;
+                    m_commandChannel.ReadUInt32(maxDepth);
+
                     unsigned long api = GetApiForVm(L);
 
                     std::string result;
@@ -1145,13 +1974,158 @@ void DebugBackend::CommandThreadProc()
 
                     if (api != -1)
                     {
-                        success = Evaluate(api, L, expression, stackLevel, result);
+                        success = Evaluate(api, L, expression, stackLevel, maxDepth, result);
+                    }
+                    
+                    m_commandChannel.WriteUInt32(success);
+                    m_commandChannel.WriteString(result);
+                    m_commandChannel.Flush();
+
+                }
+                break;
+            case CommandId_EvaluateBatch:
+                {
+
+                    unsigned int numExpressions;
+                    m_commandChannel.ReadUInt32(numExpressions);
+
+                    std::vector<std::string> expressions(numExpressions);
+
+                    for (unsigned int i = 0; i < numExpressions; ++i)
+                    {
+                        m_commandChannel.ReadString(expressions[i]);
                     }
                     
+                    unsigned int stackLevel;
+                    m_commandChannel.ReadUInt32(stackLevel);
+
+                    unsigned int maxDepth;
+                    m_commandChannel.ReadUInt32(maxDepth);
+
+                    unsigned long api = GetApiForVm(L);
+
+                    std::vector<std::string> results;
+                    std::vector<bool> succeeded;
+                    bool success = false;
+
+                    if (api != -1)
+                    {
+                        success = EvaluateBatch(api, L, expressions, stackLevel, maxDepth, results, succeeded);
+                    }
+
+                    // If the environment couldn't be created, none of the expressions
+                    // were evaluated.
+                    results.resize(numExpressions);
+                    succeeded.resize(numExpressions, false);
+
+                    m_commandChannel.WriteUInt32(success);
+
+                    for (unsigned int i = 0; i < numExpressions; ++i)
+                    {
+                        m_commandChannel.WriteUInt32(succeeded[i]);
+                        m_commandChannel.WriteString(results[i]);
+                    }
+
+                    m_commandChannel.Flush();
+
+                }
+                break;
+            case CommandId_ExpandValue:
+                {
+
+                    unsigned int handle;
+                    unsigned int start;
+                    unsigned int count;
+
+                    m_commandChannel.ReadUInt32(handle);
+                    m_commandChannel.ReadUInt32(start);
+                    m_commandChannel.ReadUInt32(count);
+
+                    unsigned long api = GetApiForVm(L);
+
+                    std::string result;
+                    bool success = false;
+
+                    if (api != -1)
+                    {
+                        success = ExpandValue(api, L, handle, start, count, result);
+                    }
+
+                    m_commandChannel.WriteUInt32(success);
+                    m_commandChannel.WriteString(result);
+                    m_commandChannel.Flush();
+
+                }
+                break;
+            case CommandId_GetStringRange:
+                {
+
+                    unsigned int handle;
+                    unsigned int start;
+                    unsigned int count;
+
+                    m_commandChannel.ReadUInt32(handle);
+                    m_commandChannel.ReadUInt32(start);
+                    m_commandChannel.ReadUInt32(count);
+
+                    unsigned long api = GetApiForVm(L);
+
+                    std::string result;
+                    bool success = false;
+
+                    if (api != -1)
+                    {
+                        success = GetStringRange(api, L, handle, start, count, result);
+                    }
+
                     m_commandChannel.WriteUInt32(success);
                     m_commandChannel.WriteString(result);
                     m_commandChannel.Flush();
 
+                }
+                break;
+            case CommandId_GetNativeStack:
+                {
+
+                    unsigned long api = GetApiForVm(L);
+
+                    StackEntry stack[s_maxStackSize];
+                    unsigned int stackSize = 0;
+
+                    if (api != -1)
+                    {
+                        stackSize = GetNativeStack(api, L, stack);
+                    }
+
+                    m_commandChannel.WriteUInt32(stackSize);
+
+                    for (unsigned int i = 0; i < stackSize; ++i)
+                    {
+                        unsigned int stackIndex = stackSize - i - 1;
+                        m_commandChannel.WriteUInt32(stack[stackIndex].scriptIndex);
+                        m_commandChannel.WriteUInt32(stack[stackIndex].line);
+                        m_commandChannel.WriteString(stack[stackIndex].name);
+                        m_commandChannel.WriteUInt32(stack[stackIndex].stackLevel);
+                    }
+
+                    m_commandChannel.Flush();
+
+                }
+                break;
+            case CommandId_GetExpressionCacheStats:
+                {
+
+                    unsigned int hits   = 0;
+                    unsigned int misses = 0;
+                    unsigned int size   = 0;
+
+                    GetExpressionCacheStats(L, hits, misses, size);
+
+                    m_commandChannel.WriteUInt32(hits);
+                    m_commandChannel.WriteUInt32(misses);
+                    m_commandChannel.WriteUInt32(size);
+                    m_commandChannel.Flush();
+
                 }
                 break;
             case CommandId_LoadDone:
@@ -1166,18 +2140,21 @@ void DebugBackend::CommandThreadProc()
 
     // Cleanup.
 
-    m_classInfos.clear();
-
-    for (unsigned int i = 0; i < m_scripts.size(); ++i)
+    for (ScriptMap::iterator iterator = m_scripts.begin(); iterator != m_scripts.end(); ++iterator)
     {
-        delete m_scripts[i];
+        delete iterator->second;
     }
 
+    ClearVector(m_unloadedScripts);
+
     m_nameToScript.clear();
+    m_hashToScript.clear();
 
     m_scripts.clear();
     ClearVector(m_vms);
+    ClearVector(m_freeVms);
     m_stateToVm.clear();
+    InterlockedIncrement(&m_vmGeneration);
 
     m_eventChannel.Destroy();
     m_commandChannel.Destroy();
@@ -1236,9 +2213,9 @@ void DebugBackend::StepOver()
 }
 
 
-void DebugBackend::Continue()
+void DebugBackend::StepOut()
 {
-    
+
     CriticalSectionLock lock(m_criticalSection);
     
     for (unsigned int i = 0; i < m_vms.size(); ++i)
@@ -1246,7 +2223,23 @@ void DebugBackend::Continue()
         m_vms[i]->callCount = 0;
     }
 
-    m_mode = Mode_Continue;
+    m_mode = Mode_StepOut;
+    SetEvent(m_stepEvent);
+
+    ActiveLuaHookInAllVms();
+}
+
+void DebugBackend::Continue()
+{
+    
+    CriticalSectionLock lock(m_criticalSection);
+    
+    for (unsigned int i = 0; i < m_vms.size(); ++i)
+    {
+        m_vms[i]->callCount = 0;
+    }
+
+    m_mode = Mode_Continue;
     SetEvent(m_stepEvent);
 
 }
@@ -1264,7 +2257,13 @@ void DebugBackend::ToggleBreakpoint(lua_State* L, unsigned int scriptIndex, unsi
 
     CriticalSectionLock lock(m_criticalSection);
 
-    Script* script = m_scripts[scriptIndex];
+    Script* script = GetScript(scriptIndex);
+
+    if (script == NULL)
+    {
+        // The script was unloaded before the command arrived.
+        return;
+    }
 
     // Move the line to the next line after the one the user specified that is
     // valid for a breakpoint.
@@ -1324,9 +2323,9 @@ void DebugBackend::BreakpointsActiveForScript(int scriptIndex)
 
 bool DebugBackend::GetHaveActiveBreakpoints(){
 
-    for(std::vector<Script*>::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
+    for(ScriptMap::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
     {
-        if((*it)->HasBreakpointsActive())
+        if(it->second->HasBreakpointsActive())
         {
             return true;
         } 
@@ -1354,279 +2353,823 @@ void DebugBackend::SetHaveActiveBreakpoints(bool breakpointsActive)
 
 void DebugBackend::DeleteAllBreakpoints(){
 
-    for(std::vector<Script*>::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
+    CriticalSectionLock lock(m_criticalSection);
+
+    for(ScriptMap::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
     {
-        (*it)->breakpoints.clear();
+        it->second->ClearBreakpoints();
     }
 
+    InterlockedIncrement(&m_conditionGeneration);
+
     //Set all haveActiveBreakpoints for the vms back to false we leave to the hook being called for the vm
     SetHaveActiveBreakpoints(false);
 }
 
-void DebugBackend::SendBreakEvent(unsigned long api, lua_State* L, int stackTop)
+/**
+ * Returns true if the name can be used as a parameter name in Lua code. This
+ * excludes internal variables like "(for index)".
+ */
+static bool GetIsIdentifier(const char* name)
 {
 
-    CriticalSectionLock lock(m_criticalSection);
-
-    VirtualMachine* vm = GetVm(L);
-
-    // The C call stack will look something like this (may be any number of
-    // these stacked on top of each other):
-    //
-    //   +------+
-    //   |      | C function
-    //   +------+
-    //   |      |
-    //   | XXXX | Lua call mechanism (luaD_*, luaV_*, lua_*)
-    //   |      |
-    //   +------+
-    //   | XXXX | lua_call/lua_pcall/lua_load, etc.
-    //   +------+
-    //   |      |
-    //   |      | Pre-Lua code (main, etc.)
-    //   |      |
-    //   +------+
-
-    StackEntry nativeStack[100];
-    unsigned int nativeStackSize = 0;
-
-    if (vm != NULL)
-    {
-        // Remember how many stack levels to skip so when we evaluate we can adjust
-        // the stack level accordingly.
-        vm->stackTop = stackTop;
-        nativeStackSize = GetCStack(vm->hThread, nativeStack, 100);
-    }
-    else
-    {
-        // For whatever reason we couldn't remember how many stack levels we want to skip,
-        // so don't skip any. This shouldn't happen under any normal circumstance since
-        // the state should have a corresponding VM.
-        stackTop = 0;
-    }
-
-    m_eventChannel.WriteUInt32(EventId_Break);
-    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
-
-    // Send the call stack.
-
-    lua_Debug scriptStack[s_maxStackSize];
-    unsigned int scriptStackSize = 0;
-
-    for (int level = stackTop; scriptStackSize < s_maxStackSize && lua_getstack_dll(api, L, level, &scriptStack[scriptStackSize]); ++level)
+    if (name == NULL || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_'))
     {
-        lua_getinfo_dll(api, L, "nSlu", &scriptStack[scriptStackSize]);
-        ++scriptStackSize;
+        return false;
     }
 
-    // Create a unified call stack.
-    StackEntry stack[s_maxStackSize];
-    unsigned int stackSize = GetUnifiedStack(api, nativeStack, nativeStackSize, scriptStack, scriptStackSize, stack);
-
-    m_eventChannel.WriteUInt32(stackSize);
-
-    for (unsigned int i = 0; i < stackSize; ++i)
+    for (const char* c = name + 1; *c != 0; ++c)
     {
-        unsigned int stackIndex = stackSize - i - 1;
-        m_eventChannel.WriteUInt32(stack[stackIndex].scriptIndex);
-        m_eventChannel.WriteUInt32(stack[stackIndex].line);
-        m_eventChannel.WriteString(stack[stackIndex].name);
+        if (!(isalnum(static_cast<unsigned char>(*c)) || *c == '_'))
+        {
+            return false;
+        }
     }
 
-    m_eventChannel.Flush();
-
-}
+    return true;
 
-void DebugBackend::SendExceptionEvent(lua_State* L, const char* message)
-{
-    m_eventChannel.WriteUInt32(EventId_Exception);
-    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
-    m_eventChannel.WriteString(message);
-    m_eventChannel.Flush();
 }
 
-void DebugBackend::BreakFromScript(unsigned long api, lua_State* L)
+/**
+ * Converts a log message like "x is {x}" into a Lua expression that builds the
+ * message by concatenating the literal parts with the values of the expressions.
+ */
+static std::string GetLogMessageExpression(const std::string& message)
 {
-    CriticalSectionLock lock(m_breakLock);
 
-    SendBreakEvent(api, L);
-    WaitForContinue();        
-}
+    std::string expression = "\"\"";
+    std::string literal;
 
-int DebugBackend::Call(unsigned long api, lua_State* L, int nargs, int nresults, int errorfunc)
-{
+    size_t i = 0;
 
-    // Check it's not our error handler that's getting called (happens when there's an
-    // error). We also need to check that our error handler is not the error function,
-    // since that can happen if one of the Lua interfaces we hooked calls another one
-    // internally.
-    if (lua_tocfunction_dll(api, L, -1) == StaticErrorHandler || (errorfunc != 0 && lua_tocfunction_dll(api, L, errorfunc) == StaticErrorHandler))
-    {
-        return lua_pcall_dll(api, L, nargs, nresults, errorfunc);
-    }
-    else
+    while (i <= message.length())
     {
 
-        int result = 0;
+        size_t start = message.find('{', i);
 
-        if (lua_gettop_dll(api, L) >= nargs + 1)
+        if (start == std::string::npos)
         {
-            
-            // Push our error handler onto the stack before the function and the arguments.
-            if (errorfunc != 0)
-            {
-                lua_pushvalue_dll(api, L, errorfunc);
-            }
-            else
+            start = message.length();
+        }
+
+        literal.assign(message, i, start - i);
+
+        if (!literal.empty())
+        {
+
+            expression += "..\"";
+
+            for (size_t j = 0; j < literal.length(); ++j)
             {
-                lua_pushnil_dll(api, L);
+                char c = literal[j];
+                switch (c)
+                {
+                case '\\': expression += "\\\\"; break;
+                case '"':  expression += "\\\""; break;
+                case '\n': expression += "\\n"; break;
+                case '\r': expression += "\\r"; break;
+                case '\0': expression += "\\0"; break;
+                default:   expression += c;      break;
+                }
             }
-            lua_pushcclosure_dll(api, L, StaticErrorHandler, 1);
 
-            int errorHandler = lua_gettop_dll(api, L) - (nargs + 1);
-            lua_insert_dll(api, L, errorHandler);
+            expression += "\"";
 
-            // Invoke the function
-            result = lua_pcall_dll(api, L, nargs, nresults, errorHandler);
+        }
 
-            // Remove our error handler from the stack.
-            lua_remove_dll(api, L, errorHandler);
-        
+        if (start == message.length())
+        {
+            break;
         }
-        else
+
+        size_t end = message.find('}', start);
+
+        if (end == std::string::npos)
         {
-            // In this case there wasn't a function on the top of the stack, so don't push our
-            // error handler there since it will get called instead.
-            result = lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+            end = message.length();
         }
 
-        return result;
+        expression += "..tostring(";
+        expression.append(message, start + 1, end - start - 1);
+        expression += ")";
+
+        i = end + 1;
 
     }
 
-}
+    return expression;
 
-int DebugBackend::StaticErrorHandler(lua_State* L)
-{
-    unsigned long api = s_instance->GetApiForVm(L);
-    return s_instance->ErrorHandler(api, L);
 }
 
-int DebugBackend::ErrorHandler(unsigned long api, lua_State* L)
+DebugBackend::HitMode DebugBackend::ParseHitCondition(const std::string& hitCondition, unsigned int& target)
 {
 
-    int top = lua_gettop_dll(api, L);
-
-    // Get the error mesasge.
-    const char* message = lua_tostring_dll(api, L, -1);
+    const char* text = hitCondition.c_str();
 
-    if (message == NULL)
+    while (isspace(static_cast<unsigned char>(*text)))
     {
-        message = "No error message available";
+        ++text;
     }
 
-    if (!GetIsExceptionIgnored(message))
+    HitMode mode = HitMode_GreaterEqual;
+
+    if (text[0] == '=' && text[1] == '=')       { mode = HitMode_Equal;        text += 2; }
+    else if (text[0] == '>' && text[1] == '=')  { mode = HitMode_GreaterEqual; text += 2; }
+    else if (text[0] == '<' && text[1] == '=')  { mode = HitMode_LessEqual;    text += 2; }
+    else if (text[0] == '>')                    { mode = HitMode_Greater;      text += 1; }
+    else if (text[0] == '<')                    { mode = HitMode_Less;         text += 1; }
+    else if (text[0] == '%')                    { mode = HitMode_Multiple;     text += 1; }
+
+    if (sscanf(text, "%u", &target) != 1)
     {
+        return HitMode_None;
+    }
 
-        // Send the exception event. Ignore the top of the stack when we send the
-        // call stack since the top of the call stack is this function.
+    return mode;
 
-        // Sometimes the break lock will already be held.  For example, consider
-        // the following sequence of events:
-        //   1) The main lua thread is stopped in the debugger, holding the
-        //      break lock in DebugBackend::BreakFromScript.
-        //   2) The decoda thread tries to evaluate a variable from the watch
-        //      window
-        //   3) The evaluation of __towatch or __tostring calls lua_error()
-        // That will lead us right here, unable to grab the break lock.  To avoid
-        // deadlocking in this case, just send an error message.
+}
 
-        CriticalSectionTryLock lock(m_breakLock);
-        if (lock.IsHeld()) 
-        {
-            SendBreakEvent(api, L, 1);
-            SendExceptionEvent(L, message);
-            WaitForContinue();
-        } 
-        else 
-        {
-            Message(message, MessageType_Error);
-        }
+void DebugBackend::SetBreakpointCondition(unsigned int scriptIndex, unsigned int line, const std::string& condition,
+    const std::string& hitCondition, const std::string& logMessage)
+{
 
-    }
-        
-    // Try invoking the user specified error function.
+    CriticalSectionLock lock(m_criticalSection);
 
-    lua_pushvalue_dll(api, L, lua_upvalueindex_dll(api, 1));
+    Script* script = GetScript(scriptIndex);
 
-    if (!lua_isnil_dll(api, L, -1))
+    if (script == NULL)
     {
-        lua_pushvalue_dll(api, L, -2);
-        lua_pcall_dll(api, L, 1, 1, 0);
+        return;
     }
-    else
+
+    unsigned int hitTarget = 0;
+    HitMode hitMode = ParseHitCondition(hitCondition, hitTarget);
+
+    // Any compiled copies of the old condition are released by the states' hooks.
+    InterlockedIncrement(&m_conditionGeneration);
+
+    if (condition.empty() && logMessage.empty() && hitMode == HitMode_None)
     {
-        lua_pop_dll(api, L, 1);
-        // Push the original message back as the return so that it will be available
-        // to custom error handlers.
-        lua_pushvalue_dll(api, L, -1);
+        script->SetBreakpointCondition(line, NULL);
+        return;
     }
-        
-    return 1;
+
+    BreakpointCondition* breakpointCondition = new BreakpointCondition;
+
+    breakpointCondition->id         = m_nextConditionId++;
+    breakpointCondition->condition  = condition;
+    breakpointCondition->logMessage = logMessage;
+    breakpointCondition->hitMode    = hitMode;
+    breakpointCondition->hitTarget  = hitTarget;
+    breakpointCondition->hitCount   = 0;
+
+    script->SetBreakpointCondition(line, breakpointCondition);
 
 }
 
-bool DebugBackend::GetStartupDirectory(char* path, int maxPathLength)
+bool DebugBackend::ShouldStopAtBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm, Script* script, unsigned int line)
 {
 
-    if (!GetModuleFileName(g_hInstance, path, maxPathLength))
+    const BreakpointCondition* condition = script->GetBreakpointCondition(line);
+
+    if (condition == NULL)
     {
-        return false;
+        return true;
     }
 
-    char* lastSlash = strrchr(path, '\\');
+    lua_Debug frame;
 
-    if (lastSlash == NULL)
+    if (!lua_getstack_dll(api, L, 0, &frame))
     {
-        return false;
+        return true;
     }
 
-    // Terminate the path after the last slash.
+    // The locals that are active can differ between the line events for the same
+    // line (e.g. the first and following iterations of a loop), so the functions
+    // are recompiled if the number of locals doesn't match.
 
-    lastSlash[1] = 0;
-    return true;
+    int numLocals = 0;
 
-}
+    while (lua_getlocal_dll(api, L, &frame, numLocals + 1) != NULL)
+    {
+        lua_pop_dll(api, L, 1);
+        ++numLocals;
+    }
 
-void DebugBackend::ChainTables(unsigned long api, lua_State* L, int child, int parent)
-{
-    
-    int t1 = lua_gettop_dll(api, L);
+    // Threads share the compiled functions of the state they were created from.
+    VirtualMachine* mainVm = vm->mainVm != NULL ? vm->mainVm : vm;
 
-    // Create the metatable to link them.
-    lua_newtable_dll(api, L);
-    int metaTable = lua_gettop_dll(api, L);
+    unsigned __int64 key = (static_cast<unsigned __int64>(script->index) << 32) | line;
+    CompiledCondition& compiled = mainVm->conditions[key];
 
-    // Set the __index metamethod to point to the parent table.
-    lua_pushstring_dll(api, L, "__index");
-    lua_pushvalue_dll(api, L, parent);
-    lua_rawset_dll(api, L, metaTable);
+    std::string error;
 
-    // Set the __newindex metamethod to point to the parent table.
-    lua_pushstring_dll(api, L, "__newindex");
-    lua_pushvalue_dll(api, L, parent);
-    lua_rawset_dll(api, L, metaTable);
+    if (compiled.id != condition->id || compiled.numLocals != numLocals)
+    {
+        
+        ReleaseCompiledCondition(api, L, compiled);
+        
+        if (!CompileBreakpointCondition(api, L, &frame, condition, compiled, error))
+        {
+            ReleaseCompiledCondition(api, L, compiled);
+            Message(("Warning 1010: Error compiling breakpoint condition: " + error).c_str(), MessageType_Warning);
+            return true;
+        }
 
-    // Set the child's metatable.
-    lua_setmetatable_dll(api, L, child);
+        compiled.id         = condition->id;
+        compiled.numLocals  = numLocals;
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t1 == t2);
+    }
 
-}
+    // Calling the functions can run other threads of the state, whose hooks may
+    // change the compiled conditions, so we don't hold on to the entry.
+    int conditionRef = compiled.conditionRef;
+    int logRef       = compiled.logRef;
+    std::vector<int> arguments = compiled.arguments;
 
-bool DebugBackend::CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel)
-{
+    if (!lua_checkstack_dll(api, L, static_cast<int>(arguments.size()) + 3))
+    {
+        return true;
+    }
+
+    EnableIntercepts(false);
+
+    bool stop = true;
+
+    if (conditionRef != LUA_NOREF)
+    {
+        if (CallBreakpointFunction(api, L, &frame, conditionRef, arguments, error))
+        {
+            stop = lua_toboolean_dll(api, L, -1) != 0;
+            lua_pop_dll(api, L, 1);
+        }
+        else
+        {
+            Message(("Warning 1010: Error evaluating breakpoint condition: " + error).c_str(), MessageType_Warning);
+        }
+    }
+
+    if (stop && condition->hitMode != HitMode_None)
+    {
+
+        unsigned int hitCount = InterlockedIncrement(const_cast<volatile LONG*>(&condition->hitCount));
+        unsigned int target   = condition->hitTarget;
+
+        switch (condition->hitMode)
+        {
+        case HitMode_Equal:         stop = hitCount == target; break;
+        case HitMode_Greater:       stop = hitCount >  target; break;
+        case HitMode_GreaterEqual:  stop = hitCount >= target; break;
+        case HitMode_Less:          stop = hitCount <  target; break;
+        case HitMode_LessEqual:     stop = hitCount <= target; break;
+        case HitMode_Multiple:      stop = target != 0 && hitCount % target == 0; break;
+        }
+
+    }
+
+    if (stop && logRef != LUA_NOREF)
+    {
+        
+        // Log points output their message instead of stopping.
+        stop = false;
+
+        if (CallBreakpointFunction(api, L, &frame, logRef, arguments, error))
+        {
+            const char* message = lua_tostring_dll(api, L, -1);
+            Message(message != NULL ? message : "");
+            lua_pop_dll(api, L, 1);
+        }
+        else
+        {
+            Message(("Warning 1010: Error evaluating log message: " + error).c_str(), MessageType_Warning);
+        }
+
+    }
+
+    EnableIntercepts(true);
+
+    return stop;
+
+}
+
+bool DebugBackend::CompileBreakpointCondition(unsigned long api, lua_State* L, lua_Debug* frame, const BreakpointCondition* condition,
+    CompiledCondition& compiled, std::string& error)
+{
+
+    LUA_CHECK_STACK(api, L, 0)
+
+    // Build the parameter list from the up values followed by the locals, so that
+    // locals shadow up values and later locals shadow earlier ones with the same
+    // name just like they do in the function itself.
+
+    std::string parameters;
+    compiled.arguments.clear();
+
+    lua_getinfo_dll(api, L, "f", frame);
+    int function = lua_gettop_dll(api, L);
+
+    for (int n = 1; ; ++n)
+    {
+        const char* name = lua_getupvalue_dll(api, L, function, n);
+        if (name == NULL)
+        {
+            break;
+        }
+        lua_pop_dll(api, L, 1);
+        if (GetIsIdentifier(name))
+        {
+            parameters += parameters.empty() ? "" : ",";
+            parameters += name;
+            compiled.arguments.push_back(-n);
+        }
+    }
+
+    for (int n = 1; ; ++n)
+    {
+        const char* name = lua_getlocal_dll(api, L, frame, n);
+        if (name == NULL)
+        {
+            break;
+        }
+        lua_pop_dll(api, L, 1);
+        if (GetIsIdentifier(name))
+        {
+            parameters += parameters.empty() ? "" : ",";
+            parameters += name;
+            compiled.arguments.push_back(n);
+        }
+    }
+
+    lua_pop_dll(api, L, 1);
+
+    EnableIntercepts(false);
+
+    bool success = true;
+
+    if (!condition->condition.empty())
+    {
+        std::string code = "return function(" + parameters + ") return (" + condition->condition + ") end";
+        success = CompileBreakpointFunction(api, L, code, compiled.conditionRef, error);
+    }
+
+    if (success && !condition->logMessage.empty())
+    {
+        std::string code = "return function(" + parameters + ") return " + GetLogMessageExpression(condition->logMessage) + " end";
+        success = CompileBreakpointFunction(api, L, code, compiled.logRef, error);
+    }
+
+    EnableIntercepts(true);
+
+    return success;
+
+}
+
+bool DebugBackend::CompileBreakpointFunction(unsigned long api, lua_State* L, const std::string& code, int& ref, std::string& error)
+{
+
+    int result = LoadScriptWithoutIntercept(api, L, code.c_str(), code.length(), "=breakpoint");
+
+    if (result == 0)
+    {
+        result = lua_pcall_dll(api, L, 0, 1, 0);
+    }
+
+    if (result != 0)
+    {
+        const char* message = lua_tostring_dll(api, L, -1);
+        error = message != NULL ? message : "";
+        lua_pop_dll(api, L, 1);
+        return false;
+    }
+
+    ref = luaL_ref_dll(api, L, GetRegistryIndex(api));
+    return true;
+
+}
+
+bool DebugBackend::CallBreakpointFunction(unsigned long api, lua_State* L, lua_Debug* frame, int ref, const std::vector<int>& arguments, std::string& error)
+{
+
+    lua_rawgeti_dll(api, L, GetRegistryIndex(api), ref);
+
+    lua_getinfo_dll(api, L, "f", frame);
+    int function = lua_gettop_dll(api, L);
+
+    for (unsigned int i = 0; i < arguments.size(); ++i)
+    {
+        const char* name = NULL;
+        if (arguments[i] < 0)
+        {
+            name = lua_getupvalue_dll(api, L, function, -arguments[i]);
+        }
+        else
+        {
+            name = lua_getlocal_dll(api, L, frame, arguments[i]);
+        }
+        if (name == NULL)
+        {
+            lua_pushnil_dll(api, L);
+        }
+    }
+
+    lua_remove_dll(api, L, function);
+
+    if (lua_pcall_dll(api, L, static_cast<int>(arguments.size()), 1, 0) != 0)
+    {
+        const char* message = lua_tostring_dll(api, L, -1);
+        error = message != NULL ? message : "";
+        lua_pop_dll(api, L, 1);
+        return false;
+    }
+
+    return true;
+
+}
+
+void DebugBackend::ReleaseCompiledCondition(unsigned long api, lua_State* L, CompiledCondition& compiled)
+{
+
+    if (compiled.conditionRef != LUA_NOREF)
+    {
+        luaL_unref_dll(api, L, GetRegistryIndex(api), compiled.conditionRef);
+        compiled.conditionRef = LUA_NOREF;
+    }
+
+    if (compiled.logRef != LUA_NOREF)
+    {
+        luaL_unref_dll(api, L, GetRegistryIndex(api), compiled.logRef);
+        compiled.logRef = LUA_NOREF;
+    }
+
+    compiled.id = 0;
+    compiled.arguments.clear();
+
+}
+
+void DebugBackend::PruneCompiledConditions(unsigned long api, lua_State* L, VirtualMachine* mainVm)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    mainVm->conditionGeneration = m_conditionGeneration;
+
+    CompiledConditionMap::iterator iterator = mainVm->conditions.begin();
+
+    while (iterator != mainVm->conditions.end())
+    {
+
+        unsigned int scriptIndex = static_cast<unsigned int>(iterator->first >> 32);
+        unsigned int line        = static_cast<unsigned int>(iterator->first);
+
+        Script* script = GetScript(scriptIndex);
+        const BreakpointCondition* condition = script != NULL ? script->GetBreakpointCondition(line) : NULL;
+
+        if (condition == NULL || condition->id != iterator->second.id)
+        {
+            ReleaseCompiledCondition(api, L, iterator->second);
+            iterator = mainVm->conditions.erase(iterator);
+        }
+        else
+        {
+            ++iterator;
+        }
+
+    }
+
+}
+
+void DebugBackend::SendBreakEvent(unsigned long api, lua_State* L, int stackTop)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    VirtualMachine* vm = GetVm(L);
+
+    if (vm != NULL)
+    {
+
+        if (!vm->announced)
+        {
+            AnnounceVm(vm);
+        }
+
+        // Remember how many stack levels to skip so when we evaluate we can adjust
+        // the stack level accordingly.
+        vm->stackTop = stackTop;
+
+    }
+    else
+    {
+        // For whatever reason we couldn't remember how many stack levels we want to skip,
+        // so don't skip any. This shouldn't happen under any normal circumstance since
+        // the state should have a corresponding VM.
+        stackTop = 0;
+    }
+
+    // The thread waits for the frontend after sending the event, so it's the one
+    // whose native stack can be walked from the command thread. GetCurrentThread
+    // returns a pseudo handle which always refers to the calling thread, so we need
+    // a real handle. It's closed when the thread continues.
+    if (m_breakThread != NULL)
+    {
+        CloseHandle(m_breakThread);
+        m_breakThread = NULL;
+    }
+
+    HANDLE hProcess = GetCurrentProcess();
+    DuplicateHandle(hProcess, GetCurrentThread(), hProcess, &m_breakThread, THREAD_GET_CONTEXT | THREAD_SUSPEND_RESUME, FALSE, 0);
+    m_breakState = L;
+
+    // The scripts have been running since the last break, so they may have stored
+    // metatables in global variables.
+    ++m_globalsGeneration;
+
+    m_eventChannel.WriteUInt32(EventId_Break);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+
+    // Send the script call stack. Walking the native stack and looking up the
+    // symbols is slow, so the frontend requests those frames when it needs them.
+
+    lua_Debug scriptStack[s_maxStackSize];
+    unsigned int scriptStackSize = GetScriptStack(api, L, stackTop, scriptStack);
+
+    StackEntry stack[s_maxStackSize];
+    unsigned int stackSize = GetUnifiedStack(api, NULL, 0, scriptStack, scriptStackSize, stack);
+
+    m_eventChannel.WriteUInt32(stackSize);
+
+    for (unsigned int i = 0; i < stackSize; ++i)
+    {
+        unsigned int stackIndex = stackSize - i - 1;
+        m_eventChannel.WriteUInt32(stack[stackIndex].scriptIndex);
+        m_eventChannel.WriteUInt32(stack[stackIndex].line);
+        m_eventChannel.WriteString(stack[stackIndex].name);
+    }
+
+    m_eventChannel.Flush();
+
+}
+
+unsigned int DebugBackend::GetNativeStack(unsigned long api, lua_State* L, StackEntry stack[])
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
+
+    if (stateIterator == m_stateToVm.end())
+    {
+        return 0;
+    }
+
+    VirtualMachine* vm = stateIterator->second;
+
+    // The C call stack will look something like this (may be any number of
+    // these stacked on top of each other):
+    //
+    //   +------+
+    //   |      | C function
+    //   +------+
+    //   |      |
+    //   | XXXX | Lua call mechanism (luaD_*, luaV_*, lua_*)
+    //   |      |
+    //   +------+
+    //   | XXXX | lua_call/lua_pcall/lua_load, etc.
+    //   +------+
+    //   |      |
+    //   |      | Pre-Lua code (main, etc.)
+    //   |      |
+    //   +------+
+
+    // Only the thread stopped at the break is waiting, so any other thread's stack
+    // would be changing under us (and suspending it could stop it holding a lock we
+    // need). Those states just get their script frames.
+    StackEntry nativeStack[s_maxNativeStackSize];
+    unsigned int nativeStackSize = 0;
+
+    if (L == m_breakState && m_breakThread != NULL)
+    {
+        nativeStackSize = GetCStack(m_breakThread, nativeStack, s_maxNativeStackSize);
+    }
+
+    lua_Debug scriptStack[s_maxStackSize];
+    unsigned int scriptStackSize = GetScriptStack(api, L, vm->stackTop, scriptStack);
+
+    return GetUnifiedStack(api, nativeStack, nativeStackSize, scriptStack, scriptStackSize, stack);
+
+}
+
+unsigned int DebugBackend::GetScriptStack(unsigned long api, lua_State* L, int stackTop, lua_Debug scriptStack[])
+{
+
+    unsigned int scriptStackSize = 0;
+
+    for (int level = stackTop; scriptStackSize < s_maxStackSize && lua_getstack_dll(api, L, level, &scriptStack[scriptStackSize]); ++level)
+    {
+        lua_getinfo_dll(api, L, "nSlu", &scriptStack[scriptStackSize]);
+        ++scriptStackSize;
+    }
+
+    return scriptStackSize;
+
+}
+
+void DebugBackend::SendExceptionEvent(lua_State* L, const char* message)
+{
+
+    // The error handler only holds the break lock, and the event channel
+    // buffers the message until it's flushed, so keep other events out of it.
+    CriticalSectionLock lock(m_criticalSection);
+
+    m_eventChannel.WriteUInt32(EventId_Exception);
+    m_eventChannel.WriteUInt32(reinterpret_cast<int>(L));
+    m_eventChannel.WriteString(message);
+    m_eventChannel.Flush();
+
+}
+
+void DebugBackend::BreakFromScript(unsigned long api, lua_State* L)
+{
+    CriticalSectionLock lock(m_breakLock);
+
+    SendBreakEvent(api, L);
+    WaitForContinue(api, L);
+}
+
+int DebugBackend::Call(unsigned long api, lua_State* L, int nargs, int nresults, int errorfunc)
+{
+
+    // Check it's not our error handler that's getting called (happens when there's an
+    // error). We also need to check that our error handler is not the error function,
+    // since that can happen if one of the Lua interfaces we hooked calls another one
+    // internally.
+    if (lua_tocfunction_dll(api, L, -1) == StaticErrorHandler || (errorfunc != 0 && lua_tocfunction_dll(api, L, errorfunc) == StaticErrorHandler))
+    {
+        return lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+    }
+    else
+    {
+
+        int result = 0;
+
+        if (lua_gettop_dll(api, L) >= nargs + 1)
+        {
+            
+            // Push our error handler onto the stack before the function and the arguments.
+            if (errorfunc != 0)
+            {
+                lua_pushvalue_dll(api, L, errorfunc);
+            }
+            else
+            {
+                lua_pushnil_dll(api, L);
+            }
+            lua_pushcclosure_dll(api, L, StaticErrorHandler, 1);
+
+            int errorHandler = lua_gettop_dll(api, L) - (nargs + 1);
+            lua_insert_dll(api, L, errorHandler);
+
+            // Invoke the function
+            result = lua_pcall_dll(api, L, nargs, nresults, errorHandler);
+
+            // Remove our error handler from the stack.
+            lua_remove_dll(api, L, errorHandler);
+        
+        }
+        else
+        {
+            // In this case there wasn't a function on the top of the stack, so don't push our
+            // error handler there since it will get called instead.
+            result = lua_pcall_dll(api, L, nargs, nresults, errorfunc);
+        }
+
+        return result;
+
+    }
+
+}
+
+int DebugBackend::StaticErrorHandler(lua_State* L)
+{
+    unsigned long api = s_instance->GetApiForVm(L);
+    return s_instance->ErrorHandler(api, L);
+}
+
+int DebugBackend::ErrorHandler(unsigned long api, lua_State* L)
+{
+
+    int top = lua_gettop_dll(api, L);
+
+    // Get the error mesasge.
+    const char* message = lua_tostring_dll(api, L, -1);
+
+    if (message == NULL)
+    {
+        message = "No error message available";
+    }
+
+    if (!GetIsExceptionIgnored(message))
+    {
+
+        // Send the exception event. Ignore the top of the stack when we send the
+        // call stack since the top of the call stack is this function.
+
+        // Sometimes the break lock will already be held.  For example, consider
+        // the following sequence of events:
+        //   1) The main lua thread is stopped in the debugger, holding the
+        //      break lock in DebugBackend::BreakFromScript.
+        //   2) The decoda thread tries to evaluate a variable from the watch
+        //      window
+        //   3) The evaluation of __towatch or __tostring calls lua_error()
+        // That will lead us right here, unable to grab the break lock.  To avoid
+        // deadlocking in this case, just send an error message.
+
+        CriticalSectionTryLock lock(m_breakLock);
+        if (lock.IsHeld()) 
+        {
+            SendBreakEvent(api, L, 1);
+            SendExceptionEvent(L, message);
+            WaitForContinue(api, L);
+        } 
+        else 
+        {
+            Message(message, MessageType_Error);
+        }
+
+    }
+        
+    // Try invoking the user specified error function.
+
+    lua_pushvalue_dll(api, L, lua_upvalueindex_dll(api, 1));
+
+    if (!lua_isnil_dll(api, L, -1))
+    {
+        lua_pushvalue_dll(api, L, -2);
+        lua_pcall_dll(api, L, 1, 1, 0);
+    }
+    else
+    {
+        lua_pop_dll(api, L, 1);
+        // Push the original message back as the return so that it will be available
+        // to custom error handlers.
+        lua_pushvalue_dll(api, L, -1);
+    }
+        
+    return 1;
+
+}
+
+bool DebugBackend::GetStartupDirectory(char* path, int maxPathLength)
+{
+
+    if (!GetModuleFileName(g_hInstance, path, maxPathLength))
+    {
+        return false;
+    }
+
+    char* lastSlash = strrchr(path, '\\');
+
+    if (lastSlash == NULL)
+    {
+        return false;
+    }
+
+    // Terminate the path after the last slash.
+
+    lastSlash[1] = 0;
+    return true;
+
+}
+
+void DebugBackend::ChainTables(unsigned long api, lua_State* L, int child, int parent)
+{
+    
+    int t1 = lua_gettop_dll(api, L);
+
+    // Create the metatable to link them.
+    lua_newtable_dll(api, L);
+    int metaTable = lua_gettop_dll(api, L);
+
+    // Set the __index metamethod to point to the parent table.
+    lua_pushstring_dll(api, L, "__index");
+    lua_pushvalue_dll(api, L, parent);
+    lua_rawset_dll(api, L, metaTable);
+
+    // Set the __newindex metamethod to point to the parent table.
+    lua_pushstring_dll(api, L, "__newindex");
+    lua_pushvalue_dll(api, L, parent);
+    lua_rawset_dll(api, L, metaTable);
+
+    // Set the child's metatable.
+    lua_setmetatable_dll(api, L, child);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 == t2);
+
+}
+
+bool DebugBackend::CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel, int dirtyTable)
+{
 
     int t1 = lua_gettop_dll(api, L);
 
@@ -1669,63 +3212,214 @@ bool DebugBackend::CreateEnvironment(unsigned long api, lua_State* L, int stackL
         }
     }
 
-    // Copy the up values into a new table.
-    if (lua_getstack_dll(api, L, stackLevel, &stackEntry) != 1)
+    // Copy the up values into a new table.
+    if (lua_getstack_dll(api, L, stackLevel, &stackEntry) != 1)
+    {
+        return false;
+    }
+
+    lua_newtable_dll(api, L);
+    int upValueTable = lua_gettop_dll(api, L);
+    
+    // Get the function which is the call stack entry so that we can examine
+    // the up values and get the environment.
+    lua_getinfo_dll(api, L, "fu", &stackEntry);
+    int functionIndex = lua_gettop_dll(api, L);
+
+    for (int upValue = 1; name = lua_getupvalue_dll(api, L, functionIndex, upValue); ++upValue) 
+    {
+        // C function up values has no name, so skip those.
+        if( name && *name)
+        {
+            // If the value is nil, we use the nil sentinel so we can differentiate
+            // between undeclared, and declared but set to nil for lexical scoping.
+            if (lua_isnil_dll(api, L, -1))
+            {
+                lua_pop_dll(api, L, 1);
+                lua_pushstring_dll(api, L, name);
+                lua_pushvalue_dll(api, L, nilSentinel);
+            }
+            else
+            {
+                lua_pushstring_dll(api, L, name);
+                lua_insert_dll(api, L, -2);
+            }
+            lua_rawset_dll(api, L, upValueTable);
+        }
+        else
+        {
+            lua_pop_dll(api, L, 1);
+        }
+    }
+
+    // Create an environment table that chains all three of the tables together.
+    // They are accessed like this: local -> upvalue -> global
+    
+    lua_getfenv_dll(api, L, functionIndex);
+    int globalTable = lua_gettop_dll(api, L);
+
+    CreateChainedTable(api, L, nilSentinel, localTable, upValueTable, globalTable, dirtyTable);
+
+    // Remove the function and global table from the stack.
+    lua_remove_dll(api, L, globalTable);
+    lua_remove_dll(api, L, functionIndex);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t2 - t1 == 3);
+    
+    return true;
+
+}
+
+bool DebugBackend::PushFrameEnvironment(unsigned long api, lua_State* L, int stackLevel)
+{
+
+    if (!lua_checkstack_dll(api, L, 12))
+    {
+        return false;
+    }
+
+    int registry = GetRegistryIndex(api);
+
+    // The snapshots are stored in a registry table keyed by the state and then
+    // by the stack level.
+
+    lua_pushstring_dll(api, L, "decoda_frames");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_newtable_dll(api, L);
+        lua_pushstring_dll(api, L, "decoda_frames");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+    }
+
+    int states = lua_gettop_dll(api, L);
+
+    lua_pushlightuserdata_dll(api, L, L);
+    lua_rawget_dll(api, L, states);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_newtable_dll(api, L);
+        lua_pushlightuserdata_dll(api, L, L);
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, states);
+    }
+
+    int frames = lua_gettop_dll(api, L);
+
+    lua_rawgeti_dll(api, L, frames, stackLevel);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+
+        lua_pop_dll(api, L, 1);
+
+        lua_newtable_dll(api, L);
+        int snapshot = lua_gettop_dll(api, L);
+
+        // Create a sentinel value used in place of nil in the local and upvalue tables.
+        // We do this since we can't store a nil value in a table, but we need to preserve
+        // the fact that those variables were declared.
+        lua_newuserdata_dll(api, L, 0);
+        int nilSentinel = lua_gettop_dll(api, L);
+
+        // The variables that are assigned to are recorded in this table.
+        lua_newtable_dll(api, L);
+        int dirtyTable = lua_gettop_dll(api, L);
+
+        if (!CreateEnvironment(api, L, stackLevel, nilSentinel, dirtyTable))
+        {
+            lua_pop_dll(api, L, 5);
+            return false;
+        }
+
+        // Store the nil sentinel, dirty table, locals, up values and environment
+        // in the snapshot.
+
+        for (int i = 1; i <= 5; ++i)
+        {
+            lua_pushinteger_dll(api, L, i);
+            lua_pushvalue_dll(api, L, snapshot + i);
+            lua_rawset_dll(api, L, snapshot);
+        }
+
+        lua_pop_dll(api, L, 5);
+
+        lua_pushinteger_dll(api, L, stackLevel);
+        lua_pushvalue_dll(api, L, snapshot);
+        lua_rawset_dll(api, L, frames);
+
+    }
+
+    int snapshot = lua_gettop_dll(api, L);
+
+    for (int i = 1; i <= 5; ++i)
+    {
+        lua_rawgeti_dll(api, L, snapshot, i);
+    }
+
+    lua_remove_dll(api, L, snapshot);
+    lua_remove_dll(api, L, frames);
+    lua_remove_dll(api, L, states);
+
+    return true;
+
+}
+
+void DebugBackend::ReleaseFrameEnvironments(unsigned long api, lua_State* L) const
+{
+
+    if (!lua_checkstack_dll(api, L, 2))
+    {
+        return;
+    }
+
+    lua_pushstring_dll(api, L, "decoda_frames");
+    lua_pushnil_dll(api, L);
+    lua_rawset_dll(api, L, GetRegistryIndex(api));
+
+}
+
+void DebugBackend::BeginVisitedTables(unsigned long api, lua_State* L) const
+{
+
+    if (!lua_checkstack_dll(api, L, 3))
     {
-        return false;
+        return;
     }
 
+    lua_pushstring_dll(api, L, "decoda_visited");
     lua_newtable_dll(api, L);
-    int upValueTable = lua_gettop_dll(api, L);
-    
-    // Get the function which is the call stack entry so that we can examine
-    // the up values and get the environment.
-    lua_getinfo_dll(api, L, "fu", &stackEntry);
-    int functionIndex = lua_gettop_dll(api, L);
+    lua_rawset_dll(api, L, GetRegistryIndex(api));
 
-    for (int upValue = 1; name = lua_getupvalue_dll(api, L, functionIndex, upValue); ++upValue) 
-    {
-        // C function up values has no name, so skip those.
-        if( name && *name)
-        {
-            // If the value is nil, we use the nil sentinel so we can differentiate
-            // between undeclared, and declared but set to nil for lexical scoping.
-            if (lua_isnil_dll(api, L, -1))
-            {
-                lua_pop_dll(api, L, 1);
-                lua_pushstring_dll(api, L, name);
-                lua_pushvalue_dll(api, L, nilSentinel);
-            }
-            else
-            {
-                lua_pushstring_dll(api, L, name);
-                lua_insert_dll(api, L, -2);
-            }
-            lua_rawset_dll(api, L, upValueTable);
-        }
-        else
-        {
-            lua_pop_dll(api, L, 1);
-        }
-    }
+}
 
-    // Create an environment table that chains all three of the tables together.
-    // They are accessed like this: local -> upvalue -> global
-    
-    lua_getfenv_dll(api, L, functionIndex);
-    int globalTable = lua_gettop_dll(api, L);
+void DebugBackend::EndVisitedTables(unsigned long api, lua_State* L) const
+{
 
-    CreateChainedTable(api, L, nilSentinel, localTable, upValueTable, globalTable);
+    if (!lua_checkstack_dll(api, L, 2))
+    {
+        return;
+    }
 
-    // Remove the function and global table from the stack.
-    lua_remove_dll(api, L, globalTable);
-    lua_remove_dll(api, L, functionIndex);
+    lua_pushstring_dll(api, L, "decoda_visited");
+    lua_pushnil_dll(api, L);
+    lua_rawset_dll(api, L, GetRegistryIndex(api));
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t2 - t1 == 3);
-    
-    return true;
+}
 
+bool DebugBackend::GetIsDirty(unsigned long api, lua_State* L, int dirtyTable, const char* name, int table) const
+{
+    lua_pushstring_dll(api, L, name);
+    lua_rawget_dll(api, L, dirtyTable);
+    bool dirty = lua_tointeger_dll(api, L, -1) == table;
+    lua_pop_dll(api, L, 1);
+    return dirty;
 }
 
 int DebugBackend::IndexChained(unsigned long api, lua_State* L)
@@ -1812,6 +3506,8 @@ int DebugBackend::NewIndexChained(unsigned long api, lua_State* L)
     table[1] = lua_upvalueindex_dll(api, 3); // Up values
     table[2] = lua_upvalueindex_dll(api, 4); // Globals
 
+    int dirtyTable = lua_upvalueindex_dll(api, 5);
+
     // Try to set the value in the local table.
     
     for (int i = 0; i < 2; ++i)
@@ -1839,6 +3535,13 @@ int DebugBackend::NewIndexChained(unsigned long api, lua_State* L)
             }
             
             lua_settable_dll(api, L, table[i]);
+
+            // Record which variables were assigned so that only those are
+            // written back to the stack frame.
+            lua_pushvalue_dll(api, L, key);
+            lua_pushinteger_dll(api, L, i + 1);
+            lua_rawset_dll(api, L, dirtyTable);
+
             return 0;
 
         }
@@ -1854,7 +3557,7 @@ int DebugBackend::NewIndexChained(unsigned long api, lua_State* L)
 
 }
 
-void DebugBackend::CreateChainedTable(unsigned long api, lua_State* L, int nilSentinel, int localTable, int upValueTable, int globalTable)
+void DebugBackend::CreateChainedTable(unsigned long api, lua_State* L, int nilSentinel, int localTable, int upValueTable, int globalTable, int dirtyTable)
 {
 
     lua_newtable_dll(api, L);
@@ -1880,8 +3583,9 @@ void DebugBackend::CreateChainedTable(unsigned long api, lua_State* L, int nilSe
     lua_pushvalue_dll(api, L, localTable);
     lua_pushvalue_dll(api, L, upValueTable);
     lua_pushvalue_dll(api, L, globalTable);
+    lua_pushvalue_dll(api, L, dirtyTable);
     
-    lua_pushcclosure_dll(api, L, m_apis[api].NewIndexChained, 4);
+    lua_pushcclosure_dll(api, L, m_apis[api].NewIndexChained, 5);
     lua_settable_dll(api, L, metaTable);
 
     // Set the table's metatable to be itself so we don't need an extra table
@@ -1892,7 +3596,7 @@ void DebugBackend::CreateChainedTable(unsigned long api, lua_State* L, int nilSe
 
 }
 
-void DebugBackend::SetLocals(unsigned long api, lua_State* L, int stackLevel, int localTable, int nilSentinel)
+void DebugBackend::SetLocals(unsigned long api, lua_State* L, int stackLevel, int localTable, int dirtyTable, int nilSentinel)
 {
 
     lua_Debug stackEntry;
@@ -1908,7 +3612,7 @@ void DebugBackend::SetLocals(unsigned long api, lua_State* L, int stackLevel, in
         // Drop the local value, we don't need it.
         lua_pop_dll(api, L, 1);
 
-        if (!GetIsInternalVariable(name))
+        if (!GetIsInternalVariable(name) && GetIsDirty(api, L, dirtyTable, name, 1))
         {
 
             // Get the new value for the local from the same named global.
@@ -1931,7 +3635,7 @@ void DebugBackend::SetLocals(unsigned long api, lua_State* L, int stackLevel, in
 
 }
 
-void DebugBackend::SetUpValues(unsigned long api, lua_State* L, int stackLevel, int upValueTable, int nilSentinel)
+void DebugBackend::SetUpValues(unsigned long api, lua_State* L, int stackLevel, int upValueTable, int dirtyTable, int nilSentinel)
 {
 
     lua_Debug stackEntry;
@@ -1951,7 +3655,7 @@ void DebugBackend::SetUpValues(unsigned long api, lua_State* L, int stackLevel,
         // Drop the up value value, we don't need it.
         lua_pop_dll(api, L, 1);
 
-        if (strlen(name) > 0)
+        if (strlen(name) > 0 && GetIsDirty(api, L, dirtyTable, name, 2))
         {
 
             // Get the new value for the local from the same named global.
@@ -1977,7 +3681,24 @@ void DebugBackend::SetUpValues(unsigned long api, lua_State* L, int stackLevel,
 
 }
 
-bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, std::string& result)
+bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, int maxDepth, std::string& result)
+{
+
+    std::vector<std::string> expressions(1, expression);
+    std::vector<std::string> results;
+    std::vector<bool> succeeded;
+
+    if (!EvaluateBatch(api, L, expressions, stackLevel, maxDepth, results, succeeded))
+    {
+        return false;
+    }
+
+    result = results[0];
+    return succeeded[0];
+
+}
+
+bool DebugBackend::EvaluateBatch(unsigned long api, lua_State* L, const std::vector<std::string>& expressions, int stackLevel, int maxDepth, std::vector<std::string>& results, std::vector<bool>& succeeded)
 {
 
     if (!GetIsLuaLoaded())
@@ -2004,60 +3725,89 @@ bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string&
 
     int t1 = lua_gettop_dll(api, L);
 
-    // Create a sentinel value used in place of nil in the local and upvalue tables.
-    // We do this since we can't store a nil value in a table, but we need to preserve
-    // the fact that those variables were declared.
-    
-    lua_newuserdata_dll(api, L, 0);
-    int nilSentinel = lua_gettop_dll(api, L);    
-    
-    if (!CreateEnvironment(api, L, stackLevel, nilSentinel))
+    if (!PushFrameEnvironment(api, L, stackLevel))
     {
-        lua_pop_dll(api, L, 1);
         return false;
     }
 
     int envTable     = lua_gettop_dll(api, L);
     int upValueTable = envTable - 1;
     int localTable   = envTable - 2;
+    int dirtyTable   = envTable - 3;
+    int nilSentinel  = envTable - 4;
 
     // Disable the debugger hook so that we don't try to debug the expression.
     SetHookMode(api, L, HookMode_None);
     EnableIntercepts(false);
-    
-    int stackTop = lua_gettop_dll(api, L);    
-    
-    // Turn the expression into a statement by making it a return.
 
-    std::string statement;
+    // All of the expressions share the environment, so changes made by one
+    // expression are visible to the ones after it.
 
-    statement  = "return ";
-    statement += expression;
-    
-    /*statement  = "local ";
-    statement += expression;
-    statement += " = ";
-    statement += expression;
-    statement += " return ";
-    statement += expression;*/
+    results.resize(expressions.size());
+    succeeded.resize(expressions.size());
 
-    int error = LoadScriptWithoutIntercept(api, L, statement.c_str());
+    for (size_t i = 0; i < expressions.size(); ++i)
+    {
+        succeeded[i] = EvaluateInEnvironment(api, L, expressions[i], envTable, maxDepth, results[i]);
+    }
 
-    if (error == LUA_ERRSYNTAX)
+    // Copy any locals and up values that were assigned by the expressions back
+    // to the stack frame.
+
+    lua_pushnil_dll(api, L);
+
+    if (lua_next_dll(api, L, dirtyTable) != 0)
     {
-        // The original expression may be a statement, so try loading it that way.
-        lua_pop_dll(api, L, 1);
-        error = LoadScriptWithoutIntercept(api, L, expression.c_str());
+
+        lua_pop_dll(api, L, 2);
+
+        SetLocals(api, L, stackLevel, localTable, dirtyTable, nilSentinel);
+        SetUpValues(api, L, stackLevel, upValueTable, dirtyTable, nilSentinel);
+
+        // Up values can be shared with other frames, so the other snapshots may
+        // be out of date now.
+        ReleaseFrameEnvironments(api, L);
+
     }
 
+    // Remove the local, up value, environment and dirty tables and the nil
+    // sentinel from the stack.
+    lua_pop_dll(api, L, 5);
+
+    // Reenable the debugger hook
+    EnableIntercepts(true);
+    SetHookMode(api, L, HookMode_Full);
+    if(GetVm(L)->haveActiveBreakpoints || m_mode == Mode_StepInto || m_mode == Mode_StepOver){
+    }
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 == t2);
+
+    return true;
+
+}
+
+bool DebugBackend::EvaluateInEnvironment(unsigned long api, lua_State* L, const std::string& expression, int envTable, int maxDepth, std::string& result)
+{
+
+    int stackTop = lua_gettop_dll(api, L);    
+    
+    int error = LoadExpression(api, L, expression);
+
     if (error == 0)
     {
         lua_pushvalue_dll(api, L, envTable);
         lua_setfenv_dll(api, L, -2);
         error = lua_pcall_dll(api, L, 0, LUA_MULTRET, 0);
+
+        // The expression may have assigned a global variable.
+        ++m_globalsGeneration;
     }
 
-    TiXmlDocument document;
+    XmlValueWriter xmlWriter;
+    BinaryValueWriter binaryWriter;
+
+    ValueWriter& writer = GetValueWriter(xmlWriter, binaryWriter);
         
     if (error == 0)
     {
@@ -2066,30 +3816,25 @@ bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string&
         // expression.
         int nresults = lua_gettop_dll(api, L) - stackTop;
 
-        TiXmlNode* root = NULL;
-
-        // If there are multiple results, create a root "values" node.
+        // If there are multiple results, write them as a list of values.
 
         if (nresults > 1)
         {
-            root = new TiXmlElement("values");
-            document.LinkEndChild(root);
-        }
-        else
-        {
-            root = &document;
+            writer.BeginValues();
         }
 
+        BeginVisitedTables(api, L);
+
         for (int i = 0; i < nresults; ++i)
         {
+            GetValueAsText(api, L, -1 - (nresults - 1 - i), writer, maxDepth);
+        }
 
-            TiXmlNode* node = GetValueAsText(api, L, -1 - (nresults - 1 - i));
+        EndVisitedTables(api, L);
 
-            if (node != NULL)
-            {
-                root->LinkEndChild(node);
-            }
-        
+        if (nresults > 1)
+        {
+            writer.EndValues();
         }
 
         // Remove the results from the stack.
@@ -2120,40 +3865,249 @@ bool DebugBackend::Evaluate(unsigned long api, lua_State* L, const std::string&
         text = "Error: ";
         text += errorMessage;
 
-        document.LinkEndChild(WriteXmlNode("error", text));
+        writer.WriteError(text);
+
+        lua_pop_dll(api, L, 1);
+
+    }
+
+    writer.GetResult(result);
+
+    return error == 0;
+
+}
+
+void DebugBackend::GetExpressionCacheStats(lua_State* L, unsigned int& hits, unsigned int& misses, unsigned int& size)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    VirtualMachine* vm = GetMainVm(L);
+
+    if (vm == NULL)
+    {
+        hits   = 0;
+        misses = 0;
+        size   = 0;
+        return;
+    }
+
+    const ExpressionCache& cache = vm->expressionCache;
+
+    hits   = cache.hits;
+    misses = cache.misses;
+    size   = static_cast<unsigned int>(cache.expressions.size());
+
+}
+
+int DebugBackend::LoadExpression(unsigned long api, lua_State* L, const std::string& expression)
+{
+
+    VirtualMachine* vm = GetMainVm(L);
+    int registry = GetRegistryIndex(api);
+
+    // The compiled functions are stored in a registry table keyed by the text of
+    // the expression. The registry is shared by the threads of a state, so the
+    // order they were last used in is tracked by the main state.
+
+    lua_pushstring_dll(api, L, "decoda_expressions");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_newtable_dll(api, L);
+        lua_pushstring_dll(api, L, "decoda_expressions");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+    }
+
+    int functions = lua_gettop_dll(api, L);
+
+    if (vm != NULL)
+    {
+
+        ExpressionCache& cache = vm->expressionCache;
+        ExpressionCache::IndexMap::iterator iterator = cache.index.find(expression);
+
+        if (iterator != cache.index.end())
+        {
+
+            lua_pushstring_dll(api, L, expression.c_str());
+            lua_rawget_dll(api, L, functions);
+
+            if (!lua_isnil_dll(api, L, -1))
+            {
+                // Move the expression to the front of the list.
+                cache.expressions.splice(cache.expressions.begin(), cache.expressions, iterator->second);
+                ++cache.hits;
+                lua_remove_dll(api, L, functions);
+                return 0;
+            }
+
+            lua_pop_dll(api, L, 1);
+
+            cache.expressions.erase(iterator->second);
+            cache.index.erase(iterator);
+
+        }
+
+        ++cache.misses;
+
+    }
+
+    // Turn the expression into a statement by making it a return.
+
+    std::string statement;
+
+    statement  = "return ";
+    statement += expression;
+    
+    /*statement  = "local ";
+    statement += expression;
+    statement += " = ";
+    statement += expression;
+    statement += " return ";
+    statement += expression;*/
+
+    int error = LoadScriptWithoutIntercept(api, L, statement.c_str());
+
+    if (error == LUA_ERRSYNTAX)
+    {
+        // The original expression may be a statement, so try loading it that way.
+        lua_pop_dll(api, L, 1);
+        error = LoadScriptWithoutIntercept(api, L, expression.c_str());
+    }
+
+    if (error == 0 && vm != NULL)
+    {
+
+        ExpressionCache& cache = vm->expressionCache;
+
+        lua_pushstring_dll(api, L, expression.c_str());
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, functions);
+
+        cache.expressions.push_front(expression);
+        cache.index[expression] = cache.expressions.begin();
+
+        if (cache.expressions.size() > s_maxCachedExpressions)
+        {
+
+            // Evict the least recently used expression.
+
+            const std::string& oldest = cache.expressions.back();
+
+            lua_pushstring_dll(api, L, oldest.c_str());
+            lua_pushnil_dll(api, L);
+            lua_rawset_dll(api, L, functions);
+
+            cache.index.erase(oldest);
+            cache.expressions.pop_back();
+
+        }
+
+    }
+
+    lua_remove_dll(api, L, functions);
+    return error;
+
+}
+
+ValueWriter& DebugBackend::GetValueWriter(XmlValueWriter& xmlWriter, BinaryValueWriter& binaryWriter) const
+{
+
+    // Frontends that haven't told us they support the binary encoding get XML.
+    if (m_protocolVersion >= ProtocolVersion_BinaryValues)
+    {
+        return binaryWriter;
+    }
+
+    return xmlWriter;
+
+}
+
+bool DebugBackend::ExpandValue(unsigned long api, lua_State* L, unsigned int handle, unsigned int start, unsigned int count, std::string& result)
+{
+
+    if (!GetIsLuaLoaded())
+    {
+        return false;
+    }
+
+    int t1 = lua_gettop_dll(api, L);
+
+    PushValueForHandle(api, L, handle);
 
+    if (lua_type_dll(api, L, -1) != LUA_TTABLE)
+    {
         lua_pop_dll(api, L, 1);
-
+        result = "Error: The value is no longer available";
+        return false;
     }
 
-    // Copy any changes to the up values due to evaluating the watch back.
-    SetLocals(api, L, stackLevel, localTable, nilSentinel);
-    SetUpValues(api, L, stackLevel, upValueTable, nilSentinel);
+    // Disable the debugger hook so that we don't try to debug any meta-methods
+    // that are called while we're getting the values.
+    SetHookMode(api, L, HookMode_None);
+    EnableIntercepts(false);
 
-    // Remove the local, up value and environment tables from the stack.
-    lua_pop_dll(api, L, 3);
+    XmlValueWriter xmlWriter;
+    BinaryValueWriter binaryWriter;
 
-    // Remove the nil sentinel.
-    lua_pop_dll(api, L, 1);
+    ValueWriter& writer = GetValueWriter(xmlWriter, binaryWriter);
 
-    // Convert from XML to a string.
+    if (!GetTablePageAsText(api, L, -1, writer, start, count))
+    {
+        writer.WriteError("Error: Stack overflow");
+    }
 
-    TiXmlPrinter printer;
-    printer.SetIndent("\t");
+    lua_pop_dll(api, L, 1);
 
-    document.Accept( &printer );
-    result = printer.Str();
+    writer.GetResult(result);
 
     // Reenable the debugger hook
     EnableIntercepts(true);
     SetHookMode(api, L, HookMode_Full);
-    if(GetVm(L)->haveActiveBreakpoints || m_mode == Mode_StepInto || m_mode == Mode_StepOver){
-    }
 
     int t2 = lua_gettop_dll(api, L);
     assert(t1 == t2);
 
-    return error == 0;
+    return true;
+
+}
+
+bool DebugBackend::GetStringRange(unsigned long api, lua_State* L, unsigned int handle, unsigned int start, unsigned int count, std::string& result)
+{
+
+    if (!GetIsLuaLoaded())
+    {
+        return false;
+    }
+
+    PushValueForHandle(api, L, handle);
+
+    if (lua_type_dll(api, L, -1) != LUA_TSTRING)
+    {
+        lua_pop_dll(api, L, 1);
+        result = "Error: The value is no longer available";
+        return false;
+    }
+
+    size_t length;
+    const char* string = lua_tolstring_dll(api, L, -1, &length);
+
+    if (start < length)
+    {
+        size_t available = length - start;
+        result.assign(string + start, count < available ? count : available);
+    }
+    else
+    {
+        result.clear();
+    }
+
+    lua_pop_dll(api, L, 1);
+    return true;
 
 }
 
@@ -2239,12 +4193,12 @@ void DebugBackend::MergeTables(unsigned long api, lua_State* L, unsigned int tab
 
 }
 
-TiXmlNode* DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, unsigned int maxDepth, bool displayAsKey) const
+bool DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, unsigned int maxDepth, ValueWriter& writer, bool displayAsKey) const
 {
 
     if (!lua_checkstack_dll(api, L, 3))
     {
-        return NULL;
+        return false;
     }
 
     if (lua_getmetatable_dll(api, L, -1))
@@ -2262,7 +4216,7 @@ TiXmlNode* DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, u
         {
             // This userdata doesn't have the luabind class signature in its
             // metatable.
-            return NULL;
+            return false;
         }
 
     }
@@ -2273,7 +4227,7 @@ TiXmlNode* DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, u
     // so we can directly convert that into the value.
     lua_getfenv_dll(api, L, -1);
 
-    TiXmlNode* node = NULL;
+    bool written = false;
 
     // If the environment has a metatable, those are the class methods and we
     // need to merge them into the 
@@ -2283,7 +4237,8 @@ TiXmlNode* DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, u
         MergeTables(api, L, -1, -2);
 
         int tableIndex = lua_gettop_dll(api, L);
-        node = GetValueAsText(api, L, tableIndex, maxDepth, className, displayAsKey); 
+        GetValueAsText(api, L, tableIndex, writer, maxDepth, className, displayAsKey);
+        written = true;
 
         lua_pop_dll(api, L, 2);
 
@@ -2291,24 +4246,26 @@ TiXmlNode* DebugBackend::GetLuaBindClassValue(unsigned long api, lua_State* L, u
     else
     {
         int tableIndex = lua_gettop_dll(api, L);
-        node = GetValueAsText(api, L, tableIndex, maxDepth, className, displayAsKey); 
+        GetValueAsText(api, L, tableIndex, writer, maxDepth, className, displayAsKey);
+        written = true;
     }
 
     // Remove the value from the stack.
     lua_pop_dll(api, L, 1);
 
-    return node;
+    return written;
 
 }
 
-TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n, int maxDepth, const char* typeNameOverride, bool displayAsKey) const
+void DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n, ValueWriter& writer, int maxDepth, const char* typeNameOverride, bool displayAsKey) const
 {
 
     int t1 = lua_gettop_dll(api, L);
 
     if (!lua_checkstack_dll(api, L, 1))
     {
-        return NULL;
+        writer.WriteError("Error: Stack overflow");
+        return;
     }
 
     // Duplicate the item since calling to* can modify the value.
@@ -2322,7 +4279,7 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
         typeNameOverride = typeName;
     }
 
-    TiXmlNode* node = NULL;
+    bool written = false;
 
     if (strcmp(typeName, "table") == 0)
     {
@@ -2347,16 +4304,17 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                     className = lua_tostring_dll(api, L, -numResults);
                 }
 
-                node = GetValueAsText(api, L, -1, maxDepth, className.c_str(), displayAsKey);
+                GetValueAsText(api, L, -1, writer, maxDepth, className.c_str(), displayAsKey);
+                written = true;
 
                 // Remove the table value.
                 lua_pop_dll(api, L, numResults);
 
             }
         }
-        if( node == NULL)
+        if (!written)
         {
-        node = GetTableAsText(api, L, -1, maxDepth - 1, typeNameOverride);
+            written = GetTableAsText(api, L, -1, writer, maxDepth - 1, typeNameOverride);
         }
         // Remove the duplicated value.
         lua_pop_dll(api, L, 1);
@@ -2369,9 +4327,8 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
 
         int scriptIndex = GetScriptIndex(GetSource(api, &ar));
 
-        node = new TiXmlElement("function");
-        node->LinkEndChild(WriteXmlNode("script", scriptIndex));
-        node->LinkEndChild(WriteXmlNode("line",   GetLineDefined(api, &ar) - 1));
+        writer.WriteFunction(scriptIndex, GetLineDefined(api, &ar) - 1);
+        written = true;
     
     }
     else
@@ -2402,9 +4359,8 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                 text += "\"";
             }
 
-            node = new TiXmlElement("value");
-            node->LinkEndChild( WriteXmlNode("data", text) );
-            node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+            writer.WriteValue(text, typeNameOverride);
+            written = true;
 
         }
         else if (strcmp(typeName, "string") == 0)
@@ -2413,8 +4369,18 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
             size_t length;
             const char* string = lua_tolstring_dll(api, L, -1, &length); 
 
+            // Only send the start of long strings so that inspecting a large blob
+            // doesn't stall both sides. The length is kept even in case the string
+            // holds wide characters.
+            size_t previewLength = length;
+
+            if (length > m_maxStringLength)
+            {
+                previewLength = m_maxStringLength & ~1;
+            }
+
             bool wide;
-            std::string result = GetASTCiString(string, length, wide);
+            std::string result = GetASTCiString(string, previewLength, wide);
 
             std::string text;
 
@@ -2434,9 +4400,15 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                 text += "\"";
             }
 
-            node = new TiXmlElement("value");
-            node->LinkEndChild( WriteXmlNode("data", text) );
-            node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+            if (previewLength < length)
+            {
+                writer.WriteTruncatedValue(text, typeNameOverride, GetValueHandle(api, L, -1), length);
+            }
+            else
+            {
+                writer.WriteValue(text, typeNameOverride);
+            }
+            written = true;
 
         }
         else if (strcmp(typeName, "userdata") == 0)
@@ -2458,9 +4430,9 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
             }
 
             // Check if this is a luabind class instance.
-            //node = GetLuaBindClassValue(api, L, maxDepth, displayAsKey);
+            //written = GetLuaBindClassValue(api, L, maxDepth, writer, displayAsKey);
 
-            if (node == NULL)
+            if (!written)
             {
 
                 // Check to see if the user data's metatable has a __towatch method. This is
@@ -2490,7 +4462,8 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                             className = lua_tostring_dll(api, L, -numResults);
                         }
 
-                        node = GetValueAsText(api, L, tableIndex, maxDepth, className.c_str(), displayAsKey); 
+                        GetValueAsText(api, L, tableIndex, writer, maxDepth, className.c_str(), displayAsKey);
+                        written = true;
 
                         // Remove the table value.
                         lua_pop_dll(api, L, numResults);
@@ -2506,9 +4479,8 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                         
                         if (string != NULL)
                         {
-                            node = new TiXmlElement("value");
-                            node->LinkEndChild( WriteXmlNode("data", string) );
-                            node->LinkEndChild( WriteXmlNode("type", className) );
+                            writer.WriteValue(string, className.c_str());
+                            written = true;
                         }
 
                         // Remove the string value.
@@ -2530,7 +4502,8 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                         error = "Error executing __tostring";
                     }
 
-                    node = WriteXmlNode("error", error);
+                    writer.WriteError(error);
+                    written = true;
                 
                     // Remove the error message.
                     lua_pop_dll(api, L, 1);
@@ -2540,7 +4513,7 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
             }
 
             // If we did't find a way to display the user data, just display the class name.
-            if (node == NULL)
+            if (!written)
             {
 
                 if (!m_warnedAboutUserData)
@@ -2562,9 +4535,8 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                     sprintf(buffer, "0x%p", p);
                 }
 
-                node = new TiXmlElement("value");
-                node->LinkEndChild( WriteXmlNode("data", buffer) );
-                node->LinkEndChild( WriteXmlNode("type", className) );
+                writer.WriteValue(buffer, className.c_str());
+                written = true;
 
             }
 
@@ -2606,15 +4578,13 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
                 result = string;
             }
 
-            node = new TiXmlElement("value");
-
             if (displayAsKey)
             {
                 result = "[" + result + "]"; 
             }
 
-            node->LinkEndChild( WriteXmlNode("data", result) );
-            node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+            writer.WriteValue(result, typeNameOverride);
+            written = true;
 
         }
 
@@ -2623,19 +4593,23 @@ TiXmlNode* DebugBackend::GetValueAsText(unsigned long api, lua_State* L, int n,
 
     }
 
+    if (!written)
+    {
+        // Always write something so that the structure of the value is intact.
+        writer.WriteError("Error: The value could not be displayed");
+    }
+
     int t2 = lua_gettop_dll(api, L);
     assert(t2 - t1 == 0);
 
-    return node;
-
 }
 
-TiXmlNode* DebugBackend::GetTableAsText(unsigned long api, lua_State* L, int t, int maxDepth, const char* typeNameOverride) const
+bool DebugBackend::GetTableAsText(unsigned long api, lua_State* L, int t, ValueWriter& writer, int maxDepth, const char* typeNameOverride) const
 {
 
-    if (!lua_checkstack_dll(api, L, 2))
+    if (!lua_checkstack_dll(api, L, 4))
     {
-        return NULL;
+        return false;
     }    
     
     int t1 = lua_gettop_dll(api, L);
@@ -2644,33 +4618,96 @@ TiXmlNode* DebugBackend::GetTableAsText(unsigned long api, lua_State* L, int t,
     // later once we've put additional stuff on the stack.
     t = lua_absindex_dll(api, L, t);
 
-    TiXmlNode* node = new TiXmlElement("table");
+    // Tables that have been written are recorded in the visited table so that a
+    // table that's reachable along more than one path (or from itself) is only
+    // written once. The visited table holds on to them, so a table that's
+    // collected while we're writing can't be confused with a new table at the
+    // same address. Tables whose elements aren't written don't get an id, so
+    // that they're written in full if they're reached again higher up.
+
+    unsigned int id = 0;
 
-    if (typeNameOverride)
+    if (maxDepth > 0)
     {
-        node->LinkEndChild( WriteXmlNode("type", typeNameOverride) );
+
+        lua_pushstring_dll(api, L, "decoda_visited");
+        lua_rawget_dll(api, L, GetRegistryIndex(api));
+
+        if (!lua_isnil_dll(api, L, -1))
+        {
+
+            lua_pushvalue_dll(api, L, t);
+            lua_rawget_dll(api, L, -2);
+
+            if (!lua_isnil_dll(api, L, -1))
+            {
+                id = lua_tointeger_dll(api, L, -1);
+                lua_pop_dll(api, L, 2);
+                writer.WriteReference(id);
+                return true;
+            }
+
+            lua_pop_dll(api, L, 1);
+
+            id = writer.AddTable();
+
+            lua_pushvalue_dll(api, L, t);
+            lua_pushinteger_dll(api, L, id);
+            lua_rawset_dll(api, L, -3);
+
+        }
+
+        lua_pop_dll(api, L, 1);
+
     }
 
-    if (maxDepth > 0)
+    writer.BeginTable(typeNameOverride, id);
+
+    unsigned int handle = 0;
+    unsigned int size   = 0;
+
+    if (maxDepth <= 0)
     {
+        // The elements aren't included, so give the frontend a handle that it
+        // can use to fetch them if they're needed, and the number of elements so
+        // that it can fetch them a page at a time.
 
-        // First key.
         lua_pushnil_dll(api, L);
 
         while (lua_next_dll(api, L, t) != 0)
         {
+            ++size;
+            lua_pop_dll(api, L, 1);
+        }
+
+        handle = GetValueHandle(api, L, t);
+    }
+    else
+    {
+
+        // First key.
+        lua_pushnil_dll(api, L);
 
-            TiXmlNode* key = new TiXmlElement("key");
-            key->LinkEndChild( GetValueAsText(api, L, -2, maxDepth - 1, NULL, true) );
+        while (lua_next_dll(api, L, t) != 0)
+        {
 
-            TiXmlNode* value = new TiXmlElement("data");
-            value->LinkEndChild( GetValueAsText(api, L, -1, maxDepth - 1) );
+            if (handle == 0 && !writer.UseElement())
+            {
+                // We've written as many elements as we're allowed to for one value,
+                // so the rest of the table is left for the frontend to request.
+                handle = GetValueHandle(api, L, t);
+            }
 
-            TiXmlNode* element = new TiXmlElement("element");
+            if (handle == 0)
+            {
+                writer.BeginElement();
+                GetValueAsText(api, L, -2, writer, maxDepth - 1, NULL, true);
+                writer.BeginElementValue();
+                GetValueAsText(api, L, -1, writer, maxDepth - 1);
+                writer.EndElement();
+            }
 
-            element->LinkEndChild(key);
-            element->LinkEndChild(value);
-            node->LinkEndChild(element);
+            ++size;
             
             // Leave the key on the stack for the next call to lua_next.
             lua_pop_dll(api, L, 1);
@@ -2679,10 +4716,160 @@ TiXmlNode* DebugBackend::GetTableAsText(unsigned long api, lua_State* L, int t,
     
     }
 
+    writer.EndTable(handle, size);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t2 - t1 == 0);
+
+    return true;
+
+}
+
+bool DebugBackend::GetTablePageAsText(unsigned long api, lua_State* L, int t, ValueWriter& writer, unsigned int start, unsigned int count) const
+{
+
+    if (!lua_checkstack_dll(api, L, 2))
+    {
+        return false;
+    }    
+    
+    int t1 = lua_gettop_dll(api, L);
+
+    t = lua_absindex_dll(api, L, t);
+
+    writer.BeginTable(NULL, 0);
+
+    unsigned int index = 0;
+
+    // First key.
+    lua_pushnil_dll(api, L);
+
+    while (lua_next_dll(api, L, t) != 0)
+    {
+
+        // We keep iterating past the end of the range so that we can report the
+        // total number of elements, but only the elements in the range are
+        // converted to text.
+
+        if (index >= start && (count == 0 || index - start < count))
+        {
+
+            writer.BeginElement();
+            GetValueAsText(api, L, -2, writer, 1, NULL, true);
+            writer.BeginElementValue();
+            GetValueAsText(api, L, -1, writer, 1);
+            writer.EndElement();
+
+        }
+
+        ++index;
+            
+        // Leave the key on the stack for the next call to lua_next.
+        lua_pop_dll(api, L, 1);
+        
+    }    
+
+    writer.EndTable(GetValueHandle(api, L, t), index);
+
     int t2 = lua_gettop_dll(api, L);
     assert(t2 - t1 == 0);
 
-    return node;
+    return true;
+
+}
+
+unsigned int DebugBackend::GetValueHandle(unsigned long api, lua_State* L, int n) const
+{
+
+    if (!lua_checkstack_dll(api, L, 4))
+    {
+        return 0;
+    }
+
+    n = lua_absindex_dll(api, L, n);
+    int registry = GetRegistryIndex(api);
+
+    // The handle table maps from handles to values and from values back to
+    // handles. The number of handles is stored at index 0.
+
+    lua_pushstring_dll(api, L, "decoda_handles");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+        lua_pop_dll(api, L, 1);
+        lua_newtable_dll(api, L);
+        lua_pushstring_dll(api, L, "decoda_handles");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+    }
+
+    int handles = lua_gettop_dll(api, L);
+
+    lua_pushvalue_dll(api, L, n);
+    lua_rawget_dll(api, L, handles);
+
+    unsigned int handle = lua_tointeger_dll(api, L, -1);
+    lua_pop_dll(api, L, 1);
+
+    if (handle == 0)
+    {
+
+        lua_rawgeti_dll(api, L, handles, 0);
+        handle = lua_tointeger_dll(api, L, -1) + 1;
+        lua_pop_dll(api, L, 1);
+
+        lua_pushinteger_dll(api, L, handle);
+        lua_pushvalue_dll(api, L, n);
+        lua_rawset_dll(api, L, handles);
+
+        lua_pushvalue_dll(api, L, n);
+        lua_pushinteger_dll(api, L, handle);
+        lua_rawset_dll(api, L, handles);
+
+        lua_pushinteger_dll(api, L, 0);
+        lua_pushinteger_dll(api, L, handle);
+        lua_rawset_dll(api, L, handles);
+
+    }
+
+    // Remove the handle table.
+    lua_pop_dll(api, L, 1);
+
+    return handle;
+
+}
+
+void DebugBackend::PushValueForHandle(unsigned long api, lua_State* L, unsigned int handle) const
+{
+
+    lua_pushstring_dll(api, L, "decoda_handles");
+    lua_rawget_dll(api, L, GetRegistryIndex(api));
+
+    if (lua_isnil_dll(api, L, -1) || handle == 0)
+    {
+        lua_pop_dll(api, L, 1);
+        lua_pushnil_dll(api, L);
+    }
+    else
+    {
+        lua_rawgeti_dll(api, L, -1, handle);
+        lua_remove_dll(api, L, -2);
+    }
+
+}
+
+void DebugBackend::ReleaseValueHandles(unsigned long api, lua_State* L) const
+{
+
+    if (!lua_checkstack_dll(api, L, 2))
+    {
+        return;
+    }
+
+    lua_pushstring_dll(api, L, "decoda_handles");
+    lua_pushnil_dll(api, L);
+    lua_rawset_dll(api, L, GetRegistryIndex(api));
 
 }
 
@@ -2692,10 +4879,72 @@ bool DebugBackend::GetIsInternalVariable(const char* name) const
     return name[0] == '(';
 }
 
+void DebugBackend::PushClassNameTable(unsigned long api, lua_State* L) const
+{
+
+    int registry = GetRegistryIndex(api);
+
+    // The class name table maps from metatables to the names of the global
+    // variables they're stored in, or 0 if they weren't in one when the
+    // global table was last scanned.
+
+    lua_pushstring_dll(api, L, "decoda_classnames");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+
+        lua_pop_dll(api, L, 1);
+        lua_newtable_dll(api, L);
+
+        // Use weak keys so that we don't prevent the metatables from being collected.
+        lua_newtable_dll(api, L);
+        lua_pushstring_dll(api, L, "__mode");
+        lua_pushstring_dll(api, L, "k");
+        lua_rawset_dll(api, L, -3);
+        lua_setmetatable_dll(api, L, -2);
+
+        lua_pushstring_dll(api, L, "decoda_classnames");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+
+    }
+
+}
+
+void DebugBackend::PushRegisteredClassNameTable(unsigned long api, lua_State* L) const
+{
+
+    int registry = GetRegistryIndex(api);
+
+    lua_pushstring_dll(api, L, "decoda_registeredclassnames");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+
+        lua_pop_dll(api, L, 1);
+        lua_newtable_dll(api, L);
+
+        // Use weak keys so that we don't prevent the metatables from being collected.
+        lua_newtable_dll(api, L);
+        lua_pushstring_dll(api, L, "__mode");
+        lua_pushstring_dll(api, L, "k");
+        lua_rawset_dll(api, L, -3);
+        lua_setmetatable_dll(api, L, -2);
+
+        lua_pushstring_dll(api, L, "decoda_registeredclassnames");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+
+    }
+
+}
+
 bool DebugBackend::GetClassNameForMetatable(unsigned long api, lua_State* L, int mt) const
 {
     
-    if (!lua_checkstack_dll(api, L, 2))
+    if (!lua_checkstack_dll(api, L, 6))
     {
         return false;
     }
@@ -2704,49 +4953,96 @@ bool DebugBackend::GetClassNameForMetatable(unsigned long api, lua_State* L, int
 
     mt = lua_absindex_dll(api, L, mt);
 
-    // Iterate over global table (can't do it with the globals pseudo index since it doesn't exist in Lua 5.2)
-    lua_pushglobaltable_dll(api, L);
+    PushClassNameTable(api, L);
+    int classNames = lua_gettop_dll(api, L);
+
+    lua_pushvalue_dll(api, L, mt);
+    lua_rawget_dll(api, L, classNames);
+
+    // When the metatable wasn't in a global variable the last time we scanned, we
+    // store the globals generation at the time. Scan again if the globals may have
+    // changed since then.
+    bool scan = lua_isnil_dll(api, L, -1) ||
+        (lua_type_dll(api, L, -1) == LUA_TNUMBER && static_cast<unsigned int>(lua_tointeger_dll(api, L, -1)) != m_globalsGeneration);
+
+    if (scan)
+    {
+
+        lua_pop_dll(api, L, 1);
+
+        // Scan the global table in case the metatable was stored in a global
+        // variable since the last scan.
+        // Record every table stored in a global variable under the name of the
+        // variable. This can't be done with the globals pseudo index since it
+        // doesn't exist in Lua 5.2.
+
+        lua_pushglobaltable_dll(api, L);
+        int globals = lua_gettop_dll(api, L);
+
+        // First key.
+        lua_pushnil_dll(api, L);
+
+        while (lua_next_dll(api, L, globals) != 0)
+        {
+
+            if (lua_type_dll(api, L, -1) == LUA_TTABLE &&
+                lua_type_dll(api, L, -2) == LUA_TSTRING)
+            {
+                lua_pushvalue_dll(api, L, -1);
+                lua_pushvalue_dll(api, L, -3);
+                lua_rawset_dll(api, L, classNames);
+            }
+
+            // Leave the key on the stack for the next call to lua_next.
+            lua_pop_dll(api, L, 1);
+        
+        }    
+
+        // Pop global table
+        lua_pop_dll(api, L, 1);
+
+        lua_pushvalue_dll(api, L, mt);
+        lua_rawget_dll(api, L, classNames);
+
+        if (lua_isnil_dll(api, L, -1))
+        {
+            // Remember that the metatable isn't in a global variable so that
+            // we don't scan again until the globals may have changed.
+            lua_pushvalue_dll(api, L, mt);
+            lua_pushinteger_dll(api, L, m_globalsGeneration);
+            lua_rawset_dll(api, L, classNames);
+        }
 
-    // First key.
-    lua_pushnil_dll(api, L);
+    }
 
-    while (lua_next_dll(api, L, t1+1) != 0)
+    if (lua_type_dll(api, L, -1) != LUA_TSTRING)
     {
 
-        if (lua_type_dll(api, L, -1) == LUA_TTABLE &&
-            lua_type_dll(api, L, -2) == LUA_TSTRING)
-        {
+        // Global variable names take precedence, so only use the name from
+        // luaL_newmetatable if the metatable isn't stored in one.
 
-            const char* className = lua_tostring_dll(api, L, -2);
+        lua_pop_dll(api, L, 1);
+        PushRegisteredClassNameTable(api, L);
 
-            if (lua_rawequal_dll(api, L, -1, mt))
-            {
+        lua_pushvalue_dll(api, L, mt);
+        lua_rawget_dll(api, L, -2);
+        lua_remove_dll(api, L, -2);
 
-                // Remove the value (the metatable) from the stack and just leave
-                // the key (the class name).
-                lua_pop_dll(api, L, 1);
-                // Remove the global table too
-                lua_remove_dll( api, L, -2);
-                int t2 = lua_gettop_dll(api, L);
-                assert(t2 - t1 == 1);
+    }
 
-                return true;
-            
-            }
-        }
+    // Remove the class name table and just leave the class name.
+    lua_remove_dll(api, L, classNames);
 
-        // Leave the key on the stack for the next call to lua_next.
+    if (lua_type_dll(api, L, -1) != LUA_TSTRING)
+    {
         lua_pop_dll(api, L, 1);
-    
-    }    
-
-    // Pop global table
-    lua_pop_dll( api, L, 1);
+        return false;
+    }
 
     int t2 = lua_gettop_dll(api, L);
-    assert(t1 == t2);
+    assert(t2 - t1 == 1);
 
-    return false;
+    return true;
 
 }
 
@@ -2758,54 +5054,43 @@ const char* DebugBackend::GetClassNameForUserdata(unsigned long api, lua_State*
         return NULL;
     }
 
-    bool result = false;
+    const char* className = NULL;
 
     if (lua_getmetatable_dll(api, L, ud))
     {
 
-        std::list<ClassInfo>::const_iterator iterator = m_classInfos.begin();
-
-        while (iterator != m_classInfos.end())
+        if (GetClassNameForMetatable(api, L, -1))
         {
-            if (iterator->L == L)
-            {
-
-                lua_rawgeti_dll(api, L, GetRegistryIndex(api), iterator->metaTableRef);
-
-                if (lua_rawequal_dll(api, L, -1, -2))
-                {
-                    lua_pop_dll(api, L, 2);
-                    return iterator->name.c_str();
-                }
-        
-                lua_pop_dll(api, L, 1);
-
-            }
-            ++iterator;
+            // The string is still referenced by the class name table after we pop it.
+            className = lua_tostring_dll(api, L, -1);
+            lua_pop_dll(api, L, 1);
         }
 
         lua_pop_dll(api, L, 1);
 
     }
 
-    return NULL;
+    return className;
 
 }
 
 void DebugBackend::RegisterClassName(unsigned long api, lua_State* L, const char* name, int metaTable)
 {
 
-    CriticalSectionLock lock(m_criticalSection);
+    if (!lua_checkstack_dll(api, L, 4))
+    {
+        return;
+    }
 
-    ClassInfo classInfo;
+    metaTable = lua_absindex_dll(api, L, metaTable);
 
-    classInfo.L             = L;
-    classInfo.name          = name;
+    PushRegisteredClassNameTable(api, L);
 
     lua_pushvalue_dll(api, L, metaTable);
-    classInfo.metaTableRef  = luaL_ref_dll(api, L, GetRegistryIndex(api));
+    lua_pushstring_dll(api, L, name);
+    lua_rawset_dll(api, L, -3);
 
-    m_classInfos.push_back(classInfo);
+    lua_pop_dll(api, L, 1);
 
 }
 
@@ -2867,15 +5152,7 @@ std::string DebugBackend::GetASTCiString(const void* buffer, size_t length, bool
         return "";
     }
 
-    bool hasEmbeddedZeros = force;
-
-    for (size_t i = 0; i < length && !hasEmbeddedZeros; ++i)
-    {
-        if (string[i] == 0)
-        {
-            hasEmbeddedZeros = true;
-        }
-    }
+    bool hasEmbeddedZeros = force || memchr(string, 0, length) != NULL;
 
     if (!hasEmbeddedZeros)
     {
@@ -2942,141 +5219,370 @@ int DebugBackend::ObjectCollectionCallback(lua_State* L)
         return 0;
     }
 
-    unsigned long api = DebugBackend::Get().GetApiForVm(L);
+    unsigned long api = DebugBackend::Get().GetApiForVm(L);
+
+    int tableIndex    = lua_upvalueindex_dll(api, 1);
+    int callbackIndex = lua_upvalueindex_dll(api, 2);
+
+    // Check if the object is still around or if it has been collected.
+    lua_pushstring_dll(api, L, "object");
+    lua_rawget_dll(api, L, tableIndex);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+        // The object has been collected, so call the callback.
+        lua_pushvalue_dll(api, L, callbackIndex);
+        lua_call_dll(api, L, 0, 0);
+    }
+    else
+    {
+        
+        // Recreate the sentinel.        
+            
+        lua_pushvalue_dll(api, L, tableIndex);
+        lua_pushvalue_dll(api, L, callbackIndex);
+
+        if (GetIsStdCall(api))
+        {
+            lua_pushcclosure_dll(api, L, (lua_CFunction)(ObjectCollectionCallback_stdcall), 2);
+        }
+        else
+        {
+            lua_pushcclosure_dll(api, L, ObjectCollectionCallback, 2);
+        }
+
+        DebugBackend::Get().CreateGarbageCollectionSentinel(api, L);
+
+    }
+
+    lua_pop_dll(api, L, 1);
+    
+    return 0;
+
+}
+
+int __stdcall DebugBackend::ObjectCollectionCallback_stdcall(lua_State* L)
+{
+    return ObjectCollectionCallback(L);
+}
+
+void DebugBackend::CreateGarbageCollectionSentinel(unsigned long api, lua_State* L)
+{
+
+    int t1 = lua_gettop_dll(api, L);
+
+    int callbackIndex = lua_gettop_dll(api, L);
+
+    // Create a new user data which can associate our garbage collection callback.
+    lua_newuserdata_dll(api, L, 4);
+    int userDataIndex = lua_gettop_dll(api, L);
+
+    lua_newtable_dll(api, L);
+    int metaTableIndex = lua_gettop_dll(api, L);
+
+    lua_pushstring_dll(api, L, "__gc");
+    lua_pushvalue_dll(api, L, callbackIndex);
+    lua_settable_dll(api, L, metaTableIndex);
+    
+    lua_setmetatable_dll(api, L, userDataIndex);
+
+    // Remove the user data from the stack. It will be collected when the garbage
+    // collector runs. We also remove the callback.
+    lua_pop_dll(api, L, 2);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 - t2 == 1);
+
+}
+
+void DebugBackend::SetGarbageCollectionCallback(unsigned long api, lua_State* L, int index)
+{
+
+    int t1 = lua_gettop_dll(api, L);
+
+    index = lua_absindex_dll(api, L, index);
+    int callbackIndex = lua_gettop_dll(api, L);
+
+    // Create a new weak table to store the object in, which allows us to detect
+    // if it's been collected or not.
+    CreateWeakTable(api, L, "v");
+    int tableIndex = lua_gettop_dll(api, L);
+
+    // Store the object in a field called "object".
+    lua_pushstring_dll(api, L, "object");
+    lua_pushvalue_dll(api, L, index);
+    lua_rawset_dll(api, L, tableIndex);
+
+    lua_pushvalue_dll(api, L, callbackIndex);
+
+    if (GetIsStdCall(api))
+    {
+        lua_pushcclosure_dll(api, L, (lua_CFunction)(ObjectCollectionCallback_stdcall), 2);
+    }
+    else
+    {
+        lua_pushcclosure_dll(api, L, ObjectCollectionCallback, 2);
+    }
+        
+    CreateGarbageCollectionSentinel(api, L);
+
+    // Pop the callback.
+    lua_pop_dll(api, L, 1);
+
+    int t2 = lua_gettop_dll(api, L);
+    assert(t1 - t2 == 1);
+
+}
+
+int DebugBackend::ThreadEndCallback(lua_State* L)
+{
+
+    unsigned long api = DebugBackend::Get().GetApiForVm(L);
+    lua_State* thread = static_cast<lua_State*>(lua_touserdata_dll(api, L, lua_upvalueindex_dll(api, 1)));
+
+    if (thread != L)
+    {
+        // This is actually a thread and not the main thread (which for some
+        // reason gets garbage collected immediately)
+        DebugBackend::Get().DetachState(api, thread);
+    }
+
+    return 0;
+
+}
+
+int __stdcall DebugBackend::ThreadEndCallback_stdcall(lua_State* L)
+{
+    return ThreadEndCallback(L);
+}
+
+void DebugBackend::PushThreadTable(unsigned long api, lua_State* L)
+{
+
+    int registry = GetRegistryIndex(api);
+
+    lua_pushstring_dll(api, L, "decoda_threads");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+
+        lua_pop_dll(api, L, 1);
+        CreateWeakTable(api, L, "k");
+
+        lua_pushstring_dll(api, L, "decoda_threads");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+
+    }
+
+}
+
+void DebugBackend::PushChunkTable(unsigned long api, lua_State* L)
+{
+
+    int registry = GetRegistryIndex(api);
+
+    lua_pushstring_dll(api, L, "decoda_chunks");
+    lua_rawget_dll(api, L, registry);
+
+    if (lua_isnil_dll(api, L, -1))
+    {
+
+        lua_pop_dll(api, L, 1);
+        CreateWeakTable(api, L, "k");
+
+        lua_pushstring_dll(api, L, "decoda_chunks");
+        lua_pushvalue_dll(api, L, -2);
+        lua_rawset_dll(api, L, registry);
+
+    }
+
+}
+
+void DebugBackend::CreateSweepSentinel(unsigned long api, lua_State* L, lua_State* mainL)
+{
+
+    lua_pushlightuserdata_dll(api, L, mainL);
+
+    if (GetIsStdCall(api))
+    {
+        lua_pushcclosure_dll(api, L, (lua_CFunction)(SweepCallback_stdcall), 1);
+    }
+    else
+    {
+        lua_pushcclosure_dll(api, L, SweepCallback, 1);
+    }
+
+    CreateGarbageCollectionSentinel(api, L);
+
+}
+
+bool DebugBackend::Sweep(unsigned long api, lua_State* L, lua_State* mainL)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(mainL);
+
+    if (stateIterator == m_stateToVm.end())
+    {
+        return false;
+    }
+
+    VirtualMachine* mainVm = stateIterator->second;
+
+    if (mainVm->threads.empty() && mainVm->numChunks == 0)
+    {
+        // Stop sweeping until another thread is created or chunk is loaded.
+        mainVm->sweeping = false;
+        return false;
+    }
+
+    if (!lua_checkstack_dll(api, L, 4))
+    {
+        return true;
+    }
+
+    // Collected objects have been cleared from the weak tables by the time the
+    // finalizers run, so anything we don't find in them is gone.
+
+    if (!mainVm->threads.empty())
+    {
+        SweepThreads(api, L, mainVm);
+    }
+
+    if (mainVm->numChunks > 0)
+    {
+        SweepChunks(api, L, mainVm);
+    }
+
+    return true;
+
+}
 
-    int tableIndex    = lua_upvalueindex_dll(api, 1);
-    int callbackIndex = lua_upvalueindex_dll(api, 2);
+void DebugBackend::SweepThreads(unsigned long api, lua_State* L, VirtualMachine* mainVm)
+{
 
-    // Check if the object is still around or if it has been collected.
-    lua_pushstring_dll(api, L, "object");
-    lua_rawget_dll(api, L, tableIndex);
+    ++mainVm->sweep;
 
-    if (lua_isnil_dll(api, L, -1))
-    {
-        // The object has been collected, so call the callback.
-        lua_pushvalue_dll(api, L, callbackIndex);
-        lua_call_dll(api, L, 0, 0);
-    }
-    else
+    PushThreadTable(api, L);
+    int tableIndex = lua_gettop_dll(api, L);
+
+    lua_pushnil_dll(api, L);
+
+    while (lua_next_dll(api, L, tableIndex))
     {
-        
-        // Recreate the sentinel.        
-            
-        lua_pushvalue_dll(api, L, tableIndex);
-        lua_pushvalue_dll(api, L, callbackIndex);
 
-        if (GetIsStdCall(api))
-        {
-            lua_pushcclosure_dll(api, L, (lua_CFunction)(ObjectCollectionCallback_stdcall), 2);
-        }
-        else
+        lua_State* thread = static_cast<lua_State*>(lua_touserdata_dll(api, L, -1));
+        StateToVmMap::iterator iterator = m_stateToVm.find(thread);
+
+        if (iterator != m_stateToVm.end() && iterator->second->mainVm == mainVm)
         {
-            lua_pushcclosure_dll(api, L, ObjectCollectionCallback, 2);
+            iterator->second->sweep = mainVm->sweep;
         }
 
-        DebugBackend::Get().CreateGarbageCollectionSentinel(api, L);
+        lua_pop_dll(api, L, 1);
 
     }
 
     lua_pop_dll(api, L, 1);
-    
-    return 0;
 
-}
+    // Removing a thread moves the last thread into its place, so walk backwards.
+
+    for (unsigned int i = mainVm->threads.size(); i > 0; --i)
+    {
+        VirtualMachine* vm = mainVm->threads[i - 1];
+        if (vm->sweep != mainVm->sweep)
+        {
+            RemoveVm(vm);
+        }
+    }
 
-int __stdcall DebugBackend::ObjectCollectionCallback_stdcall(lua_State* L)
-{
-    return ObjectCollectionCallback(L);
 }
 
-void DebugBackend::CreateGarbageCollectionSentinel(unsigned long api, lua_State* L)
+void DebugBackend::SweepChunks(unsigned long api, lua_State* L, VirtualMachine* mainVm)
 {
 
-    int t1 = lua_gettop_dll(api, L);
+    // Count the chunks for each script that are still alive.
 
-    int callbackIndex = lua_gettop_dll(api, L);
+    std::unordered_map<unsigned int, unsigned int> liveChunks;
 
-    // Create a new user data which can associate our garbage collection callback.
-    lua_newuserdata_dll(api, L, 4);
-    int userDataIndex = lua_gettop_dll(api, L);
+    PushChunkTable(api, L);
+    int tableIndex = lua_gettop_dll(api, L);
 
-    lua_newtable_dll(api, L);
-    int metaTableIndex = lua_gettop_dll(api, L);
+    lua_pushnil_dll(api, L);
 
-    lua_pushstring_dll(api, L, "__gc");
-    lua_pushvalue_dll(api, L, callbackIndex);
-    lua_settable_dll(api, L, metaTableIndex);
-    
-    lua_setmetatable_dll(api, L, userDataIndex);
+    while (lua_next_dll(api, L, tableIndex))
+    {
+        ++liveChunks[lua_tointeger_dll(api, L, -1)];
+        lua_pop_dll(api, L, 1);
+    }
 
-    // Remove the user data from the stack. It will be collected when the garbage
-    // collector runs. We also remove the callback.
-    lua_pop_dll(api, L, 2);
+    lua_pop_dll(api, L, 1);
 
-    int t2 = lua_gettop_dll(api, L);
-    assert(t1 - t2 == 1);
+    std::vector<unsigned int> released;
 
-}
+    for (ScriptRefMap::iterator iterator = mainVm->scriptRefs.begin(); iterator != mainVm->scriptRefs.end(); ++iterator)
+    {
 
-void DebugBackend::SetGarbageCollectionCallback(unsigned long api, lua_State* L, int index)
-{
+        ScriptRef& ref = iterator->second;
 
-    int t1 = lua_gettop_dll(api, L);
+        if (ref.chunks == 0)
+        {
+            continue;
+        }
 
-    index = lua_absindex_dll(api, L, index);
-    int callbackIndex = lua_gettop_dll(api, L);
+        // The table is shared by every state in the Lua instance, so it may hold
+        // more chunks for the script than this state loaded.
+        unsigned int chunks = 0;
+        std::unordered_map<unsigned int, unsigned int>::const_iterator live = liveChunks.find(iterator->first);
 
-    // Create a new weak table to store the object in, which allows us to detect
-    // if it's been collected or not.
-    CreateWeakTable(api, L, "v");
-    int tableIndex = lua_gettop_dll(api, L);
+        if (live != liveChunks.end())
+        {
+            chunks = std::min(live->second, ref.chunks);
+        }
 
-    // Store the object in a field called "object".
-    lua_pushstring_dll(api, L, "object");
-    lua_pushvalue_dll(api, L, index);
-    lua_rawset_dll(api, L, tableIndex);
+        mainVm->numChunks -= ref.chunks - chunks;
+        ref.chunks = chunks;
 
-    lua_pushvalue_dll(api, L, callbackIndex);
+        if (ref.chunks == 0 && !ref.pinned)
+        {
+            released.push_back(iterator->first);
+        }
 
-    if (GetIsStdCall(api))
-    {
-        lua_pushcclosure_dll(api, L, (lua_CFunction)(ObjectCollectionCallback_stdcall), 2);
     }
-    else
+
+    for (unsigned int i = 0; i < released.size(); ++i)
     {
-        lua_pushcclosure_dll(api, L, ObjectCollectionCallback, 2);
+        ReleaseScript(mainVm, released[i]);
     }
-        
-    CreateGarbageCollectionSentinel(api, L);
-
-    // Pop the callback.
-    lua_pop_dll(api, L, 1);
-
-    int t2 = lua_gettop_dll(api, L);
-    assert(t1 - t2 == 1);
 
 }
 
-int DebugBackend::ThreadEndCallback(lua_State* L)
+int DebugBackend::SweepCallback(lua_State* L)
 {
 
+    if (!DebugBackend::Get().GetIsAttached())
+    {
+        return 0;
+    }
+
     unsigned long api = DebugBackend::Get().GetApiForVm(L);
-    lua_State* thread = static_cast<lua_State*>(lua_touserdata_dll(api, L, lua_upvalueindex_dll(api, 1)));
+    lua_State* mainL = static_cast<lua_State*>(lua_touserdata_dll(api, L, lua_upvalueindex_dll(api, 1)));
 
-    if (thread != L)
+    if (DebugBackend::Get().Sweep(api, L, mainL))
     {
-        // This is actually a thread and not the main thread (which for some
-        // reason gets garbage collected immediately)
-        DebugBackend::Get().DetachState(api, thread);
+        DebugBackend::Get().CreateSweepSentinel(api, L, mainL);
     }
 
     return 0;
 
 }
 
-int __stdcall DebugBackend::ThreadEndCallback_stdcall(lua_State* L)
+int __stdcall DebugBackend::SweepCallback_stdcall(lua_State* L)
 {
-    return ThreadEndCallback(L);
+    return SweepCallback(L);
 }
 
 void DebugBackend::GetFileTitle(const char* name, std::string& title) const
@@ -3099,6 +5605,106 @@ void DebugBackend::GetFileTitle(const char* name, std::string& title) const
 
 }
 
+void DebugBackend::GetFilePath(const char* name, std::string& path) const
+{
+
+    if (name[0] == '@')
+    {
+        ++name;
+    }
+
+    path.clear();
+
+    while (name[0] != 0)
+    {
+
+        // Skip references to the current directory so that "./a.lua" and "a.lua"
+        // are the same path.
+        if (name[0] == '.' && (name[1] == '/' || name[1] == '\\') && (path.empty() || path[path.length() - 1] == '/'))
+        {
+            name += 2;
+            continue;
+        }
+
+        char c = name[0];
+
+        if (c == '\\')
+        {
+            c = '/';
+        }
+
+        path += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        ++name;
+
+    }
+
+}
+
+void DebugBackend::SetFileBreakpoints(const std::string& fileName, bool wait, const std::vector<FileBreakpoint>& breakpoints)
+{
+
+    CriticalSectionLock lock(m_criticalSection);
+
+    if (breakpoints.empty() && !wait)
+    {
+        m_fileBreakpoints.erase(fileName);
+        return;
+    }
+
+    FileBreakpoints& fileBreakpoints = m_fileBreakpoints[fileName];
+    fileBreakpoints.wait        = wait;
+    fileBreakpoints.breakpoints = breakpoints;
+
+}
+
+DebugBackend::FileBreakpointMap::const_iterator DebugBackend::FindFileBreakpoints(const std::string& fileName) const
+{
+
+    // The frontend may know the file by its full path while the script was loaded
+    // with a relative name (or the other way around), so find the file that matches
+    // the most of the name.
+
+    FileBreakpointMap::const_iterator bestMatch = m_fileBreakpoints.end();
+    size_t bestMatchLength = 0;
+
+    for (FileBreakpointMap::const_iterator iterator = m_fileBreakpoints.begin(); iterator != m_fileBreakpoints.end(); ++iterator)
+    {
+        size_t matchLength = GetFileNameMatchLength(iterator->first, fileName);
+        if (matchLength > bestMatchLength)
+        {
+            bestMatch       = iterator;
+            bestMatchLength = matchLength;
+        }
+    }
+
+    return bestMatch;
+
+}
+
+void DebugBackend::ApplyFileBreakpoints(lua_State* L, Script* script, const FileBreakpoints& fileBreakpoints)
+{
+
+    for (unsigned int i = 0; i < fileBreakpoints.breakpoints.size(); ++i)
+    {
+
+        const FileBreakpoint& breakpoint = fileBreakpoints.breakpoints[i];
+
+        // Set the condition first so that we never stop on the breakpoint unconditionally.
+        if (!breakpoint.condition.empty() || !breakpoint.hitCondition.empty() || !breakpoint.logMessage.empty())
+        {
+            SetBreakpointCondition(script->index, breakpoint.line, breakpoint.condition, breakpoint.hitCondition, breakpoint.logMessage);
+        }
+
+        // This sends the frontend the same event as if it had toggled the breakpoint.
+        if (!script->GetHasBreakPoint(breakpoint.line))
+        {
+            ToggleBreakpoint(L, script->index, breakpoint.line);
+        }
+
+    }
+
+}
+
 bool DebugBackend::EnableJit(unsigned long api, lua_State* L, bool enable)
 {
 
@@ -3160,7 +5766,6 @@ unsigned int DebugBackend::GetCStack(HANDLE hThread, StackEntry stack[], unsigne
 {
 
     const unsigned int maxNameLength = 256;
-    const unsigned int maxStackFrames = 64; 
 
     IMAGEHLP_SYMBOL64* symbol = static_cast<IMAGEHLP_SYMBOL64*>(alloca(sizeof(IMAGEHLP_SYMBOL64) + maxNameLength));
     
@@ -3175,32 +5780,54 @@ unsigned int DebugBackend::GetCStack(HANDLE hThread, StackEntry stack[], unsigne
     for (unsigned int i = 0; i < numStackFrames; ++i)
     {
 
-        IMAGEHLP_MODULE64 module;
-        module.SizeOfStruct = sizeof(module);
+        DWORD64 address = stackFrame[i].AddrPC.Offset;
 
-        if (SymGetModuleInfo64_dll(hProcess, stackFrame[i].AddrPC.Offset, &module))
-        {
-            strcpy(stack[i].module, module.ModuleName);
-        }
-        else
-        {
-            stack[i].module[0] = 0;
-        }
-        
+        stack[i].address     = reinterpret_cast<void*>(address);
         stack[i].scriptIndex = -1;
         stack[i].line        = 0;
+        stack[i].stackLevel  = -1;
 
-        // Try to get the symbol name from the address.
+        // Repeated breaks usually happen in the same code, so remember the names
+        // we've looked up for each address.
 
-        if (SymGetSymFromAddr64_dll(hProcess, stackFrame[i].AddrPC.Offset, NULL, symbol))
-        {
-            sprintf(stack[i].name, "%s", symbol->Name);
-        }
-        else
+        SymbolCache::const_iterator iterator = m_symbolCache.find(address);
+
+        if (iterator == m_symbolCache.end())
         {
-            sprintf(stack[i].name, "0x%x", stackFrame[i].AddrPC.Offset);
+
+            NativeSymbol nativeSymbol;
+
+            IMAGEHLP_MODULE64 module;
+            module.SizeOfStruct = sizeof(module);
+
+            if (SymGetModuleInfo64_dll(hProcess, address, &module))
+            {
+                nativeSymbol.module = module.ModuleName;
+            }
+
+            // Try to get the symbol name from the address.
+
+            if (SymGetSymFromAddr64_dll(hProcess, address, NULL, symbol))
+            {
+                nativeSymbol.name = symbol->Name;
+            }
+            else
+            {
+                char buffer[32];
+                sprintf(buffer, "0x%llx", address);
+                nativeSymbol.name = buffer;
+            }
+
+            iterator = m_symbolCache.insert(std::make_pair(address, nativeSymbol)).first;
+
         }
 
+        strncpy(stack[i].module, iterator->second.module.c_str(), s_maxModuleNameLength - 1);
+        stack[i].module[s_maxModuleNameLength - 1] = 0;
+
+        strncpy(stack[i].name, iterator->second.name.c_str(), s_maxEntryNameLength - 1);
+        stack[i].name[s_maxEntryNameLength - 1] = 0;
+
     }
 
     return numStackFrames;
@@ -3222,6 +5849,35 @@ int DebugBackend::GetStackDepth(unsigned long api, lua_State* L) const
 
 }
 
+DebugBackend::VirtualMachine* DebugBackend::GetMainVm(lua_State* L)
+{
+
+    StateToVmMap::iterator stateIterator = m_stateToVm.find(L);
+
+    if (stateIterator == m_stateToVm.end())
+    {
+        return NULL;
+    }
+
+    VirtualMachine* vm = stateIterator->second;
+    return vm->mainVm != NULL ? vm->mainVm : vm;
+
+}
+
+DebugBackend::Script* DebugBackend::GetScript(unsigned int scriptIndex) const
+{
+
+    ScriptMap::const_iterator iterator = m_scripts.find(scriptIndex);
+
+    if (iterator == m_scripts.end())
+    {
+        return NULL;
+    }
+
+    return iterator->second;
+
+}
+
 DebugBackend::VirtualMachine* DebugBackend::GetVm(lua_State* L)
 {
 
@@ -3238,6 +5894,44 @@ DebugBackend::VirtualMachine* DebugBackend::GetVm(lua_State* L)
 
 }
 
+void DebugBackend::GetScriptStackEntry(unsigned long api, const lua_Debug* ar, unsigned int stackLevel, StackEntry& entry)
+{
+
+    const char* function = GetName(api, ar);
+    const char* arwhat = GetWhat(api, ar);
+
+    if (function == NULL || function[0] == '\0')
+    {
+        if (arwhat != NULL)
+        {
+            function = arwhat;
+        }
+        else
+        {
+            function = "<Unknown>";
+        }
+    }
+
+    entry.module[0]  = 0;
+    entry.address    = NULL;
+    entry.stackLevel = stackLevel;
+
+    if (arwhat != NULL && strcmp(arwhat, "C") == 0)
+    {
+        entry.scriptIndex = -1;
+        entry.line        = 0;
+    }
+    else
+    {
+        entry.scriptIndex = GetScriptIndex(GetSource(api, ar));
+        entry.line        = GetCurrentLine(api, ar) - 1;
+    }
+
+    strncpy(entry.name, function, s_maxEntryNameLength - 1);
+    entry.name[s_maxEntryNameLength - 1] = 0;
+
+}
+
 unsigned int DebugBackend::GetUnifiedStack(unsigned long api, const StackEntry nativeStack[], unsigned int nativeStackSize, const lua_Debug scriptStack[], unsigned int scriptStackSize, StackEntry stack[])
 {
 
@@ -3269,34 +5963,22 @@ unsigned int DebugBackend::GetUnifiedStack(unsigned long api, const StackEntry n
             --nativePos;
         }
 
-        // Walk up the script stack until we hit a transition into C.
+        // Walk up the script stack until we hit a transition into C. Without the
+        // native frames the C functions are kept so that the stack has an entry
+        // for each level.
         while (scriptPos >= 0 && stackSize < s_maxStackSize)
         {
+
             const lua_Debug* ar = &scriptStack[scriptPos];
-            const char* function = GetName(api, ar);
             const char* arwhat = GetWhat(api, ar);
-            if (function == NULL || function[0] == '\0')
-            {
-                if (arwhat != NULL)
-                {
-                    function = arwhat;
-                }
-                else
-                {
-                    function = "<Unknown>";
-                }
-            }
 
-            if (arwhat != NULL && strcmp(arwhat, "C") == 0)
+            if (nativeStackSize > 0 && arwhat != NULL && strcmp(arwhat, "C") == 0)
             {
                 --scriptPos;
                 break;
             }
 
-            stack[stackSize].scriptIndex = GetScriptIndex(GetSource(api, ar));
-            stack[stackSize].line        = GetCurrentLine(api, ar) - 1;
-            
-            strncpy(stack[stackSize].name, function, s_maxEntryNameLength);
+            GetScriptStackEntry(api, ar, scriptPos, stack[stackSize]);
             
             ++stackSize;
             --scriptPos;
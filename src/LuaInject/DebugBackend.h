@@ -27,6 +27,7 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #include "Protocol.h"
 #include "CriticalSection.h"
 #include "LuaDll.h"
+#include "LineBitmap.h"
 
 #include <vector>
 #include <string>
@@ -39,6 +40,9 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 //
 
 class TiXmlNode;
+class ValueWriter;
+class XmlValueWriter;
+class BinaryValueWriter;
 
 /**
  * This class encapsulates the part of the debugger that runs inside the
@@ -77,6 +81,13 @@ public:
      * Attaches the debugger to the state.
      */
     VirtualMachine* AttachState(unsigned long api, lua_State* L);
+
+    /**
+     * Attaches the debugger to a thread created from the state L. The thread must
+     * be on the top of L's stack. Threads are tracked as children of the main state
+     * and are only announced to the frontend if they stop in the debugger.
+     */
+    VirtualMachine* AttachThread(unsigned long api, lua_State* L, lua_State* thread);
     
     void VMInitialize(unsigned long api, lua_State* L, VirtualMachine* vm);
 
@@ -93,12 +104,15 @@ public:
 
     /**
      * Registers a script with the backend. This will tell track this source file
-     * and send notification to the front end about it. If the script is already
-     * loaded the method returns -1. The unavailable flag specifies that the code
-     * was not available for the script. This should be set if the script was encountered
-     * through a call other than the load function.
+     * and send notification to the front end about it. The method returns true if
+     * the caller must wait for the frontend to process the script before running it,
+     * which never happens if the script is already loaded. The unavailable flag
+     * specifies that the code was not available for the script. This should be set
+     * if the script was encountered through a call other than the load function. If
+     * scriptIndex is specified it's set to the index of the script the source was
+     * matched to, even if the script was already loaded.
      */
-    int RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable);
+    bool RegisterScript(lua_State* L, const char* source, size_t size, const char* name, bool unavailable, unsigned int* scriptIndex = NULL);
 
     int RegisterScript(unsigned long api, lua_State* L, lua_Debug* ar);
 
@@ -114,6 +128,12 @@ public:
      */
     void StepOver();
 
+    /**
+     * Steps execution of a "broken" script until the current function returns to
+     * its caller.
+     */
+    void StepOut();
+
     /**
      * Continues execution until a breakpoint is hit.
      */
@@ -131,7 +151,31 @@ public:
      * Evalates the expression. If there was an error evaluating the expression the
      * method returns false and the error message is stored in the result.
      */
-    bool Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, std::string& result);
+    bool Evaluate(unsigned long api, lua_State* L, const std::string& expression, int stackLevel, int maxDepth, std::string& result);
+
+    /**
+     * Evaluates a list of expressions in the same environment. The environment
+     * is only built once, so this is cheaper than evaluating the expressions one
+     * at a time. If the environment couldn't be created the method returns false,
+     * otherwise the result and success of each expression are stored in results
+     * and succeeded.
+     */
+    bool EvaluateBatch(unsigned long api, lua_State* L, const std::vector<std::string>& expressions, int stackLevel, int maxDepth, std::vector<std::string>& results, std::vector<bool>& succeeded);
+
+    /**
+     * Gets a range of the elements of the table identified by the handle as XML.
+     * Tables nested inside the elements are not expanded, but are given their own
+     * handles so that they can be expanded later. If count is 0, all of the
+     * elements starting at start are returned.
+     */
+    bool ExpandValue(unsigned long api, lua_State* L, unsigned int handle, unsigned int start, unsigned int count, std::string& result);
+
+    /**
+     * Gets a range of the bytes of the string identified by the handle. Strings
+     * longer than the maximum string length are only sent as a preview when they
+     * are evaluated, so this is used to get the rest of the string.
+     */
+    bool GetStringRange(unsigned long api, lua_State* L, unsigned int handle, unsigned int start, unsigned int count, std::string& result);
 
     /**
      * Evalates the expression. If there was an error evaluating the expression the
@@ -166,6 +210,17 @@ public:
     void SetHaveActiveBreakpoints(bool breakpointsActive);
 
     void DeleteAllBreakpoints();
+
+    /**
+     * Sets the condition, hit condition and log message for a breakpoint. When the
+     * breakpoint is hit the condition is evaluated inside the VM and execution only
+     * stops if it's true and the hit condition is met. If a log message is set, the
+     * message is output instead of stopping. Passing empty strings for all three
+     * removes the condition from the breakpoint.
+     */
+    void SetBreakpointCondition(unsigned int scriptIndex, unsigned int line, const std::string& condition,
+        const std::string& hitCondition, const std::string& logMessage);
+
     /**
      * Calls the function on the top of the stack in a protected environment that
      * triggers a debugger exception on error.
@@ -179,17 +234,20 @@ public:
      */
     int GetScriptIndex(const char* name) const;
 
-    bool StackHasBreakpoint(unsigned long api, lua_State* L);
+    bool StackHasBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm);
 
     /**
-     * Returns the class name associated with the metatable index. This makes
-     * a few assumptions, namely that the metatable was associated with a global
-     * variable which is the class name (i.e. what luaL_newmetatable does).
+     * Returns the class name associated with the metatable index. The name is the
+     * global variable the metatable is stored in, found by scanning the global table
+     * the first time the metatable is looked up (and again if it wasn't found and the
+     * globals may have changed since), or else the name it was registered with through
+     * luaL_newmetatable. If the name is found it is left on the stack.
      */
     bool GetClassNameForMetatable(unsigned long api, lua_State* L, int mt) const;
 
     /**
-     * Pushes onto the stack the class name for a userdata.
+     * Returns the class name for a userdata. The string is owned by the class
+     * name table in the registry and is valid as long as the userdata's metatable.
      */
     const char* GetClassNameForUserdata(unsigned long api, lua_State* L, int ud) const;
 
@@ -199,6 +257,12 @@ public:
      */
     void RegisterClassName(unsigned long api, lua_State* L, const char* name, int metaTable);
 
+    /**
+     * Sets the name of the VM for the state and notifies the front end if the
+     * name has changed. This is called by decoda_setname.
+     */
+    void SetVmName(lua_State* L, const char* name);
+
     /**
      * Sends a text message to the front end.
      */
@@ -234,9 +298,33 @@ public:
 
 private:
 
+    enum HitMode
+    {
+        HitMode_None,                   // Hit count is not checked.
+        HitMode_Equal,
+        HitMode_Greater,
+        HitMode_GreaterEqual,
+        HitMode_Less,
+        HitMode_LessEqual,
+        HitMode_Multiple,               // Stops every hitTarget hits.
+    };
+
+    struct BreakpointCondition
+    {
+        unsigned int    id;             // Unique id, changes whenever the condition is changed.
+        std::string     condition;      // Expression that must be true to stop (may be empty).
+        std::string     logMessage;     // Message with {expression} parts to output instead of stopping.
+        HitMode         hitMode;
+        unsigned int    hitTarget;
+        volatile LONG   hitCount;       // Number of times the condition has been true.
+    };
+
     struct Script
     {
 
+        Script();
+        ~Script();
+
         /**
          * Returns true if there is a break point on the specified line
          * of the script.
@@ -247,16 +335,58 @@ private:
 
         bool ToggleBreakpoint(unsigned int line);
 
-        bool HasBreakpointsActive();
+        bool HasBreakpointsActive() const;
 
         void ClearBreakpoints();
 
+        /**
+         * Returns the condition for the breakpoint on the line, or NULL if the
+         * breakpoint is unconditional.
+         */
+        const BreakpointCondition* GetBreakpointCondition(unsigned int line) const;
+
+        /**
+         * Sets the condition for the breakpoint on the line. The script takes
+         * ownership of the condition. Passing NULL removes the condition.
+         */
+        void SetBreakpointCondition(unsigned int line, BreakpointCondition* condition);
+
+        unsigned int                index;
+        unsigned int                refCount;       // Number of states that reference the script.
+        bool                        collectable;    // Unloaded once its functions are collected.
         std::string                 name;
-        std::string                 source;
-        std::string                 title;
-        std::vector<unsigned int>   breakpoints;    // Lines that have breakpoints on them.
+        std::vector<std::string>    aliases;        // Other names the script was loaded under.
+        std::string                 hash;           // SHA-256 digest of the source.
+        std::string                 path;           // Normalized file name, see GetFilePath.
         std::vector<unsigned int>   validLines;     // Lines that can have breakpoints on them.
 
+    private:
+
+        /**
+         * The lines that have breakpoints on them and the conditions for them.
+         */
+        struct BreakpointSet
+        {
+            LineBitmap                  lines;
+            std::unordered_map<unsigned int, const BreakpointCondition*> conditions;
+        };
+
+        /**
+         * Returns the current set of breakpoints. The set is immutable once it's
+         * been published so the hook can read it without holding the critical section.
+         */
+        const BreakpointSet* GetBreakpoints() const;
+
+        /**
+         * Replaces the current set of breakpoints. The old set is kept around until
+         * the script is destroyed since a hook on another thread may still be reading it.
+         */
+        void PublishBreakpoints(BreakpointSet* breakpoints);
+
+        const BreakpointSet* volatile       m_breakpoints;  // Lines that have breakpoints on them.
+        std::vector<const BreakpointSet*>   m_retired;
+        std::vector<BreakpointCondition*>   m_conditions;   // Conditions owned by the script.
+
     };
 
     struct EvaluateData
@@ -278,9 +408,9 @@ private:
 
     /**
      * Blocks execution until the the debugger is instructed to continue
-     * executing.
+     * executing. Any value handles created while we were stopped are released.
      */
-    void WaitForContinue();
+    void WaitForContinue(unsigned long api, lua_State* L);
 
     /**
      * Entry point into the command handling thread.
@@ -314,7 +444,8 @@ private:
      * Sends a break event to the frontend. The stack will be treated is if it
      * starts at the stackTop entry so that frames on the top of the stack can
      * be skipped. This is usful when the current execution point is an error
-     * handler we defined.
+     * handler we defined. Only the script call stack is sent; the native frames
+     * can be requested separately with CommandId_GetNativeStack.
      */
     void SendBreakEvent(unsigned long api, lua_State* L, int stackTop = 0);
 
@@ -334,19 +465,86 @@ private:
      * Gets the value at location n on the stack as text. If expandTable is true
      * then tables will be returned in their expanded form (i.e. "{ ... }")
      */
-    TiXmlNode* GetValueAsText(unsigned long api, lua_State* L, int n, int maxDepth = 10, const char* typeNameOverride = NULL, bool displayAsKey = false) const;
+    void GetValueAsText(unsigned long api, lua_State* L, int n, ValueWriter& writer, int maxDepth = 10, const char* typeNameOverride = NULL, bool displayAsKey = false) const;
 
     /**
      * Gets the value at location n on the stack as text. If expandTable is true
      * then tables will be returned in their expanded form (i.e. "{ ... }")
      */
-    TiXmlNode* GetLuaBindClassValue(unsigned long api, lua_State* L, unsigned int maxDepth, bool displayAsKey = false) const;
+    bool GetLuaBindClassValue(unsigned long api, lua_State* L, unsigned int maxDepth, ValueWriter& writer, bool displayAsKey = false) const;
 
     /**
      * Gets the table value at location n on the stack as text. Nested tables are
      * not expanded.
      */
-    TiXmlNode* GetTableAsText(unsigned long api, lua_State* L, int t, int maxDepth = 10, const char* typeNameOverride = NULL) const;
+    bool GetTableAsText(unsigned long api, lua_State* L, int t, ValueWriter& writer, int maxDepth = 10, const char* typeNameOverride = NULL) const;
+
+    /**
+     * Gets count elements of the table at location t on the stack as text,
+     * starting with element number start. Nested tables are not expanded.
+     */
+    bool GetTablePageAsText(unsigned long api, lua_State* L, int t, ValueWriter& writer, unsigned int start, unsigned int count) const;
+
+    /**
+     * Pushes the compiled function for the expression onto the stack. Compiled
+     * expressions are cached so that expressions that are evaluated repeatedly
+     * (like watches) are only compiled once. If the expression couldn't be
+     * compiled the error message is pushed and the error code is returned.
+     */
+    int LoadExpression(unsigned long api, lua_State* L, const std::string& expression);
+
+    /**
+     * Gets the number of expressions LoadExpression found in the cache and had to
+     * compile, and the number currently cached, for the state's Lua instance.
+     */
+    void GetExpressionCacheStats(lua_State* L, unsigned int& hits, unsigned int& misses, unsigned int& size);
+
+    /**
+     * Evaluates an expression using the environment table at index envTable on
+     * the stack. If there was an error evaluating the expression the method
+     * returns false and the error message is stored in the result.
+     */
+    bool EvaluateInEnvironment(unsigned long api, lua_State* L, const std::string& expression, int envTable, int maxDepth, std::string& result);
+
+    /**
+     * Returns the writer that values sent to the frontend should be encoded with.
+     * Frontends that haven't negotiated a newer protocol version get XML.
+     */
+    ValueWriter& GetValueWriter(XmlValueWriter& xmlWriter, BinaryValueWriter& binaryWriter) const;
+
+    /**
+     * Returns a handle that identifies the value at location n on the stack until
+     * execution resumes. The value is stored in a table in the registry so that it
+     * isn't collected while the frontend can still refer to it, and the same value
+     * always gets the same handle.
+     */
+    unsigned int GetValueHandle(unsigned long api, lua_State* L, int n) const;
+
+    /**
+     * Pushes the value identified by the handle onto the stack. If the handle isn't
+     * valid, nil is pushed.
+     */
+    void PushValueForHandle(unsigned long api, lua_State* L, unsigned int handle) const;
+
+    /**
+     * Releases all of the values that have been given handles so that they can be
+     * garbage collected.
+     */
+    void ReleaseValueHandles(unsigned long api, lua_State* L) const;
+
+    /**
+     * Pushes the table mapping metatables to the names of the global variables
+     * they're stored in onto the stack, creating it if necessary. The table has
+     * weak keys so that it doesn't keep metatables from being garbage collected.
+     */
+    void PushClassNameTable(unsigned long api, lua_State* L) const;
+
+    /**
+     * Pushes the table mapping metatables to the names they were registered with
+     * through luaL_newmetatable onto the stack, creating it if necessary. Like the
+     * class name table it has weak keys.
+     */
+    void PushRegisteredClassNameTable(unsigned long api, lua_State* L) const;
 
     /**
      * Returns true if the name belongs to a Lua internal variable that we
@@ -376,12 +574,14 @@ private:
 
     static const int s_maxModuleNameLength = 32;
     static const int s_maxEntryNameLength  = 256;
+    static const int s_hookCacheSize       = 8;
 
     enum Mode
     {
         Mode_Continue,
         Mode_StepOver,
         Mode_StepInto,
+        Mode_StepOut,
     };
     
     struct Api
@@ -391,20 +591,79 @@ private:
         lua_CFunction   NewIndexChained;
     };
 
-    struct ClassInfo
+    typedef std::unordered_map<const char*, Script*>        SourceToScriptMap;
+
+    /**
+     * References a main state holds on a script. Scripts compiled from strings are
+     * referenced by the chunks that were loaded until they're garbage collected.
+     * Other scripts are pinned until the state is closed.
+     */
+    struct ScriptRef
     {
-        lua_State*      L;
-        int             metaTableRef;
-        std::string     name;
+        ScriptRef() : chunks(0), pinned(false) { }
+        unsigned int    chunks;             // Loaded chunks that haven't been collected.
+        bool            pinned;
+    };
+
+    typedef std::unordered_map<unsigned int, ScriptRef>     ScriptRefMap;
+
+    /**
+     * Breakpoint registered by the frontend for a file which may not be loaded yet.
+     */
+    struct FileBreakpoint
+    {
+        unsigned int    line;
+        std::string     condition;
+        std::string     hitCondition;
+        std::string     logMessage;
+    };
+
+    struct FileBreakpoints
+    {
+        bool                        wait;       // Wait for the frontend when the file is loaded.
+        std::vector<FileBreakpoint> breakpoints;
+    };
+
+    typedef std::unordered_map<std::string, FileBreakpoints> FileBreakpointMap;
+
+    /**
+     * Breakpoint condition and log message compiled into functions in a VM. The
+     * functions take the locals and up values visible at the breakpoint as
+     * arguments so that they can be called without building an environment.
+     */
+    struct CompiledCondition
+    {
+        CompiledCondition() : id(0), conditionRef(LUA_NOREF), logRef(LUA_NOREF), numLocals(0) { }
+        unsigned int        id;             // Id of the BreakpointCondition these were compiled from.
+        int                 conditionRef;   // Registry reference to the condition function.
+        int                 logRef;         // Registry reference to the log message function.
+        int                 numLocals;      // Number of locals active when compiled.
+        std::vector<int>    arguments;      // Local indices (positive) and up value indices (negative).
+    };
+
+    typedef std::unordered_map<unsigned __int64, CompiledCondition> CompiledConditionMap;
+
+    /**
+     * Tracks the order the compiled expressions stored in the registry were last
+     * used in, so that the least recently used one can be evicted.
+     */
+    struct ExpressionCache
+    {
+        typedef std::unordered_map<std::string, std::list<std::string>::iterator> IndexMap;
+        ExpressionCache() : hits(0), misses(0) { }
+        std::list<std::string>  expressions;    // Most recently used first.
+        IndexMap                index;          // Position of each expression in the list.
+        unsigned int            hits;
+        unsigned int            misses;
     };
 
     struct VirtualMachine
     {
         lua_State*      L;
-        HANDLE          hThread;
         bool            initialized;
-        int             callCount;
+        int             callCount;          // Calls made since stepping, goes negative when stepping out.
         int             callStackDepth;
+        int             stepOutDepth;       // Stack depth when stepping out started (LuaJIT only).
         int             lastStepLine;
         int             lastStepScript;
         unsigned long   api;
@@ -413,7 +672,40 @@ private:
         bool            luaJitWorkAround;
         bool            breakpointInStack;
         bool            haveActiveBreakpoints;
-        std::string     lastFunctions;
+        SourceToScriptMap scripts;      // Only accessed from the hook for this VM.
+        LONG            scriptGeneration;   // Value of m_scriptGeneration when scripts was filled.
+        CompiledConditionMap conditions;    // Keyed by script index and line, only used for main states.
+        LONG            conditionGeneration;    // Value of m_conditionGeneration when conditions was pruned.
+        ExpressionCache expressionCache;    // Only used for main states, accessed from the command thread.
+        unsigned int    vmIndex;            // Position in m_vms.
+        volatile unsigned int serial;       // Unique to each use of the record, 0 once it's removed.
+        bool            announced;          // True once EventId_CreateVM has been sent.
+        VirtualMachine* mainVm;             // State a thread was created from, NULL for main states.
+        unsigned int    threadIndex;        // Position in mainVm->threads.
+        std::vector<VirtualMachine*> threads;   // Threads created from a main state.
+        unsigned int    sweep;              // Current sweep for main states, last sweep a thread was seen alive.
+        bool            sweeping;           // True while a sweep sentinel exists for a main state.
+        ScriptRefMap    scriptRefs;         // Scripts referenced by a main state.
+        unsigned int    numChunks;          // Total chunks referenced in scriptRefs.
+    };
+
+    /**
+     * Per-thread cache of the last few VMs the hook was called for, indexed by
+     * the address of the state. This lets the hook find the VM without taking the
+     * critical section to search m_stateToVm, even when the thread switches
+     * between coroutines. An entry is valid as long as the VM still has the serial
+     * number it had when the entry was stored.
+     */
+    struct HookThreadCache
+    {
+        struct Entry
+        {
+            lua_State*      L;
+            VirtualMachine* vm;
+            unsigned int    serial;
+        };
+        Entry           entries[s_hookCacheSize];
+        LONG            generation;
     };
 
     struct StackEntry
@@ -423,8 +715,20 @@ private:
         void*           address;
         unsigned int    scriptIndex;
         unsigned int    line;
+        unsigned int    stackLevel;     // Level in the script stack, or -1 for native frames.
+    };
+
+    /**
+     * Module and function name for an address in the native call stack.
+     */
+    struct NativeSymbol
+    {
+        std::string     module;
+        std::string     name;
     };
 
+    typedef std::unordered_map<DWORD64, NativeSymbol> SymbolCache;
+
     /**
      * Waits for the specified event or the detached event.
      */
@@ -447,10 +751,42 @@ private:
     /**
      * Creates an environment for the specified level of the stack. This table has all of the locals,
      * up values and globals for the function's scope. If the function is successful, the return
-     * value is true and the table is placed on the stack. Otherwise the function returns false and
-     * nothing is put on the stack.
+     * value is true and the local, up value and environment tables are placed on the stack. Otherwise
+     * the function returns false and nothing is put on the stack. Assignments to locals and up values
+     * through the environment are recorded in the dirty table.
      */
-    bool CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel);
+    bool CreateEnvironment(unsigned long api, lua_State* L, int stackLevel, int nilSentinel, int dirtyTable);
+
+    /**
+     * Pushes the nil sentinel, dirty table, locals, up values and environment for the specified
+     * level of the stack. These are created the first time the frame is accessed and reused until
+     * execution continues, so evaluating many expressions in the same frame only walks the locals
+     * and up values once. If the function fails nothing is put on the stack.
+     */
+    bool PushFrameEnvironment(unsigned long api, lua_State* L, int stackLevel);
+
+    /**
+     * Releases the environments created by PushFrameEnvironment.
+     */
+    void ReleaseFrameEnvironments(unsigned long api, lua_State* L) const;
+
+    /**
+     * Creates the table GetTableAsText uses to record the tables written while
+     * converting the values for one request. The table keeps them alive until
+     * EndVisitedTables is called, so they can be compared by identity.
+     */
+    void BeginVisitedTables(unsigned long api, lua_State* L) const;
+
+    /**
+     * Releases the table created by BeginVisitedTables.
+     */
+    void EndVisitedTables(unsigned long api, lua_State* L) const;
+
+    /**
+     * Returns true if the variable was assigned to through an environment. The table
+     * is 1 for locals and 2 for up values.
+     */
+    bool GetIsDirty(unsigned long api, lua_State* L, int dirtyTable, const char* name, int table) const;
 
     /**
      * Chains two tables together so that accessing members of a child table that don't exist
@@ -461,21 +797,21 @@ private:
     /**
      *
      */
-    void CreateChainedTable(unsigned long api, lua_State* L, int nilSentinel, int localTable, int upValueTable, int globalTable);
+    void CreateChainedTable(unsigned long api, lua_State* L, int nilSentinel, int localTable, int upValueTable, int globalTable, int dirtyTable);
 
     /**
      * Sets the values of the locals at the specified stack level based on values in the table.
      * Values which are equal to the value stored at the nilSentinel stack index will be converted
-     * to nils.
+     * to nils. Only the locals marked in the dirty table are set.
      */
-    void SetLocals(unsigned long api, lua_State* L, int stackLevel, int localTable, int nilSentinel);
+    void SetLocals(unsigned long api, lua_State* L, int stackLevel, int localTable, int dirtyTable, int nilSentinel);
 
     /**
      * Sets the values of the up values at the specified stack level based on values in the table.
      * Values which are equal to the value stored at the nilSentinel stack index will be converted
-     * to nils.
+     * to nils. Only the up values marked in the dirty table are set.
      */
-    void SetUpValues(unsigned long api, lua_State* L, int stackLevel, int upValueTable, int nilSentinel);
+    void SetUpValues(unsigned long api, lua_State* L, int stackLevel, int upValueTable, int dirtyTable, int nilSentinel);
 
     /**
      * Sets the function (on the top of the Lua stack) to be called when a Lua
@@ -504,6 +840,53 @@ private:
      */
     static int __stdcall ThreadEndCallback_stdcall(lua_State* L);
 
+    /**
+     * Pushes the table of threads created from attached states onto the stack,
+     * creating it if necessary. The table maps each thread to its address and has
+     * weak keys so that collected threads drop out of it.
+     */
+    void PushThreadTable(unsigned long api, lua_State* L);
+
+    /**
+     * Pushes the table of chunks loaded into attached states onto the stack,
+     * creating it if necessary. The table maps each chunk to its script index and
+     * has weak keys so that collected chunks drop out of it.
+     */
+    void PushChunkTable(unsigned long api, lua_State* L);
+
+    /**
+     * Creates a garbage collection sentinel which sweeps the threads and chunks of
+     * the main state when it's collected.
+     */
+    void CreateSweepSentinel(unsigned long api, lua_State* L, lua_State* mainL);
+
+    /**
+     * Releases the threads and chunks of the main state which have been garbage
+     * collected. Returns false if the state no longer needs to be swept.
+     */
+    bool Sweep(unsigned long api, lua_State* L, lua_State* mainL);
+
+    /**
+     * Detaches the threads of the main state which are no longer in the thread table.
+     */
+    void SweepThreads(unsigned long api, lua_State* L, VirtualMachine* mainVm);
+
+    /**
+     * Releases the references held by chunks which are no longer in the chunk table.
+     */
+    void SweepChunks(unsigned long api, lua_State* L, VirtualMachine* mainVm);
+
+    /**
+     * Garbage collection callback for the sweep sentinel.
+     */
+    static int SweepCallback(lua_State* L);
+
+    /**
+     * stdcall version of the sweep callback. This is used if the Lua API was linked
+     * with the stdcall calling convention.
+     */
+    static int __stdcall SweepCallback_stdcall(lua_State* L);
+
     /**
      * Calls the function on the top of the stack when the garbage collector runs.
      * The function is popped from the stack.
@@ -535,12 +918,84 @@ private:
      */
     void GetFileTitle(const char* name, std::string& title) const;
 
+    /**
+     * Returns the file name with the @ prefix and references to the current
+     * directory removed, forward slashes and in lower case. Names with the same
+     * path refer to the same file.
+     */
+    void GetFilePath(const char* name, std::string& path) const;
+
+    /**
+     * Sets the breakpoints that are applied to scripts with the normalized file name
+     * when they're registered. If wait is true, loading a script with the file name
+     * waits for the frontend regardless of the load policy.
+     */
+    void SetFileBreakpoints(const std::string& fileName, bool wait, const std::vector<FileBreakpoint>& breakpoints);
+
+    /**
+     * Returns the breakpoints registered for the file that best matches the script's
+     * normalized file name (see GetFileNameMatchLength), or the end of the map if no
+     * file matches.
+     */
+    FileBreakpointMap::const_iterator FindFileBreakpoints(const std::string& fileName) const;
+
+    /**
+     * Applies the breakpoints registered for the script's file name to a script
+     * which was just registered.
+     */
+    void ApplyFileBreakpoints(lua_State* L, Script* script, const FileBreakpoints& fileBreakpoints);
+
     /**
      * Logs information about a hook callback event. This is used for debugging.
      */
     void LogHookEvent(unsigned long api, lua_State* L, lua_Debug* ar);
 
-    void UpdateHookMode(unsigned long api, lua_State* L, lua_Debug* hookEvent);
+    void UpdateHookMode(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* hookEvent);
+
+    /**
+     * Called from the hook when a line with a breakpoint is reached. Evaluates the
+     * breakpoint's condition, hit condition and log message (compiling them into the
+     * VM the first time) and returns true if execution should stop.
+     */
+    bool ShouldStopAtBreakpoint(unsigned long api, lua_State* L, VirtualMachine* vm, Script* script, unsigned int line);
+
+    /**
+     * Compiles the condition and log message into functions that take the locals and
+     * up values of the function at the top of the stack as arguments.
+     */
+    bool CompileBreakpointCondition(unsigned long api, lua_State* L, lua_Debug* frame, const BreakpointCondition* condition,
+        CompiledCondition& compiled, std::string& error);
+
+    /**
+     * Compiles a chunk that returns a function and stores a reference to the function
+     * in the registry.
+     */
+    bool CompileBreakpointFunction(unsigned long api, lua_State* L, const std::string& code, int& ref, std::string& error);
+
+    /**
+     * Calls a compiled breakpoint function with the values of the locals and up values
+     * from the frame. If successful, the result is left on the top of the stack.
+     */
+    bool CallBreakpointFunction(unsigned long api, lua_State* L, lua_Debug* frame, int ref, const std::vector<int>& arguments, std::string& error);
+
+    /**
+     * Parses a hit condition of the form "[op] count" where op is one of ==, >, >=, <,
+     * <= or %. If no operator is given, the breakpoint stops once the count is reached.
+     */
+    static HitMode ParseHitCondition(const std::string& hitCondition, unsigned int& target);
+
+    /**
+     * Releases the registry references held by a compiled condition.
+     */
+    void ReleaseCompiledCondition(unsigned long api, lua_State* L, CompiledCondition& compiled);
+
+    /**
+     * Releases the compiled conditions of a main state whose breakpoint condition has
+     * been removed or replaced, or whose script has been unloaded. This must be called
+     * from the thread running the state; L can be any thread of the state since the
+     * registry is shared.
+     */
+    void PruneCompiledConditions(unsigned long api, lua_State* L, VirtualMachine* mainVm);
 
     /**
      * Calls the named meta-method for the specified value. If the value does
@@ -551,10 +1006,30 @@ private:
     bool CallMetaMethod(unsigned long api, lua_State* L, int valueIndex, const char* method, int numResults, int& result) const;
 
     /**
-     * Gets the current C/C++ call stack.
+     * Gets the C/C++ call stack for the thread. The thread must not be the calling
+     * thread. Module and function names are looked up in the symbol cache before
+     * resorting to the debug help library.
      */
     unsigned int GetCStack(HANDLE hThread, StackEntry stack[], unsigned int maxStackSize);
 
+    /**
+     * Fills in the script stack starting from the stackTop level of the Lua stack.
+     */
+    unsigned int GetScriptStack(unsigned long api, lua_State* L, int stackTop, lua_Debug scriptStack[]);
+
+    /**
+     * Fills in the stack entry for a level of the script stack.
+     */
+    void GetScriptStackEntry(unsigned long api, const lua_Debug* ar, unsigned int stackLevel, StackEntry& entry);
+
+    /**
+     * Gets the call stack for a VM stopped at a break, including the native
+     * frames. This is called from the command thread while the VM's thread is
+     * waiting to continue. Native frames are only available for the state that
+     * sent the last break event.
+     */
+    unsigned int GetNativeStack(unsigned long api, lua_State* L, StackEntry stack[]);
+
     /**
      * Creates a new table on the top of the stack which is the result of merging
      * the two specified tables.
@@ -572,9 +1047,98 @@ private:
      */
     VirtualMachine* GetVm(lua_State* L);
 
+    /**
+     * Takes a virtual machine record from the pool (or allocates one) for the state
+     * and adds it to the list of virtual machines.
+     */
+    VirtualMachine* AllocateVm(unsigned long api, lua_State* L);
+
+    /**
+     * Removes the virtual machine and the threads created from it, notifying the
+     * frontend if it knows about them, and returns the records to the pool.
+     */
+    void RemoveVm(VirtualMachine* vm);
+
+    /**
+     * Sends EventId_CreateVM for a thread which hasn't been announced to the frontend.
+     */
+    void AnnounceVm(VirtualMachine* vm);
+
+    /**
+     * Returns the main state the state belongs to. If the state isn't attached the
+     * method returns NULL.
+     */
+    VirtualMachine* GetMainVm(lua_State* L);
+
+    /**
+     * Returns the script with the specified index, or NULL if it has been unloaded.
+     */
+    Script* GetScript(unsigned int scriptIndex) const;
+
+    /**
+     * References the script from the chunk on the top of the stack, which was just
+     * loaded into L. The reference is released when the chunk is garbage collected.
+     */
+    void AddChunkReference(unsigned long api, lua_State* L, unsigned int scriptIndex);
+
+    /**
+     * References the script from the main state until the state is closed, unless the
+     * state already references it.
+     */
+    void PinScript(VirtualMachine* mainVm, unsigned int scriptIndex);
+
+    /**
+     * References the script from the function running at ar, so the script stays
+     * loaded while the function is alive.
+     */
+    void ReferenceFunction(unsigned long api, lua_State* L, lua_Debug* ar, Script* script);
+
+    /**
+     * Releases a reference to the script by a main state, unloading the script when
+     * no states reference it.
+     */
+    void ReleaseScript(VirtualMachine* mainVm, unsigned int scriptIndex);
+
+    /**
+     * Removes the script from the backend and tells the frontend to drop it. If a
+     * hook is running the script is deleted once the hooks have finished.
+     */
+    void UnloadScript(lua_State* L, Script* script);
+
+    /**
+     * Deletes the scripts that were unloaded while hooks were running, unless a hook
+     * is still running.
+     */
+    void DeleteUnloadedScripts();
+
+    /**
+     * Handles a debug event for HookCallback.
+     */
+    void HandleHookEvent(unsigned long api, lua_State* L, lua_Debug* ar);
+
+    /**
+     * Returns the virtual machine for the state from inside the hook, attaching
+     * to the state if necessary. The critical section is only entered when the
+     * calling thread's cached VM doesn't match.
+     */
+    VirtualMachine* GetVmForHook(unsigned long api, lua_State* L);
+
+    /**
+     * Returns the script for the function described by the debug record. The VM's
+     * script cache is keyed by the address of the source name Lua gives us, so in
+     * the common case no strings are built or hashed and the critical section is
+     * only entered the first time the VM encounters a source. Source names only
+     * come from loaded chunks, so the memory for one can only be reused for a
+     * different name after a load; loads change the script generation, which
+     * empties the caches. If registerNew is
+     * true, scripts that haven't been seen before are sent to the frontend.
+     */
+    Script* GetScriptForHook(unsigned long api, lua_State* L, VirtualMachine* vm, lua_Debug* ar, bool registerNew);
+
     /**
      * Creates a call stack that unifies the native call stack and the script
-     * call stack.
+     * call stack. If there are no native frames, every level of the script
+     * stack is included (C functions are shown by name).
      */
     unsigned int GetUnifiedStack(unsigned long api, const StackEntry nativeStack[], unsigned int nativeStackSize,
         const lua_Debug scriptStack[], unsigned int scriptStackSize,
@@ -588,32 +1152,55 @@ private:
 private:
 
     typedef std::unordered_map<lua_State*, VirtualMachine*>   StateToVmMap;
+    typedef std::unordered_map<unsigned int, Script*>         ScriptMap;
     typedef std::unordered_map<std::string, unsigned int>     NameToScriptMap;
+    typedef std::unordered_multimap<std::string, unsigned int> HashToScriptMap;
 
     static DebugBackend*            s_instance;
     static const unsigned int       s_maxStackSize  = 100;
+    static const unsigned int       s_maxNativeStackSize = 100;
+    static const unsigned int       s_maxCachedExpressions = 64;
+    static const unsigned int       s_defaultMaxStringLength = 16 * 1024;
+    static const unsigned int       s_maxFreeVms = 1024;
 
     FILE*                           m_log;
 
-    Mode                            m_mode;
+    volatile Mode                   m_mode;
     HANDLE                          m_stepEvent;
     HANDLE                          m_loadEvent;
     HANDLE                          m_detachEvent;
 
     CriticalSection                 m_criticalSection;
     CriticalSection                 m_breakLock;
-
-    std::vector<Script*>            m_scripts;
+    lua_State*                      m_breakState;           // State stopped at the current break.
+    HANDLE                          m_breakThread;          // Thread stopped at the current break.
+    unsigned int                    m_globalsGeneration;    // Incremented when scripts may have changed the globals.
+
+    ScriptMap                       m_scripts;              // Keyed by index, which are never reused.
+    unsigned int                    m_nextScriptIndex;
+    volatile LONG                   m_scriptGeneration;     // Incremented when a script is loaded or unloaded.
+    std::vector<Script*>            m_unloadedScripts;      // Unloaded while a hook may be using them.
+    volatile LONG                   m_activeHooks;          // Number of threads running the hook.
     NameToScriptMap                 m_nameToScript;
+    HashToScriptMap                 m_hashToScript;
 
     Channel                         m_eventChannel;
 
     HANDLE                          m_commandThread;
     Channel                         m_commandChannel;
 
-    std::list<ClassInfo>            m_classInfos;
     std::vector<VirtualMachine*>    m_vms;
     StateToVmMap                    m_stateToVm;
+    std::vector<VirtualMachine*>    m_freeVms;              // Pool of records for short-lived threads.
+
+    SymbolCache                     m_symbolCache;          // Names for native call stack addresses.
+
+    DWORD                           m_hookCacheIndex;       // TLS slot holding a HookThreadCache.
+    std::vector<HookThreadCache*>   m_hookCaches;
+    volatile LONG                   m_vmGeneration;         // Incremented when a VM record is deleted.
+    unsigned int                    m_nextVmSerial;
+    unsigned int                    m_nextConditionId;
+    volatile LONG                   m_conditionGeneration;  // Incremented when a condition is removed or replaced.
     
     mutable CriticalSection         m_exceptionCriticalSection; // Controls access to ignoreExceptions 
     std::unordered_set<std::string>   m_ignoreExceptions;
@@ -622,6 +1209,12 @@ private:
 
     mutable bool                    m_warnedAboutUserData;
 
+    volatile unsigned int           m_protocolVersion;      // Version negotiated with the frontend.
+    volatile unsigned int           m_maxStringLength;      // Strings longer than this are sent as a preview.
+
+    FileBreakpointMap               m_fileBreakpoints;      // Keyed by normalized file name, see NormalizeFileName.
+    volatile LoadPolicy             m_loadPolicy;
+
 };
 
 #endif
\ No newline at end of file
@@ -200,6 +200,9 @@ unsigned int GetCStack(HANDLE hThread, STACKFRAME64 stack[], unsigned int maxSta
         HANDLE hProcess = GetCurrentProcess();
         unsigned int stackSize = 0;
 
+        // The thread has to be suspended for the context to be valid.
+        SuspendThread(hThread);
+
         if (GetThreadContext(hThread, &context))
         {
             
@@ -237,6 +240,8 @@ unsigned int GetCStack(HANDLE hThread, STACKFRAME64 stack[], unsigned int maxSta
 
         }
 
+        ResumeThread(hThread);
+
         return stackSize;
     
     }
@@ -69,7 +69,9 @@ bool LoadDebugHelp(HINSTANCE hInstance);
 unsigned int GetCStack(STACKFRAME64 stack[], unsigned int maxStackSize);
 
 /**
- * Gets the C/C++ stack for the specified thead.
+ * Gets the C/C++ stack for the specified thead. The thread is suspended while
+ * the stack is walked, so it should be one that's waiting on us rather than one
+ * that's running (and could be holding a lock we need).
  */
 unsigned int GetCStack(HANDLE hThread, STACKFRAME64 stack[], unsigned int maxStackSize);
 
@@ -0,0 +1,104 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "LineBitmap.h"
+
+/**
+ * Returns the number of bits set in the value.
+ */
+static unsigned int CountBits(unsigned int value)
+{
+    value = value - ((value >> 1) & 0x55555555);
+    value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+    return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+LineBitmap::LineBitmap()
+{
+    m_count = 0;
+}
+
+bool LineBitmap::GetIsSet(unsigned int line) const
+{
+    unsigned int word = line >> 5;
+    return word < m_bits.size() && (m_bits[word] & (1u << (line & 31))) != 0;
+}
+
+unsigned int LineBitmap::GetCountBefore(unsigned int line) const
+{
+
+    unsigned int word = line >> 5;
+
+    if (word >= m_bits.size())
+    {
+        return m_count;
+    }
+
+    unsigned int mask = (1u << (line & 31)) - 1;
+    return m_prefix[word] + CountBits(m_bits[word] & mask);
+
+}
+
+unsigned int LineBitmap::GetCount() const
+{
+    return m_count;
+}
+
+bool LineBitmap::Toggle(unsigned int line)
+{
+
+    unsigned int word = line >> 5;
+
+    if (word >= m_bits.size())
+    {
+        // All of the bits past the end are clear, so the new words are preceded
+        // by every line in the set.
+        m_bits.resize(word + 1, 0);
+        m_prefix.resize(word + 1, m_count);
+    }
+
+    unsigned int bit = 1u << (line & 31);
+    m_bits[word] ^= bit;
+
+    bool set = (m_bits[word] & bit) != 0;
+
+    if (set)
+    {
+        ++m_count;
+        for (unsigned int i = word + 1; i < m_prefix.size(); ++i)
+        {
+            ++m_prefix[i];
+        }
+    }
+    else
+    {
+        --m_count;
+        for (unsigned int i = word + 1; i < m_prefix.size(); ++i)
+        {
+            --m_prefix[i];
+        }
+    }
+
+    return set;
+
+}
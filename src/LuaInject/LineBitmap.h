@@ -0,0 +1,73 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef LINE_BITMAP_H
+#define LINE_BITMAP_H
+
+#include <vector>
+
+/**
+ * Bitmap of the lines in a script. Along with the bits we store the number of
+ * bits set before each word, so the number of lines set in a range can be
+ * computed without scanning.
+ */
+class LineBitmap
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    LineBitmap();
+
+    /**
+     * Returns true if the line is set.
+     */
+    bool GetIsSet(unsigned int line) const;
+
+    /**
+     * Returns the number of lines set before the specified line.
+     */
+    unsigned int GetCountBefore(unsigned int line) const;
+
+    /**
+     * Returns the total number of lines set.
+     */
+    unsigned int GetCount() const;
+
+    /**
+     * Toggles the line and updates the counts for the words that follow.
+     * Returns true if the line is now set.
+     */
+    bool Toggle(unsigned int line);
+
+private:
+
+    std::vector<unsigned int>   m_bits;
+    std::vector<unsigned int>   m_prefix;   // Number of bits set in the words before each word.
+    unsigned int                m_count;    // Total number of bits set.
+
+};
+
+#endif
@@ -53,160 +53,137 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 typedef const char* (__stdcall *lua_Reader_stdcall) (lua_State*, void*, size_t*);
 typedef void        (__stdcall *lua_Hook_stdcall)   (lua_State*, lua_Debug*);
 
+/**
+ * Lua API functions that the *_dll wrappers call straight through to. Each entry
+ * gives the return type, name, parameters and the arguments to pass on. The function
+ * pointer types, the LuaInterface members and the wrappers for these are generated
+ * from this list; functions that need emulation or other special handling are
+ * declared and wrapped by hand.
+ */
+#define LUA_FORWARDED_FUNCTIONS(X) \
+    X(void*,           lua_newuserdata,         (lua_State *L, size_t size), (L, size)) \
+    X(void,            lua_close,               (lua_State* L), (L)) \
+    X(lua_State*,      lua_newthread,           (lua_State* L), (L)) \
+    X(int,             lua_error,               (lua_State* L), (L)) \
+    X(int,             lua_getinfo,             (lua_State* L, const char* what, lua_Debug* ar), (L, what, ar)) \
+    X(void,            lua_settable,            (lua_State* L, int index), (L, index)) \
+    X(void,            lua_gettable,            (lua_State* L, int index), (L, index)) \
+    X(void,            lua_rawget,              (lua_State* L, int idx), (L, idx)) \
+    X(void,            lua_rawgeti,             (lua_State *L, int idx, lua_Integer n), (L, idx, n)) \
+    X(void,            lua_rawset,              (lua_State* L, int idx), (L, idx)) \
+    X(void,            lua_pushstring,          (lua_State* L, const char* s), (L, s)) \
+    X(void,            lua_pushlstring,         (lua_State* L, const char* s, size_t len), (L, s, len)) \
+    X(int,             lua_type,                (lua_State* L, int index), (L, index)) \
+    X(const char*,     lua_typename,            (lua_State* L, int type), (L, type)) \
+    X(int,             lua_checkstack,          (lua_State* L, int extra), (L, extra)) \
+    X(void,            lua_settop,              (lua_State* L, int index), (L, index)) \
+    X(const char*,     lua_getlocal,            (lua_State* L, const lua_Debug* ar, int n), (L, ar, n)) \
+    X(const char*,     lua_setlocal,            (lua_State* L, const lua_Debug* ar, int n), (L, ar, n)) \
+    X(int,             lua_getstack,            (lua_State* L, int level, lua_Debug* ar), (L, level, ar)) \
+    X(void,            lua_pushnil,             (lua_State* L), (L)) \
+    X(void,            lua_pushcclosure,        (lua_State* L, lua_CFunction fn, int n), (L, fn, n)) \
+    X(void,            lua_pushvalue,           (lua_State* L, int index), (L, index)) \
+    X(void,            lua_pushnumber,          (lua_State* L, lua_Number value), (L, value)) \
+    X(void,            lua_pushlightuserdata,   (lua_State* L, void* p), (L, p)) \
+    X(int,             lua_toboolean,           (lua_State* L, int index), (L, index)) \
+    X(lua_CFunction,   lua_tocfunction,         (lua_State* L, int index), (L, index)) \
+    X(void*,           lua_touserdata,          (lua_State *L, int index), (L, index)) \
+    X(int,             lua_gettop,              (lua_State* L), (L)) \
+    X(void,            lua_call,                (lua_State* L, int nargs, int nresults), (L, nargs, nresults)) \
+    X(int,             lua_pcallk,              (lua_State* L, int nargs, int nresults, int errfunc, int ctx, lua_CFunction k), (L, nargs, nresults, errfunc, ctx, k)) \
+    X(int,             lua_next,                (lua_State* L, int index), (L, index)) \
+    X(int,             lua_rawequal,            (lua_State *L, int idx1, int idx2), (L, idx1, idx2)) \
+    X(int,             lua_getmetatable,        (lua_State* L, int index), (L, index)) \
+    X(int,             lua_setmetatable,        (lua_State* L, int index), (L, index)) \
+    X(int,             luaL_newmetatable,       (lua_State *L, const char *tname), (L, tname)) \
+    X(int,             luaL_loadbuffer,         (lua_State *L, const char *buff, size_t sz, const char *name), (L, buff, sz, name)) \
+    X(int,             luaL_loadbufferx,        (lua_State *L, const char *buff, size_t sz, const char *name, const char* mode), (L, buff, sz, name, mode)) \
+    X(int,             luaL_loadfile,           (lua_State* L, const char* fileName), (L, fileName)) \
+    X(int,             luaL_loadfilex,          (lua_State* L, const char* fileName, const char* mode), (L, fileName, mode)) \
+    X(void,            lua_rotate,              (lua_State* L, int index, int n), (L, index, n)) \
+    X(const char*,     lua_getupvalue,          (lua_State *L, int funcindex, int n), (L, funcindex, n)) \
+    X(const char*,     lua_setupvalue,          (lua_State *L, int funcindex, int n), (L, funcindex, n))
+
+#define LUA_UNWRAP(...) __VA_ARGS__
+
+#define DECLARE_FORWARDED_FUNCTION_TYPES(ret, function, params, args)                                                          \
+    typedef ret (*function##_cdecl_t) params;                                                                                   \
+    typedef ret (__stdcall *function##_stdcall_t) params;
+
+LUA_FORWARDED_FUNCTIONS(DECLARE_FORWARDED_FUNCTION_TYPES)
+
+
 typedef lua_State*      (*lua_open_cdecl_t)             (int stacksize);
 typedef lua_State*      (*lua_open_500_cdecl_t)         ();
 typedef lua_State*      (*lua_newstate_cdecl_t)         (lua_Alloc, void*);
-typedef void            (*lua_close_cdecl_t)            (lua_State*);
-typedef lua_State*      (*lua_newthread_cdecl_t)        (lua_State*);
-typedef int             (*lua_error_cdecl_t)            (lua_State*);
 typedef int             (*lua_absindex_cdecl_t)         (lua_State*, int);
 typedef int             (*lua_sethook_cdecl_t)          (lua_State*, lua_Hook, int, int);
 typedef int             (*lua_gethookmask_cdecl_t)      (lua_State*);
-typedef int             (*lua_getinfo_cdecl_t)          (lua_State*, const char*, lua_Debug* ar);
 typedef void            (*lua_remove_cdecl_t)           (lua_State*, int);
-typedef void            (*lua_settable_cdecl_t)         (lua_State*, int);
-typedef void            (*lua_gettable_cdecl_t)         (lua_State*, int);
 typedef void            (*lua_setglobal_cdecl_t)        (lua_State*, const char*);
 typedef void            (*lua_getglobal_cdecl_t)        (lua_State*, const char*);
-typedef void            (*lua_rawget_cdecl_t)           (lua_State *L, int idx);
-typedef void            (*lua_rawgeti_cdecl_t)          (lua_State *L, int idx, lua_Integer n);
-typedef void            (*lua_rawset_cdecl_t)           (lua_State *L, int idx);
-typedef void            (*lua_pushstring_cdecl_t)       (lua_State*, const char*);
-typedef void            (*lua_pushlstring_cdecl_t)      (lua_State*, const char*, size_t);
-typedef int             (*lua_type_cdecl_t)             (lua_State*, int);
-typedef const char*     (*lua_typename_cdecl_t)         (lua_State*, int);
-typedef void            (*lua_settop_cdecl_t)           (lua_State*, int);
-typedef const char*     (*lua_getlocal_cdecl_t)         (lua_State*, const lua_Debug*, int);
-typedef const char*     (*lua_setlocal_cdecl_t)         (lua_State*, const lua_Debug*, int);
-typedef int             (*lua_getstack_cdecl_t)         (lua_State*, int, lua_Debug*);
 typedef void            (*lua_insert_cdecl_t)           (lua_State*, int);
-typedef void            (*lua_pushnil_cdecl_t)          (lua_State*);
-typedef void            (*lua_pushcclosure_cdecl_t)     (lua_State*, lua_CFunction, int);
-typedef void            (*lua_pushvalue_cdecl_t)        (lua_State*, int);
 typedef void            (*lua_pushinteger_cdecl_t)      (lua_State*, int);
-typedef void            (*lua_pushnumber_cdecl_t)       (lua_State*, lua_Number);
 typedef const char*     (*lua_tostring_cdecl_t)         (lua_State*, int);
 typedef const char*     (*lua_tolstring_cdecl_t)        (lua_State*, int, size_t*);
-typedef int             (*lua_toboolean_cdecl_t)        (lua_State*, int);
 typedef int             (*lua_tointeger_cdecl_t)        (lua_State*, int);
 typedef lua_Integer     (*lua_tointegerx_cdecl_t)       (lua_State*, int, int*);
-typedef lua_CFunction   (*lua_tocfunction_cdecl_t)      (lua_State*, int);
 typedef lua_Number      (*lua_tonumber_cdecl_t)         (lua_State*, int);
 typedef lua_Number      (*lua_tonumberx_cdecl_t)        (lua_State*, int,  int*);
-typedef void*           (*lua_touserdata_cdecl_t)       (lua_State*, int);
-typedef int             (*lua_gettop_cdecl_t)           (lua_State*);
+typedef const void*     (*lua_topointer_cdecl_t)        (lua_State*, int);
 typedef int             (*lua_load_510_cdecl_t)         (lua_State*, lua_Reader, void*, const char *chunkname);
 typedef int             (*lua_load_cdecl_t)             (lua_State*, lua_Reader, void*, const char *chunkname, const char *mode);
-typedef void            (*lua_call_cdecl_t)             (lua_State*, int, int);
 typedef void            (*lua_callk_cdecl_t)            (lua_State*, int, int, int, lua_CFunction);
 typedef int             (*lua_pcall_cdecl_t)            (lua_State*, int, int, int);
-typedef int             (*lua_pcallk_cdecl_t)           (lua_State*, int, int, int, int, lua_CFunction);
 typedef void            (*lua_newtable_cdecl_t)         (lua_State*);
 typedef void            (*lua_createtable_cdecl_t)      (lua_State*, int, int);
-typedef int             (*lua_next_cdecl_t)             (lua_State*, int);
-typedef int             (*lua_rawequal_cdecl_t)         (lua_State *L, int idx1, int idx2);
-typedef int             (*lua_getmetatable_cdecl_t)     (lua_State*, int objindex);
-typedef int             (*lua_setmetatable_cdecl_t)     (lua_State*, int objindex);
 typedef int             (*luaL_ref_cdecl_t)             (lua_State *L, int t);
 typedef void            (*luaL_unref_cdecl_t)           (lua_State *L, int t, int ref);
-typedef int             (*luaL_newmetatable_cdecl_t)    (lua_State *L, const char *tname);
-typedef int             (*luaL_loadbuffer_cdecl_t)      (lua_State *L, const char *buff, size_t sz, const char *name);
-typedef int             (*luaL_loadbufferx_cdecl_t)     (lua_State *L, const char *buff, size_t sz, const char *name, const char* mode);
-typedef int             (*luaL_loadfile_cdecl_t)        (lua_State *L, const char *fileName);
-typedef int             (*luaL_loadfilex_cdecl_t)       (lua_State *L, const char *fileName, const char* mode);
 typedef const lua_WChar* (*lua_towstring_cdecl_t)       (lua_State *L, int index);
 typedef int             (*lua_iswstring_cdecl_t)        (lua_State *L, int index);
-typedef const char*     (*lua_getupvalue_cdecl_t)       (lua_State *L, int funcindex, int n);
-typedef const char*     (*lua_setupvalue_cdecl_t)       (lua_State *L, int funcindex, int n);
 typedef void            (*lua_getfenv_cdecl_t)          (lua_State *L, int index);
 typedef int             (*lua_setfenv_cdecl_t)          (lua_State *L, int index);
-typedef void            (*lua_pushlightuserdata_cdecl_t)(lua_State *L, void *p);
 typedef int             (*lua_pushthread_cdecl_t)       (lua_State *L);
-typedef void *          (*lua_newuserdata_cdecl_t)      (lua_State *L, size_t size);
 typedef lua_State*      (*luaL_newstate_cdecl_t)        ();
-typedef int             (*lua_checkstack_cdecl_t)       (lua_State* L, int extra);
 
 typedef lua_State*      (__stdcall *lua_open_stdcall_t)           (int stacksize);
 typedef lua_State*      (__stdcall *lua_open_500_stdcall_t)       ();
 typedef lua_State*      (__stdcall *lua_newstate_stdcall_t)       (lua_Alloc, void*);
-typedef void            (__stdcall *lua_close_stdcall_t)          (lua_State*);
-typedef lua_State*      (__stdcall *lua_newthread_stdcall_t)      (lua_State*);
-typedef int             (__stdcall *lua_error_stdcall_t)          (lua_State*);
 typedef int             (__stdcall *lua_absindex_stdcall_t)       (lua_State*, int);
 typedef int             (__stdcall *lua_sethook_stdcall_t)        (lua_State*, lua_Hook_stdcall, int, int);
 typedef int             (__stdcall *lua_gethookmaskstdcall_t)     (lua_State*);
-typedef int             (__stdcall *lua_getinfo_stdcall_t)        (lua_State*, const char*, lua_Debug* ar);
 typedef void            (__stdcall *lua_remove_stdcall_t)         (lua_State*, int);
-typedef void            (__stdcall *lua_settable_stdcall_t)       (lua_State*, int);
-typedef void            (__stdcall *lua_gettable_stdcall_t)       (lua_State*, int);
 typedef void            (__stdcall *lua_setglobal_stdcall_t)      (lua_State*, const char*);
 typedef void            (__stdcall *lua_getglobal_stdcall_t)      (lua_State*, const char*);
-typedef void            (__stdcall *lua_rawget_stdcall_t)         (lua_State *L, int idx);
-typedef void            (__stdcall *lua_rawgeti_stdcall_t)        (lua_State *L, int idx, lua_Integer n);
-typedef void            (__stdcall *lua_rawset_stdcall_t)         (lua_State *L, int idx);
-typedef void            (__stdcall *lua_pushstring_stdcall_t)     (lua_State*, const char*);
-typedef void            (__stdcall *lua_pushlstring_stdcall_t)    (lua_State*, const char*, size_t);
-typedef int             (__stdcall *lua_type_stdcall_t)           (lua_State*, int);
-typedef const char*     (__stdcall *lua_typename_stdcall_t)       (lua_State*, int);
-typedef void            (__stdcall *lua_settop_stdcall_t)         (lua_State*, int);
-typedef const char*     (__stdcall *lua_getlocal_stdcall_t)       (lua_State*, const lua_Debug*, int);
-typedef const char*     (__stdcall *lua_setlocal_stdcall_t)       (lua_State*, const lua_Debug*, int);
-typedef int             (__stdcall *lua_getstack_stdcall_t)       (lua_State*, int, lua_Debug*);
 typedef void            (__stdcall *lua_insert_stdcall_t)         (lua_State*, int);
-typedef void            (__stdcall *lua_pushnil_stdcall_t)        (lua_State*);
-typedef void            (__stdcall *lua_pushcclosure_stdcall_t)   (lua_State*, lua_CFunction, int);
-typedef void            (__stdcall *lua_pushvalue_stdcall_t)      (lua_State*, int);
 typedef void            (__stdcall *lua_pushinteger_stdcall_t)    (lua_State*, int);
-typedef void            (__stdcall *lua_pushnumber_stdcall_t)     (lua_State*, lua_Number);
 typedef const char*     (__stdcall *lua_tostring_stdcall_t)       (lua_State*, int);
 typedef const char*     (__stdcall *lua_tolstring_stdcall_t)      (lua_State*, int, size_t*);
-typedef int             (__stdcall *lua_toboolean_stdcall_t)      (lua_State*, int);
 typedef int             (__stdcall *lua_tointeger_stdcall_t)      (lua_State*, int);
 typedef lua_Integer     (__stdcall *lua_tointegerx_stdcall_t)     (lua_State*, int, int*);
-typedef lua_CFunction   (__stdcall *lua_tocfunction_stdcall_t)    (lua_State*, int);
 typedef lua_Number      (__stdcall *lua_tonumber_stdcall_t)       (lua_State*, int);
 typedef lua_Number      (__stdcall *lua_tonumberx_stdcall_t)      (lua_State*, int,  int*);
-typedef void*           (__stdcall *lua_touserdata_stdcall_t)     (lua_State*, int);
-typedef int             (__stdcall *lua_gettop_stdcall_t)         (lua_State*);
+typedef const void*     (__stdcall *lua_topointer_stdcall_t)      (lua_State*, int);
 typedef int             (__stdcall *lua_load_510_stdcall_t)       (lua_State*, lua_Reader_stdcall, void*, const char *chunkname);
 typedef int             (__stdcall *lua_load_stdcall_t)           (lua_State*, lua_Reader_stdcall, void*, const char *chunkname, const char *mode);
-typedef void            (__stdcall *lua_call_stdcall_t)           (lua_State*, int, int);
 typedef void            (__stdcall *lua_callk_stdcall_t)          (lua_State*, int, int, int, lua_CFunction);
 typedef int             (__stdcall *lua_pcall_stdcall_t)          (lua_State*, int, int, int);
-typedef int             (__stdcall *lua_pcallk_stdcall_t)         (lua_State*, int, int, int, int, lua_CFunction);
 typedef void            (__stdcall *lua_newtable_stdcall_t)       (lua_State*);
 typedef void            (__stdcall *lua_createtable_stdcall_t)    (lua_State*, int, int);
-typedef int             (__stdcall *lua_next_stdcall_t)           (lua_State*, int);
-typedef int             (__stdcall *lua_rawequal_stdcall_t)       (lua_State *L, int idx1, int idx2);
-typedef int             (__stdcall *lua_getmetatable_stdcall_t)   (lua_State*, int objindex);
-typedef int             (__stdcall *lua_setmetatable_stdcall_t)   (lua_State*, int objindex);
 typedef int             (__stdcall *luaL_ref_stdcall_t)           (lua_State *L, int t);
 typedef void            (__stdcall *luaL_unref_stdcall_t)         (lua_State *L, int t, int ref);
-typedef int             (__stdcall *luaL_newmetatable_stdcall_t)  (lua_State *L, const char *tname);
-typedef int             (__stdcall *luaL_loadbuffer_stdcall_t)    (lua_State *L, const char *buff, size_t sz, const char *name);
-typedef int             (__stdcall *luaL_loadbufferx_stdcall_t)   (lua_State *L, const char *buff, size_t sz, const char *name, const char* mode);
-typedef int             (__stdcall *luaL_loadfile_stdcall_t)      (lua_State *L, const char *fileName);
-typedef int             (__stdcall *luaL_loadfilex_stdcall_t)     (lua_State *L, const char *fileName, const char* mode);
 typedef const lua_WChar* (__stdcall *lua_towstring_stdcall_t)     (lua_State *L, int index);
 typedef int             (__stdcall *lua_iswstring_stdcall_t)      (lua_State *L, int index);
-typedef const char*     (__stdcall *lua_getupvalue_stdcall_t)     (lua_State *L, int funcindex, int n);
-typedef const char*     (__stdcall *lua_setupvalue_stdcall_t)     (lua_State *L, int funcindex, int n);
 typedef void            (__stdcall *lua_getfenv_stdcall_t)        (lua_State *L, int index);
 typedef int             (__stdcall *lua_setfenv_stdcall_t)        (lua_State *L, int index);
-typedef void            (__stdcall *lua_pushlightuserdata_stdcall_t)(lua_State *L, void *p);
 typedef int             (__stdcall *lua_pushthread_stdcall_t)     (lua_State *L);
-typedef void *          (__stdcall *lua_newuserdata_stdcall_t)    (lua_State *L, size_t size);
 typedef lua_State*      (__stdcall *luaL_newstate_stdcall_t)      ();
-typedef int             (__stdcall *lua_checkstack_stdcall_t)     (lua_State* L, int extra);
 
 typedef HMODULE         (WINAPI *LoadLibraryExW_t)              (LPCWSTR lpFileName, HANDLE hFile, DWORD dwFlags);
 typedef HMODULE			(WINAPI *LoadLibraryA_t)                (LPCSTR lpFileName);
 typedef HMODULE			(WINAPI *LoadLibraryW_t)                (LPCWSTR lpFileName);
 typedef ULONG           (WINAPI *LdrLockLoaderLock_t)           (ULONG flags, PULONG disposition, PULONG cookie);
 typedef LONG            (WINAPI *LdrUnlockLoaderLock_t)         (ULONG flags, ULONG cookie);
-typedef void            (*lua_rotate_cdecl_t )          (lua_State*, int, int);
-typedef int             (__stdcall *lua_getinfo_stdcall_t)        (lua_State*, const char*, lua_Debug*);
-typedef void            (__stdcall *lua_rotate_stdcall_t)         (lua_State*, int, int);
 /**
  * Structure that holds pointers to all of the Lua API functions.
  */
@@ -225,155 +202,82 @@ struct LuaInterface
     int                          hookTailCall;
     int                          hookTailRet;
 
+    // Forwarded functions. The cdecl and stdcall pointers for each function are
+    // next to each other so that a call only has to touch one of them.
+    #define DECLARE_FORWARDED_FUNCTION(ret, function, params, args)                                                             \
+        function##_cdecl_t           function##_dll_cdecl;                                                                      \
+        function##_stdcall_t         function##_dll_stdcall;
+
+    LUA_FORWARDED_FUNCTIONS(DECLARE_FORWARDED_FUNCTION)
+
     // cdecl functions.
     lua_open_cdecl_t             lua_open_dll_cdecl;
     lua_open_500_cdecl_t         lua_open_500_dll_cdecl;
     lua_newstate_cdecl_t         lua_newstate_dll_cdecl;
-    lua_close_cdecl_t            lua_close_dll_cdecl;
-    lua_newthread_cdecl_t        lua_newthread_dll_cdecl;
-    lua_error_cdecl_t            lua_error_dll_cdecl;
 	lua_absindex_cdecl_t         lua_absindex_dll_cdecl;
-    lua_gettop_cdecl_t           lua_gettop_dll_cdecl;
     lua_sethook_cdecl_t          lua_sethook_dll_cdecl;
     lua_gethookmask_cdecl_t      lua_gethookmask_dll_cdecl;
-    lua_getinfo_cdecl_t          lua_getinfo_dll_cdecl;
     lua_remove_cdecl_t           lua_remove_dll_cdecl;
-    lua_settable_cdecl_t         lua_settable_dll_cdecl;
-    lua_gettable_cdecl_t         lua_gettable_dll_cdecl;
     lua_setglobal_cdecl_t        lua_setglobal_dll_cdecl;
     lua_getglobal_cdecl_t        lua_getglobal_dll_cdecl;
-    lua_rawget_cdecl_t           lua_rawget_dll_cdecl;
-    lua_rawgeti_cdecl_t          lua_rawgeti_dll_cdecl;
-    lua_rawset_cdecl_t           lua_rawset_dll_cdecl;
-    lua_pushstring_cdecl_t       lua_pushstring_dll_cdecl;
-    lua_pushlstring_cdecl_t      lua_pushlstring_dll_cdecl;
-    lua_type_cdecl_t             lua_type_dll_cdecl;
-    lua_typename_cdecl_t         lua_typename_dll_cdecl;
-    lua_settop_cdecl_t           lua_settop_dll_cdecl;
-    lua_getlocal_cdecl_t         lua_getlocal_dll_cdecl;
-    lua_setlocal_cdecl_t         lua_setlocal_dll_cdecl;
-    lua_getstack_cdecl_t         lua_getstack_dll_cdecl;
     lua_insert_cdecl_t           lua_insert_dll_cdecl;
-    lua_pushnil_cdecl_t          lua_pushnil_dll_cdecl;
-    lua_pushvalue_cdecl_t        lua_pushvalue_dll_cdecl;
     lua_pushinteger_cdecl_t      lua_pushinteger_dll_cdecl;
-    lua_pushnumber_cdecl_t       lua_pushnumber_dll_cdecl;
-    lua_pushcclosure_cdecl_t     lua_pushcclosure_dll_cdecl;
     lua_tostring_cdecl_t         lua_tostring_dll_cdecl;
     lua_tolstring_cdecl_t        lua_tolstring_dll_cdecl;
-    lua_toboolean_cdecl_t        lua_toboolean_dll_cdecl;
     lua_tointeger_cdecl_t        lua_tointeger_dll_cdecl;
     lua_tointegerx_cdecl_t       lua_tointegerx_dll_cdecl;
-    lua_tocfunction_cdecl_t      lua_tocfunction_dll_cdecl;
     lua_tonumber_cdecl_t         lua_tonumber_dll_cdecl;
     lua_tonumberx_cdecl_t        lua_tonumberx_dll_cdecl;
-    lua_touserdata_cdecl_t       lua_touserdata_dll_cdecl;
+    lua_topointer_cdecl_t        lua_topointer_dll_cdecl;
     lua_load_cdecl_t             lua_load_dll_cdecl;
     lua_load_510_cdecl_t         lua_load_510_dll_cdecl;
-    lua_call_cdecl_t             lua_call_dll_cdecl;
     lua_callk_cdecl_t            lua_callk_dll_cdecl;
     lua_pcall_cdecl_t            lua_pcall_dll_cdecl;
-    lua_pcallk_cdecl_t           lua_pcallk_dll_cdecl;
     lua_newtable_cdecl_t         lua_newtable_dll_cdecl;
     lua_createtable_cdecl_t      lua_createtable_dll_cdecl;
-    lua_next_cdecl_t             lua_next_dll_cdecl;
-    lua_rawequal_cdecl_t         lua_rawequal_dll_cdecl;
-    lua_getmetatable_cdecl_t     lua_getmetatable_dll_cdecl;
-    lua_setmetatable_cdecl_t     lua_setmetatable_dll_cdecl;
     luaL_ref_cdecl_t             luaL_ref_dll_cdecl;
     luaL_unref_cdecl_t           luaL_unref_dll_cdecl;
-    luaL_newmetatable_cdecl_t    luaL_newmetatable_dll_cdecl;
-    luaL_loadbuffer_cdecl_t      luaL_loadbuffer_dll_cdecl;
-    luaL_loadbufferx_cdecl_t     luaL_loadbufferx_dll_cdecl;
-    luaL_loadfile_cdecl_t        luaL_loadfile_dll_cdecl;
-    luaL_loadfilex_cdecl_t       luaL_loadfilex_dll_cdecl;
     lua_towstring_cdecl_t        lua_towstring_dll_cdecl;
     lua_iswstring_cdecl_t        lua_iswstring_dll_cdecl;
-    lua_getupvalue_cdecl_t       lua_getupvalue_dll_cdecl;
-    lua_setupvalue_cdecl_t       lua_setupvalue_dll_cdecl;
     lua_getfenv_cdecl_t          lua_getfenv_dll_cdecl;
     lua_setfenv_cdecl_t          lua_setfenv_dll_cdecl;
-    lua_pushlightuserdata_cdecl_t lua_pushlightuserdata_dll_cdecl;
     lua_pushthread_cdecl_t       lua_pushthread_dll_cdecl;
-    lua_newuserdata_cdecl_t      lua_newuserdata_dll_cdecl;
     luaL_newstate_cdecl_t        luaL_newstate_dll_cdecl;
-    lua_checkstack_cdecl_t       lua_checkstack_dll_cdecl;
-	lua_rotate_cdecl_t           lua_rotate_dll_cdecl;
     // stdcall functions.
     lua_open_stdcall_t           lua_open_dll_stdcall;
     lua_open_500_stdcall_t       lua_open_500_dll_stdcall;
     lua_newstate_stdcall_t       lua_newstate_dll_stdcall;
-    lua_close_stdcall_t          lua_close_dll_stdcall;
-    lua_newthread_stdcall_t      lua_newthread_dll_stdcall;
-    lua_error_stdcall_t          lua_error_dll_stdcall;
     lua_absindex_stdcall_t       lua_absindex_dll_stdcall;
-    lua_gettop_stdcall_t         lua_gettop_dll_stdcall;
     lua_sethook_stdcall_t        lua_sethook_dll_stdcall;
     lua_gethookmaskstdcall_t     lua_gethookmask_dll_stdcall;
-    lua_getinfo_stdcall_t        lua_getinfo_dll_stdcall;
     lua_remove_stdcall_t         lua_remove_dll_stdcall;
-    lua_settable_stdcall_t       lua_settable_dll_stdcall;
-    lua_gettable_stdcall_t       lua_gettable_dll_stdcall;
     lua_setglobal_stdcall_t      lua_setglobal_dll_stdcall;
     lua_getglobal_stdcall_t      lua_getglobal_dll_stdcall;
-    lua_rawget_stdcall_t         lua_rawget_dll_stdcall;
-    lua_rawgeti_stdcall_t        lua_rawgeti_dll_stdcall;
-    lua_rawset_stdcall_t         lua_rawset_dll_stdcall;
-    lua_pushstring_stdcall_t     lua_pushstring_dll_stdcall;
-    lua_pushlstring_stdcall_t    lua_pushlstring_dll_stdcall;
-    lua_type_stdcall_t           lua_type_dll_stdcall;
-    lua_typename_stdcall_t       lua_typename_dll_stdcall;
-    lua_settop_stdcall_t         lua_settop_dll_stdcall;
-    lua_getlocal_stdcall_t       lua_getlocal_dll_stdcall;
-    lua_setlocal_stdcall_t       lua_setlocal_dll_stdcall;
-    lua_getstack_stdcall_t       lua_getstack_dll_stdcall;
     lua_insert_stdcall_t         lua_insert_dll_stdcall;
-    lua_pushnil_stdcall_t        lua_pushnil_dll_stdcall;
-    lua_pushvalue_stdcall_t      lua_pushvalue_dll_stdcall;
     lua_pushinteger_stdcall_t    lua_pushinteger_dll_stdcall;
-    lua_pushnumber_stdcall_t     lua_pushnumber_dll_stdcall;
-    lua_pushcclosure_stdcall_t   lua_pushcclosure_dll_stdcall;
     lua_tostring_stdcall_t       lua_tostring_dll_stdcall;
     lua_tolstring_stdcall_t      lua_tolstring_dll_stdcall;
-    lua_toboolean_stdcall_t      lua_toboolean_dll_stdcall;
     lua_tointeger_stdcall_t      lua_tointeger_dll_stdcall;
     lua_tointegerx_stdcall_t     lua_tointegerx_dll_stdcall;
-    lua_tocfunction_stdcall_t    lua_tocfunction_dll_stdcall;
     lua_tonumber_stdcall_t       lua_tonumber_dll_stdcall;
     lua_tonumberx_stdcall_t      lua_tonumberx_dll_stdcall;
-    lua_touserdata_stdcall_t     lua_touserdata_dll_stdcall;
+    lua_topointer_stdcall_t      lua_topointer_dll_stdcall;
     lua_load_stdcall_t           lua_load_dll_stdcall;
     lua_load_510_stdcall_t       lua_load_510_dll_stdcall;
-    lua_call_stdcall_t           lua_call_dll_stdcall;
     lua_callk_stdcall_t          lua_callk_dll_stdcall;
     lua_pcall_stdcall_t          lua_pcall_dll_stdcall;
-    lua_pcallk_stdcall_t         lua_pcallk_dll_stdcall;
     lua_newtable_stdcall_t       lua_newtable_dll_stdcall;
     lua_createtable_stdcall_t    lua_createtable_dll_stdcall;
-    lua_next_stdcall_t           lua_next_dll_stdcall;
-    lua_rawequal_stdcall_t       lua_rawequal_dll_stdcall;
-    lua_getmetatable_stdcall_t   lua_getmetatable_dll_stdcall;
-    lua_setmetatable_stdcall_t   lua_setmetatable_dll_stdcall;
     luaL_ref_stdcall_t           luaL_ref_dll_stdcall;
     luaL_unref_stdcall_t         luaL_unref_dll_stdcall;
-    luaL_newmetatable_stdcall_t  luaL_newmetatable_dll_stdcall;
-    luaL_loadbuffer_stdcall_t    luaL_loadbuffer_dll_stdcall;
-    luaL_loadbufferx_stdcall_t   luaL_loadbufferx_dll_stdcall;
-    luaL_loadfile_stdcall_t      luaL_loadfile_dll_stdcall;
-    luaL_loadfilex_stdcall_t     luaL_loadfilex_dll_stdcall;
     lua_towstring_stdcall_t      lua_towstring_dll_stdcall;
     lua_iswstring_stdcall_t      lua_iswstring_dll_stdcall;
-    lua_getupvalue_stdcall_t     lua_getupvalue_dll_stdcall;
-    lua_setupvalue_stdcall_t     lua_setupvalue_dll_stdcall;
     lua_getfenv_stdcall_t        lua_getfenv_dll_stdcall;
     lua_setfenv_stdcall_t        lua_setfenv_dll_stdcall;
-    lua_pushlightuserdata_stdcall_t lua_pushlightuserdata_dll_stdcall;
     lua_pushthread_stdcall_t     lua_pushthread_dll_stdcall;
-    lua_newuserdata_stdcall_t    lua_newuserdata_dll_stdcall;
     luaL_newstate_stdcall_t      luaL_newstate_dll_stdcall;
-    lua_checkstack_stdcall_t     lua_checkstack_dll_stdcall;
-	lua_rotate_stdcall_t         lua_rotate_dll_stdcall;
     lua_CFunction                DecodaOutput;
+    lua_CFunction                DecodaSetName;
     lua_CFunction                CPCallHandler;
     lua_Hook                     HookHandler;
 
@@ -458,6 +362,7 @@ bool                            g_warnedAboutJit     = false;
 
 std::string                     g_symbolsDirectory;
 static DWORD                    g_disableInterceptIndex = 0;
+static DWORD                    g_loadBufferIndex    = TLS_OUT_OF_INDEXES;  // TLS slot holding the Memory being loaded by luaL_loadbuffer.
 bool                            g_initializedDebugHelp = false; 
 
 /**
@@ -545,6 +450,45 @@ __declspec(naked) int DecodaOutput(unsigned long api, lua_State* L)
 
 }
 
+#pragma auto_inline(off)
+int DecodaSetNameWorker(unsigned long api, lua_State* L, bool& stdcall)
+{
+
+    stdcall = g_interfaces[api].stdcall;
+
+    const char* name = lua_tostring_dll(api, L, 1);
+
+    if (name == NULL)
+    {
+        name = "";
+    }
+
+    // Also store the name in the global so that threads created from this state
+    // will pick it up when they are attached.
+    lua_pushstring_dll(api, L, name);
+    lua_setglobal_dll(api, L, "decoda_name");
+
+    DebugBackend::Get().SetVmName(L, name);
+    
+    return 0;
+
+}
+#pragma auto_inline()
+
+__declspec(naked) int DecodaSetName(unsigned long api, lua_State* L)
+{
+
+    int result;
+    bool stdcall;
+
+    INTERCEPT_PROLOG()
+
+    result = DecodaSetNameWorker(api, L, stdcall);
+
+    INTERCEPT_EPILOG(4)
+
+}
+
 #pragma auto_inline(off)
 int CPCallHandlerWorker(unsigned long api, lua_State* L, bool& stdcall)
 {
@@ -928,17 +872,27 @@ bool lua_pushthread_dll(unsigned long api, lua_State *L)
 
 }
 
-void* lua_newuserdata_dll(unsigned long api, lua_State *L, size_t size)
-{
-    if (g_interfaces[api].lua_newuserdata_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_newuserdata_dll_cdecl(L, size);
-    }
-    else
-    {
-        return g_interfaces[api].lua_newuserdata_dll_stdcall(L, size);
+/**
+ * Generates the wrapper for a function in LUA_FORWARDED_FUNCTIONS. Once the calling
+ * convention has been determined only one of the two pointers is set, so the test
+ * below goes the same way on every call for an API and is predicted. It can't be
+ * resolved at compile time since each Lua DLL we hook is checked for stdcall when
+ * it's loaded, and on x86 a function can't be called through a pointer with the
+ * other calling convention; replacing the test with a thunk would add an indirect
+ * call instead.
+ */
+#define DEFINE_FORWARDED_FUNCTION(ret, function, params, args)                                                                  \
+    ret function##_dll(unsigned long api, LUA_UNWRAP params)                                                                    \
+    {                                                                                                                           \
+        const LuaInterface& luaInterface = g_interfaces[api];                                                                   \
+        if (luaInterface.function##_dll_cdecl != NULL)                                                                          \
+        {                                                                                                                       \
+            return luaInterface.function##_dll_cdecl args;                                                                      \
+        }                                                                                                                       \
+        return luaInterface.function##_dll_stdcall args;                                                                        \
     }
-}
+
+LUA_FORWARDED_FUNCTIONS(DEFINE_FORWARDED_FUNCTION)
 
 void EnableIntercepts(bool enableIntercepts)
 {
@@ -963,6 +917,7 @@ bool GetAreInterceptsEnabled()
 void RegisterDebugLibrary(unsigned long api, lua_State* L)
 {
     lua_register_dll(api, L, "decoda_output", g_interfaces[api].DecodaOutput);
+    lua_register_dll(api, L, "decoda_setname", g_interfaces[api].DecodaSetName);
 }
 
 int GetGlobalsIndex(unsigned long api)
@@ -1087,42 +1042,6 @@ lua_State* lua_newstate_dll(unsigned long api, lua_Alloc f, void* ud)
 
 }
 
-void lua_close_dll(unsigned long api, lua_State* L)
-{
-    if (g_interfaces[api].lua_close_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_close_dll_cdecl(L);
-    }
-    else
-    {
-        g_interfaces[api].lua_close_dll_stdcall(L);
-    }
-}
-
-lua_State* lua_newthread_dll(unsigned long api, lua_State* L)
-{
-    if (g_interfaces[api].lua_newthread_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_newthread_dll_cdecl(L);
-    }
-    else
-    {
-        return g_interfaces[api].lua_newthread_dll_stdcall(L);
-    }
-}
-
-int lua_error_dll(unsigned long api, lua_State* L)
-{
-    if (g_interfaces[api].lua_error_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_error_dll_cdecl(L);
-    }
-    else
-    {
-        return g_interfaces[api].lua_error_dll_stdcall(L);
-    }
-}
-
 int lua_sethook_dll(unsigned long api, lua_State* L, lua_Hook f, int mask, int count)
 {
     if (g_interfaces[api].lua_sethook_dll_cdecl != NULL)
@@ -1135,18 +1054,6 @@ int lua_sethook_dll(unsigned long api, lua_State* L, lua_Hook f, int mask, int c
     }
 }
 
-int lua_getinfo_dll(unsigned long api, lua_State* L, const char* what, lua_Debug* ar)
-{
-    if (g_interfaces[api].lua_getinfo_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_getinfo_dll_cdecl(L, what, ar);
-    }
-    else
-    {
-        return g_interfaces[api].lua_getinfo_dll_stdcall(L, what, ar);
-    }
-}
-
 void lua_remove_dll(unsigned long api, lua_State* L, int index)
 {
 	if (g_interfaces[api].version >= 530)
@@ -1167,126 +1074,6 @@ void lua_remove_dll(unsigned long api, lua_State* L, int index)
 	}
 }
 
-void lua_settable_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_settable_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_settable_dll_cdecl(L, index);
-    }
-    else
-    {
-        g_interfaces[api].lua_settable_dll_stdcall(L, index);
-    }
-}
-
-void lua_gettable_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_gettable_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_gettable_dll_cdecl(L, index);
-    }
-    else
-    {
-        g_interfaces[api].lua_gettable_dll_stdcall(L, index);
-    }
-}
-
-void lua_rawget_dll(unsigned long api, lua_State* L, int idx)
-{
-    if (g_interfaces[api].lua_rawget_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_rawget_dll_cdecl(L, idx);
-    }
-    else
-    {
-        g_interfaces[api].lua_rawget_dll_stdcall(L, idx);
-    }
-}
-
-void lua_rawgeti_dll(unsigned long api, lua_State *L, int idx, lua_Integer n)
-{
-    if (g_interfaces[api].lua_rawgeti_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_rawgeti_dll_cdecl(L, idx, n);
-    }
-    else
-    {
-        g_interfaces[api].lua_rawgeti_dll_stdcall(L, idx, n);
-    }
-}
-
-void lua_rawset_dll(unsigned long api, lua_State* L, int idx)
-{
-    if (g_interfaces[api].lua_rawset_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_rawset_dll_cdecl(L, idx);
-    }
-    else
-    {
-        g_interfaces[api].lua_rawset_dll_stdcall(L, idx);
-    }
-}
-
-void lua_pushstring_dll(unsigned long api, lua_State* L, const char* s)
-{
-    if (g_interfaces[api].lua_pushstring_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushstring_dll_cdecl(L, s);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushstring_dll_stdcall(L, s);
-    }
-}
-
-void lua_pushlstring_dll(unsigned long api, lua_State* L, const char* s, size_t len)
-{
-    if (g_interfaces[api].lua_pushlstring_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushlstring_dll_cdecl(L, s, len);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushlstring_dll_stdcall(L, s, len);
-    }
-}
-
-int lua_type_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_type_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_type_dll_cdecl(L, index);
-    }
-    else
-    {
-        return g_interfaces[api].lua_type_dll_stdcall(L, index);
-    }
-}
-
-const char* lua_typename_dll(unsigned long api, lua_State* L, int type)
-{
-    if (g_interfaces[api].lua_typename_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_typename_dll_cdecl(L, type);
-    }
-    else
-    {
-        return g_interfaces[api].lua_typename_dll_stdcall(L, type);
-    }
-}
-
-int lua_checkstack_dll(unsigned long api, lua_State* L, int extra)
-{
-    if (g_interfaces[api].lua_checkstack_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_checkstack_dll_cdecl(L, extra);
-    }
-    else
-    {
-        return g_interfaces[api].lua_checkstack_dll_stdcall(L, extra);
-    }
-}
-
 void lua_getfield_dll(unsigned long api, lua_State* L, int index, const char* k)
 {
 
@@ -1314,54 +1101,6 @@ void lua_setfield_dll(unsigned long api, lua_State* L, int index, const char* k)
 
 }
 
-void lua_settop_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_settop_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_settop_dll_cdecl(L, index);
-    }
-    else
-    {
-        g_interfaces[api].lua_settop_dll_stdcall(L, index);
-    }
-}
-
-const char* lua_getlocal_dll(unsigned long api, lua_State* L, const lua_Debug* ar, int n)
-{
-    if (g_interfaces[api].lua_getlocal_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_getlocal_dll_cdecl(L, ar, n);
-    }
-    else
-    {
-        return g_interfaces[api].lua_getlocal_dll_stdcall(L, ar, n);
-    }
-}
-
-const char* lua_setlocal_dll(unsigned long api, lua_State* L, const lua_Debug* ar, int n)
-{
-    if (g_interfaces[api].lua_setlocal_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_setlocal_dll_cdecl(L, ar, n);
-    }
-    else
-    {
-        return g_interfaces[api].lua_setlocal_dll_stdcall(L, ar, n);
-    }
-}
-
-int lua_getstack_dll(unsigned long api, lua_State* L, int level, lua_Debug* ar)
-{
-    if (g_interfaces[api].lua_getstack_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_getstack_dll_cdecl(L, level, ar);
-    }
-    else
-    {
-        return g_interfaces[api].lua_getstack_dll_stdcall(L, level, ar);
-    }
-}
-
 void lua_insert_dll(unsigned long api, lua_State* L, int index)
 {
 	if (g_interfaces[api].version >= 530)
@@ -1379,54 +1118,6 @@ void lua_insert_dll(unsigned long api, lua_State* L, int index)
     }
 }
 
-void lua_pushnil_dll(unsigned long api, lua_State* L)
-{
-    if (g_interfaces[api].lua_pushnil_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushnil_dll_cdecl(L);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushnil_dll_stdcall(L);
-    }
-}
-
-void lua_pushcclosure_dll(unsigned long api, lua_State* L, lua_CFunction fn, int n)
-{
-    if (g_interfaces[api].lua_pushcclosure_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushcclosure_dll_cdecl(L, fn, n);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushcclosure_dll_stdcall(L, fn, n);
-    }
-}
-
-void lua_pushvalue_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_pushvalue_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushvalue_dll_cdecl(L, index);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushvalue_dll_stdcall(L, index);
-    }
-}
-
-void lua_pushnumber_dll(unsigned long api, lua_State* L, lua_Number value)
-{
-    if (g_interfaces[api].lua_pushnumber_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushnumber_dll_cdecl(L, value);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushnumber_dll_stdcall(L, value);
-    }
-}
-
 void lua_pushinteger_dll(unsigned long api, lua_State* L, int value)
 {
     if (g_interfaces[api].lua_pushinteger_dll_cdecl != NULL ||
@@ -1449,18 +1140,6 @@ void lua_pushinteger_dll(unsigned long api, lua_State* L, int value)
     }
 }
 
-void lua_pushlightuserdata_dll(unsigned long api, lua_State* L, void* p)
-{
-    if (g_interfaces[api].lua_pushlightuserdata_dll_cdecl != NULL)
-    {
-        g_interfaces[api].lua_pushlightuserdata_dll_cdecl(L, p);
-    }
-    else
-    {
-        g_interfaces[api].lua_pushlightuserdata_dll_stdcall(L, p);
-    }
-}
-
 void lua_pushglobaltable_dll(unsigned long api, lua_State* L)
 {
     if( g_interfaces[api].version >= 520)
@@ -1551,18 +1230,6 @@ const char* lua_tolstring_dll(unsigned long api, lua_State* L, int index, size_t
     }
 }
 
-int lua_toboolean_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_toboolean_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_toboolean_dll_cdecl(L, index);
-    }
-    else
-    {
-        return g_interfaces[api].lua_toboolean_dll_stdcall(L, index);
-    }
-}
-
 lua_Integer lua_tointeger_dll(unsigned long api, lua_State* L, int index)
 {
     if (g_interfaces[api].lua_tointegerx_dll_cdecl != NULL ||
@@ -1598,18 +1265,6 @@ lua_Integer lua_tointeger_dll(unsigned long api, lua_State* L, int index)
     }
 }
 
-lua_CFunction lua_tocfunction_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_tocfunction_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_tocfunction_dll_cdecl(L, index);
-    }
-    else
-    {
-        return g_interfaces[api].lua_tocfunction_dll_stdcall(L, index);
-    }
-}
-
 lua_Number lua_tonumber_dll(unsigned long api, lua_State* L, int index)
 {
     if (g_interfaces[api].lua_tonumberx_dll_cdecl != NULL ||
@@ -1636,28 +1291,17 @@ lua_Number lua_tonumber_dll(unsigned long api, lua_State* L, int index)
     }
 }
 
-void* lua_touserdata_dll(unsigned long api, lua_State *L, int index)
+const void* lua_topointer_dll(unsigned long api, lua_State *L, int index)
 {
-    if (g_interfaces[api].lua_touserdata_dll_cdecl != NULL)
+    if (g_interfaces[api].lua_topointer_dll_cdecl != NULL)
     {
-        return g_interfaces[api].lua_touserdata_dll_cdecl(L, index);
+        return g_interfaces[api].lua_topointer_dll_cdecl(L, index);
     }
-    else
-    {
-        return g_interfaces[api].lua_touserdata_dll_stdcall(L, index);
-    }
-}
-
-int lua_gettop_dll(unsigned long api, lua_State* L)
-{
-    if (g_interfaces[api].lua_gettop_dll_cdecl != NULL)
+    else if (g_interfaces[api].lua_topointer_dll_stdcall != NULL)
     {
-        return g_interfaces[api].lua_gettop_dll_cdecl(L);
-    }
-    else
-    {
-        return g_interfaces[api].lua_gettop_dll_stdcall(L);
+        return g_interfaces[api].lua_topointer_dll_stdcall(L, index);
     }
+    return NULL;
 }
 
 int lua_loadbuffer_dll(unsigned long api, lua_State* L, const char* buffer, size_t size, const char* chunkname, const char* mode)
@@ -1689,28 +1333,32 @@ int lua_loadbuffer_dll(unsigned long api, lua_State* L, const char* buffer, size
     return 0;
 }
 
-void lua_call_dll(unsigned long api, lua_State* L, int nargs, int nresults)
+/**
+ * Calls the original lua_load with the reader supplied by the caller. The reader is
+ * assumed to use the same calling convention as lua_load.
+ */
+static int lua_load_reader_dll(unsigned long api, lua_State* L, lua_Reader reader, void* data, const char* chunkname, const char* mode)
 {
-    if (g_interfaces[api].lua_call_dll_cdecl != NULL)
+
+    if (g_interfaces[api].lua_load_dll_cdecl != NULL)
     {
-        return g_interfaces[api].lua_call_dll_cdecl(L, nargs, nresults);
+        return g_interfaces[api].lua_load_dll_cdecl(L, reader, data, chunkname, mode);
     }
-    else
+    else if (g_interfaces[api].lua_load_dll_stdcall != NULL)
     {
-        return g_interfaces[api].lua_call_dll_stdcall(L, nargs, nresults);
+        return g_interfaces[api].lua_load_dll_stdcall(L, reinterpret_cast<lua_Reader_stdcall>(reader), data, chunkname, mode);
     }
-}
-
-int lua_pcallk_dll(unsigned long api, lua_State* L, int nargs, int nresults, int errfunc, int ctx, lua_CFunction k)
-{
-    if (g_interfaces[api].lua_pcallk_dll_cdecl != NULL)
+    else if (g_interfaces[api].lua_load_510_dll_cdecl != NULL)
     {
-        return g_interfaces[api].lua_pcallk_dll_cdecl(L, nargs, nresults, errfunc, ctx, k);
+        return g_interfaces[api].lua_load_510_dll_cdecl(L, reader, data, chunkname);
     }
-    else
+    else if (g_interfaces[api].lua_load_510_dll_stdcall != NULL)
     {
-        return g_interfaces[api].lua_pcallk_dll_stdcall(L, nargs, nresults, errfunc, ctx, k);
+        return g_interfaces[api].lua_load_510_dll_stdcall(L, reinterpret_cast<lua_Reader_stdcall>(reader), data, chunkname);
     }
+
+    assert(0);
+    return 0;
 }
 
 int lua_pcall_dll(unsigned long api, lua_State* L, int nargs, int nresults, int errfunc)
@@ -1763,54 +1411,6 @@ void lua_newtable_dll(unsigned long api, lua_State* L)
 
 }
 
-int lua_next_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_next_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_next_dll_cdecl(L, index);
-    }
-    else
-    {
-        return g_interfaces[api].lua_next_dll_stdcall(L, index);
-    }
-}
-
-int lua_rawequal_dll(unsigned long api, lua_State *L, int idx1, int idx2)
-{
-    if (g_interfaces[api].lua_rawequal_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_rawequal_dll_cdecl(L, idx1, idx2);
-    }
-    else
-    {
-        return g_interfaces[api].lua_rawequal_dll_stdcall(L, idx1, idx2);
-    }
-}
-
-int lua_getmetatable_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_getmetatable_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_getmetatable_dll_cdecl(L, index);
-    }
-    else
-    {
-        return g_interfaces[api].lua_getmetatable_dll_stdcall(L, index);
-    }
-}
-
-int lua_setmetatable_dll(unsigned long api, lua_State* L, int index)
-{
-    if (g_interfaces[api].lua_setmetatable_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_setmetatable_dll_cdecl(L, index);
-    }
-    else
-    {
-        return g_interfaces[api].lua_setmetatable_dll_stdcall(L, index);
-    }
-}
-
 int luaL_ref_dll(unsigned long api, lua_State *L, int t)
 {
     if (g_interfaces[api].luaL_ref_dll_cdecl != NULL)
@@ -1838,66 +1438,6 @@ void luaL_unref_dll(unsigned long api, lua_State *L, int t, int ref)
     }
 }
 
-int luaL_newmetatable_dll(unsigned long api, lua_State *L, const char *tname)
-{
-    if (g_interfaces[api].luaL_newmetatable_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].luaL_newmetatable_dll_cdecl(L, tname);
-    }
-    else
-    {
-        return g_interfaces[api].luaL_newmetatable_dll_stdcall(L, tname);
-    }
-}
-
-int luaL_loadbuffer_dll(unsigned long api, lua_State *L, const char *buff, size_t sz, const char *name)
-{
-    if (g_interfaces[api].luaL_loadbuffer_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].luaL_loadbuffer_dll_cdecl(L, buff, sz, name);
-    }
-    else
-    {
-        return g_interfaces[api].luaL_loadbuffer_dll_stdcall(L, buff, sz, name);
-    }
-}
-
-int luaL_loadbufferx_dll(unsigned long api, lua_State *L, const char *buff, size_t sz, const char *name, const char* mode)
-{
-    if (g_interfaces[api].luaL_loadbufferx_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].luaL_loadbufferx_dll_cdecl(L, buff, sz, name, mode);
-    }
-    else
-    {
-        return g_interfaces[api].luaL_loadbufferx_dll_stdcall(L, buff, sz, name, mode);
-    }
-}
-
-int luaL_loadfile_dll(unsigned long api, lua_State* L, const char* fileName)
-{
-    if (g_interfaces[api].luaL_loadfile_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].luaL_loadfile_dll_cdecl(L, fileName);
-    }
-    else
-    {
-        return g_interfaces[api].luaL_loadfile_dll_stdcall(L, fileName);
-    }
-}
-
-int luaL_loadfilex_dll(unsigned long api, lua_State* L, const char* fileName, const char* mode)
-{
-    if (g_interfaces[api].luaL_loadfilex_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].luaL_loadfilex_dll_cdecl(L, fileName, mode);
-    }
-    else
-    {
-        return g_interfaces[api].luaL_loadfilex_dll_stdcall(L, fileName, mode);
-    }
-}
-
 lua_State* luaL_newstate_dll(unsigned long api)
 {
     if (g_interfaces[api].luaL_newstate_dll_cdecl != NULL)
@@ -1952,42 +1492,6 @@ int lua_iswstring_dll(unsigned long api, lua_State* L, int index)
     }
 }
 
-void lua_rotate_dll(unsigned long api, lua_State* L, int index, int n)
-{
-	if (g_interfaces[api].lua_rotate_dll_cdecl != NULL)
-	{
-		g_interfaces[api].lua_rotate_dll_cdecl(L, index, n);
-	}
-	else
-	{
-		g_interfaces[api].lua_rotate_dll_stdcall(L, index, n);
-	}
-}
-
-const char* lua_getupvalue_dll(unsigned long api, lua_State *L, int funcindex, int n)
-{
-    if (g_interfaces[api].lua_getupvalue_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_getupvalue_dll_cdecl(L, funcindex, n);
-    }
-    else
-    {
-        return g_interfaces[api].lua_getupvalue_dll_stdcall(L, funcindex, n);
-    }
-}
-
-const char* lua_setupvalue_dll(unsigned long api, lua_State *L, int funcindex, int n)
-{
-    if (g_interfaces[api].lua_setupvalue_dll_cdecl != NULL)
-    {
-        return g_interfaces[api].lua_setupvalue_dll_cdecl(L, funcindex, n);
-    }
-    else
-    {
-        return g_interfaces[api].lua_setupvalue_dll_stdcall(L, funcindex, n);
-    }
-}
-
 void lua_getfenv_dll(unsigned long api, lua_State *L, int index)
 {
     if (g_interfaces[api].lua_getfenv_dll_cdecl != NULL)
@@ -2168,73 +1672,35 @@ void FinishLoadingLua(unsigned long api, bool stdcall)
         SET_STDCALL(lua_open);
         SET_STDCALL(lua_open_500);
         SET_STDCALL(lua_newstate);
-        SET_STDCALL(lua_newthread);
-        SET_STDCALL(lua_close);
-        SET_STDCALL(lua_error);
         SET_STDCALL(lua_absindex);
         SET_STDCALL(lua_sethook);
-        SET_STDCALL(lua_getinfo);
         SET_STDCALL(lua_remove);
-        SET_STDCALL(lua_settable);
-        SET_STDCALL(lua_gettable);
         SET_STDCALL(lua_setglobal);
         SET_STDCALL(lua_getglobal);
-        SET_STDCALL(lua_rawget);
-        SET_STDCALL(lua_rawgeti);
-        SET_STDCALL(lua_rawset);
-        SET_STDCALL(lua_pushstring);
-        SET_STDCALL(lua_pushlstring);
-        SET_STDCALL(lua_type);
-        SET_STDCALL(lua_typename);
-        SET_STDCALL(lua_settop);
-        SET_STDCALL(lua_gettop);
-        SET_STDCALL(lua_getlocal);
-        SET_STDCALL(lua_setlocal);
-        SET_STDCALL(lua_getstack);
         SET_STDCALL(lua_insert);
-        SET_STDCALL(lua_pushnil);
-        SET_STDCALL(lua_pushvalue);
         SET_STDCALL(lua_pushinteger);
-        SET_STDCALL(lua_pushnumber);
-        SET_STDCALL(lua_pushcclosure);
-        SET_STDCALL(lua_pushlightuserdata);
         SET_STDCALL(lua_tostring);
         SET_STDCALL(lua_tolstring);
-        SET_STDCALL(lua_toboolean);
         SET_STDCALL(lua_tointeger);
         SET_STDCALL(lua_tointegerx);
-        SET_STDCALL(lua_tocfunction);
         SET_STDCALL(lua_tonumber);
         SET_STDCALL(lua_tonumberx);
-        SET_STDCALL(lua_touserdata);
-        SET_STDCALL(lua_call);
+        SET_STDCALL(lua_topointer);
         SET_STDCALL(lua_callk);
         SET_STDCALL(lua_pcall);
-        SET_STDCALL(lua_pcallk);
         SET_STDCALL(lua_newtable);
         SET_STDCALL(lua_createtable);
         SET_STDCALL(lua_load);
         SET_STDCALL(lua_load_510);
-        SET_STDCALL(lua_next);
-        SET_STDCALL(lua_rawequal);
-        SET_STDCALL(lua_getmetatable);
-        SET_STDCALL(lua_setmetatable);
         SET_STDCALL(luaL_ref);
         SET_STDCALL(luaL_unref);
-        SET_STDCALL(luaL_newmetatable);
-        SET_STDCALL(luaL_loadbuffer);
-        SET_STDCALL(luaL_loadbufferx);
-        SET_STDCALL(luaL_loadfile);
-        SET_STDCALL(luaL_loadfilex);
-        SET_STDCALL(lua_getupvalue);
-        SET_STDCALL(lua_setupvalue);
         SET_STDCALL(lua_getfenv);
         SET_STDCALL(lua_setfenv);
         SET_STDCALL(lua_pushthread);
-        SET_STDCALL(lua_newuserdata);
         SET_STDCALL(lua_pushthread);
-        SET_STDCALL(lua_checkstack);
-		SET_STDCALL(lua_rotate);
+
+        #define SET_FORWARDED_STDCALL(ret, function, params, args) SET_STDCALL(function)
+        LUA_FORWARDED_FUNCTIONS(SET_FORWARDED_STDCALL)
     }
         
     g_interfaces[api].finishedLoading = true;
@@ -2582,7 +2048,7 @@ lua_State* lua_newthread_worker(unsigned long api, lua_State* L, bool& stdcall)
     
     if (result != NULL)
     {
-        DebugBackend::Get().AttachState(api, result);
+        DebugBackend::Get().AttachThread(api, L, result);
     }
 
     return result;
@@ -2727,6 +2193,41 @@ int lua_load_worker(unsigned long api, lua_State* L, lua_Reader reader, void* da
     // when we access the reader function.
     stdcall = (g_interfaces[api].lua_load_dll_stdcall != NULL);
 
+    // When we're called from inside luaL_loadbuffer the source is already in one
+    // contiguous block, so there's no need to buffer it; Lua can read it directly
+    // and luaL_loadbufferx_worker registers the script from the caller's buffer.
+    
+    const Memory* memory = NULL;
+
+    if (g_loadBufferIndex != TLS_OUT_OF_INDEXES)
+    {
+        memory = static_cast<const Memory*>(TlsGetValue(g_loadBufferIndex));
+    }
+
+    if (memory != NULL && g_interfaces[api].finishedLoading)
+    {
+
+        // Any loads the reader makes aren't part of the luaL_loadbuffer call.
+        TlsSetValue(g_loadBufferIndex, NULL);
+
+        DebugBackend::Get().AttachState(api, L);
+        
+        if (DebugBackend::Get().EnableJit(api, L, false))
+        {
+            if (!g_warnedAboutJit)
+            {
+                DebugBackend::Get().Message("Warning 1007: Just-in-time compilation of Lua code disabled to allow debugging", MessageType_Warning);
+                g_warnedAboutJit = true;
+            }
+        }
+
+        int result = lua_load_reader_dll(api, L, reader, data, name, mode);
+        TlsSetValue(g_loadBufferIndex, const_cast<Memory*>(memory));
+
+        return result;
+
+    }
+
     // Read all of the data out of the reader and into a big buffer.
 
     std::vector<char> buffer;
@@ -2761,6 +2262,12 @@ int lua_load_worker(unsigned long api, lua_State* L, lua_Reader reader, void* da
 
         if (chunk != NULL && chunkSize > 0)
         {
+            // Readers usually return fixed size chunks, so grow by a multiple of the
+            // chunk size rather than one chunk at a time.
+            if (buffer.capacity() - buffer.size() < chunkSize)
+            {
+                buffer.reserve(std::max<size_t>(buffer.capacity() * 2, buffer.size() + chunkSize * 4));
+            }
             buffer.insert(buffer.end(), chunk, chunk + chunkSize);
         }
 
@@ -2992,6 +2499,22 @@ int luaL_loadbufferx_worker(unsigned long api, lua_State *L, const char *buff, s
 
     int result = 0;
 
+    // Let lua_load_worker know the lua_load call the library makes is reading
+    // straight from buff.
+
+    Memory memory;
+
+    memory.buffer   = buff;
+    memory.size     = sz;
+
+    LPVOID pending = NULL;
+
+    if (g_loadBufferIndex != TLS_OUT_OF_INDEXES)
+    {
+        pending = TlsGetValue(g_loadBufferIndex);
+        TlsSetValue(g_loadBufferIndex, &memory);
+    }
+
     if (!g_interfaces[api].finishedLoading)
     {
         stdcall = GetIsStdCallConvention(g_interfaces[api].luaL_loadbuffer_dll_cdecl, L, (void*)buff, (void*)sz, (void*)name, (void**)&result);
@@ -3018,6 +2541,11 @@ int luaL_loadbufferx_worker(unsigned long api, lua_State *L, const char *buff, s
         stdcall = true;
     }
 
+    if (g_loadBufferIndex != TLS_OUT_OF_INDEXES)
+    {
+        TlsSetValue(g_loadBufferIndex, pending);
+    }
+
     // Make sure the debugger knows about this state. This is necessary since we might have
     // attached the debugger after the state was created.
     DebugBackend::Get().AttachState(api, L);
@@ -3425,6 +2953,7 @@ bool LoadLuaFunctions(const std::unordered_map<std::string, DWORD64>& symbols, H
     GET_FUNCTION(lua_toboolean);
     GET_FUNCTION(lua_tocfunction);
     GET_FUNCTION(lua_touserdata);
+    GET_FUNCTION_OPTIONAL(lua_topointer);
     
     // Exists as a macro in Lua 5.2
     GET_FUNCTION_OPTIONAL(lua_callk);
@@ -3525,6 +3054,7 @@ bool LoadLuaFunctions(const std::unordered_map<std::string, DWORD64>& symbols, H
     // Setup our API.
 
     luaInterface.DecodaOutput  = (lua_CFunction)InstanceFunction(DecodaOutput, api);
+    luaInterface.DecodaSetName = (lua_CFunction)InstanceFunction(DecodaSetName, api);
     luaInterface.CPCallHandler = (lua_CFunction)InstanceFunction(CPCallHandler, api);
     luaInterface.HookHandler   = (lua_Hook)InstanceFunction(HookHandler, api);
 
@@ -4178,6 +3708,8 @@ bool InstallLuaHooker(HINSTANCE hInstance, const char* symbolsDirectory)
 
     g_symbolsDirectory = symbolsDirectory;
 
+    g_loadBufferIndex = TlsAlloc();
+
     // Add the "standard" stuff to the symbols directory search path.
     g_symbolsDirectory += ";" + GetApplicationDirectory();
     g_symbolsDirectory += ";" + GetEnvironmentVariable("_NT_SYMBOL_PATH");
@@ -74,6 +74,7 @@ int             lua_tointeger_dll       (unsigned long api, lua_State*, int);
 lua_CFunction   lua_tocfunction_dll     (unsigned long api, lua_State*, int);
 lua_Number      lua_tonumber_dll        (unsigned long api, lua_State*, int);
 void*           lua_touserdata_dll      (unsigned long api, lua_State* L, int index);
+const void*     lua_topointer_dll       (unsigned long api, lua_State* L, int index);
 int             lua_gettop_dll          (unsigned long api, lua_State*);
 int             lua_loadbuffer_dll      (unsigned long api, lua_State*, const char*, size_t, const char*, const char*);
 void            lua_call_dll            (unsigned long api, lua_State*, int, int);
@@ -0,0 +1,144 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef VALUE_WRITER_H
+#define VALUE_WRITER_H
+
+#include <string>
+
+/**
+ * Interface used by the backend to describe the value of an expression to
+ * the frontend. The writer determines how the value is encoded.
+ */
+class ValueWriter
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    ValueWriter();
+
+    /**
+     * Destructor.
+     */
+    virtual ~ValueWriter() { }
+
+    /**
+     * Writes a value that is displayed as text.
+     */
+    virtual void WriteValue(const std::string& data, const char* type) = 0;
+
+    /**
+     * Writes a value where data only contains a preview of a long string. The
+     * handle identifies the string so that other ranges of it can be requested,
+     * and length is the total length of the string in bytes.
+     */
+    virtual void WriteTruncatedValue(const std::string& data, const char* type, unsigned int handle, size_t length) = 0;
+
+    /**
+     * Writes a function value as the location where it was defined.
+     */
+    virtual void WriteFunction(int scriptIndex, int line) = 0;
+
+    /**
+     * Writes an error message in place of a value.
+     */
+    virtual void WriteError(const std::string& message) = 0;
+
+    /**
+     * Starts a table. The elements of the table are written between the call
+     * to BeginTable and the matching call to EndTable. The type can be NULL.
+     * If the id is not 0, later occurrences of the table in the same value are
+     * written as references to that id.
+     */
+    virtual void BeginTable(const char* type, unsigned int id) = 0;
+
+    /**
+     * Writes a table that has already been written as part of the value.
+     */
+    virtual void WriteReference(unsigned int id) = 0;
+
+    /**
+     * Finishes a table. If the elements of the table weren't all written, the
+     * handle identifies the table so that the elements can be requested later,
+     * and the size is the total number of elements in the table. This is the
+     * case when the table is nested too deeply or the element budget ran out.
+     */
+    virtual void EndTable(unsigned int handle, unsigned int size) = 0;
+
+    /**
+     * Starts an element of a table. The next value written is the key.
+     */
+    virtual void BeginElement() = 0;
+
+    /**
+     * Indicates that the next value written is the value of the element.
+     */
+    virtual void BeginElementValue() = 0;
+
+    /**
+     * Finishes an element of a table.
+     */
+    virtual void EndElement() = 0;
+
+    /**
+     * Starts a list of values. This is used when an expression evaluates to
+     * multiple values.
+     */
+    virtual void BeginValues() = 0;
+
+    /**
+     * Finishes a list of values.
+     */
+    virtual void EndValues() = 0;
+
+    /**
+     * Gets the encoded result.
+     */
+    virtual void GetResult(std::string& result) = 0;
+
+    /**
+     * Assigns an id to a table that is about to be written. The caller keeps
+     * track of which tables have been written, since it can keep them alive
+     * while the value is being written.
+     */
+    unsigned int AddTable();
+
+    /**
+     * Uses up one element of the budget for the value. Returns false once the
+     * budget has been exhausted, in which case no more elements should be
+     * written.
+     */
+    bool UseElement();
+
+private:
+
+    static const unsigned int   s_maxElements = 5000;
+
+    unsigned int                m_numTables;
+    unsigned int                m_elementsLeft;
+
+};
+
+#endif
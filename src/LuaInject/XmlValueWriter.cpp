@@ -0,0 +1,162 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "XmlValueWriter.h"
+#include "XmlUtility.h"
+
+#include <assert.h>
+
+XmlValueWriter::XmlValueWriter()
+{
+    m_parents.push_back(&m_document);
+}
+
+void XmlValueWriter::Add(TiXmlNode* node)
+{
+    m_parents.back()->LinkEndChild(node);
+}
+
+void XmlValueWriter::WriteValue(const std::string& data, const char* type)
+{
+    TiXmlNode* node = new TiXmlElement("value");
+    node->LinkEndChild( WriteXmlNode("data", data) );
+    node->LinkEndChild( WriteXmlNode("type", type) );
+    Add(node);
+}
+
+void XmlValueWriter::WriteTruncatedValue(const std::string& data, const char* type, unsigned int handle, size_t length)
+{
+    TiXmlNode* node = new TiXmlElement("value");
+    node->LinkEndChild( WriteXmlNode("data", data) );
+    node->LinkEndChild( WriteXmlNode("type", type) );
+    node->LinkEndChild( WriteXmlNode("handle", handle) );
+    node->LinkEndChild( WriteXmlNode("length", static_cast<int>(length)) );
+    Add(node);
+}
+
+void XmlValueWriter::WriteFunction(int scriptIndex, int line)
+{
+    TiXmlNode* node = new TiXmlElement("function");
+    node->LinkEndChild( WriteXmlNode("script", scriptIndex) );
+    node->LinkEndChild( WriteXmlNode("line", line) );
+    Add(node);
+}
+
+void XmlValueWriter::WriteError(const std::string& message)
+{
+    Add( WriteXmlNode("error", message) );
+}
+
+void XmlValueWriter::BeginTable(const char* type, unsigned int id)
+{
+
+    TiXmlNode* node = new TiXmlElement("table");
+
+    if (type != NULL)
+    {
+        node->LinkEndChild( WriteXmlNode("type", type) );
+    }
+
+    if (id != 0)
+    {
+        node->LinkEndChild( WriteXmlNode("id", id) );
+    }
+
+    Add(node);
+    m_parents.push_back(node);
+
+}
+
+void XmlValueWriter::WriteReference(unsigned int id)
+{
+    Add( WriteXmlNode("reference", id) );
+}
+
+void XmlValueWriter::EndTable(unsigned int handle, unsigned int size)
+{
+
+    if (handle != 0)
+    {
+        Add( WriteXmlNode("handle", handle) );
+        Add( WriteXmlNode("size", size) );
+    }
+
+    m_parents.pop_back();
+
+}
+
+void XmlValueWriter::BeginElement()
+{
+
+    TiXmlNode* element = new TiXmlElement("element");
+    Add(element);
+    m_parents.push_back(element);
+
+    TiXmlNode* key = new TiXmlElement("key");
+    Add(key);
+    m_parents.push_back(key);
+
+}
+
+void XmlValueWriter::BeginElementValue()
+{
+
+    // Finish the key.
+    m_parents.pop_back();
+
+    TiXmlNode* value = new TiXmlElement("data");
+    Add(value);
+    m_parents.push_back(value);
+
+}
+
+void XmlValueWriter::EndElement()
+{
+    // Finish the value and the element.
+    m_parents.pop_back();
+    m_parents.pop_back();
+}
+
+void XmlValueWriter::BeginValues()
+{
+    TiXmlNode* node = new TiXmlElement("values");
+    Add(node);
+    m_parents.push_back(node);
+}
+
+void XmlValueWriter::EndValues()
+{
+    m_parents.pop_back();
+}
+
+void XmlValueWriter::GetResult(std::string& result)
+{
+
+    assert(m_parents.size() == 1);
+
+    TiXmlPrinter printer;
+    printer.SetIndent("\t");
+
+    m_document.Accept( &printer );
+    result = printer.Str();
+
+}
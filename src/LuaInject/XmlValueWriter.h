@@ -0,0 +1,73 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef XML_VALUE_WRITER_H
+#define XML_VALUE_WRITER_H
+
+#include "ValueWriter.h"
+
+#include <vector>
+#include <tinyxml.h>
+
+/**
+ * Value writer that encodes the value as an XML document. This is the
+ * encoding used by frontends that don't support the binary encoding.
+ */
+class XmlValueWriter : public ValueWriter
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    XmlValueWriter();
+
+    virtual void WriteValue(const std::string& data, const char* type);
+    virtual void WriteTruncatedValue(const std::string& data, const char* type, unsigned int handle, size_t length);
+    virtual void WriteFunction(int scriptIndex, int line);
+    virtual void WriteError(const std::string& message);
+    virtual void BeginTable(const char* type, unsigned int id);
+    virtual void WriteReference(unsigned int id);
+    virtual void EndTable(unsigned int handle, unsigned int size);
+    virtual void BeginElement();
+    virtual void BeginElementValue();
+    virtual void EndElement();
+    virtual void BeginValues();
+    virtual void EndValues();
+    virtual void GetResult(std::string& result);
+
+private:
+
+    /**
+     * Adds the node to the current parent node.
+     */
+    void Add(TiXmlNode* node);
+
+private:
+
+    TiXmlDocument               m_document;
+    std::vector<TiXmlNode*>     m_parents;
+
+};
+
+#endif
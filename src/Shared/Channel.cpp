@@ -21,156 +21,202 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "Channel.h"
-#include <stdio.h>
+
+#ifdef _WIN32
+#include "PipeTransport.h"
+#include "SocketTransport.h"
+#else
+#include "PosixTransport.h"
+typedef PosixTransport PipeTransport;
+typedef PosixTransport SocketTransport;
+#endif
+
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 Channel::Channel()
 {
-    m_pipe      = INVALID_HANDLE_VALUE;
-    m_doneEvent = INVALID_HANDLE_VALUE;
-    m_readEvent = INVALID_HANDLE_VALUE;
-    m_creator   = false;
+    m_transport         = NULL;
+    m_readOffset        = 0;
+    m_frameRemaining    = 0;
 }
 
 Channel::~Channel()
 {
     Destroy();
+    Reset();
 }
 
-bool Channel::Create(const char* name)
+void Channel::Reset()
 {
 
-    char pipeName[256];
-    _snprintf(pipeName, 256, "\\\\.\\pipe\\%s", name);
+    delete m_transport;
+    m_transport = NULL;
 
-    DWORD bufferSize = 2048;
+    m_writeBuffer.clear();
+    m_readBuffer.clear();
+    m_readOffset = 0;
+    m_frameRemaining = 0;
 
-    m_pipe = CreateNamedPipe(pipeName, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
-        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE, 1, bufferSize, bufferSize, 0, NULL);
+}
 
-    if (m_pipe != INVALID_HANDLE_VALUE)
-    {
-        // Remember that we're the creator of the pipe so we can properly
-        // destroy it.
-        m_creator = true;
-    }
+bool Channel::Create(const char* name)
+{
+
+    Reset();
 
-    if (m_pipe != INVALID_HANDLE_VALUE)
+    PipeTransport* transport = new PipeTransport;
+
+    if (!transport->Create(name))
     {
-        m_doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
-        m_readEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        delete transport;
+        return false;
     }
 
-    return m_pipe != INVALID_HANDLE_VALUE;
+    m_transport = transport;
+    return true;
 
 }
 
 bool Channel::Connect(const char* name)
 {
 
-    char pipeName[256];
-    _snprintf(pipeName, 256, "\\\\.\\pipe\\%s", name);
+    Reset();
 
-    m_pipe = CreateFile(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    PipeTransport* transport = new PipeTransport;
 
-    if (m_pipe != INVALID_HANDLE_VALUE)
+    if (!transport->Connect(name))
     {
-        m_doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
-        m_readEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
-        DWORD flags = PIPE_READMODE_MESSAGE;
-        SetNamedPipeHandleState(m_pipe, &flags, NULL, NULL);
+        delete transport;
+        return false;
     }
 
-    return m_pipe != INVALID_HANDLE_VALUE;
+    m_transport = transport;
+    return true;
 
 }
 
-bool Channel::WaitForConnection()
+bool Channel::Listen(unsigned short port)
 {
-    return ConnectNamedPipe(m_pipe, NULL) != FALSE;
+
+    Reset();
+
+    SocketTransport* transport = new SocketTransport;
+
+    if (!transport->Listen(port))
+    {
+        delete transport;
+        return false;
+    }
+
+    m_transport = transport;
+    return true;
+
 }
 
-void Channel::Destroy()
+bool Channel::Connect(const char* host, unsigned short port)
 {
 
-    if (m_creator)
+    Reset();
+
+    SocketTransport* transport = new SocketTransport;
+
+    if (!transport->Connect(host, port))
     {
-        FlushFileBuffers(m_pipe);
-        DisconnectNamedPipe(m_pipe);
-        m_creator = false;
+        delete transport;
+        return false;
     }
 
-    if (m_doneEvent != INVALID_HANDLE_VALUE)
-    {
-        
-        // Signal the done event so that if we're currently blocked reading,
-        // we'll stop.
+    m_transport = transport;
+    return true;
+
+}
+
+bool Channel::GetSocketAddress(std::string& host, unsigned short& port)
+{
 
-        SetEvent(m_doneEvent);
+    char address[256];
 
-        CloseHandle(m_doneEvent);
-        m_doneEvent = INVALID_HANDLE_VALUE;
+#ifdef _WIN32
+    DWORD addressLength = GetEnvironmentVariableA("DECODA_CHANNEL_ADDRESS", address, sizeof(address));
 
+    if (addressLength == 0 || addressLength >= sizeof(address))
+    {
+        return false;
     }
+#else
+    const char* value = getenv("DECODA_CHANNEL_ADDRESS");
 
-    if (m_readEvent != INVALID_HANDLE_VALUE)
+    if (value == NULL || value[0] == 0 || strlen(value) >= sizeof(address))
     {
-        CloseHandle(m_readEvent);
-        m_readEvent = INVALID_HANDLE_VALUE;
+        return false;
     }
 
-    if (m_pipe != INVALID_HANDLE_VALUE)
+    strcpy(address, value);
+#endif
+
+    char* separator = strrchr(address, ':');
+
+    if (separator == NULL)
     {
-        CloseHandle(m_pipe);
-        m_pipe = INVALID_HANDLE_VALUE;
+        return false;
     }
 
+    host.assign(address, separator);
+    port = static_cast<unsigned short>(atoi(separator + 1));
+
+    return port != 0;
+
 }
 
-bool Channel::Write(const void* buffer, unsigned int length)
+void Channel::Attach(ChannelTransport* transport)
 {
+    Reset();
+    m_transport = transport;
+}
 
-    assert(m_pipe != INVALID_HANDLE_VALUE);
-
-    if (length == 0)
-    {
-        // Because of the way message pipes work, writing 0 is different than
-        // writing nothing.
-        return true;
-    }
+bool Channel::WaitForConnection()
+{
+    return m_transport != NULL && m_transport->WaitForConnection();
+}
 
-    OVERLAPPED overlapped = { 0 };
-    overlapped.hEvent = m_readEvent;
+void Channel::Destroy()
+{
 
-    BOOL result = WriteFile(m_pipe, buffer, length, NULL, &overlapped) != 0;
+    // The transport isn't deleted here since another thread may currently be
+    // blocked reading from it; closing it will release that thread. It's
+    // deleted when the channel is destroyed or recreated.
 
-    if (result == FALSE)
+    if (m_transport != NULL)
     {
-        DWORD error = GetLastError();
+        m_transport->Close();
+    }
 
-        if (error == ERROR_IO_PENDING)
-        {
-           // Wait for the operation to complete so that we don't need to keep around
-           // the buffer.
-           WaitForSingleObject(m_readEvent, INFINITE);
+}
 
-           DWORD numBytesWritten = 0;
+bool Channel::Write(const void* buffer, unsigned int length)
+{
 
-           if (GetOverlappedResult(m_pipe, &overlapped, &numBytesWritten, FALSE))
-           {
-               result = (numBytesWritten == length);
-           }
-        }
+    assert(m_transport != NULL);
+
+    if (m_writeBuffer.empty())
+    {
+        // Reserve space for the frame header, which is filled in when the
+        // frame is flushed.
+        m_writeBuffer.resize(s_headerSize);
     }
 
-    return result == TRUE;
+    const char* data = static_cast<const char*>(buffer);
+    m_writeBuffer.insert(m_writeBuffer.end(), data, data + length);
+
+    return true;
 
 }
 
 bool Channel::WriteUInt32(unsigned int value)
 {
-    DWORD temp = value;
-    return Write(&temp, 4);
+    return Write(&value, 4);
 }
 
 bool Channel::WriteString(const char* value)
@@ -189,14 +235,18 @@ bool Channel::WriteString(const char* value)
 
 bool Channel::WriteString(const std::string& value)
 {
-    unsigned int length = value.length();
-    if (!WriteUInt32(length))
+    return WriteString(value.c_str(), value.length());
+}
+
+bool Channel::WriteString(const char* value, size_t length)
+{
+    if (!WriteUInt32(static_cast<unsigned int>(length)))
     {
         return false;
     }
     if (length > 0)
     {
-        return Write(value.c_str(), length);
+        return Write(value, static_cast<unsigned int>(length));
     }
     return true;
 }
@@ -208,13 +258,7 @@ bool Channel::WriteBool(bool value)
 
 bool Channel::ReadUInt32(unsigned int& value)
 {
-    DWORD temp;
-    if (!Read(&temp, 4))
-    {
-        return false;
-    }
-    value = temp;
-    return true;
+    return Read(&value, 4);
 }
 
 bool Channel::ReadString(std::string& value)
@@ -227,26 +271,42 @@ bool Channel::ReadString(std::string& value)
         return false;
     }
 
+    // Large strings are received directly into the string's memory rather than
+    // copied out of the read buffer. This also preserves any embedded zeros.
+    value.resize(length);
+
     if (length != 0)
     {
-
-        char* buffer = new char[length + 1];
-
-        if (!Read(buffer, length))
+        if (!Read(&value[0], length))
         {
-            delete [] buffer;
+            value.clear();
             return false;
         }
+    }
+
+    return true;
+
+}
+
+bool Channel::ReadBuffer(std::vector<char>& buffer)
+{
 
-        buffer[length] = 0;
-        value = buffer;
-        
-        delete [] buffer;
+    unsigned int length;
 
+    if (!ReadUInt32(length))
+    {
+        return false;
     }
-    else
+
+    buffer.resize(length);
+
+    if (length != 0)
     {
-        value.clear();
+        if (!Read(&buffer[0], length))
+        {
+            buffer.clear();
+            return false;
+        }
     }
 
     return true;
@@ -271,58 +331,143 @@ bool Channel::ReadBool(bool& value)
 bool Channel::Read(void* buffer, unsigned int length)
 {
 
-    assert(m_pipe != INVALID_HANDLE_VALUE);
-    
-    if (length == 0)
+    assert(m_transport != NULL);
+
+    char* data = static_cast<char*>(buffer);
+
+    while (length > 0)
     {
-        // Because of the way message pipes work, reading 0 is different than
-        // reading nothing.
-        return true;
-    }
 
-    OVERLAPPED overlapped = { 0 };
-    overlapped.hEvent = m_readEvent;
+        unsigned int available = static_cast<unsigned int>(m_readBuffer.size()) - m_readOffset;
+
+        if (available > 0)
+        {
 
-    DWORD numBytesRead;
-    BOOL result = ReadFile(m_pipe, buffer, length, &numBytesRead, &overlapped);
+            unsigned int numBytes = length < available ? length : available;
 
-    if (result == FALSE)
-    {
+            memcpy(data, &m_readBuffer[m_readOffset], numBytes);
 
-        DWORD error = GetLastError();
+            m_readOffset += numBytes;
+            data         += numBytes;
+            length       -= numBytes;
 
-        if (error == ERROR_IO_PENDING)
+        }
+        else if (m_frameRemaining == 0)
         {
-        
-            // Wait for the operation to complete.
-            
-            HANDLE events[] =
-                {
-                    m_readEvent,
-                    m_doneEvent,
-                };
-
-            WaitForMultipleObjects(2, events, FALSE, INFINITE);
-
-            if (WaitForSingleObject(m_doneEvent, 0) == WAIT_OBJECT_0)
+            if (!ReadFrame())
             {
-                // The pipe has been closed.
-                result = FALSE;
+                return false;
             }
-            else if (GetOverlappedResult(m_pipe, &overlapped, &numBytesRead, FALSE))
+        }
+        else if (length >= s_directReadSize)
+        {
+
+            // Large reads like script source go straight from the transport
+            // into the caller's memory.
+
+            unsigned int numBytes = length < m_frameRemaining ? length : m_frameRemaining;
+
+            if (!Receive(data, numBytes))
             {
-                result = (numBytesRead == length);
+                return false;
             }
-        
+
+            m_frameRemaining -= numBytes;
+            data             += numBytes;
+            length           -= numBytes;
+
+        }
+        else if (!FillReadBuffer())
+        {
+            return false;
         }
 
     }
 
-    return result == TRUE;
+    return true;
 
 }
 
-void Channel::Flush()
+bool Channel::ReadFrame()
 {
-    //FlushFileBuffers(m_pipe);
+
+    unsigned int frameSize;
+
+    if (!Receive(&frameSize, s_headerSize))
+    {
+        return false;
+    }
+
+    m_readBuffer.clear();
+    m_readOffset     = 0;
+    m_frameRemaining = frameSize;
+
+    return true;
+
+}
+
+bool Channel::FillReadBuffer()
+{
+
+    unsigned int numBytes = m_frameRemaining < s_readBufferSize ? m_frameRemaining : s_readBufferSize;
+
+    m_readBuffer.resize(numBytes);
+    m_readOffset = 0;
+
+    if (!Receive(&m_readBuffer[0], numBytes))
+    {
+        m_readBuffer.clear();
+        return false;
+    }
+
+    m_frameRemaining -= numBytes;
+    return true;
+
+}
+
+bool Channel::Receive(void* buffer, unsigned int length)
+{
+
+    char* data = static_cast<char*>(buffer);
+
+    while (length > 0)
+    {
+
+        unsigned int numBytesRead = 0;
+
+        if (!m_transport->Receive(data, length, numBytesRead))
+        {
+            return false;
+        }
+
+        data   += numBytesRead;
+        length -= numBytesRead;
+
+    }
+
+    return true;
+
+}
+
+bool Channel::Flush()
+{
+
+    if (m_writeBuffer.empty())
+    {
+        return true;
+    }
+
+    assert(m_transport != NULL);
+
+    unsigned int frameSize = static_cast<unsigned int>(m_writeBuffer.size() - s_headerSize);
+    memcpy(&m_writeBuffer[0], &frameSize, s_headerSize);
+
+    bool result = m_transport->Send(&m_writeBuffer[0], static_cast<unsigned int>(m_writeBuffer.size()));
+
+    // Keep the allocated memory around so that the next message doesn't need
+    // to grow the buffer again.
+    m_writeBuffer.clear();
+
+    return result;
+
 }
@@ -23,13 +23,25 @@ along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef CHANNEL_H
 #define CHANNEL_H
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
+
 #include <string>
+#include <vector>
+
+class ChannelTransport;
 
 /**
- * Communication channel used to between two processess. The current
- * implementation uses pipes, however in the future we may expand this
- * to include sockets for communictating across a network.
+ * Communication channel used to between two processess. Data written to the
+ * channel is buffered until Flush is called, at which point it's sent as a
+ * single length-prefixed frame over the underlying transport. Channels
+ * created by name use pipes (Unix domain sockets on POSIX systems), and
+ * channels created with a port use TCP sockets for communicating across a
+ * network.
+ *
+ * The write buffer is shared by every message, so callers writing from more
+ * than one thread must serialize each message up to and including its Flush.
  */
 class Channel
 {
@@ -56,6 +68,31 @@ public:
      */
     bool Connect(const char* name);
 
+    /**
+     * Initializes the channel to accept a TCP connection on the specified
+     * port. WaitForConnection must be called to accept the connection.
+     */
+    bool Listen(unsigned short port);
+
+    /**
+     * Connects to a channel that is listening on a TCP port on the host.
+     */
+    bool Connect(const char* host, unsigned short port);
+
+    /**
+     * Gets the address set in the DECODA_CHANNEL_ADDRESS environment variable,
+     * which has the form host:port. When it's set, the event channel uses the
+     * port and the command channel uses the port after it instead of pipes.
+     * Returns false if the variable isn't set.
+     */
+    static bool GetSocketAddress(std::string& host, unsigned short& port);
+
+    /**
+     * Uses an already connected transport for the channel. The channel takes
+     * ownership of the transport.
+     */
+    void Attach(ChannelTransport* transport);
+
     /**
      * Waits for someone to connect to the channel.
      */
@@ -81,6 +118,12 @@ public:
      */
     bool WriteString(const std::string& value);
 
+    /**
+     * Writes length bytes of a string that isn't null terminated to the channel
+     * and returns immediately.
+     */
+    bool WriteString(const char* value, size_t length);
+
     /**
      * Writes a boolean to the channel and returns immediately.
      */
@@ -98,6 +141,15 @@ public:
      */
     bool ReadString(std::string& value);
 
+    /**
+     * Reads a string written with WriteString into a caller supplied buffer.
+     * The buffer is resized to the length of the data and its existing
+     * capacity is reused, so a buffer that's kept around between calls
+     * doesn't need to be reallocated for each read. The data is not null
+     * terminated.
+     */
+    bool ReadBuffer(std::vector<char>& buffer);
+
     /**
      * Reads a boolean from the channel. This operation blocks until the
      * data is available.
@@ -105,30 +157,58 @@ public:
     bool ReadBool(bool& value);
 
     /**
-     * Flushes the buffers, causing any written data to be sent.
+     * Flushes the buffers, causing any written data to be sent as a single
+     * frame. Each message should be followed by a call to Flush.
      */
-    void Flush();
+    bool Flush();
 
 private:
 
     /**
-     * Writes data to the channel and returns immediately.
+     * Appends data to the write buffer. The data isn't sent until Flush is
+     * called.
      */
     bool Write(const void* buffer, unsigned int length);
 
     /**
-     * Reads data to the channel. Returns when the specified amount has been
+     * Reads data from the channel. Returns when the specified amount has been
      * read or when an error occurs.
      */
     bool Read(void* buffer, unsigned int length);
 
+    /**
+     * Reads the header of the next frame from the transport. The body of the
+     * frame is received as it's read.
+     */
+    bool ReadFrame();
+
+    /**
+     * Receives the next part of the current frame into the read buffer.
+     */
+    bool FillReadBuffer();
+
+    /**
+     * Receives exactly length bytes from the transport.
+     */
+    bool Receive(void* buffer, unsigned int length);
+
+    /**
+     * Deletes the transport and resets the buffers.
+     */
+    void Reset();
+
 private:
 
-    HANDLE  m_pipe;
-    HANDLE  m_doneEvent;
-    HANDLE  m_readEvent;
+    static const unsigned int   s_headerSize        = 4;
+    static const unsigned int   s_readBufferSize    = 64 * 1024;
+    static const unsigned int   s_directReadSize    = 4 * 1024;
+
+    ChannelTransport*   m_transport;
 
-    bool    m_creator;
+    std::vector<char>   m_writeBuffer;
+    std::vector<char>   m_readBuffer;
+    unsigned int        m_readOffset;
+    unsigned int        m_frameRemaining;
 
 };
 
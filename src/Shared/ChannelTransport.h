@@ -0,0 +1,66 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CHANNEL_TRANSPORT_H
+#define CHANNEL_TRANSPORT_H
+
+/**
+ * Interface for the connection a Channel uses to move bytes between two
+ * processes. The channel handles buffering and framing, so the transport
+ * only needs to provide a reliable, ordered stream of bytes.
+ */
+class ChannelTransport
+{
+
+public:
+
+    /**
+     * Destructor.
+     */
+    virtual ~ChannelTransport() { }
+
+    /**
+     * Waits for the other side to connect to the transport.
+     */
+    virtual bool WaitForConnection() = 0;
+
+    /**
+     * Sends the data. This blocks until all of the data has been sent.
+     */
+    virtual bool Send(const void* buffer, unsigned int length) = 0;
+
+    /**
+     * Receives up to length bytes of data. This blocks until at least some
+     * data is available, and the number of bytes that were read is stored
+     * in numBytesRead.
+     */
+    virtual bool Receive(void* buffer, unsigned int length, unsigned int& numBytesRead) = 0;
+
+    /**
+     * Shuts down the transport. If another thread is blocked receiving data,
+     * it will be released.
+     */
+    virtual void Close() = 0;
+
+};
+
+#endif
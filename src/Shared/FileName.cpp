@@ -0,0 +1,94 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "FileName.h"
+
+#include <ctype.h>
+
+void NormalizeFileName(const char* name, std::string& fileName)
+{
+
+    if (name[0] == '@')
+    {
+        ++name;
+    }
+
+    fileName.clear();
+
+    while (name[0] != 0)
+    {
+
+        // Skip references to the current directory so that "./a.lua" and "a.lua"
+        // are the same file.
+        if (name[0] == '.' && (name[1] == '/' || name[1] == '\\') && (fileName.empty() || fileName[fileName.length() - 1] == '/'))
+        {
+            name += 2;
+            continue;
+        }
+
+        char c = name[0];
+
+        if (c == '\\')
+        {
+            c = '/';
+        }
+        else if (c == ':')
+        {
+            c = '_';
+        }
+
+        fileName += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        ++name;
+
+    }
+
+}
+
+size_t GetFileNameMatchLength(const std::string& fileName1, const std::string& fileName2)
+{
+
+    const std::string& shorter = fileName1.length() <= fileName2.length() ? fileName1 : fileName2;
+    const std::string& longer  = fileName1.length() <= fileName2.length() ? fileName2 : fileName1;
+
+    if (shorter.empty())
+    {
+        return 0;
+    }
+
+    size_t start = longer.length() - shorter.length();
+
+    if (longer.compare(start, shorter.length(), shorter) != 0)
+    {
+        return 0;
+    }
+
+    // "b/init.lua" is the end of "a/b/init.lua", but "init.lua" isn't a match for
+    // "xinit.lua".
+    if (start > 0 && longer[start - 1] != '/')
+    {
+        return 0;
+    }
+
+    return shorter.length();
+
+}
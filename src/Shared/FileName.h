@@ -0,0 +1,47 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef FILE_NAME_H
+#define FILE_NAME_H
+
+#include <string>
+
+/**
+ * Normalizes a script or file name so that names frontends use for a file can be
+ * compared with the names scripts are loaded under. The @ prefix and references
+ * to the current directory are removed, back slashes become forward slashes, the
+ * name is made lower case and colons are replaced by underscores (which is what
+ * frontends do when they make a file name out of a script name).
+ */
+void NormalizeFileName(const char* name, std::string& fileName);
+
+/**
+ * Returns the number of characters at the end of two normalized file names that
+ * identify the same file, or 0 if they don't. The names match if one is the end
+ * of the other starting at a directory, so a relative name matches an absolute
+ * name for the same file and a name without a directory matches any file with
+ * that title. Longer matches are better.
+ */
+size_t GetFileNameMatchLength(const std::string& fileName1, const std::string& fileName2);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "PipeTransport.h"
+#include <stdio.h>
+#include <assert.h>
+
+PipeTransport::PipeTransport()
+{
+    m_pipe          = INVALID_HANDLE_VALUE;
+    m_doneEvent     = INVALID_HANDLE_VALUE;
+    m_readEvent     = INVALID_HANDLE_VALUE;
+    m_writeEvent    = INVALID_HANDLE_VALUE;
+    m_creator       = false;
+}
+
+PipeTransport::~PipeTransport()
+{
+    Close();
+}
+
+bool PipeTransport::Create(const char* name)
+{
+
+    char pipeName[256];
+    _snprintf(pipeName, 256, "\\\\.\\pipe\\%s", name);
+
+    DWORD bufferSize = 2048;
+
+    m_pipe = CreateNamedPipe(pipeName, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE, 1, bufferSize, bufferSize, 0, NULL);
+
+    if (m_pipe != INVALID_HANDLE_VALUE)
+    {
+        // Remember that we're the creator of the pipe so we can properly
+        // destroy it.
+        m_creator = true;
+    }
+
+    if (m_pipe != INVALID_HANDLE_VALUE)
+    {
+        m_doneEvent  = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_readEvent  = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_writeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    }
+
+    return m_pipe != INVALID_HANDLE_VALUE;
+
+}
+
+bool PipeTransport::Connect(const char* name)
+{
+
+    char pipeName[256];
+    _snprintf(pipeName, 256, "\\\\.\\pipe\\%s", name);
+
+    m_pipe = CreateFile(pipeName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+
+    if (m_pipe != INVALID_HANDLE_VALUE)
+    {
+        m_doneEvent  = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_readEvent  = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_writeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        DWORD flags = PIPE_READMODE_MESSAGE;
+        SetNamedPipeHandleState(m_pipe, &flags, NULL, NULL);
+    }
+
+    return m_pipe != INVALID_HANDLE_VALUE;
+
+}
+
+bool PipeTransport::WaitForConnection()
+{
+    return ConnectNamedPipe(m_pipe, NULL) != FALSE;
+}
+
+void PipeTransport::Close()
+{
+
+    if (m_creator)
+    {
+        FlushFileBuffers(m_pipe);
+        DisconnectNamedPipe(m_pipe);
+        m_creator = false;
+    }
+
+    if (m_doneEvent != INVALID_HANDLE_VALUE)
+    {
+        
+        // Signal the done event so that if we're currently blocked reading,
+        // we'll stop.
+
+        SetEvent(m_doneEvent);
+
+        CloseHandle(m_doneEvent);
+        m_doneEvent = INVALID_HANDLE_VALUE;
+
+    }
+
+    if (m_readEvent != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_readEvent);
+        m_readEvent = INVALID_HANDLE_VALUE;
+    }
+
+    if (m_writeEvent != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_writeEvent);
+        m_writeEvent = INVALID_HANDLE_VALUE;
+    }
+
+    if (m_pipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_pipe);
+        m_pipe = INVALID_HANDLE_VALUE;
+    }
+
+}
+
+bool PipeTransport::Send(const void* buffer, unsigned int length)
+{
+
+    assert(m_pipe != INVALID_HANDLE_VALUE);
+
+    if (length == 0)
+    {
+        // Because of the way message pipes work, writing 0 is different than
+        // writing nothing.
+        return true;
+    }
+
+    OVERLAPPED overlapped = { 0 };
+    overlapped.hEvent = m_writeEvent;
+
+    BOOL result = WriteFile(m_pipe, buffer, length, NULL, &overlapped) != 0;
+
+    if (result == FALSE)
+    {
+        DWORD error = GetLastError();
+
+        if (error == ERROR_IO_PENDING)
+        {
+           // Wait for the operation to complete so that we don't need to keep around
+           // the buffer.
+           WaitForSingleObject(m_writeEvent, INFINITE);
+
+           DWORD numBytesWritten = 0;
+
+           if (GetOverlappedResult(m_pipe, &overlapped, &numBytesWritten, FALSE))
+           {
+               result = (numBytesWritten == length);
+           }
+        }
+    }
+
+    return result == TRUE;
+
+}
+
+bool PipeTransport::Receive(void* buffer, unsigned int length, unsigned int& numBytesRead)
+{
+
+    assert(m_pipe != INVALID_HANDLE_VALUE);
+
+    numBytesRead = 0;
+    
+    if (length == 0)
+    {
+        // Because of the way message pipes work, reading 0 is different than
+        // reading nothing.
+        return true;
+    }
+
+    OVERLAPPED overlapped = { 0 };
+    overlapped.hEvent = m_readEvent;
+
+    DWORD numBytes = 0;
+    BOOL result = ReadFile(m_pipe, buffer, length, &numBytes, &overlapped);
+
+    if (result == FALSE)
+    {
+
+        DWORD error = GetLastError();
+
+        if (error == ERROR_IO_PENDING)
+        {
+        
+            // Wait for the operation to complete.
+            
+            HANDLE events[] =
+                {
+                    m_readEvent,
+                    m_doneEvent,
+                };
+
+            WaitForMultipleObjects(2, events, FALSE, INFINITE);
+
+            if (WaitForSingleObject(m_doneEvent, 0) == WAIT_OBJECT_0)
+            {
+                // The pipe has been closed.
+                return false;
+            }
+
+            result = GetOverlappedResult(m_pipe, &overlapped, &numBytes, FALSE);
+            error  = GetLastError();
+        
+        }
+
+        // Since we're in message mode, reading part of a message reports that
+        // there's more data. The rest of the message is returned by the next read.
+        if (result == FALSE && error == ERROR_MORE_DATA)
+        {
+            result = TRUE;
+        }
+
+    }
+
+    numBytesRead = numBytes;
+    return result == TRUE && numBytes > 0;
+
+}
@@ -0,0 +1,91 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PIPE_TRANSPORT_H
+#define PIPE_TRANSPORT_H
+
+#include "ChannelTransport.h"
+
+#include <windows.h>
+
+/**
+ * Channel transport that uses a named pipe to communicate between two
+ * processes on the same machine.
+ */
+class PipeTransport : public ChannelTransport
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    PipeTransport();
+
+    /**
+     * Destructor.
+     */
+    virtual ~PipeTransport();
+
+    /**
+     * Creates a new named pipe.
+     */
+    bool Create(const char* name);
+
+    /**
+     * Connects to an existing named pipe.
+     */
+    bool Connect(const char* name);
+
+    /**
+     * Waits for someone to connect to the pipe.
+     */
+    virtual bool WaitForConnection();
+
+    /**
+     * Sends the data. This blocks until all of the data has been sent.
+     */
+    virtual bool Send(const void* buffer, unsigned int length);
+
+    /**
+     * Receives up to length bytes of data. This blocks until at least some
+     * data is available.
+     */
+    virtual bool Receive(void* buffer, unsigned int length, unsigned int& numBytesRead);
+
+    /**
+     * Shuts down the pipe.
+     */
+    virtual void Close();
+
+private:
+
+    HANDLE  m_pipe;
+    HANDLE  m_doneEvent;
+    HANDLE  m_readEvent;
+    HANDLE  m_writeEvent;
+
+    bool    m_creator;
+
+};
+
+#endif
@@ -0,0 +1,386 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "PosixTransport.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+PosixTransport::PosixTransport()
+{
+    m_listenSocket  = -1;
+    m_socket        = -1;
+}
+
+PosixTransport::~PosixTransport()
+{
+
+    Close();
+
+    if (m_listenSocket != -1)
+    {
+        close(m_listenSocket);
+    }
+
+    if (m_socket != -1)
+    {
+        close(m_socket);
+    }
+
+    if (!m_path.empty())
+    {
+        unlink(m_path.c_str());
+    }
+
+}
+
+void PosixTransport::GetSocketPath(const char* name, std::string& path)
+{
+    if (strchr(name, '/') == NULL)
+    {
+        path = "/tmp/";
+        path += name;
+    }
+    else
+    {
+        path = name;
+    }
+}
+
+bool PosixTransport::Create(const char* name)
+{
+
+    std::string path;
+    GetSocketPath(name, path);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.length() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    strcpy(address.sun_path, path.c_str());
+
+    m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (m_listenSocket == -1)
+    {
+        return false;
+    }
+
+    // A socket left behind by a process that didn't exit cleanly would keep us
+    // from binding.
+    unlink(path.c_str());
+
+    if (bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(m_listenSocket, 1) == -1)
+    {
+        close(m_listenSocket);
+        m_listenSocket = -1;
+        return false;
+    }
+
+    m_path = path;
+    return true;
+
+}
+
+bool PosixTransport::Connect(const char* name)
+{
+
+    std::string path;
+    GetSocketPath(name, path);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.length() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    strcpy(address.sun_path, path.c_str());
+
+    int connectSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (connectSocket == -1)
+    {
+        return false;
+    }
+
+    if (connect(connectSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        close(connectSocket);
+        return false;
+    }
+
+    return InitializeSocket(connectSocket, false);
+
+}
+
+bool PosixTransport::Listen(unsigned short port)
+{
+
+    m_listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (m_listenSocket == -1)
+    {
+        return false;
+    }
+
+    int reuseAddress = 1;
+    setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(port);
+
+    if (bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+        listen(m_listenSocket, 1) == -1)
+    {
+        close(m_listenSocket);
+        m_listenSocket = -1;
+        return false;
+    }
+
+    return true;
+
+}
+
+bool PosixTransport::Connect(const char* host, unsigned short port)
+{
+
+    char service[16];
+    snprintf(service, sizeof(service), "%u", port);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = SOCK_STREAM;
+    hints.ai_protocol   = IPPROTO_TCP;
+
+    addrinfo* addresses = NULL;
+
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        return false;
+    }
+
+    int connectSocket = -1;
+
+    for (addrinfo* address = addresses; address != NULL; address = address->ai_next)
+    {
+
+        connectSocket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+        if (connectSocket == -1)
+        {
+            continue;
+        }
+
+        if (connect(connectSocket, address->ai_addr, address->ai_addrlen) == 0)
+        {
+            break;
+        }
+
+        close(connectSocket);
+        connectSocket = -1;
+
+    }
+
+    freeaddrinfo(addresses);
+
+    if (connectSocket == -1)
+    {
+        return false;
+    }
+
+    return InitializeSocket(connectSocket, true);
+
+}
+
+bool PosixTransport::CreatePair(PosixTransport*& transport1, PosixTransport*& transport2)
+{
+
+    int sockets[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1)
+    {
+        return false;
+    }
+
+    transport1 = new PosixTransport;
+    transport1->InitializeSocket(sockets[0], false);
+
+    transport2 = new PosixTransport;
+    transport2->InitializeSocket(sockets[1], false);
+
+    return true;
+
+}
+
+bool PosixTransport::WaitForConnection()
+{
+
+    if (m_listenSocket == -1)
+    {
+        return false;
+    }
+
+    int acceptSocket = -1;
+
+    while (acceptSocket == -1)
+    {
+        acceptSocket = accept(m_listenSocket, NULL, NULL);
+        if (acceptSocket == -1 && errno != EINTR)
+        {
+            // This also happens when the transport is closed while we're waiting.
+            return false;
+        }
+    }
+
+    // We only accept a single connection, so we don't need to keep listening.
+    close(m_listenSocket);
+    m_listenSocket = -1;
+
+    return InitializeSocket(acceptSocket, m_path.empty());
+
+}
+
+bool PosixTransport::InitializeSocket(int socket, bool tcp)
+{
+
+    m_socket = socket;
+
+    if (tcp)
+    {
+        // Each message is sent as a single frame, so there's no benefit to delaying
+        // small writes, and doing so would add latency to every command.
+        int noDelay = 1;
+        setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+
+    return true;
+
+}
+
+void PosixTransport::Close()
+{
+
+    // Shutting the sockets down releases any thread that's blocked accepting,
+    // sending or receiving on them.
+
+    if (m_listenSocket != -1)
+    {
+        shutdown(m_listenSocket, SHUT_RDWR);
+    }
+
+    if (m_socket != -1)
+    {
+        shutdown(m_socket, SHUT_RDWR);
+    }
+
+}
+
+bool PosixTransport::Send(const void* buffer, unsigned int length)
+{
+
+    assert(m_socket != -1);
+
+    const char* data = static_cast<const char*>(buffer);
+
+    while (length > 0)
+    {
+
+        ssize_t result = send(m_socket, data, length, MSG_NOSIGNAL);
+
+        if (result == -1)
+        {
+            if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            data   += result;
+            length -= static_cast<unsigned int>(result);
+        }
+
+    }
+
+    return true;
+
+}
+
+bool PosixTransport::Receive(void* buffer, unsigned int length, unsigned int& numBytesRead)
+{
+
+    assert(m_socket != -1);
+
+    numBytesRead = 0;
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    while (true)
+    {
+
+        ssize_t result = recv(m_socket, buffer, length, 0);
+
+        if (result > 0)
+        {
+            numBytesRead = static_cast<unsigned int>(result);
+            return true;
+        }
+
+        if (result == 0 || errno != EINTR)
+        {
+            // The connection has been closed.
+            return false;
+        }
+
+    }
+
+}
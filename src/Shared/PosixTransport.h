@@ -0,0 +1,126 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef POSIX_TRANSPORT_H
+#define POSIX_TRANSPORT_H
+
+#include "ChannelTransport.h"
+
+#include <string>
+
+/**
+ * Channel transport for POSIX systems that uses a stream socket. Channels
+ * created by name use a Unix domain socket (the name is a path, or a file in
+ * /tmp if it doesn't have a directory), and channels created with a port use
+ * TCP with Nagle's algorithm disabled, since the channel already coalesces
+ * each message into a single frame before sending it. A connected pair can
+ * also be created in the same process with CreatePair.
+ */
+class PosixTransport : public ChannelTransport
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    PosixTransport();
+
+    /**
+     * Destructor.
+     */
+    virtual ~PosixTransport();
+
+    /**
+     * Creates a Unix domain socket with the name. WaitForConnection must be
+     * called to accept the connection.
+     */
+    bool Create(const char* name);
+
+    /**
+     * Connects to an existing Unix domain socket.
+     */
+    bool Connect(const char* name);
+
+    /**
+     * Starts listening for a TCP connection on the specified port. The
+     * connection is accepted by WaitForConnection.
+     */
+    bool Listen(unsigned short port);
+
+    /**
+     * Connects to a host that is listening on the specified port.
+     */
+    bool Connect(const char* host, unsigned short port);
+
+    /**
+     * Creates two transports connected to each other with socketpair. The
+     * caller owns both transports.
+     */
+    static bool CreatePair(PosixTransport*& transport1, PosixTransport*& transport2);
+
+    /**
+     * Waits for someone to connect to the socket we're listening on.
+     */
+    virtual bool WaitForConnection();
+
+    /**
+     * Sends the data. This blocks until all of the data has been sent.
+     */
+    virtual bool Send(const void* buffer, unsigned int length);
+
+    /**
+     * Receives up to length bytes of data. This blocks until at least some
+     * data is available.
+     */
+    virtual bool Receive(void* buffer, unsigned int length, unsigned int& numBytesRead);
+
+    /**
+     * Shuts down the connection. The sockets stay open until the transport is
+     * destroyed, so that a thread blocked on them is released rather than left
+     * using a descriptor that may have been reused.
+     */
+    virtual void Close();
+
+private:
+
+    /**
+     * Gets the path of the Unix domain socket for a channel name.
+     */
+    static void GetSocketPath(const char* name, std::string& path);
+
+    /**
+     * Sets up a connected socket for use by the transport.
+     */
+    bool InitializeSocket(int socket, bool tcp);
+
+private:
+
+    int         m_listenSocket;
+    int         m_socket;
+
+    std::string m_path;         // Path of the Unix domain socket we created.
+
+};
+
+#endif
@@ -50,6 +50,7 @@ enum EventId
     EventId_Message             = 9,    // Event containing a string message from the debugger.
     EventId_SessionEnd          = 8,    // This is used internally and shouldn't be sent.
     EventId_NameVM              = 10,   // Sent when the name of a VM is set.
+    EventId_UnloadScript        = 12,   // Sent when a script is no longer referenced by any VM.
 };
 
 enum CommandId
@@ -67,6 +68,52 @@ enum CommandId
     CommandId_LoadDone          = 12,   // Signals to the backend that the frontend has finished processing a load.
     CommandId_IgnoreException   = 13,   // Instructs the backend to ignore the specified exception message in the future.
     CommandId_DeleteAllBreakpoints = 14,// Instructs the backend to clear all breakpoints set
+    CommandId_SetBreakpointCondition = 15,// Sets the condition, hit condition and log message for a breakpoint.
+    CommandId_StepOut           = 16,   // Steps until the current function returns.
+    CommandId_ExpandValue       = 17,   // Gets a range of the elements of a table returned by a previous evaluation.
+    CommandId_SetProtocolVersion = 18,  // Tells the backend which version of the protocol the frontend understands.
+    CommandId_EvaluateBatch     = 19,   // Evaluates a list of expressions in the same context.
+    CommandId_GetNativeStack    = 20,   // Gets the call stack including the native frames for a VM stopped at a break.
+    CommandId_GetStringRange    = 21,   // Gets a range of the bytes of a string returned by a previous evaluation.
+    CommandId_SetMaxStringLength = 22,  // Sets the length above which strings are sent as a preview.
+    CommandId_SetFileBreakpoints = 23,  // Sets the breakpoints applied to scripts with a file name when they're loaded.
+    CommandId_SetLoadPolicy     = 24,   // Sets which loaded scripts the backend waits for the frontend to process.
+    CommandId_GetExpressionCacheStats = 25, // Gets the hit and miss counts of the compiled expression cache for a VM.
+};
+
+/**
+ * Controls when the backend waits for CommandId_LoadDone after sending EventId_LoadScript.
+ * Scripts whose file name was registered with CommandId_SetFileBreakpoints have their
+ * breakpoints applied by the backend, so only unresolved scripts need the frontend.
+ */
+enum LoadPolicy
+{
+    LoadPolicy_Wait             = 0,    // Wait for every new script.
+    LoadPolicy_WaitIfUnresolved = 1,    // Wait for scripts with a file name that wasn't registered.
+    LoadPolicy_NoWait           = 2,    // Only wait for scripts whose file was registered with the wait flag.
+};
+
+enum ProtocolVersion
+{
+    ProtocolVersion_Initial     = 1,    // Values are sent as XML.
+    ProtocolVersion_BinaryValues = 2,   // Values are sent with the binary encoding described by ValueTag.
+    ProtocolVersion_Current     = ProtocolVersion_BinaryValues,
+};
+
+/**
+ * Tags that start each value in the binary value encoding. Numbers are written as
+ * 32-bit little endian integers and strings as a 32-bit length followed by the
+ * characters (without a terminator).
+ */
+enum ValueTag
+{
+    ValueTag_Value              = 0,    // string type, string data
+    ValueTag_Table              = 1,    // string type, uint id, uint handle, uint size, uint numElements, numElements key/value pairs
+    ValueTag_Function           = 2,    // uint script, uint line
+    ValueTag_Error              = 3,    // string message
+    ValueTag_Values             = 4,    // uint numValues, numValues values
+    ValueTag_Reference          = 5,    // uint id of a table written earlier in the same value
+    ValueTag_TruncatedValue     = 6,    // string type, string preview, uint handle, uint length
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,168 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "Sha256.h"
+
+#include <string.h>
+
+namespace
+{
+
+    const unsigned int s_roundConstants[64] =
+        {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+    inline unsigned int RotateRight(unsigned int value, unsigned int bits)
+    {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    /**
+     * Processes one 64 byte block of the message.
+     */
+    void ProcessBlock(unsigned int state[8], const unsigned char* block)
+    {
+
+        unsigned int w[64];
+
+        for (unsigned int i = 0; i < 16; ++i)
+        {
+            w[i] = (block[i * 4 + 0] << 24) |
+                   (block[i * 4 + 1] << 16) |
+                   (block[i * 4 + 2] <<  8) |
+                   (block[i * 4 + 3]);
+        }
+
+        for (unsigned int i = 16; i < 64; ++i)
+        {
+            unsigned int s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            unsigned int s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19)  ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        unsigned int a = state[0];
+        unsigned int b = state[1];
+        unsigned int c = state[2];
+        unsigned int d = state[3];
+        unsigned int e = state[4];
+        unsigned int f = state[5];
+        unsigned int g = state[6];
+        unsigned int h = state[7];
+
+        for (unsigned int i = 0; i < 64; ++i)
+        {
+
+            unsigned int s1    = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+            unsigned int ch    = (e & f) ^ (~e & g);
+            unsigned int temp1 = h + s1 + ch + s_roundConstants[i] + w[i];
+            unsigned int s0    = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+            unsigned int maj   = (a & b) ^ (a & c) ^ (b & c);
+            unsigned int temp2 = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+
+    }
+
+}
+
+std::string ComputeSha256(const void* data, size_t length)
+{
+
+    unsigned int state[8] =
+        {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+        };
+
+    const unsigned char* message = static_cast<const unsigned char*>(data);
+    size_t remaining = length;
+
+    // Process all of the complete blocks directly from the data.
+    while (remaining >= 64)
+    {
+        ProcessBlock(state, message);
+        message   += 64;
+        remaining -= 64;
+    }
+
+    // Pad the final block(s) with a 1 bit followed by zeros and the length of
+    // the message in bits.
+
+    unsigned char block[128] = { 0 };
+    memcpy(block, message, remaining);
+    block[remaining] = 0x80;
+
+    size_t paddedLength = remaining + 1 + 8 <= 64 ? 64 : 128;
+    unsigned long long numBits = static_cast<unsigned long long>(length) * 8;
+
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        block[paddedLength - 1 - i] = static_cast<unsigned char>(numBits >> (i * 8));
+    }
+
+    ProcessBlock(state, block);
+
+    if (paddedLength == 128)
+    {
+        ProcessBlock(state, block + 64);
+    }
+
+    static const char hexDigits[] = "0123456789abcdef";
+
+    std::string digest;
+    digest.resize(64);
+
+    for (unsigned int i = 0; i < 32; ++i)
+    {
+        unsigned char byte = static_cast<unsigned char>(state[i / 4] >> (24 - (i % 4) * 8));
+        digest[i * 2 + 0] = hexDigits[byte >> 4];
+        digest[i * 2 + 1] = hexDigits[byte & 0xF];
+    }
+
+    return digest;
+
+}
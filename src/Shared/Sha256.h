@@ -0,0 +1,36 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <string>
+
+/**
+ * Computes the SHA-256 digest of the data and returns it as a lowercase
+ * hexadecimal string. This is used to identify script sources so that the
+ * same source only needs to be sent between the debugger and the debuggee
+ * once.
+ */
+std::string ComputeSha256(const void* data, size_t length);
+
+#endif
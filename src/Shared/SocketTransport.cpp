@@ -0,0 +1,333 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "SocketTransport.h"
+#include <stdio.h>
+#include <assert.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+SocketTransport::SocketTransport()
+{
+    m_listenSocket          = INVALID_SOCKET;
+    m_socket                = INVALID_SOCKET;
+    m_doneEvent             = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_readEvent             = WSACreateEvent();
+    m_initializedWinsock    = false;
+
+    WSADATA data;
+    m_initializedWinsock = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+SocketTransport::~SocketTransport()
+{
+
+    Close();
+
+    CloseHandle(m_doneEvent);
+    WSACloseEvent(m_readEvent);
+
+    if (m_initializedWinsock)
+    {
+        WSACleanup();
+    }
+
+}
+
+bool SocketTransport::Listen(unsigned short port)
+{
+
+    if (!m_initializedWinsock)
+    {
+        return false;
+    }
+
+    m_listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (m_listenSocket == INVALID_SOCKET)
+    {
+        return false;
+    }
+
+    sockaddr_in address = { 0 };
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(port);
+
+    if (bind(m_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+        listen(m_listenSocket, 1) == SOCKET_ERROR)
+    {
+        closesocket(m_listenSocket);
+        m_listenSocket = INVALID_SOCKET;
+        return false;
+    }
+
+    // This also puts the socket into non-blocking mode.
+    WSAEventSelect(m_listenSocket, m_readEvent, FD_ACCEPT);
+
+    return true;
+
+}
+
+bool SocketTransport::Connect(const char* host, unsigned short port)
+{
+
+    if (!m_initializedWinsock)
+    {
+        return false;
+    }
+
+    char service[16];
+    _snprintf(service, 16, "%u", port);
+
+    addrinfo hints = { 0 };
+    hints.ai_family     = AF_UNSPEC;
+    hints.ai_socktype   = SOCK_STREAM;
+    hints.ai_protocol   = IPPROTO_TCP;
+
+    addrinfo* addresses = NULL;
+
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        return false;
+    }
+
+    SOCKET connectSocket = INVALID_SOCKET;
+
+    for (addrinfo* address = addresses; address != NULL; address = address->ai_next)
+    {
+
+        connectSocket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+        if (connectSocket == INVALID_SOCKET)
+        {
+            continue;
+        }
+
+        if (connect(connectSocket, address->ai_addr, static_cast<int>(address->ai_addrlen)) != SOCKET_ERROR)
+        {
+            break;
+        }
+
+        closesocket(connectSocket);
+        connectSocket = INVALID_SOCKET;
+
+    }
+
+    freeaddrinfo(addresses);
+
+    if (connectSocket == INVALID_SOCKET)
+    {
+        return false;
+    }
+
+    return InitializeSocket(connectSocket);
+
+}
+
+bool SocketTransport::WaitForConnection()
+{
+
+    if (m_listenSocket == INVALID_SOCKET)
+    {
+        return false;
+    }
+
+    SOCKET acceptSocket = INVALID_SOCKET;
+
+    while (acceptSocket == INVALID_SOCKET)
+    {
+
+        WSAResetEvent(m_readEvent);
+        acceptSocket = accept(m_listenSocket, NULL, NULL);
+
+        if (acceptSocket == INVALID_SOCKET)
+        {
+            if (WSAGetLastError() != WSAEWOULDBLOCK || !WaitForEvent(m_readEvent))
+            {
+                return false;
+            }
+        }
+
+    }
+
+    // We only accept a single connection, so we don't need to keep listening.
+    closesocket(m_listenSocket);
+    m_listenSocket = INVALID_SOCKET;
+
+    return InitializeSocket(acceptSocket);
+
+}
+
+bool SocketTransport::InitializeSocket(UINT_PTR socket)
+{
+
+    m_socket = socket;
+
+    // Each message is sent as a single frame, so there's no benefit to delaying
+    // small writes, and doing so would add latency to every command.
+    BOOL noDelay = TRUE;
+    setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+    // The accepted socket inherits the event selection of the listening socket,
+    // so this replaces it. This also puts the socket into non-blocking mode.
+    if (WSAEventSelect(m_socket, m_readEvent, FD_READ | FD_CLOSE) == SOCKET_ERROR)
+    {
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+        return false;
+    }
+
+    return true;
+
+}
+
+bool SocketTransport::WaitForEvent(HANDLE event)
+{
+
+    HANDLE events[] =
+        {
+            event,
+            m_doneEvent,
+        };
+
+    DWORD result = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+    return result == WAIT_OBJECT_0;
+
+}
+
+void SocketTransport::Close()
+{
+
+    // Signal the done event so that if we're currently blocked reading or
+    // writing, we'll stop.
+    SetEvent(m_doneEvent);
+
+    if (m_listenSocket != INVALID_SOCKET)
+    {
+        closesocket(m_listenSocket);
+        m_listenSocket = INVALID_SOCKET;
+    }
+
+    if (m_socket != INVALID_SOCKET)
+    {
+        shutdown(m_socket, SD_BOTH);
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+    }
+
+}
+
+bool SocketTransport::Send(const void* buffer, unsigned int length)
+{
+
+    assert(m_socket != INVALID_SOCKET);
+
+    const char* data = static_cast<const char*>(buffer);
+
+    while (length > 0)
+    {
+
+        int result = send(m_socket, data, length, 0);
+
+        if (result == SOCKET_ERROR)
+        {
+
+            if (WSAGetLastError() != WSAEWOULDBLOCK)
+            {
+                return false;
+            }
+
+            // The socket's send buffer is full. The read event is owned by
+            // the receiving thread, so we wait for the socket to become
+            // writable with select, checking periodically if we've been
+            // closed.
+
+            fd_set writeSet;
+            FD_ZERO(&writeSet);
+            FD_SET(m_socket, &writeSet);
+
+            timeval timeout = { 0, 100 * 1000 };
+            select(0, NULL, &writeSet, NULL, &timeout);
+
+            if (WaitForSingleObject(m_doneEvent, 0) == WAIT_OBJECT_0)
+            {
+                return false;
+            }
+
+        }
+        else
+        {
+            data   += result;
+            length -= result;
+        }
+
+    }
+
+    return true;
+
+}
+
+bool SocketTransport::Receive(void* buffer, unsigned int length, unsigned int& numBytesRead)
+{
+
+    assert(m_socket != INVALID_SOCKET);
+
+    numBytesRead = 0;
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    while (true)
+    {
+
+        // Reset the event before we try to read, so that if no data is
+        // available the event will be signaled when it arrives.
+        WSAResetEvent(m_readEvent);
+
+        int result = recv(m_socket, static_cast<char*>(buffer), length, 0);
+
+        if (result > 0)
+        {
+            numBytesRead = result;
+            return true;
+        }
+
+        if (result == 0 || WSAGetLastError() != WSAEWOULDBLOCK)
+        {
+            // The connection has been closed.
+            return false;
+        }
+
+        if (!WaitForEvent(m_readEvent))
+        {
+            return false;
+        }
+
+    }
+
+}
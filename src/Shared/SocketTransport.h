@@ -0,0 +1,108 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SOCKET_TRANSPORT_H
+#define SOCKET_TRANSPORT_H
+
+#include "ChannelTransport.h"
+
+#include <windows.h>
+
+/**
+ * Channel transport that uses a TCP connection, which allows the debugger and
+ * the debugged process to run on different machines. The socket is used in
+ * non-blocking mode with Nagle's algorithm disabled, since the channel already
+ * coalesces each message into a single frame before sending it.
+ */
+class SocketTransport : public ChannelTransport
+{
+
+public:
+
+    /**
+     * Constructor.
+     */
+    SocketTransport();
+
+    /**
+     * Destructor.
+     */
+    virtual ~SocketTransport();
+
+    /**
+     * Starts listening for a connection on the specified port. The connection
+     * is accepted by WaitForConnection.
+     */
+    bool Listen(unsigned short port);
+
+    /**
+     * Connects to a host that is listening on the specified port.
+     */
+    bool Connect(const char* host, unsigned short port);
+
+    /**
+     * Waits for someone to connect to the port we're listening on.
+     */
+    virtual bool WaitForConnection();
+
+    /**
+     * Sends the data. This blocks until all of the data has been sent.
+     */
+    virtual bool Send(const void* buffer, unsigned int length);
+
+    /**
+     * Receives up to length bytes of data. This blocks until at least some
+     * data is available.
+     */
+    virtual bool Receive(void* buffer, unsigned int length, unsigned int& numBytesRead);
+
+    /**
+     * Shuts down the connection.
+     */
+    virtual void Close();
+
+private:
+
+    /**
+     * Sets up a connected socket for use by the transport.
+     */
+    bool InitializeSocket(UINT_PTR socket);
+
+    /**
+     * Waits for the socket to signal one of the network events. Returns false
+     * if the transport was closed while waiting.
+     */
+    bool WaitForEvent(HANDLE event);
+
+private:
+
+    UINT_PTR    m_listenSocket;
+    UINT_PTR    m_socket;
+
+    HANDLE      m_doneEvent;
+    HANDLE      m_readEvent;
+
+    bool        m_initializedWinsock;
+
+};
+
+#endif
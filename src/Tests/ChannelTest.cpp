@@ -0,0 +1,302 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "TestHarness.h"
+#include "Channel.h"
+#include "ChannelTransport.h"
+
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+int g_numFailedChecks = 0;
+
+/**
+ * Bytes sent from one memory transport to another.
+ */
+struct MemoryStream
+{
+    std::deque<char>            data;
+    std::vector<unsigned int>   sends;      // Length of each call to Send.
+};
+
+/**
+ * Transport that sends into a memory stream and receives from another one, so
+ * that two channels can be connected without any threads. Receive returns at
+ * most maxReceive bytes at a time to exercise partial reads, and fails once
+ * the stream is empty since nothing else would ever fill it.
+ */
+class MemoryTransport : public ChannelTransport
+{
+
+public:
+
+    MemoryTransport(MemoryStream* sendStream, MemoryStream* receiveStream, unsigned int maxReceive)
+        : m_sendStream(sendStream), m_receiveStream(receiveStream), m_maxReceive(maxReceive)
+    {
+    }
+
+    virtual bool WaitForConnection()
+    {
+        return true;
+    }
+
+    virtual bool Send(const void* buffer, unsigned int length)
+    {
+        const char* data = static_cast<const char*>(buffer);
+        m_sendStream->data.insert(m_sendStream->data.end(), data, data + length);
+        m_sendStream->sends.push_back(length);
+        return true;
+    }
+
+    virtual bool Receive(void* buffer, unsigned int length, unsigned int& numBytesRead)
+    {
+
+        numBytesRead = 0;
+
+        if (m_receiveStream->data.empty())
+        {
+            return false;
+        }
+
+        char* data = static_cast<char*>(buffer);
+
+        while (numBytesRead < length && numBytesRead < m_maxReceive && !m_receiveStream->data.empty())
+        {
+            data[numBytesRead] = m_receiveStream->data.front();
+            m_receiveStream->data.pop_front();
+            ++numBytesRead;
+        }
+
+        return true;
+
+    }
+
+    virtual void Close()
+    {
+    }
+
+private:
+
+    MemoryStream*   m_sendStream;
+    MemoryStream*   m_receiveStream;
+    unsigned int    m_maxReceive;
+
+};
+
+/**
+ * Connects the writer channel to the reader channel through the stream.
+ */
+static void ConnectChannels(Channel& writer, Channel& reader, MemoryStream& stream, unsigned int maxReceive = 0xFFFFFFFF)
+{
+    writer.Attach(new MemoryTransport(&stream, NULL, maxReceive));
+    reader.Attach(new MemoryTransport(NULL, &stream, maxReceive));
+}
+
+static unsigned int GetUInt32(const MemoryStream& stream, size_t offset)
+{
+    unsigned char bytes[4];
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        bytes[i] = static_cast<unsigned char>(stream.data[offset + i]);
+    }
+    unsigned int value;
+    memcpy(&value, bytes, 4);
+    return value;
+}
+
+static void TestFraming()
+{
+
+    MemoryStream stream;
+    Channel writer;
+    Channel reader;
+
+    ConnectChannels(writer, reader, stream);
+
+    // Nothing is sent until the message is flushed, and then it's sent as one
+    // frame with the length of the body in front of it.
+
+    writer.WriteUInt32(7);
+    writer.WriteString("abc");
+    writer.WriteBool(true);
+
+    CHECK(stream.data.empty());
+    CHECK(writer.Flush());
+
+    CHECK_EQUAL(1u, stream.sends.size());
+    CHECK_EQUAL(static_cast<size_t>(4 + 4 + 4 + 3 + 4), stream.data.size());
+    CHECK_EQUAL(4u + 4u + 3u + 4u, GetUInt32(stream, 0));
+    CHECK_EQUAL(7u, GetUInt32(stream, 4));
+
+    // Flushing without writing anything doesn't send an empty frame.
+    CHECK(writer.Flush());
+    CHECK_EQUAL(1u, stream.sends.size());
+
+    unsigned int value = 0;
+    std::string text;
+    bool flag = false;
+
+    CHECK(reader.ReadUInt32(value));
+    CHECK(reader.ReadString(text));
+    CHECK(reader.ReadBool(flag));
+
+    CHECK_EQUAL(7u, value);
+    CHECK_EQUAL(std::string("abc"), text);
+    CHECK(flag);
+
+    // The stream is closed once it's empty.
+    CHECK(!reader.ReadUInt32(value));
+
+}
+
+static void TestMultipleFrames()
+{
+
+    MemoryStream stream;
+    Channel writer;
+    Channel reader;
+
+    // Receiving a few bytes at a time splits the headers and the values.
+    ConnectChannels(writer, reader, stream, 3);
+
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+        writer.WriteUInt32(i);
+        writer.WriteString(std::string(i, static_cast<char>('a' + i % 26)));
+        writer.Flush();
+    }
+
+    CHECK_EQUAL(100u, stream.sends.size());
+
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+
+        unsigned int value = 0;
+        std::string text;
+
+        CHECK(reader.ReadUInt32(value));
+        CHECK(reader.ReadString(text));
+
+        CHECK_EQUAL(i, value);
+        CHECK_EQUAL(std::string(i, static_cast<char>('a' + i % 26)), text);
+
+    }
+
+}
+
+static void TestLargeStrings()
+{
+
+    MemoryStream stream;
+    Channel writer;
+    Channel reader;
+
+    ConnectChannels(writer, reader, stream, 10000);
+
+    // Strings larger than the read buffer are received directly into the
+    // destination, and embedded zeros are preserved.
+
+    std::string large(200 * 1024, 0);
+
+    for (size_t i = 0; i < large.length(); ++i)
+    {
+        large[i] = static_cast<char>(i * 7);
+    }
+
+    writer.WriteString(large);
+    writer.WriteUInt32(42);
+    writer.WriteString(large.data(), 5000);
+    writer.Flush();
+
+    std::string text;
+    unsigned int value = 0;
+    std::vector<char> buffer(10, 'x');
+
+    CHECK(reader.ReadString(text));
+    CHECK(reader.ReadUInt32(value));
+    CHECK(reader.ReadBuffer(buffer));
+
+    CHECK(text == large);
+    CHECK_EQUAL(42u, value);
+    CHECK_EQUAL(static_cast<size_t>(5000), buffer.size());
+    CHECK(memcmp(&buffer[0], large.data(), 5000) == 0);
+
+}
+
+static void TestEmptyStrings()
+{
+
+    MemoryStream stream;
+    Channel writer;
+    Channel reader;
+
+    ConnectChannels(writer, reader, stream);
+
+    writer.WriteString("");
+    writer.WriteString(std::string());
+    writer.Flush();
+
+    std::string text("x");
+    std::vector<char> buffer(3, 'x');
+
+    CHECK(reader.ReadString(text));
+    CHECK(reader.ReadBuffer(buffer));
+
+    CHECK(text.empty());
+    CHECK(buffer.empty());
+
+}
+
+static void TestTruncatedFrame()
+{
+
+    MemoryStream stream;
+    Channel writer;
+    Channel reader;
+
+    ConnectChannels(writer, reader, stream);
+
+    writer.WriteString(std::string(100, 'x'));
+    writer.Flush();
+
+    // Drop the end of the frame, as if the connection was lost while it was
+    // being sent.
+    stream.data.resize(stream.data.size() - 10);
+
+    std::string text;
+    CHECK(!reader.ReadString(text));
+    CHECK(text.empty());
+
+}
+
+int main()
+{
+    TestFraming();
+    TestMultipleFrames();
+    TestLargeStrings();
+    TestEmptyStrings();
+    TestTruncatedFrame();
+    return GetTestResult();
+}
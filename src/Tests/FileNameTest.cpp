@@ -0,0 +1,94 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "TestHarness.h"
+#include "FileName.h"
+
+#include <string>
+
+int g_numFailedChecks = 0;
+
+static std::string Normalize(const char* name)
+{
+    std::string fileName;
+    NormalizeFileName(name, fileName);
+    return fileName;
+}
+
+static size_t Match(const char* name1, const char* name2)
+{
+    return GetFileNameMatchLength(Normalize(name1), Normalize(name2));
+}
+
+static void TestNormalize()
+{
+
+    CHECK_EQUAL(std::string("init.lua"), Normalize("init.lua"));
+    CHECK_EQUAL(std::string("init.lua"), Normalize("@init.lua"));
+    CHECK_EQUAL(std::string("a/init.lua"), Normalize("@./a/init.lua"));
+    CHECK_EQUAL(std::string("a/init.lua"), Normalize("a\\.\\Init.LUA"));
+    CHECK_EQUAL(std::string("c_/proj/a/init.lua"), Normalize("C:\\Proj\\A\\init.lua"));
+
+    // Frontends replace colons when they make a file name out of a script name,
+    // so the normalized names have to agree.
+    CHECK_EQUAL(Normalize("game:init.lua"), Normalize("game_init.lua"));
+
+    // Only references to the current directory are removed.
+    CHECK_EQUAL(std::string("../a.lua"), Normalize("../a.lua"));
+    CHECK_EQUAL(std::string("a./b.lua"), Normalize("a./b.lua"));
+
+}
+
+static void TestMatch()
+{
+
+    // The same file.
+    CHECK_EQUAL(10u, Match("@a/init.lua", "a/init.lua"));
+    CHECK_EQUAL(10u, Match("@./a/init.lua", "A\\init.lua"));
+
+    // A relative script name matches the full path a frontend knows the file by.
+    CHECK_EQUAL(10u, Match("C:\\Proj\\a\\init.lua", "@a/init.lua"));
+
+    // Files with the same title in different directories don't match.
+    CHECK_EQUAL(0u, Match("C:\\Proj\\a\\init.lua", "@b/init.lua"));
+    CHECK_EQUAL(0u, Match("a/init.lua", "b/init.lua"));
+
+    // Names without a directory fall back to matching the title.
+    CHECK_EQUAL(8u, Match("C:\\Proj\\a\\init.lua", "@init.lua"));
+    CHECK_EQUAL(8u, Match("init.lua", "@b/init.lua"));
+
+    // The end of a name has to start at a directory.
+    CHECK_EQUAL(0u, Match("xinit.lua", "init.lua"));
+    CHECK_EQUAL(0u, Match("", "init.lua"));
+
+    // Longer matches are better, so the file in the right directory wins.
+    CHECK(Match("proj/a/init.lua", "@a/init.lua") > Match("init.lua", "@a/init.lua"));
+
+}
+
+int main()
+{
+    TestNormalize();
+    TestMatch();
+    return GetTestResult();
+}
@@ -0,0 +1,138 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "TestHarness.h"
+#include "LineBitmap.h"
+
+#include <vector>
+
+int g_numFailedChecks = 0;
+
+static void TestEmpty()
+{
+
+    LineBitmap bitmap;
+
+    CHECK(!bitmap.GetIsSet(0));
+    CHECK(!bitmap.GetIsSet(1000));
+    CHECK_EQUAL(0u, bitmap.GetCount());
+    CHECK_EQUAL(0u, bitmap.GetCountBefore(0));
+    CHECK_EQUAL(0u, bitmap.GetCountBefore(1000));
+
+}
+
+static void TestToggle()
+{
+
+    LineBitmap bitmap;
+
+    CHECK(bitmap.Toggle(5));
+    CHECK(bitmap.GetIsSet(5));
+    CHECK(!bitmap.GetIsSet(4));
+    CHECK(!bitmap.GetIsSet(6));
+    CHECK_EQUAL(1u, bitmap.GetCount());
+
+    CHECK(!bitmap.Toggle(5));
+    CHECK(!bitmap.GetIsSet(5));
+    CHECK_EQUAL(0u, bitmap.GetCount());
+
+}
+
+static void TestCountBefore()
+{
+
+    LineBitmap bitmap;
+
+    // Lines in the same word, at the ends of words and in later words.
+    bitmap.Toggle(3);
+    bitmap.Toggle(31);
+    bitmap.Toggle(32);
+    bitmap.Toggle(100);
+
+    CHECK_EQUAL(0u, bitmap.GetCountBefore(3));
+    CHECK_EQUAL(1u, bitmap.GetCountBefore(4));
+    CHECK_EQUAL(1u, bitmap.GetCountBefore(31));
+    CHECK_EQUAL(2u, bitmap.GetCountBefore(32));
+    CHECK_EQUAL(3u, bitmap.GetCountBefore(33));
+    CHECK_EQUAL(3u, bitmap.GetCountBefore(100));
+    CHECK_EQUAL(4u, bitmap.GetCountBefore(101));
+    CHECK_EQUAL(4u, bitmap.GetCountBefore(100000));
+
+    // Clearing a line in an early word updates the counts of the words after it.
+    bitmap.Toggle(3);
+
+    CHECK_EQUAL(0u, bitmap.GetCountBefore(31));
+    CHECK_EQUAL(2u, bitmap.GetCountBefore(100));
+    CHECK_EQUAL(3u, bitmap.GetCount());
+
+}
+
+static void TestAgainstModel()
+{
+
+    // Compare against a plain array of flags for a pseudo-random sequence of
+    // toggles, including lines that grow the bitmap past the end.
+
+    const unsigned int numLines = 700;
+
+    LineBitmap bitmap;
+    std::vector<bool> model(numLines, false);
+
+    unsigned int seed = 12345;
+
+    for (unsigned int i = 0; i < 5000; ++i)
+    {
+
+        seed = seed * 1103515245 + 12345;
+        unsigned int line = (seed >> 8) % numLines;
+
+        model[line] = !model[line];
+        CHECK_EQUAL(model[line], bitmap.Toggle(line));
+
+        if (i % 97 == 0)
+        {
+            unsigned int count = 0;
+            for (unsigned int j = 0; j < numLines; ++j)
+            {
+                CHECK_EQUAL(count, bitmap.GetCountBefore(j));
+                CHECK_EQUAL(model[j], bitmap.GetIsSet(j));
+                if (model[j])
+                {
+                    ++count;
+                }
+            }
+            CHECK_EQUAL(count, bitmap.GetCount());
+        }
+
+    }
+
+}
+
+int main()
+{
+    TestEmpty();
+    TestToggle();
+    TestCountBefore();
+    TestAgainstModel();
+    return GetTestResult();
+}
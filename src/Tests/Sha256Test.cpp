@@ -0,0 +1,93 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "TestHarness.h"
+#include "Sha256.h"
+
+#include <string>
+#include <vector>
+
+int g_numFailedChecks = 0;
+
+static void TestKnownDigests()
+{
+
+    // Test vectors from FIPS 180-2.
+
+    CHECK_EQUAL(std::string("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"), ComputeSha256("", 0));
+    CHECK_EQUAL(std::string("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"), ComputeSha256("abc", 3));
+
+    const char* message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    CHECK_EQUAL(std::string("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"), ComputeSha256(message, 56));
+
+    std::string million(1000000, 'a');
+    CHECK_EQUAL(std::string("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"), ComputeSha256(million.data(), million.length()));
+
+}
+
+static void TestPaddingBoundaries()
+{
+
+    // Lengths around the block size, where the length either does or doesn't
+    // fit into the final block.
+
+    struct Digest
+    {
+        size_t      length;
+        const char* digest;
+    };
+
+    static const Digest digests[] =
+        {
+            {  55, "463eb28e72f82e0a96c0a4cc53690c571281131f672aa229e0d45ae59b598b59" },
+            {  56, "da2ae4d6b36748f2a318f23e7ab1dfdf45acdc9d049bd80e59de82a60895f562" },
+            {  63, "29af2686fd53374a36b0846694cc342177e428d1647515f078784d69cdb9e488" },
+            {  64, "fdeab9acf3710362bd2658cdc9a29e8f9c757fcf9811603a8c447cd1d9151108" },
+            {  65, "4bfd2c8b6f1eec7a2afeb48b934ee4b2694182027e6d0fc075074f2fabb31781" },
+            { 119, "da18797ed7c3a777f0847f429724a2d8cd5138e6ed2895c3fa1a6d39d18f7ec6" },
+            { 120, "f52b23db1fbb6ded89ef42a23ce0c8922c45f25c50b568a93bf1c075420bbb7c" },
+            { 128, "471fb943aa23c511f6f72f8d1652d9c880cfa392ad80503120547703e56a2be5" },
+        };
+
+    for (unsigned int i = 0; i < sizeof(digests) / sizeof(digests[0]); ++i)
+    {
+
+        std::vector<unsigned char> data(digests[i].length);
+
+        for (size_t j = 0; j < data.size(); ++j)
+        {
+            data[j] = static_cast<unsigned char>(j % 251);
+        }
+
+        CHECK_EQUAL(std::string(digests[i].digest), ComputeSha256(data.empty() ? NULL : &data[0], data.size()));
+
+    }
+
+}
+
+int main()
+{
+    TestKnownDigests();
+    TestPaddingBoundaries();
+    return GetTestResult();
+}
@@ -0,0 +1,73 @@
+/*
+
+Decoda
+Copyright (C) 2007-2013 Unknown Worlds Entertainment, Inc. 
+
+This file is part of Decoda.
+
+Decoda is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Decoda is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Decoda.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <stdio.h>
+
+/**
+ * Minimal test harness for the parts of the debugger that don't depend on
+ * Windows or Lua. Each test program calls its test functions from main and
+ * returns GetTestResult(), which ctest reports as a failure if any check
+ * failed.
+ */
+
+extern int g_numFailedChecks;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++g_numFailedChecks; \
+        } \
+    } \
+    while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do \
+    { \
+        if (!((expected) == (actual))) \
+        { \
+            fprintf(stderr, "%s(%d): CHECK_EQUAL(%s, %s) failed\n", __FILE__, __LINE__, #expected, #actual); \
+            ++g_numFailedChecks; \
+        } \
+    } \
+    while (0)
+
+/**
+ * Returns the exit code for the test program.
+ */
+inline int GetTestResult()
+{
+    if (g_numFailedChecks != 0)
+    {
+        fprintf(stderr, "%d checks failed\n", g_numFailedChecks);
+        return 1;
+    }
+    return 0;
+}
+
+#endif